@@ -0,0 +1,222 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 RPCEmu contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * common.h - Minimal emulator environment for running the AMD64 code
+ * generator outside RPCEmu
+ *
+ * Each harness includes the code generator named by the CODEGEN macro,
+ * then this file, which supplies the state and memory functions the
+ * generated code uses. Memory page 1 (0x1000-0x1fff) is fast-path
+ * mapped onto mem[]; every other address goes through the slow-path
+ * functions, which count their calls.
+ */
+
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+ARMState arm;
+int blockend, linecyc;
+uint32_t inscount;
+int countbitstable[65536];
+uint8_t flaglookup[16][16];
+uintptr_t vraddrl[0x100000], vwaddrl[0x100000];
+
+static uint8_t mem[0x4000] __attribute__((aligned(4096)));
+static int slowcalls;
+
+uint32_t
+readmemfl(uint32_t a)
+{
+	slowcalls++;
+	return *(uint32_t *) &mem[a & 0x3ffc];
+}
+
+uint32_t
+readmemfb(uint32_t a)
+{
+	slowcalls++;
+	return mem[a & 0x3fff];
+}
+
+void
+writememfl(uint32_t a, uint32_t v)
+{
+	slowcalls++;
+	*(uint32_t *) &mem[a & 0x3ffc] = v;
+}
+
+void
+writememfb(uint32_t a, uint8_t v)
+{
+	slowcalls++;
+	mem[a & 0x3fff] = v;
+}
+
+void
+set_memory_executable(void *p, size_t l)
+{
+	mprotect(p, l, PROT_READ | PROT_WRITE | PROT_EXEC);
+}
+
+void
+arm_store_multiple(uint32_t op, uint32_t a, uint32_t wb)
+{
+	int c;
+
+	slowcalls++;
+	for (c = 0; c < 16; c++) {
+		if (op & (1u << c)) {
+			writememfl(a, arm.reg[c]);
+			a += 4;
+		}
+	}
+	if (op & (1u << 21)) {
+		arm.reg[(op >> 16) & 15] = wb;
+	}
+}
+
+void
+arm_load_multiple(uint32_t op, uint32_t a, uint32_t wb)
+{
+	int c;
+
+	slowcalls++;
+	if (op & (1u << 21)) {
+		arm.reg[(op >> 16) & 15] = wb;
+	}
+	for (c = 0; c < 16; c++) {
+		if (op & (1u << c)) {
+			arm.reg[c] = readmemfl(a);
+			a += 4;
+		}
+	}
+}
+
+/**
+ * Set up the condition code table, bit count table and memory map, and
+ * initialise the code generator.
+ */
+static void
+bench_init(void)
+{
+	unsigned i;
+	int f, cc;
+
+	for (f = 0; f < 16; f++) {
+		const int n = f >> 3 & 1, z = f >> 2 & 1, c = f >> 1 & 1, v = f & 1;
+		const int r[16] = { z, !z, c, !c, n, !n, v, !v, c && !z, !c || z,
+		                    n == v, n != v, !z && n == v, z || n != v, 1, 0 };
+
+		for (cc = 0; cc < 16; cc++) {
+			flaglookup[cc][f] = (uint8_t) r[cc];
+		}
+	}
+	for (i = 0; i < 65536; i++) {
+		countbitstable[i] = __builtin_popcount(i) * 4;
+	}
+	for (i = 0; i < 0x100000; i++) {
+		vraddrl[i] = 1;
+		vwaddrl[i] = 3;
+	}
+	vraddrl[1] = (uintptr_t) mem;
+	vwaddrl[1] = (uintptr_t) mem;
+
+	initcodeblocks();
+	arm.r15_mask = 0xfffffffc;
+}
+
+/**
+ * Compile a block at 0x8000 from a list of instructions, the way the
+ * dynarec does: instructions it cannot recompile are handed to interp.
+ *
+ * @param prog   Instructions
+ * @param n      Number of instructions
+ * @param interp Interpreter for instructions the code generator hands back
+ */
+static void
+bench_compile(const uint32_t *prog, int n, int (*interp)(uint32_t))
+{
+	int i;
+
+	blockend = 0;
+	initcodeblock(0x8000);
+	for (i = 0; i < n; i++) {
+		const uint32_t op = prog[i];
+
+		generatepcinc();
+		if ((op >> 28) != 0xe) {
+			generateflagtestandbranch(op, &arm.reg[16]);
+		}
+		generatecall(interp, op, &arm.reg[16]);
+		generateirqtest();
+	}
+	endblock(0);
+}
+
+/**
+ * Run the block compiled last.
+ */
+static void
+bench_run(void)
+{
+	linecyc = 0;
+	((void (*)(void)) &rcodeblock[blockpoint2][BLOCKSTART])();
+}
+
+/**
+ * Time many runs of the block compiled last, in CPU time so that other
+ * load on the host matters less. Reports the best of several rounds.
+ *
+ * @param runs Number of block runs per round
+ * @return Best round, in milliseconds
+ */
+static double
+bench_time(unsigned runs)
+{
+	double best = 0.0;
+	int round;
+
+	for (round = 0; round < 5; round++) {
+		struct timespec t0, t1;
+		double ms;
+		unsigned i;
+
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t0);
+		for (i = 0; i < runs; i++) {
+			bench_run();
+		}
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t1);
+
+		ms = (double) (t1.tv_sec - t0.tv_sec) * 1e3 + (double) (t1.tv_nsec - t0.tv_nsec) / 1e6;
+		if (round == 0 || ms < best) {
+			best = ms;
+		}
+	}
+	return best;
+}
+
+#endif /* BENCH_COMMON_H */
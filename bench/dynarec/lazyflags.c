@@ -0,0 +1,191 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 RPCEmu contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * lazyflags.c - Check and time recompiled CMP, CMN, TST and TEQ on AMD64
+ *
+ * The check compiles every combination of eight compare forms, edge-case
+ * operands, 14 conditions and both incoming C and V states into a block
+ * that follows the compare with conditional ALU instructions, a second
+ * compare and a conditional branch. It compares the CPSR, registers and
+ * R15 the block leaves against a C reference, and exits non-zero on any
+ * mismatch. Compares the code generator hands back are run by the same
+ * reference, so the check also passes with code generators that do not
+ * recompile them.
+ *
+ * The benchmark times an ADD, CMP, BNE loop body.
+ *
+ * Only 32-bit modes are covered: in 26-bit modes the flags live in R15
+ * and the code generator always hands compares to the interpreter.
+ */
+
+#define _GNU_SOURCE
+#include CODEGEN
+#include "common.h"
+
+static int interp_calls;
+
+/**
+ * Reference result of a compare or test
+ *
+ * @param op   Instruction
+ * @param cpsr CPSR before the instruction
+ * @param a    First operand (Rn)
+ * @param b    Second operand
+ * @return CPSR after the instruction
+ */
+static uint32_t
+compare(uint32_t op, uint32_t cpsr, uint32_t a, uint32_t b)
+{
+	uint32_t r;
+	uint32_t c = cpsr & CFLAG;
+	uint32_t v = cpsr & VFLAG;
+
+	switch ((op >> 21) & 3) {
+	case 0: /* TST */
+		r = a & b;
+		break;
+	case 1: /* TEQ */
+		r = a ^ b;
+		break;
+	case 2: /* CMP */
+		r = a - b;
+		c = (a >= b) ? CFLAG : 0;
+		v = (((a ^ b) & (a ^ r)) >> 31) ? VFLAG : 0;
+		break;
+	default: /* CMN */
+		r = a + b;
+		c = (r < a) ? CFLAG : 0;
+		v = ((~(a ^ b) & (a ^ r)) >> 31) ? VFLAG : 0;
+		break;
+	}
+	return (cpsr & 0x0fffffff) | (r & NFLAG) | (r ? 0 : ZFLAG) | c | v;
+}
+
+/**
+ * Interpreter for instructions the code generator hands back, which may
+ * only be compares with an unshifted register or unrotated immediate
+ */
+static int
+interp(uint32_t op)
+{
+	uint32_t b;
+
+	if ((op & 0x0d900000) != 0x01100000 || (op & 0xf00) != 0 ||
+	    (!(op & 0x02000000) && (op & 0xff0) != 0))
+	{
+		fprintf(stderr, "Unexpected interpreted instruction %08x\n", op);
+		exit(1);
+	}
+
+	interp_calls++;
+	b = (op & 0x02000000) ? (op & 0xff) : arm.reg[op & 15];
+	arm.reg[16] = compare(op, arm.reg[16], arm.reg[(op >> 16) & 15], b);
+	return 0;
+}
+
+static int
+check(void)
+{
+	static const uint32_t vals[] = {
+		0, 1, 2, 5, 0x7fffffff, 0x80000000, 0x80000001, 0xfffffffe, 0xffffffff
+	};
+	static const uint32_t ops[] = {
+		0xe1500001, 0xe1700001, 0xe1100001, 0xe1300001, /* CMP/CMN/TST/TEQ R0,R1 */
+		0xe3500005, 0xe3700005, 0xe3100001, 0xe3300080, /* Immediate forms */
+	};
+	const unsigned nvals = sizeof(vals) / sizeof(vals[0]);
+	int tests = 0, errors = 0;
+	unsigned oi, vi, vj, cc, cin;
+
+	for (oi = 0; oi < 8; oi++)
+	for (vi = 0; vi < nvals; vi++)
+	for (vj = 0; vj < nvals; vj++)
+	for (cc = 0; cc < 14; cc++)
+	for (cin = 0; cin < 2; cin++) {
+		const uint32_t cpsr = cin ? 0x300000d3 : 0x000000d3;
+		const uint32_t b = (ops[oi] & 0x02000000) ? (ops[oi] & 0xff) : vals[vj];
+		const uint32_t exp_cpsr = compare(ops[oi], cpsr, vals[vi], b);
+		const int taken = flaglookup[cc][exp_cpsr >> 28];
+		const uint32_t exp_r15 = 0x8008 + 5 * 4 + (taken ? 0x44 : 0);
+		uint32_t prog[5];
+
+		prog[0] = ops[oi];
+		prog[1] = (cc << 28) | 0x02822001;	/* ADDcc R2,R2,#1 */
+		prog[2] = (cc << 28) | 0x02833001;	/* ADDcc R3,R3,#1 */
+		prog[3] = ops[oi];
+		prog[4] = (cc << 28) | 0x0a000010;	/* Bcc +0x48 */
+
+		arm.reg[0] = vals[vi];
+		arm.reg[1] = vals[vj];
+		arm.reg[2] = 100;
+		arm.reg[3] = 0;
+		arm.reg[15] = 0x8008;
+		arm.reg[16] = cpsr;
+
+		bench_compile(prog, 5, interp);
+		bench_run();
+
+		tests++;
+		if (arm.reg[16] != exp_cpsr || arm.reg[2] != 100u + taken ||
+		    arm.reg[3] != (uint32_t) taken || arm.reg[15] != exp_r15)
+		{
+			if (errors++ < 10) {
+				printf("%08x a=%08x b=%08x cc=%u: CPSR %08x (expected %08x) "
+				       "R2 %u (%u) R15 %08x (%08x)\n",
+				       ops[oi], vals[vi], b, cc, arm.reg[16], exp_cpsr,
+				       arm.reg[2], 100u + taken, arm.reg[15], exp_r15);
+			}
+		}
+	}
+
+	printf("%d tests, %d errors, %d compares interpreted\n", tests, errors, interp_calls);
+	return errors != 0;
+}
+
+static void
+benchmark(void)
+{
+	static const uint32_t body[] = {
+		0xe2800001, /* ADD R0,R0,#1 */
+		0xe1500001, /* CMP R0,R1 */
+		0x1afffffc, /* BNE loop */
+	};
+
+	memset(arm.reg, 0, sizeof(arm.reg));
+	arm.reg[1] = 0xffffffff;
+	arm.reg[15] = 0x8008;
+	arm.reg[16] = 0xd3;
+
+	bench_compile(body, 3, interp);
+	printf("ADD/CMP/BNE block x 50M: %.1f ms\n", bench_time(50000000));
+}
+
+int
+main(int argc, char **argv)
+{
+	bench_init();
+
+	if (argc > 1 && strcmp(argv[1], "--check") == 0) {
+		return check();
+	}
+	benchmark();
+	return 0;
+}
@@ -0,0 +1,145 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 RPCEmu contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * regcache.c - Check and time the caching of ARM registers in host
+ * registers within AMD64 blocks
+ *
+ * The check compiles a block mixing ALU operations, fast and slow path
+ * memory accesses, LDM/STM, conditional instructions and an instruction
+ * the code generator hands to the interpreter, runs it once and prints
+ * the registers and memory it left. Code generators with and without the
+ * register cache must print the same.
+ *
+ * The benchmark times a 96-instruction integer loop body.
+ */
+
+#define _GNU_SOURCE
+#include CODEGEN
+#include "common.h"
+
+static int interp_calls;
+
+/**
+ * Interpreter for the one instruction the check expects to be handed
+ * back: MOV Rd, Rm, LSL Rs
+ */
+static int
+interp(uint32_t op)
+{
+	interp_calls++;
+	arm.reg[(op >> 12) & 15] = arm.reg[op & 15] << (arm.reg[(op >> 8) & 15] & 31);
+	return 0;
+}
+
+static int
+interp_none(uint32_t op)
+{
+	fprintf(stderr, "Unexpected interpreted instruction %08x\n", op);
+	exit(1);
+}
+
+static void
+check(void)
+{
+	static const uint32_t prog[] = {
+		0xe3a00005, /* MOV R0,#5 */
+		0xe2801003, /* ADD R1,R0,#3 */
+		0xe0800001, /* ADD R0,R0,R1 */
+		0xe0412000, /* SUB R2,R1,R0 */
+		0xe0030190, /* MUL R3,R0,R1 */
+		0xe5843004, /* STR R3,[R4,#4] */
+		0xe5945004, /* LDR R5,[R4,#4] */
+		0xe4860004, /* STR R0,[R6],#4 (slow path) */
+		0x12877001, /* ADDNE R7,R7,#1 */
+		0x02877010, /* ADDEQ R7,R7,#16 */
+		0xe1a08110, /* MOV R8,R0,LSL R1 (interpreter) */
+		0xe2888001, /* ADD R8,R8,#1 */
+		0xe8a4000f, /* STMIA R4!,{R0-R3} */
+		0xe8990c00, /* LDMIA R9,{R10,R11} */
+		0xe08aa00b, /* ADD R10,R10,R11 */
+		0xe4d6c001, /* LDRB R12,[R6],#1 (slow path) */
+		0xe0213092, /* MLA R1,R2,R0,R3 */
+		0xe8b60003, /* LDMIA R6!,{R0,R1} (slow path) */
+		0xe1a0e000, /* MOV R14,R0 */
+	};
+	unsigned i;
+
+	for (i = 0; i < sizeof(mem); i++) {
+		mem[i] = (uint8_t) (i * 7);
+	}
+	memset(arm.reg, 0, sizeof(arm.reg));
+	arm.reg[4] = 0x1100;
+	arm.reg[6] = 0x2000;
+	arm.reg[7] = 100;
+	arm.reg[9] = 0x1200;
+	arm.reg[15] = 0x8008;
+	arm.reg[16] = 0x10;
+
+	bench_compile(prog, (int) (sizeof(prog) / sizeof(prog[0])), interp);
+	bench_run();
+
+	for (i = 0; i < 16; i++) {
+		printf("R%u=%08x\n", i, arm.reg[i]);
+	}
+	printf("CPSR=%08x\n", arm.reg[16]);
+	printf("mem=%08x %08x %08x %08x %08x\n",
+	       *(uint32_t *) &mem[0x1100], *(uint32_t *) &mem[0x1104], *(uint32_t *) &mem[0x1108],
+	       *(uint32_t *) &mem[0x110c], *(uint32_t *) &mem[0x2000]);
+	printf("slow path calls=%d interpreted=%d\n", slowcalls, interp_calls);
+}
+
+static void
+benchmark(void)
+{
+	/* Checksum-style mixing over R0-R3 */
+	static const uint32_t body[] = {
+		0xe0800001, /* ADD R0,R0,R1 */
+		0xe0211000, /* EOR R1,R1,R0 */
+		0xe0822081, /* ADD R2,R2,R1,LSL #1 */
+		0xe2833001, /* ADD R3,R3,#1 */
+		0xe0400002, /* SUB R0,R0,R2 */
+		0xe1a01161, /* MOV R1,R1,ROR #2 */
+	};
+	uint32_t prog[96];
+	unsigned i;
+
+	for (i = 0; i < 96; i++) {
+		prog[i] = body[i % 6];
+	}
+	memset(arm.reg, 0, sizeof(arm.reg));
+	arm.reg[15] = 0x8008;
+
+	bench_compile(prog, 96, interp_none);
+	printf("96-instruction block x 10M: %.1f ms\n", bench_time(10000000));
+}
+
+int
+main(int argc, char **argv)
+{
+	bench_init();
+
+	if (argc > 1 && strcmp(argv[1], "--check") == 0) {
+		check();
+	} else {
+		benchmark();
+	}
+	return 0;
+}
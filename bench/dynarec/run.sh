@@ -0,0 +1,67 @@
+#!/bin/sh
+#
+# Build a dynarec harness against the code generator in an earlier
+# revision and against the one in the working tree (or a second revision),
+# run its check with both and compare, then time both.
+#
+# Usage: run.sh <harness> <revision> [<new revision>]
+#
+# Only for x86-64 hosts; needs gcc and git.
+
+set -e
+
+if [ $# -lt 2 ] || [ $# -gt 3 ] || [ ! -f "$(dirname "$0")/$1.c" ]; then
+	echo "Usage: $0 <harness> <revision> [<new revision>]" >&2
+	exit 1
+fi
+
+harness=$1
+revision=$2
+new_revision=${3:-}
+new_name=${3:-working tree}
+here=$(cd "$(dirname "$0")" && pwd)
+top=$(cd "$here/../.." && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+mkdir "$work/tree" "$work/new_tree"
+git -C "$top" archive "$revision" src | tar -x -C "$work/tree"
+if [ -n "$new_revision" ]; then
+	git -C "$top" archive "$new_revision" src | tar -x -C "$work/new_tree"
+fi
+
+for tree in base new; do
+	if [ $tree = base ]; then
+		src="$work/tree/src"
+	elif [ -n "$new_revision" ]; then
+		src="$work/new_tree/src"
+	else
+		src="$top/src"
+	fi
+	gcc -O2 -w -I"$src" -DCODEGEN='"codegen_amd64.c"' \
+	    "$here/$harness.c" "$here/stubs.c" -o "$work/$tree"
+done
+
+"$work/base" --check > "$work/base.txt"
+"$work/new" --check > "$work/new.txt"
+echo "Check, $revision:"
+cat "$work/base.txt"
+echo "Check, $new_name:"
+cat "$work/new.txt"
+if [ $harness = regcache ]; then
+	# Both must leave the same state
+	if diff "$work/base.txt" "$work/new.txt" > /dev/null; then
+		echo "Same final state"
+	else
+		echo "Final state differs" >&2
+		exit 1
+	fi
+fi
+
+# Alternate the builds, so that changes in host load affect both
+for i in 1 2 3; do
+	printf '%s: ' "$revision"
+	"$work/base"
+	printf '%s: ' "$new_name"
+	"$work/new"
+done
@@ -0,0 +1,91 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 RPCEmu contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * stubs.c - Hooks into other subsystems that the code generator calls,
+ * with the caches and profiler they belong to turned off
+ *
+ * Built as a separate file without the emulator's headers, so the same
+ * stubs link with older code generators that lack some of the hooks.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+int dynprof_active = 0;
+int replay_mode = 0;
+
+void
+dynprof_slot_reused(int slot, uint32_t entries, uint32_t fallbacks)
+{
+	(void) slot;
+	(void) entries;
+	(void) fallbacks;
+}
+
+void
+dynprof_invalidate(uint32_t pc)
+{
+	(void) pc;
+}
+
+int
+transcache_enabled(void)
+{
+	return 0;
+}
+
+void
+transcache_set_build(uint64_t build_id)
+{
+	(void) build_id;
+}
+
+int
+transcache_rom_offset(const uint32_t *code, uint32_t *rom_offset)
+{
+	(void) code;
+	(void) rom_offset;
+	return 0;
+}
+
+const void *
+transcache_find(uint32_t pc, uint32_t rom_offset, uint32_t r15_mask)
+{
+	(void) pc;
+	(void) rom_offset;
+	(void) r15_mask;
+	return NULL;
+}
+
+void
+transcache_store(const void *block, const uint8_t *code, const uint16_t *relocs)
+{
+	(void) block;
+	(void) code;
+	(void) relocs;
+}
+
+int
+rpcemu_executable_hash(uint64_t *hash)
+{
+	(void) hash;
+	return 0;
+}
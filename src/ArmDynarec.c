@@ -40,6 +40,7 @@ int blockend;
 #include "rpcemu.h"
 #include "arm.h"
 #include "cp15.h"
+#include "dynprof.h"
 #include "mem.h"
 
 #if defined __amd64__
@@ -787,7 +788,7 @@ arm_exec(void)
 				pagedirty[PC>>9]=0;
 				cacheclearpage(PC>>9);
 			}
-			else */ if (!debugger_requires_instruction_hook() && codeblockpc[hash] == PC) {
+			else */ if (!debugger_requires_instruction_hook() && codeblockpc[hash] == PC && !codeblockhot(PC)) {
 				const uint32_t templ = codeblocknum[hash];
 				void (*gen_func)(void);
 
@@ -801,6 +802,7 @@ arm_exec(void)
 					updatemode(arm.reg[cpsr] & arm.mmask);
 				}
 			} else {
+				const uint32_t *block_code;
 				uint32_t opcode;
 
 				if ((PC >> 12) != pccache) {
@@ -814,7 +816,24 @@ arm_exec(void)
 						continue;
 					}
 				}
-				initcodeblock(PC);
+				if (dynprof_active) {
+					dynprof_compile_begin(PC);
+				}
+				if (codeblockpc[hash] != PC && fetchcodeblock(PC, &pccache2[PC >> 2])) {
+					// Installed from the translation cache, run it
+					// next time round
+					if (dynprof_active) {
+						dynprof_compile_end(1);
+					}
+					continue;
+				}
+				block_code = &pccache2[PC >> 2];
+				if (codeblockpc[hash] == PC && codeblockhot(PC)) {
+					// Hot block, rebuild following its branches
+					initsuperblock(PC);
+				} else {
+					initcodeblock(PC);
+				}
 				blockend = 0;
 				do {
 					opcode = pccache2[PC >> 2];
@@ -825,6 +844,9 @@ arm_exec(void)
 							return 1000;
 						}
 					}
+					if (dynprof_active) {
+						dynprof_compile_instruction(PC);
+					}
 					if ((opcode >> 28) == 0xf) {
 						// NV condition code
 						generatepcinc();
@@ -854,6 +876,9 @@ arm_exec(void)
 							OpFn fn = arm_opcode_fn(opcode);
 							fn(opcode);
 						}
+						if (superblockcontinues()) {
+							blockend = 0;
+						}
 					}
 					if (debug_active) {
 						debugger_after_instruction(PC, opcode);
@@ -864,6 +889,10 @@ arm_exec(void)
 					}
 				} while (!blockend && !(arm.event & 0x40));
 				endblock(opcode);
+				if (dynprof_active) {
+					dynprof_compile_end(0);
+				}
+				storecodeblock(block_code);
 			}
 		}
 
@@ -71,6 +71,17 @@ arm_is_dynarec(void)
 	return 0;
 }
 
+/**
+ * Get superblock statistics; the interpreter has none.
+ *
+ * @param stats Filled in with zeroes
+ */
+void
+superblock_get_stats(SuperblockStats *stats)
+{
+	memset(stats, 0, sizeof(SuperblockStats));
+}
+
 void updatemode(uint32_t m)
 {
         uint32_t c, om = arm.mode;
@@ -59,6 +59,34 @@ extern void generatecall(OpFn addr, uint32_t opcode, uint32_t *pcpsr);
 extern void generateirqtest(void);
 extern void endblock(uint32_t opcode);
 extern void initcodeblock(uint32_t l);
+extern void initsuperblock(uint32_t l);
+extern int codeblockhot(uint32_t l);
+extern int superblockcontinues(void);
+extern int fetchcodeblock(uint32_t l, const uint32_t *code);
+extern void storecodeblock(const uint32_t *code);
+
+/** Superblock statistics for display */
+typedef struct {
+	uint32_t	formed;		/**< Superblocks built since start-up */
+	uint32_t	resident;	/**< Superblocks currently in the code cache */
+	float		coverage;	/**< Percentage of resident block entries made into superblocks */
+} SuperblockStats;
+
+extern void superblock_get_stats(SuperblockStats *stats);
+
+/** A code cache slot, for the dynarec profiler */
+typedef struct {
+	uint32_t	pc;		/**< Address of first instruction */
+	const uint8_t	*code;		/**< Host code, from the block entry point */
+	uint32_t	code_size;	/**< Bytes of host code at code */
+	uint32_t	entries;	/**< Times entered since compiled */
+	uint32_t	fallbacks;	/**< Interpreter calls made since compiled */
+	uint32_t	fallback_sites;	/**< Instructions compiled as interpreter calls */
+	int		superblock;	/**< Non-zero if a superblock */
+} CodeBlockInfo;
+
+extern int codeblock_lookup(uint32_t l);
+extern int codeblock_get_info(int slot, CodeBlockInfo *info);
 
 extern uint32_t *usrregs[16];
 extern int cpsr;
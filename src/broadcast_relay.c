@@ -34,9 +34,19 @@
  * Outgoing broadcasts are relayed to the host network; incoming
  * responses are repackaged and injected into the guest. Payloads
  * exceeding Ethernet MTU are delivered via IP fragmentation.
+ *
+ * On Linux the sockets are serviced by an epoll driven I/O thread that
+ * batch receives with recvmmsg(). Frames for the guest are handed to the
+ * emulator thread through a lock-free ring, and datagrams from the guest
+ * go the other way, so the emulator thread makes no socket calls.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE /* recvmmsg() */
+#endif
+
 #include <errno.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <time.h>
 
@@ -82,10 +92,19 @@
 
 #endif
 
+#ifdef __linux__
+  /* Socket handling runs on its own epoll driven thread */
+  #define RELAY_IO_THREAD
+  #include <pthread.h>
+  #include <sys/epoll.h>
+  #include <sys/eventfd.h>
+#endif
+
 #include "broadcast_relay.h"
 #include "rpcemu.h"
 #include "network.h"
 #include "network-nat.h"
+#include "packet_ring.h"
 
 /* Access+ ports */
 #define ACCESS_PORT_ANNOUNCE    32770
@@ -107,6 +126,14 @@
 /* Rate limiting */
 #define MAX_PACKETS_PER_SECOND  100
 
+/* Largest UDP datagram accepted from the host network */
+#define RELAY_MAX_DATAGRAM      8192
+
+/* I/O thread tuning */
+#define RELAY_RX_BATCH          8       /* Datagrams per recvmmsg() call */
+#define RELAY_RING_SIZE         64      /* Slots in each direction, power of two */
+#define RELAY_WAKE_TAG          0xffffffffu /* epoll tag of the wakeup eventfd */
+
 /* SLiRP network constants */
 #define SLIRP_NET       0x0a0a0a00  /* 10.10.10.0 */
 #define SLIRP_MASK      0xffffff00  /* 255.255.255.0 */
@@ -133,22 +160,37 @@ static const uint16_t access_ports[NUM_ACCESS_SOCKETS] = {
 /* Relay state */
 typedef struct {
     relay_socket_t sockets[NUM_ACCESS_SOCKETS]; /* UDP sockets, RELAY_INVALID_SOCKET if disabled */
-    int enabled;                     /* Runtime enable flag */
+    atomic_int enabled;              /* Runtime enable flag */
 
     struct sockaddr_in host_addr;    /* Host's IP address */
     struct sockaddr_in bcast_addr;   /* Subnet broadcast address */
 
     /* Learned guest IP from outgoing packets */
-    uint32_t guest_ip;               /* Guest's IP in host byte order, 0 if unknown */
+    atomic_uint guest_ip;            /* Guest's IP in host byte order, 0 if unknown */
 
-    /* Rate limiting */
+    /* Receive rate limiting (only touched by the thread doing socket I/O) */
     uint32_t packets_this_second;
     time_t last_rate_reset;
 
+    /* Transmit rate limiting (only touched by the emulator thread) */
+    uint32_t tx_packets_this_second;
+    time_t tx_last_rate_reset;
+
     /* Statistics */
-    uint32_t tx_count;              /* Guest -> Host */
-    uint32_t rx_count;              /* Host -> Guest */
-    uint32_t dropped;               /* Rate limited or errors */
+    atomic_uint tx_count;           /* Guest -> Host */
+    atomic_uint rx_count;           /* Host -> Guest */
+    atomic_uint dropped;            /* Rate limited or errors */
+
+#ifdef RELAY_IO_THREAD
+    /* I/O thread, when running all socket calls are made from it */
+    int io_running;
+    atomic_int io_quit;
+    pthread_t io_thread;
+    int epoll_fd;
+    int wake_fd;                    /* eventfd used to wake the thread */
+    PacketRing rx_ring;             /* Frames for the guest, I/O thread -> emulator */
+    PacketRing tx_ring;             /* Datagrams for the host, emulator -> I/O thread */
+#endif
 } relay_state_t;
 
 static relay_state_t relay = {
@@ -356,6 +398,11 @@ sock_strerror(void)
 #define sock_strerror() strerror(errno)
 #endif
 
+#ifdef RELAY_IO_THREAD
+static int relay_io_start(void);
+static void relay_io_stop(void);
+#endif
+
 /**
  * Initialize the broadcast relay.
  */
@@ -479,8 +526,17 @@ broadcast_relay_init(void)
     relay.dropped = 0;
     relay.packets_this_second = 0;
     relay.last_rate_reset = time(NULL);
+    relay.tx_packets_this_second = 0;
+    relay.tx_last_rate_reset = relay.last_rate_reset;
     relay.guest_ip = 0;  /* Will be learned from first outgoing packet */
 
+#ifdef RELAY_IO_THREAD
+    /* Fall back to polling from the emulator thread if this fails */
+    if (relay_io_start() < 0) {
+        rpclog("broadcast_relay: I/O thread unavailable, polling instead\n");
+    }
+#endif
+
     relay.enabled = 1;
 
     return 0;
@@ -493,6 +549,11 @@ void
 broadcast_relay_close(void)
 {
     int i;
+
+#ifdef RELAY_IO_THREAD
+    relay_io_stop();
+#endif
+
     for (i = 0; i < NUM_ACCESS_SOCKETS; i++) {
         if (relay.sockets[i] != RELAY_INVALID_SOCKET) {
             relay_closesocket(relay.sockets[i]);
@@ -525,6 +586,24 @@ ip_checksum(const uint8_t *hdr, int len)
 /* IP identification counter for fragmentation - start high to avoid conflicts */
 static uint16_t ip_id_counter = 0x8000;
 
+/**
+ * Hand a complete Ethernet frame on towards the guest.
+ * With the I/O thread running it is queued for broadcast_relay_poll()
+ * on the emulator thread, otherwise it is injected directly.
+ *
+ * Returns: 1 on success, 0 if the frame was dropped
+ */
+static int
+relay_deliver_frame(const uint8_t *frame, int frame_len)
+{
+#ifdef RELAY_IO_THREAD
+    if (relay.io_running) {
+        return packet_ring_push(&relay.rx_ring, frame, (uint32_t) frame_len);
+    }
+#endif
+    return network_nat_inject_packet(frame, frame_len);
+}
+
 /**
  * Inject a large UDP payload as multiple IP fragments.
  * This is needed when the payload exceeds Ethernet MTU.
@@ -669,7 +748,7 @@ inject_fragmented_udp(const struct sockaddr_in *from,
         }
 
         /* Inject this fragment */
-        if (!network_nat_inject_packet(frame, frame_len)) {
+        if (!relay_deliver_frame(frame, frame_len)) {
             return frag_count;
         }
 
@@ -776,60 +855,32 @@ build_guest_frame(uint8_t *frame, int max_len,
 }
 
 /**
- * Poll a single socket for incoming packets.
- * Returns 1 if a packet was processed, 0 otherwise.
+ * Relay one UDP datagram received from the host network into the guest.
+ * Returns 1 if a packet was delivered, 0 otherwise.
  */
 static int
-poll_socket(int sock_idx)
+relay_receive_datagram(int sock_idx, const struct sockaddr_in *from,
+                       const uint8_t *udp_payload, int n)
 {
     /* 
-     * Buffer sizes: 
-     * - UDP receive buffer: 8192 to avoid truncation (UDP datagrams can be up to 65535)
-     * - Frame buffer: must fit in nat.buffer (2048 bytes) after adding headers
-     * - Max UDP payload we can inject: 2048 - 14(eth) - 20(ip) - 8(udp) = 2006 bytes
+     * Frame buffer: must fit in nat.buffer (2048 bytes) after adding headers
+     * Max UDP payload we can inject: 2048 - 14(eth) - 20(ip) - 8(udp) = 2006 bytes
      */
-    static uint8_t udp_payload[8192];  /* Static to avoid stack overflow */
     uint8_t frame[2048];
-    struct sockaddr_in from;
-#ifdef _WIN32
-    int fromlen;
-    int n;
-#else
-    socklen_t fromlen;
-    ssize_t n;
-#endif
     int frame_len;
     uint16_t port;
     int is_broadcast;
     time_t now;
 
-    if (relay.sockets[sock_idx] == RELAY_INVALID_SOCKET) {
-        return 0;
-    }
-
     port = access_ports[sock_idx];
 
-    /* Non-blocking receive (socket is already set non-blocking) */
-    fromlen = sizeof(from);
-#ifdef _WIN32
-    n = recvfrom(relay.sockets[sock_idx], (char *)udp_payload, sizeof(udp_payload), 0,
-                 (struct sockaddr *)&from, &fromlen);
-#else
-    n = recvfrom(relay.sockets[sock_idx], udp_payload, sizeof(udp_payload), MSG_DONTWAIT,
-                 (struct sockaddr *)&from, &fromlen);
-#endif
-
-    if (n <= 0) {
-        return 0;  /* No data or error */
-    }
-
     /* Don't relay packets from localhost - these are SLiRP loopback */
-    if (ntohl(from.sin_addr.s_addr) == INADDR_LOOPBACK) {
+    if (ntohl(from->sin_addr.s_addr) == INADDR_LOOPBACK) {
         return 0;
     }
 
     /* Don't relay our own packets back (from host IP) */
-    if (from.sin_addr.s_addr == relay.host_addr.sin_addr.s_addr) {
+    if (from->sin_addr.s_addr == relay.host_addr.sin_addr.s_addr) {
         return 0;
     }
 
@@ -853,7 +904,7 @@ poll_socket(int sock_idx)
     /* Max UDP payload in single frame: 1500 - 20(IP) - 8(UDP) = 1472 */
     if (n > 1472) {
         /* Use IP fragmentation for large payloads */
-        int frags = inject_fragmented_udp(&from, port, udp_payload, n, is_broadcast);
+        int frags = inject_fragmented_udp(from, port, udp_payload, n, is_broadcast);
         if (frags > 0) {
             relay.rx_count++;
             return 1;
@@ -864,14 +915,14 @@ poll_socket(int sock_idx)
     }
 
     /* Build frame for guest (single unfragmented frame) */
-    frame_len = build_guest_frame(frame, sizeof(frame), &from, port, udp_payload, n, is_broadcast);
+    frame_len = build_guest_frame(frame, sizeof(frame), from, port, udp_payload, n, is_broadcast);
     if (frame_len < 0) {
         relay.dropped++;
         return 0;
     }
 
     /* Inject into guest via direct buffer delivery */
-    if (network_nat_inject_packet(frame, frame_len)) {
+    if (relay_deliver_frame(frame, frame_len)) {
         relay.rx_count++;
         return 1;
     } else {
@@ -880,6 +931,301 @@ poll_socket(int sock_idx)
     }
 }
 
+/**
+ * Poll a single socket for incoming packets.
+ * Returns 1 if a packet was processed, 0 otherwise.
+ */
+static int
+poll_socket(int sock_idx)
+{
+    /* 
+     * UDP receive buffer: 8192 to avoid truncation (UDP datagrams can be up to 65535)
+     */
+    static uint8_t udp_payload[RELAY_MAX_DATAGRAM];  /* Static to avoid stack overflow */
+    struct sockaddr_in from;
+#ifdef _WIN32
+    int fromlen;
+    int n;
+#else
+    socklen_t fromlen;
+    ssize_t n;
+#endif
+
+    if (relay.sockets[sock_idx] == RELAY_INVALID_SOCKET) {
+        return 0;
+    }
+
+    /* Non-blocking receive (socket is already set non-blocking) */
+    fromlen = sizeof(from);
+#ifdef _WIN32
+    n = recvfrom(relay.sockets[sock_idx], (char *)udp_payload, sizeof(udp_payload), 0,
+                 (struct sockaddr *)&from, &fromlen);
+#else
+    n = recvfrom(relay.sockets[sock_idx], udp_payload, sizeof(udp_payload), MSG_DONTWAIT,
+                 (struct sockaddr *)&from, &fromlen);
+#endif
+
+    if (n <= 0) {
+        return 0;  /* No data or error */
+    }
+
+    return relay_receive_datagram(sock_idx, &from, udp_payload, (int) n);
+}
+
+/**
+ * Send a datagram from the guest to the host network. Called from
+ * whichever thread owns the sockets; broadcast_relay_tx() has already
+ * applied the rate limit.
+ */
+static void
+relay_send_datagram(int sock_idx, const struct sockaddr_in *dest,
+                    const uint8_t *payload, int payload_len)
+{
+    int sent;
+
+    /* Send from the appropriate socket (bound to correct source port) */
+#ifdef _WIN32
+    sent = sendto(relay.sockets[sock_idx], (const char *)payload, payload_len, 0,
+                  (const struct sockaddr *)dest, sizeof(*dest));
+#else
+    sent = sendto(relay.sockets[sock_idx], payload, payload_len, 0,
+                  (const struct sockaddr *)dest, sizeof(*dest));
+#endif
+
+    if (sent < 0) {
+        relay.dropped++;
+    } else {
+        relay.tx_count++;
+    }
+}
+
+#ifdef RELAY_IO_THREAD
+
+/**
+ * Receive everything pending on one socket, in batches.
+ */
+static void
+relay_io_receive(int sock_idx)
+{
+    static uint8_t buffers[RELAY_RX_BATCH][RELAY_MAX_DATAGRAM];
+    struct mmsghdr msgs[RELAY_RX_BATCH];
+    struct iovec iovs[RELAY_RX_BATCH];
+    struct sockaddr_in from[RELAY_RX_BATCH];
+    int n, i;
+
+    do {
+        memset(msgs, 0, sizeof(msgs));
+        for (i = 0; i < RELAY_RX_BATCH; i++) {
+            iovs[i].iov_base = buffers[i];
+            iovs[i].iov_len = sizeof(buffers[i]);
+            msgs[i].msg_hdr.msg_name = &from[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        n = recvmmsg(relay.sockets[sock_idx], msgs, RELAY_RX_BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0) {
+            return;  /* Drained, or error */
+        }
+
+        for (i = 0; i < n; i++) {
+            if (msgs[i].msg_len > 0) {
+                relay_receive_datagram(sock_idx, &from[i], buffers[i], (int) msgs[i].msg_len);
+            }
+        }
+    } while (n == RELAY_RX_BATCH);
+}
+
+/**
+ * Send all datagrams queued by broadcast_relay_tx().
+ */
+static void
+relay_io_send_queued(void)
+{
+    PacketRingSlot *slot;
+
+    while ((slot = packet_ring_peek(&relay.tx_ring)) != NULL) {
+        struct sockaddr_in dest;
+
+        memset(&dest, 0, sizeof(dest));
+        dest.sin_family = AF_INET;
+        dest.sin_addr.s_addr = slot->meta[1];
+        dest.sin_port = (uint16_t) slot->meta[2];
+
+        relay_send_datagram((int) slot->meta[0], &dest, slot->data, (int) slot->len);
+        packet_ring_release(&relay.tx_ring);
+    }
+}
+
+/**
+ * I/O thread: wait for socket readiness or queued transmissions.
+ */
+static void *
+relay_io_thread(void *arg)
+{
+    struct epoll_event events[NUM_ACCESS_SOCKETS + 1];
+    int n, i;
+
+    NOT_USED(arg);
+
+    while (!relay.io_quit) {
+        n = epoll_wait(relay.epoll_fd, events, NUM_ACCESS_SOCKETS + 1, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            rpclog("broadcast_relay: epoll_wait() failed: %s\n", strerror(errno));
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (events[i].data.u32 == RELAY_WAKE_TAG) {
+                uint64_t count;
+
+                (void) read(relay.wake_fd, &count, sizeof(count));
+                relay_io_send_queued();
+            } else {
+                relay_io_receive((int) events[i].data.u32);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Wake the I/O thread.
+ */
+static void
+relay_io_wake(void)
+{
+    const uint64_t one = 1;
+
+    (void) write(relay.wake_fd, &one, sizeof(one));
+}
+
+/**
+ * Create the rings and start the I/O thread.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+static int
+relay_io_start(void)
+{
+    struct epoll_event ev;
+    int i;
+
+    relay.io_running = 0;
+    relay.io_quit = 0;
+    relay.epoll_fd = -1;
+    relay.wake_fd = -1;
+
+    if (!packet_ring_init(&relay.rx_ring, RELAY_RING_SIZE) ||
+        !packet_ring_init(&relay.tx_ring, RELAY_RING_SIZE)) {
+        goto fail;
+    }
+
+    relay.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    relay.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (relay.epoll_fd < 0 || relay.wake_fd < 0) {
+        goto fail;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = RELAY_WAKE_TAG;
+    if (epoll_ctl(relay.epoll_fd, EPOLL_CTL_ADD, relay.wake_fd, &ev) < 0) {
+        goto fail;
+    }
+
+    for (i = 0; i < NUM_ACCESS_SOCKETS; i++) {
+        if (relay.sockets[i] == RELAY_INVALID_SOCKET) {
+            continue;
+        }
+        ev.events = EPOLLIN;
+        ev.data.u32 = (uint32_t) i;
+        if (epoll_ctl(relay.epoll_fd, EPOLL_CTL_ADD, relay.sockets[i], &ev) < 0) {
+            goto fail;
+        }
+    }
+
+    if (pthread_create(&relay.io_thread, NULL, relay_io_thread, NULL) != 0) {
+        goto fail;
+    }
+    (void) pthread_setname_np(relay.io_thread, "rpcemu: relay");
+
+    relay.io_running = 1;
+    return 0;
+
+fail:
+    rpclog("broadcast_relay: failed to start I/O thread: %s\n", strerror(errno));
+    if (relay.epoll_fd >= 0) {
+        close(relay.epoll_fd);
+        relay.epoll_fd = -1;
+    }
+    if (relay.wake_fd >= 0) {
+        close(relay.wake_fd);
+        relay.wake_fd = -1;
+    }
+    packet_ring_free(&relay.rx_ring);
+    packet_ring_free(&relay.tx_ring);
+    return -1;
+}
+
+/**
+ * Stop the I/O thread and release its resources.
+ */
+static void
+relay_io_stop(void)
+{
+    if (!relay.io_running) {
+        return;
+    }
+
+    relay.io_quit = 1;
+    relay_io_wake();
+    pthread_join(relay.io_thread, NULL);
+    relay.io_running = 0;
+
+    close(relay.epoll_fd);
+    close(relay.wake_fd);
+    relay.epoll_fd = -1;
+    relay.wake_fd = -1;
+    packet_ring_free(&relay.rx_ring);
+    packet_ring_free(&relay.tx_ring);
+}
+
+/**
+ * Pass a datagram from the guest to the I/O thread for sending.
+ */
+static void
+relay_queue_datagram(int sock_idx, const struct sockaddr_in *dest,
+                     const uint8_t *payload, int payload_len)
+{
+    PacketRingSlot *slot = packet_ring_reserve(&relay.tx_ring);
+
+    if (slot == NULL) {
+        relay.dropped++;
+        return;
+    }
+
+    memcpy(slot->data, payload, (size_t) payload_len);
+    slot->len = (uint32_t) payload_len;
+    slot->meta[0] = (uint32_t) sock_idx;
+    slot->meta[1] = dest->sin_addr.s_addr;
+    slot->meta[2] = dest->sin_port;
+    packet_ring_commit(&relay.tx_ring);
+
+    /* Only wake the thread when the ring goes from empty to non-empty;
+       otherwise it is already draining and will pick this up */
+    if (packet_ring_count(&relay.tx_ring) == 1) {
+        relay_io_wake();
+    }
+}
+
+#endif /* RELAY_IO_THREAD */
+
 /**
  * Poll for incoming packets from the host network on all Access+ ports.
  */
@@ -892,6 +1238,21 @@ broadcast_relay_poll(void)
         return;
     }
 
+#ifdef RELAY_IO_THREAD
+    /* Frames were received and built on the I/O thread, just inject them */
+    if (relay.io_running) {
+        PacketRingSlot *slot;
+
+        while ((slot = packet_ring_peek(&relay.rx_ring)) != NULL) {
+            if (!network_nat_inject_packet(slot->data, (int) slot->len)) {
+                relay.dropped++;
+            }
+            packet_ring_release(&relay.rx_ring);
+        }
+        return;
+    }
+#endif
+
     /* Poll all sockets */
     for (i = 0; i < NUM_ACCESS_SOCKETS; i++) {
         poll_socket(i);
@@ -917,11 +1278,10 @@ broadcast_relay_tx(const uint8_t *pkt, int pkt_len)
     int payload_len;
     const uint8_t *payload;
     struct sockaddr_in dest;
-    int sent;
-    time_t now;
     int sock_idx;
     int is_broadcast;
     int is_external_unicast;
+    time_t now;
 
     if (!relay.enabled) {
         return 0;
@@ -998,17 +1358,17 @@ broadcast_relay_tx(const uint8_t *pkt, int pkt_len)
         return 0;
     }
 
-    /* Rate limiting */
+    /* Rate limiting, decided here so dropped packets don't reach SLiRP */
     now = time(NULL);
-    if (now != relay.last_rate_reset) {
-        relay.packets_this_second = 0;
-        relay.last_rate_reset = now;
+    if (now != relay.tx_last_rate_reset) {
+        relay.tx_packets_this_second = 0;
+        relay.tx_last_rate_reset = now;
     }
-    if (relay.packets_this_second >= MAX_PACKETS_PER_SECOND) {
+    if (relay.tx_packets_this_second >= MAX_PACKETS_PER_SECOND) {
         relay.dropped++;
         return 1;  /* Handled (dropped) */
     }
-    relay.packets_this_second++;
+    relay.tx_packets_this_second++;
 
     /* Extract UDP payload */
     udp_len = (udp_hdr[4] << 8) | udp_hdr[5];
@@ -1032,19 +1392,14 @@ broadcast_relay_tx(const uint8_t *pkt, int pkt_len)
         dest.sin_addr.s_addr = htonl(dst_ip);
     }
 
-    /* Send from the appropriate socket (bound to correct source port) */
-#ifdef _WIN32
-    sent = sendto(relay.sockets[sock_idx], (const char *)payload, payload_len, 0,
-                  (struct sockaddr *)&dest, sizeof(dest));
-#else
-    sent = sendto(relay.sockets[sock_idx], payload, payload_len, 0,
-                  (struct sockaddr *)&dest, sizeof(dest));
+    /* Sending happens on the thread owning the sockets */
+#ifdef RELAY_IO_THREAD
+    if (relay.io_running) {
+        relay_queue_datagram(sock_idx, &dest, payload, payload_len);
+    } else
 #endif
-
-    if (sent < 0) {
-        relay.dropped++;
-    } else {
-        relay.tx_count++;
+    {
+        relay_send_datagram(sock_idx, &dest, payload, payload_len);
     }
 
     /* Return 1 for external unicast (we handle it completely) */
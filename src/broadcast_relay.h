@@ -73,7 +73,8 @@ void broadcast_relay_poll(void);
  * @param pkt     Complete Ethernet frame from guest
  * @param pkt_len Length of frame in bytes
  *
- * @return 1 if packet was relayed (still pass to SLiRP too), 0 otherwise
+ * @return 1 if packet was relayed (still pass to SLiRP too) or dropped by
+ *         the rate limit, 0 otherwise
  */
 int broadcast_relay_tx(const uint8_t *pkt, int pkt_len);
 
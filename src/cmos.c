@@ -25,14 +25,25 @@
   Includes code from Softgun by Jochen Karrer used under the terms of the
   GPLv2.
 */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 
+#include <pthread.h>
+
 #include "rpcemu.h"
+#include "arm.h"
 #include "cmos.h"
+#include "mem.h"
+#include "replay.h"
+#include "swi.h"
 
 #if 0
 #define dbgprintf(x...) { fprintf(stderr, x); }
@@ -48,6 +59,35 @@ int i2cdata  = 1; /**< The current value of the I2C data pin */
 static unsigned char cmosram[256];
 static uint32_t i2c_devices; /**< Bitfield of devices on the I2C bus */
 
+/* cmos.ram holds the 256 bytes of CMOS followed by a trailer of a magic
+   word and the CRC-32 of the CMOS bytes, both little-endian. Files
+   without the trailer, as written by older versions, are also accepted. */
+#define CMOS_SIZE		256
+#define CMOS_FILE_SIZE		(CMOS_SIZE + 8)
+#define CMOS_FILE_MAGIC		0x534f4d43 /* "CMOS" */
+
+/** Minimum time between writes of cmos.ram while the machine is running */
+#define CMOS_SAVE_INTERVAL	2 /* seconds */
+
+/** Background writer for cmos.ram, so CMOS writes never wait for the disc */
+typedef struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	pthread_t	thread;
+	int		started;	/**< Writer thread is running */
+	int		quit;		/**< Writer thread should flush and exit */
+	int		pending;	/**< image needs writing to path */
+	int		writing;	/**< Writer thread is writing outside the lock */
+	time_t		last_write;	/**< Time of the last write */
+	char		path[512];
+	uint8_t		image[CMOS_FILE_SIZE];
+} CMOSStore;
+
+static CMOSStore cmos_store = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
 /****************************************************************************/
 
 /* returnvalues for the start and write I2C Operations */
@@ -94,6 +134,19 @@ typedef struct {
 	int state;
 } PCF8583;
 
+/**
+ * @return The time the RTC shows: the host's, or while recording or
+ *         replaying, the recording's start time plus the emulated clock
+ */
+static time_t
+cmos_rtc_time(void)
+{
+	if (replay_mode != ReplayMode_Off) {
+		return replay_time_base + (time_t) (replay_clock / 1000000000);
+	}
+	return time(NULL);
+}
+
 /**
  * Update CMOS contents to automatically handle various Host and emulation
  * settings.
@@ -101,7 +154,7 @@ typedef struct {
 static void
 cmos_update_settings(void)
 {
-	time_t now = time(NULL);
+	time_t now = cmos_rtc_time();
 	const struct tm *t = gmtime(&now);
 	const struct tm *tloc = localtime(&now);
 
@@ -166,11 +219,161 @@ cmos_update_checksum(void)
 }
 
 /**
- * Load CMOS data from cmos.ram file on file system
+ * Calculate the CRC-32 of a block of data, as stored in the cmos.ram trailer.
+ *
+ * @param data Data
+ * @param size Size of data in bytes
+ * @return CRC-32
+ */
+static uint32_t
+cmos_crc32(const uint8_t *data, size_t size)
+{
+	uint32_t crc = 0xffffffff;
+	size_t i;
+	int bit;
+
+	for (i = 0; i < size; i++) {
+		crc ^= data[i];
+		for (bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+
+/**
+ * Read a little-endian 32-bit word.
+ */
+static uint32_t
+cmos_get_le32(const uint8_t *p)
+{
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) |
+	       ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/**
+ * Write a little-endian 32-bit word.
+ */
+static void
+cmos_put_le32(uint8_t *p, uint32_t val)
+{
+	p[0] = (uint8_t) val;
+	p[1] = (uint8_t) (val >> 8);
+	p[2] = (uint8_t) (val >> 16);
+	p[3] = (uint8_t) (val >> 24);
+}
+
+/**
+ * Build the cmos.ram file image of the current CMOS contents.
+ *
+ * @param image Filled in with CMOS_FILE_SIZE bytes
+ */
+static void
+cmos_make_image(uint8_t *image)
+{
+	memcpy(image, cmosram, CMOS_SIZE);
+	cmos_put_le32(image + CMOS_SIZE, CMOS_FILE_MAGIC);
+	cmos_put_le32(image + CMOS_SIZE + 4, cmos_crc32(cmosram, CMOS_SIZE));
+}
+
+/**
+ * Write a cmos.ram file image to disc, replacing the old file atomically.
+ *
+ * @param path  Pathname of cmos.ram
+ * @param image CMOS_FILE_SIZE bytes to write
+ */
+static void
+cmos_write_image(const char *path, const uint8_t *image)
+{
+	if (!rpcemu_file_write_atomic(path, image, CMOS_FILE_SIZE)) {
+		fprintf(stderr, "Could not write CMOS file '%s': %s\n", path,
+		        strerror(errno));
+		rpclog("Could not write CMOS file '%s': %s\n", path,
+		       strerror(errno));
+	}
+}
+
+/**
+ * Writer thread for cmos.ram. Writes the latest image handed over by
+ * cmos_request_save(), no more often than every CMOS_SAVE_INTERVAL
+ * seconds, and anything still pending when asked to quit.
+ *
+ * @param arg UNUSED
+ * @return NULL
+ */
+static void *
+cmos_store_thread(void *arg)
+{
+	uint8_t image[CMOS_FILE_SIZE];
+	char path[sizeof(cmos_store.path)];
+
+	NOT_USED(arg);
+
+	pthread_mutex_lock(&cmos_store.lock);
+	for (;;) {
+		while (!cmos_store.pending && !cmos_store.quit) {
+			pthread_cond_wait(&cmos_store.cond, &cmos_store.lock);
+		}
+		if (!cmos_store.pending) {
+			break;
+		}
+
+		/* Let further changes accumulate until the interval is up */
+		if (!cmos_store.quit) {
+			const time_t due = cmos_store.last_write + CMOS_SAVE_INTERVAL;
+
+			if (time(NULL) < due) {
+				struct timespec ts;
+
+				ts.tv_sec = due;
+				ts.tv_nsec = 0;
+				pthread_cond_timedwait(&cmos_store.cond, &cmos_store.lock, &ts);
+				continue;
+			}
+		}
+
+		memcpy(image, cmos_store.image, sizeof(image));
+		memcpy(path, cmos_store.path, sizeof(path));
+		cmos_store.pending = 0;
+		cmos_store.writing = 1;
+		pthread_mutex_unlock(&cmos_store.lock);
+
+		cmos_write_image(path, image);
+
+		pthread_mutex_lock(&cmos_store.lock);
+		cmos_store.writing = 0;
+		cmos_store.last_write = time(NULL);
+		pthread_cond_broadcast(&cmos_store.cond);
+	}
+	pthread_mutex_unlock(&cmos_store.lock);
+
+	return NULL;
+}
+
+/**
+ * Hand the current CMOS contents to the writer thread to be saved to the
+ * current machine's cmos.ram. Does not wait for the disc.
+ */
+static void
+cmos_request_save(void)
+{
+	pthread_mutex_lock(&cmos_store.lock);
+	cmos_make_image(cmos_store.image);
+	snprintf(cmos_store.path, sizeof(cmos_store.path), "%scmos.ram",
+	         rpcemu_get_machine_datadir());
+	cmos_store.pending = 1;
+	pthread_cond_signal(&cmos_store.cond);
+	pthread_mutex_unlock(&cmos_store.lock);
+}
+
+/**
+ * Load CMOS data from cmos.ram file on file system, and start the thread
+ * that saves it back.
  */
 void
 cmos_init(void)
 {
+        uint8_t image[CMOS_FILE_SIZE];
         char fn[512];
         FILE *cmosf;
 
@@ -180,11 +383,25 @@ cmos_init(void)
 
         if (cmosf) {
                 /* File open suceeded, load CMOS data */
-                if (fread(cmosram, 1, 256, cmosf) != 256) {
+                size_t len = fread(image, 1, sizeof(image), cmosf);
+
+                if (len < CMOS_SIZE) {
                         fatal("Unable to read from CMOS file '%s', %s", fn,
                               strerror(errno));
                 }
                 fclose(cmosf);
+
+                if (len == CMOS_FILE_SIZE &&
+                    cmos_get_le32(image + CMOS_SIZE) == CMOS_FILE_MAGIC &&
+                    cmos_get_le32(image + CMOS_SIZE + 4) != cmos_crc32(image, CMOS_SIZE))
+                {
+                        /* Report corruption and initialise the array */
+                        fprintf(stderr, "CMOS file '%s' is corrupt, resetting CMOS\n", fn);
+                        rpclog("CMOS file '%s' is corrupt, resetting CMOS\n", fn);
+                        memset(cmosram, 0, CMOS_SIZE);
+                } else {
+                        memcpy(cmosram, image, CMOS_SIZE);
+                }
         } else {
                 /* Report failure and initialise the array */
                 fprintf(stderr, "Could not open CMOS file '%s': %s\n", fn, 
@@ -192,7 +409,48 @@ cmos_init(void)
                 memset(cmosram, 0, 256);
         }
 
+	/* A replay starts from the CMOS contents the recording did */
+	if (replay_mode == ReplayMode_Record) {
+		replay_record_data(ReplayEvent_Cmos, 0, 0, cmosram, CMOS_SIZE);
+	} else if (replay_mode == ReplayMode_Play) {
+		ReplayEvent event;
+		const uint8_t *recorded = replay_pull(ReplayEvent_Cmos, &event);
+
+		if (recorded != NULL && event.length == CMOS_SIZE) {
+			memcpy(cmosram, recorded, CMOS_SIZE);
+		}
+	}
+
+	if (!cmos_store.started) {
+		cmos_store.quit = 0;
+		if (pthread_create(&cmos_store.thread, NULL, cmos_store_thread, NULL)) {
+			fatal("Couldn't create CMOS writer thread");
+		}
+#ifdef __linux__
+		pthread_setname_np(cmos_store.thread, "rpcemu: cmos");
+#endif
+		cmos_store.started = 1;
+	}
+}
+
+/**
+ * Stop the thread that saves cmos.ram, after it has written any pending
+ * changes. Called on program closing.
+ */
+void
+cmos_close(void)
+{
+	if (!cmos_store.started) {
+		return;
+	}
+
+	pthread_mutex_lock(&cmos_store.lock);
+	cmos_store.quit = 1;
+	pthread_cond_signal(&cmos_store.cond);
+	pthread_mutex_unlock(&cmos_store.lock);
 
+	pthread_join(cmos_store.thread, NULL);
+	cmos_store.started = 0;
 }
 
 /**
@@ -213,39 +471,48 @@ cmos_reset(void)
 }
 
 /**
- * Save CMOS data to file system.
+ * Save CMOS data to file system now, waiting for the write to finish.
+ * Any save already handed to the writer thread is superseded.
  */
 void
 savecmos(void)
 {
-        char fn[512];
-        FILE *cmosf;
+	uint8_t image[CMOS_FILE_SIZE];
+	char fn[512];
 
 	/* Save cmos.ram to machine-specific directory */
 	snprintf(fn, sizeof(fn), "%scmos.ram", rpcemu_get_machine_datadir());
-        cmosf = fopen(fn, "wb");
+	cmos_make_image(image);
 
-        if (cmosf) {
-                if(fwrite(cmosram, 256, 1, cmosf) != 1) {
-                        fatal("Unable to write CMOS file '%s': %s", fn,
-                              strerror(errno));
-                        // TODO does it have to be fatal?
-                }
-                fclose(cmosf);
-        } else {
-                fprintf(stderr, "Could not open CMOS file '%s' for writing: %s\n", fn,
-                        strerror(errno));
-        }
+	pthread_mutex_lock(&cmos_store.lock);
+	while (cmos_store.writing) {
+		pthread_cond_wait(&cmos_store.cond, &cmos_store.lock);
+	}
+	cmos_store.pending = 0;
+	cmos_write_image(fn, image);
+	cmos_store.last_write = time(NULL);
+	pthread_mutex_unlock(&cmos_store.lock);
 }
 
+/** Time the PCF8583 time registers were last filled in from */
+static time_t cmos_time_cached = (time_t) -1;
+
 /**
- * Update PCF8583 time registers based on the current host system time
+ * Update PCF8583 time registers based on the current host system time (or
+ * emulated time while recording or replaying). The registers only change
+ * once a second, so the conversion is skipped while the time is unchanged.
  */
 static void
 cmosgettime(void)
 {
-	time_t now = time(NULL);
-	const struct tm *t = gmtime(&now);
+	time_t now = cmos_rtc_time();
+	const struct tm *t;
+
+	if (now == cmos_time_cached) {
+		return;
+	}
+	cmos_time_cached = now;
+	t = gmtime(&now);
 
 	cmosram[1] = 0;
 	cmosram[2] = BIN2BCD(t->tm_sec);
@@ -280,7 +547,7 @@ pcf8583_write(void *dev, uint8_t data)
 		// RISC OS updates the checksum byte after any change, so if
 		// the write is to the RISC OS checksum byte, save the data
 		if (pcf->reg_address == 0x3f) {
-			savecmos();
+			cmos_request_save();
 		}
 
 		pcf->reg_address = (pcf->reg_address + 1) & 0xff;
@@ -494,6 +761,24 @@ typedef struct {
 	int oldpinstate;
 } I2C_SerDes;
 
+/**
+ * Find the attached I2C slave device at a bus address.
+ *
+ * @param address 7-bit I2C address
+ * @return Slave device, or NULL if nothing is attached at that address
+ */
+static I2C_Slave *
+i2c_find_slave(uint8_t address)
+{
+	if ((address == pcf8583->address) && (i2c_devices & I2C_PCF8583)) {
+		return pcf8583;
+	}
+	if ((address == spd_i2c->address) && (i2c_devices & I2C_SPD_DIMM0)) {
+		return spd_i2c;
+	}
+	return NULL;
+}
+
 static I2C_SerDes serdes_s;
 static I2C_SerDes *serdes = &serdes_s; /**< Handle of the I2C state machine */
 
@@ -580,15 +865,7 @@ cmosi2cchange(int scl, int sda)
 				serdes->address = serdes->inbuf >> 1;
 
 				/* Detect which device is being talked to */
-				if ((serdes->address == pcf8583->address) && (i2c_devices & I2C_PCF8583)) {
-					slave = pcf8583;
-				} else if ((serdes->address == spd_i2c->address) && (i2c_devices & I2C_SPD_DIMM0)) {
-					slave = spd_i2c;
-				} else {
-					//fprintf(stderr, "Request for unhandled I2C device %02X\n",
-					//        serdes->address);
-					//rpclog("Request for unhandled I2C device %02X\n", serdes->address);
-				}
+				slave = i2c_find_slave(serdes->address);
 
 				dbgprintf("I2C-Address %02x slave %p\n",
 				          serdes->inbuf >> 1, slave);
@@ -769,6 +1046,68 @@ cmosi2cchange(int scl, int sda)
 	serdes->oldpinstate = (scl << 1) | sda;
 }
 
+/**
+ * Handle IIC_Control by running the whole transaction directly against the
+ * slave device, instead of RISC OS clocking every bit through IOMD.
+ *
+ * On entry R0 = device address (bit 0 set to read), R1 = buffer,
+ * R2 = length. Transactions for addresses with nothing attached, or using
+ * the extended forms of the call, are passed on to RISC OS. So is a write
+ * the device stops acknowledging part way through: RISC OS repeats it on
+ * the bus and returns its own "No acknowledge" error.
+ *
+ * @param swinum UNUSED
+ * @return 1 if the SWI has been handled
+ */
+static int
+i2c_swi_iic_control(uint32_t swinum)
+{
+	const uint32_t addr = arm.reg[0];
+	uint32_t buf = arm.reg[1];
+	uint32_t len = arm.reg[2];
+	I2C_Slave *slave;
+
+	NOT_USED(swinum);
+
+	if (addr > 0xff) {
+		return 0;
+	}
+
+	slave = i2c_find_slave((uint8_t) (addr >> 1));
+	if (slave == NULL) {
+		return 0;
+	}
+
+	if (addr & 1) {
+		if (slave->devops->start(slave->dev, (int) (addr >> 1), I2C_READ) != I2C_ACK) {
+			return 0;
+		}
+		while (len-- > 0) {
+			uint8_t data;
+
+			(void) slave->devops->read(slave->dev, &data);
+			mem_write8(buf++, data);
+			if (slave->devops->read_ack) {
+				slave->devops->read_ack(slave->dev, (len > 0) ? I2C_ACK : I2C_NACK);
+			}
+		}
+	} else {
+		if (slave->devops->start(slave->dev, (int) (addr >> 1), I2C_WRITE) != I2C_ACK) {
+			return 0;
+		}
+		while (len-- > 0) {
+			if (slave->devops->write(slave->dev, mem_read8(buf++)) != I2C_ACK) {
+				slave->devops->stop(slave->dev);
+				return 0;
+			}
+		}
+	}
+	slave->devops->stop(slave->dev);
+
+	arm.reg[cpsr] &= ~VFLAG;
+	return 1;
+}
+
 /**
  * Reset the I2C emulation and attached Philips PCF8583 RTC
  *
@@ -794,4 +1133,7 @@ reseti2c(uint32_t chosen_i2c_devices)
 
 	/* Initialise the I2C state machine */
 	reset_serdes(serdes);
+
+	/* Serve whole transactions without going through the state machine */
+	swi_register(SWI_IIC_Control, i2c_swi_iic_control);
 }
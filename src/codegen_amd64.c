@@ -21,7 +21,8 @@
 /*r15 is pointer to ARMState
   r14 is vwaddrl
   r13 is vraddrl
-  r12 contains R15*/
+  r12 contains R15
+  rbp, r9, r10, r11 cache ARM registers within a block*/
 
 #include <assert.h>
 #include <stddef.h>
@@ -32,7 +33,10 @@
 #include "arm.h"
 #include "arm_common.h"
 #include "codegen_amd64.h"
+#include "dynprof.h"
 #include "mem.h"
+#include "replay.h"
+#include "transcache.h"
 
 int lastflagchange;
 
@@ -57,6 +61,101 @@ static int pcinc;
 static int lastrecompiled;
 static int block_enter;
 
+/*
+ * Block-local register cache.
+ *
+ * ARM registers R0-R14 are given a host register on first use within a block
+ * and stay there until the block exits, an interpreter function is called or
+ * a conditional instruction is reached. Values are only written back to the
+ * ARMState when something outside the generated code may look at them.
+ *
+ * A register is only allocated on a path that every later instruction in
+ * the block will also have executed, so the mapping is the same wherever
+ * code paths meet. Dirty flags only ever accumulate between flushes, which
+ * keeps them a safe over-approximation at those points.
+ */
+#define REG_CACHE_SIZE	4
+
+static int reg_cache_host[16];		/**< Host register holding each ARM register, or -1 */
+static uint32_t reg_cache_used;		/**< Bitmask of pool entries in use */
+static uint32_t reg_cache_dirty;	/**< Bitmask of ARM registers needing writeback */
+static int reg_cache_frozen;		/**< Non-zero while allocation is not allowed */
+
+/*
+ * Lazy flags.
+ *
+ * After a recompiled compare or test the result is left in the host EFLAGS
+ * and the CPSR is not written. A following branch tests EFLAGS directly, and
+ * NZCV is only stored to the CPSR before code that would clobber EFLAGS or
+ * look at the CPSR: any other instruction, or the end of the block.
+ *
+ * This only applies in 32-bit modes. In 26-bit modes the flags live in R15,
+ * and CMP, CMN, TST and TEQ are still handed to the interpreter.
+ */
+typedef enum {
+	FLAGS_NONE,	/**< CPSR is up to date */
+	FLAGS_SUB,	/**< EFLAGS hold a subtraction (ARM C is inverted CF) */
+	FLAGS_ADD,	/**< EFLAGS hold an addition */
+	FLAGS_LOGICAL,	/**< EFLAGS hold N and Z only, C and V unchanged */
+} FlagsPending;
+
+static FlagsPending flags_pending;
+
+/*
+ * Superblocks.
+ *
+ * Every block counts its entries. Once a block has been entered
+ * SUPERBLOCK_THRESHOLD times it is rebuilt as a superblock. The rebuild runs
+ * through B and BL instructions in the direction they go while it is being
+ * built, as long as the target is in the same page. The other direction of a
+ * conditional branch gets a side exit, which leaves the block the same way
+ * endblock() does.
+ */
+#define SUPERBLOCK_THRESHOLD	64	/**< Block entries before rebuilding */
+#define SUPERBLOCK_MAX_BRANCHES	8	/**< Branches followed per superblock */
+#define SUPERBLOCK_MAX_POS	1000	/**< No branch followed beyond this code size */
+
+static uint32_t codeblockcount[BLOCKS];	/**< Entries into each block */
+static uint8_t codeblocksuper[BLOCKS];	/**< Non-zero if block is a superblock */
+static int superblock;			/**< Non-zero while building a superblock */
+static uint32_t superblock_start;
+static int superblock_branches;
+static int branch_followed;		/**< Last instruction was a followed branch */
+static uint32_t superblocks_formed;
+
+/*
+ * Translation cache.
+ *
+ * Blocks compiled from the ROM are handed to the persistent translation
+ * cache (transcache.c), and installed from it instead of being compiled.
+ * The prologue is regenerated, and only the body after it is cached. Every
+ * 32-bit field in the body that addresses something outside the block
+ * (RIP-relative data and calls) is recorded, so the body can be moved to a
+ * different rcodeblock[] slot. Everything it addresses is in the emulator
+ * image, so the distances only depend on the build.
+ */
+#define BLOCK_RELOCS_MAX	512
+
+static uint32_t block_pc;		/**< Address of first instruction */
+static uint32_t block_r15_mask;		/**< R15 address mask when compiled */
+static int block_body;			/**< Start of code after the prologue */
+static uint16_t block_relocs[BLOCK_RELOCS_MAX];
+static int block_reloc_count;
+
+/*
+ * Profiling (dynprof.c).
+ *
+ * While the profiler is recording, each call into the interpreter also
+ * counts itself. The counter belongs to the slot, so such blocks are not
+ * offered to the translation cache.
+ */
+static uint32_t codeblockfallbacks[BLOCKS];	/**< Interpreter calls from each block */
+static uint16_t codeblockfallbacksites[BLOCKS];	/**< Instructions compiled as interpreter calls */
+static uint16_t codeblocksize[BLOCKS];		/**< Bytes of code in each slot */
+static int block_profiled;			/**< Block being built counts interpreter calls */
+
+static void gen_branch_end(uint32_t opcode, const uint32_t *pcpsr, uint32_t offset);
+
 static inline void
 addbyte(uint32_t a)
 {
@@ -78,11 +177,26 @@ addptr64(const void *a)
 	codeblockpos += 8;
 }
 
+/**
+ * Record that a 32-bit field addressing something outside the block is
+ * about to be generated.
+ */
+static inline void
+reloc_note(void)
+{
+	if (block_reloc_count < BLOCK_RELOCS_MAX) {
+		block_relocs[block_reloc_count] = (uint16_t) (codeblockpos - block_body);
+	}
+	block_reloc_count++;
+}
+
 static inline void
 addrip(const void *addr)
 {
 	const ptrdiff_t rel = ((const char *) addr) -
 	                      ((const char *) &rcodeblock[blockpoint2][codeblockpos]);
+
+	reloc_note();
 	addlong((uint32_t) (rel - 4));
 }
 
@@ -91,6 +205,8 @@ addrip_byte(const void *addr, uint8_t x)
 {
 	const ptrdiff_t rel = ((const char *) addr) -
 	                      ((const char *) &rcodeblock[blockpoint2][codeblockpos]);
+
+	reloc_note();
 	addlong((uint32_t) (rel - 5));
 	addbyte(x);
 }
@@ -100,12 +216,18 @@ addrip_long(const void *addr, uint32_t x)
 {
 	const ptrdiff_t rel = ((const char *) addr) -
 	                      ((const char *) &rcodeblock[blockpoint2][codeblockpos]);
+
+	reloc_note();
 	addlong((uint32_t) (rel - 8));
 	addlong(x);
 }
 
 #include "codegen_x86_common.h"
 
+// Calls leave the block, so note them for relocation
+#undef gen_x86_call
+#define gen_x86_call(addr)	addbyte(0xe8); reloc_note(); addrel32(addr)
+
 // AMD64 registers and aliases
 #define RAX	EAX
 #define RCX	ECX
@@ -124,6 +246,10 @@ addrip_long(const void *addr, uint32_t x)
 #define R14	14
 #define R15	15
 
+// Host registers available to the register cache: %rbp is callee-saved, the
+// others are saved around C calls by the generated code
+static const int reg_cache_pool[REG_CACHE_SIZE] = { RBP, R9, R10, R11 };
+
 static inline void
 gen_x86_push_reg(int x86reg)
 {
@@ -170,6 +296,219 @@ gen_x86_mov_stack_reg32(int x86reg, int offset)
 	}
 }
 
+/**
+ * Generate MOV between two 32-bit registers.
+ *
+ * @param dst Destination x86 register
+ * @param src Source x86 register
+ */
+static inline void
+gen_x86_mov_reg32_reg32(int dst, int src)
+{
+	const uint8_t rex = 0x40 | ((src & 8) >> 1) | ((dst & 8) >> 3);
+
+	if (rex != 0x40) {
+		addbyte(rex);
+	}
+	addbyte(0x89); addbyte(0xc0 | ((src & 7) << 3) | (dst & 7)); // MOV %{src},%{dst}
+}
+
+/**
+ * Generate a load of an ARM register from the ARMState into a host register.
+ *
+ * @param x86reg Destination x86 register (any of the 16)
+ * @param reg    ARM register number (0-14)
+ */
+static inline void
+gen_load_reg_mem(int reg, int x86reg)
+{
+	addbyte(0x41 | ((x86reg & 8) >> 1)); addbyte(0x8b); addbyte(0x47 | ((x86reg & 7) << 3)); addbyte(reg<<2); // MOV R{reg},%{x86reg}
+}
+
+/**
+ * Generate a store of a host register to an ARM register in the ARMState.
+ *
+ * @param reg    ARM register number (0-14)
+ * @param x86reg Source x86 register (any of the 16)
+ */
+static inline void
+gen_save_reg_mem(int reg, int x86reg)
+{
+	addbyte(0x41 | ((x86reg & 8) >> 1)); addbyte(0x89); addbyte(0x47 | ((x86reg & 7) << 3)); addbyte(reg<<2); // MOV %{x86reg},R{reg}
+}
+
+/**
+ * Forget all cached ARM registers. Any dirty values must already have been
+ * written back.
+ */
+static void
+reg_cache_reset(void)
+{
+	int c;
+
+	for (c = 0; c < 16; c++) {
+		reg_cache_host[c] = -1;
+	}
+	reg_cache_used = 0;
+	reg_cache_dirty = 0;
+	reg_cache_frozen = 0;
+}
+
+/**
+ * Find the host register caching an ARM register, allocating one if allowed.
+ *
+ * No allocation happens inside a conditionally executed instruction or while
+ * reg_cache_frozen is set, as the code doing so might be skipped at run time.
+ *
+ * @param reg  ARM register number
+ * @param load Non-zero to generate a load of the current value on allocation
+ * @return Host register, or -1 if the register must be accessed in memory
+ */
+static int
+reg_cache_get(int reg, int load)
+{
+	int c;
+
+	if (reg == 15) {
+		return -1;
+	}
+	if (reg_cache_host[reg] >= 0) {
+		return reg_cache_host[reg];
+	}
+	if (reg_cache_frozen || lastjumppos != 0) {
+		return -1;
+	}
+	for (c = 0; c < REG_CACHE_SIZE; c++) {
+		if (!(reg_cache_used & (1u << c))) {
+			reg_cache_used |= (1u << c);
+			reg_cache_host[reg] = reg_cache_pool[c];
+			if (load) {
+				gen_load_reg_mem(reg, reg_cache_pool[c]);
+			}
+			return reg_cache_pool[c];
+		}
+	}
+	return -1;
+}
+
+/**
+ * Generate stores of all dirty cached registers to the ARMState, without
+ * changing the compile-time cache state. Used on paths that leave the block
+ * or call out to C, where the straight-line code continues with the cache.
+ */
+static void
+gen_reg_cache_store_dirty(void)
+{
+	int c;
+
+	for (c = 0; c < 15; c++) {
+		if (reg_cache_dirty & (1u << c)) {
+			gen_save_reg_mem(c, reg_cache_host[c]);
+		}
+	}
+}
+
+/**
+ * Generate reloads of the cached registers that a C function call clobbers.
+ */
+static void
+gen_reg_cache_reload_volatile(void)
+{
+	int c;
+
+	for (c = 0; c < 15; c++) {
+		if (reg_cache_host[c] >= 8) {
+			gen_load_reg_mem(c, reg_cache_host[c]);
+		}
+	}
+}
+
+/**
+ * Write back all dirty cached registers, leaving them cached and clean.
+ */
+static void
+gen_reg_cache_flush(void)
+{
+	gen_reg_cache_store_dirty();
+	reg_cache_dirty = 0;
+}
+
+/**
+ * Generate a call to a C helper that may read the ARMState (memory access
+ * slow paths). Cached registers are preserved across the call.
+ *
+ * @param fn Function to call
+ */
+static void
+gen_call_preserving_cache(const void *fn)
+{
+	gen_reg_cache_store_dirty();
+	gen_x86_call(fn);
+	gen_reg_cache_reload_volatile();
+}
+
+/**
+ * Generate a jump to the block epilogue, writing back dirty cached registers
+ * on the way out.
+ *
+ * @param condition Jump condition (or CC_ALWAYS for unconditional)
+ */
+static void
+gen_exit_jump(int condition)
+{
+	int jump_stay;
+
+	if (reg_cache_dirty == 0) {
+		gen_x86_jump(condition, 0);
+		return;
+	}
+	if (condition == CC_ALWAYS) {
+		gen_reg_cache_store_dirty();
+		gen_x86_jump(CC_ALWAYS, 0);
+		return;
+	}
+	jump_stay = gen_x86_jump_forward(condition ^ 1);
+	gen_reg_cache_store_dirty();
+	gen_x86_jump(CC_ALWAYS, 0);
+	gen_x86_jump_here(jump_stay);
+}
+
+/**
+ * Identify this build of the code generator for the translation cache.
+ * Cached blocks call and address code and data elsewhere in the
+ * executable, so the whole executable file is hashed; the distances from
+ * rcodeblock[] to what the blocks use are included as well.
+ *
+ * @return Build identifier, or 0 if the executable could not be hashed
+ */
+static uint64_t
+codegen_build_id(void)
+{
+	const uintptr_t base = (uintptr_t) rcodeblock;
+	uintptr_t layout[5];
+	uint64_t hash;
+	const uint8_t *p;
+	size_t i;
+
+	if (!rpcemu_executable_hash(&hash)) {
+		return 0;
+	}
+
+	layout[0] = (uintptr_t) &arm - base;
+	layout[1] = (uintptr_t) &inscount - base;
+	layout[2] = (uintptr_t) readmemfl - base;
+	layout[3] = (uintptr_t) generatecall - base;
+	layout[4] = sizeof(ARMState);
+
+	p = (const uint8_t *) layout;
+	for (i = 0; i < sizeof(layout); i++) {
+		hash ^= p[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+
+	return hash;
+}
+
 void
 initcodeblocks(void)
 {
@@ -186,6 +525,10 @@ initcodeblocks(void)
 	// Set memory pages containing rcodeblock[]s executable -
 	// necessary when NX/XD feature is active on CPU(s)
 	set_memory_executable(rcodeblock, sizeof(rcodeblock));
+
+	if (transcache_enabled()) {
+		transcache_set_build(codegen_build_id());
+	}
 }
 
 void
@@ -217,6 +560,9 @@ cacheclearpage(uint32_t a)
 	d = HASH(a << 12);
 	for (c = 0; c < 0x400; c++) {
 		if ((codeblockpc[c + d] >> 12) == a) {
+			if (dynprof_active) {
+				dynprof_invalidate(codeblockpc[c + d]);
+			}
 			codeblockpc[c + d] = 0xffffffff;
 		}
 	}
@@ -236,6 +582,18 @@ initcodeblock(uint32_t l)
 		codeblocknum[blocks[blockpoint] & 0x7fff] = 0xffffffff;
 	}
 	blocknum = HASH(l);
+	if (codeblockpc[blocknum] != 0xffffffff && blocks[codeblocknum[blocknum]] == (uint32_t) blocknum) {
+		// Block being replaced (e.g. by a superblock) must not evict
+		// its replacement when its slot is reused
+		blocks[codeblocknum[blocknum]] = 0xffffffff;
+	}
+	dynprof_slot_reused(blockpoint, codeblockcount[blockpoint], codeblockfallbacks[blockpoint]);
+	codeblockcount[blockpoint] = 0;
+	codeblockfallbacks[blockpoint] = 0;
+	codeblockfallbacksites[blockpoint] = 0;
+	codeblocksuper[blockpoint] = 0;
+	block_profiled = dynprof_active;
+	superblock = 0;
 //        blockcount=0;//codeblockcount[blocknum];
 //        codeblockcount[blocknum]++;
 //        if (codeblockcount[blocknum]==3) codeblockcount[blocknum]=0;
@@ -254,15 +612,15 @@ initcodeblock(uint32_t l)
 	gen_x86_pop_reg(R13);
 	gen_x86_pop_reg(R14);
 	gen_x86_pop_reg(R15);
-	gen_x86_leave();
+	gen_x86_pop_reg(RBP);
 	gen_x86_ret();
 
 	// Block Prologue
 	assert(codeblockpos <= BLOCKSTART);
 	codeblockpos = BLOCKSTART;
-	// Set up a stack frame and preserve registers that are callee-saved
+	// Preserve registers that are callee-saved (%rbp is used by the
+	// register cache, not as a frame pointer)
 	gen_x86_push_reg(RBP);
-	addbyte(0x48); addbyte(0x89); addbyte(0xe5); // MOV %rsp,%rbp
 	gen_x86_push_reg(R15);
 	gen_x86_push_reg(R14);
 	gen_x86_push_reg(R13);
@@ -276,13 +634,373 @@ initcodeblock(uint32_t l)
 	addbyte(0x49); addbyte(0xbd); addptr64(&vraddrl[0]); // MOVABS $vraddrl,%r13
 	addbyte(0x45); addbyte(0x8b); addbyte(0x67); addbyte(15<<2); // MOV R15,%r12d
 	block_enter = codeblockpos;
+
+	// Count entries, including those chained from other blocks
+	addbyte(0x83); addbyte(0x05); addrip_byte(&codeblockcount[blockpoint], 1); // ADDL $1,codeblockcount[blockpoint](%rip)
+
+	block_pc = l;
+	block_r15_mask = arm.r15_mask;
+	block_body = codeblockpos;
+	block_reloc_count = 0;
+
+	reg_cache_reset();
+	flags_pending = FLAGS_NONE;
+}
+
+/**
+ * Forget the block being built.
+ */
+static void
+discardcodeblock(void)
+{
+	codeblockpc[blocknum] = 0xffffffff;
+	codeblocknum[blocknum] = 0xffffffff;
+	blocks[blockpoint2] = 0xffffffff;
+}
+
+/**
+ * Install a block for an address from the translation cache, if it has one.
+ *
+ * @param l    Address of first instruction
+ * @param code Host pointer to first instruction
+ * @return Non-zero if a block was installed
+ */
+int
+fetchcodeblock(uint32_t l, const uint32_t *code)
+{
+	const TransCacheBlock *b;
+	const uint8_t *cached;
+	uint32_t rom_offset, slot_distance, field;
+	unsigned c;
+
+	if (replay_mode != ReplayMode_Off) {
+		// Cached blocks may be split differently from freshly compiled
+		// ones, which would move the recorded event points
+		return 0;
+	}
+	if (!transcache_rom_offset(code, &rom_offset)) {
+		return 0;
+	}
+	b = transcache_find(l, rom_offset, arm.r15_mask);
+	if (b == NULL) {
+		return 0;
+	}
+
+	initcodeblock(l);
+	if (b->code_size > sizeof(rcodeblock[0]) - (size_t) block_body) {
+		discardcodeblock();
+		return 0;
+	}
+	cached = transcache_block_code(b);
+	memcpy(&rcodeblock[blockpoint2][block_body], cached, b->code_size);
+
+	// Cached fields are relative to the first slot
+	slot_distance = (uint32_t) (blockpoint2 * sizeof(rcodeblock[0]));
+	for (c = 0; c < b->reloc_count; c++) {
+		const uint16_t offset = transcache_block_reloc(b, c);
+
+		if ((uint32_t) offset + 4 > b->code_size) {
+			discardcodeblock();
+			return 0;
+		}
+		memcpy(&field, &cached[offset], sizeof(field));
+		field -= slot_distance;
+		memcpy(&rcodeblock[blockpoint2][block_body + offset], &field, sizeof(field));
+	}
+	codeblockpos = block_body + (int) b->code_size;
+	codeblocksize[blockpoint2] = (uint16_t) codeblockpos;
+	codeblocksuper[blockpoint2] = (b->flags & TRANSCACHE_SUPERBLOCK) ? 1 : 0;
+
+	return 1;
+}
+
+/**
+ * Offer the block just finished to the translation cache. Only blocks from
+ * the ROM are kept.
+ *
+ * @param code Host pointer to first instruction
+ */
+void
+storecodeblock(const uint32_t *code)
+{
+	static uint8_t body[sizeof(rcodeblock[0])];
+	TransCacheBlock b;
+	uint32_t rom_offset, slot_distance, field;
+	int c;
+
+	if (codeblockpc[blocknum] != block_pc || codeblocknum[blocknum] != blockpoint2 ||
+	    arm.r15_mask != block_r15_mask || block_reloc_count > BLOCK_RELOCS_MAX)
+	{
+		// Invalidated or mode changed while compiling
+		return;
+	}
+	if (block_profiled || replay_mode != ReplayMode_Off) {
+		return;
+	}
+	if (!transcache_rom_offset(code, &rom_offset)) {
+		return;
+	}
+
+	b.pc = block_pc;
+	b.rom_offset = rom_offset;
+	b.r15_mask = block_r15_mask;
+	b.flags = codeblocksuper[blockpoint2] ? TRANSCACHE_SUPERBLOCK : 0;
+	b.reloc_count = (uint16_t) block_reloc_count;
+	b.code_size = (uint32_t) (codeblockpos - block_body);
+
+	// Make fields relative to the first slot
+	memcpy(body, &rcodeblock[blockpoint2][block_body], b.code_size);
+	slot_distance = (uint32_t) (blockpoint2 * sizeof(rcodeblock[0]));
+	for (c = 0; c < block_reloc_count; c++) {
+		memcpy(&field, &body[block_relocs[c]], sizeof(field));
+		field += slot_distance;
+		memcpy(&body[block_relocs[c]], &field, sizeof(field));
+	}
+
+	transcache_store(&b, body, block_relocs);
+}
+
+/**
+ * Store pending flags from the host EFLAGS into the CPSR.
+ *
+ * Register usage:
+ *	%eax, %ecx	scratch
+ */
+static void
+gen_flags_materialise(void)
+{
+	switch (flags_pending) {
+	case FLAGS_NONE:
+		return;
+	case FLAGS_SUB:
+	case FLAGS_ADD:
+		// AX = [SF ZF - AF - PF - CF][OF]; one multiply moves SF, ZF,
+		// CF and OF to bits 31-28, the stray copies are masked off
+		gen_x86_lahf();
+		addbyte(0x0f); addbyte(0x90); addbyte(0xc0); // SETO %al
+		if (flags_pending == FLAGS_SUB) {
+			addbyte(0x80); addbyte(0xf4); addbyte(0x01); // XOR $1,%ah
+		}
+		addbyte(0x25); addlong(0xc101); // AND $0xc101,%eax
+		addbyte(0x69); addbyte(0xc0); addlong(0x10210000); // IMUL $0x10210000,%eax,%eax
+		addbyte(0x25); addlong(0xf0000000); // AND $0xf0000000,%eax
+		addbyte(0x41); addbyte(0x8b); addbyte(0x4f); addbyte(16<<2); // MOV CPSR,%ecx
+		addbyte(0x81); addbyte(0xe1); addlong(0x0fffffff); // AND $0x0fffffff,%ecx
+		break;
+	case FLAGS_LOGICAL:
+		gen_x86_lahf();
+		addbyte(0x25); addlong(0xc000); // AND $0xc000,%eax
+		addbyte(0xc1); addbyte(0xe0); addbyte(16); // SHL $16,%eax
+		addbyte(0x41); addbyte(0x8b); addbyte(0x4f); addbyte(16<<2); // MOV CPSR,%ecx
+		addbyte(0x81); addbyte(0xe1); addlong(0x3fffffff); // AND $0x3fffffff,%ecx
+		break;
+	}
+	addbyte(0x09); addbyte(0xc1); // OR %eax,%ecx
+	addbyte(0x41); addbyte(0x89); addbyte(0x4f); addbyte(16<<2); // MOV %ecx,CPSR
+	flags_pending = FLAGS_NONE;
+}
+
+/**
+ * Find the x86 condition that is true when an ARM condition fails, judged
+ * from the pending host EFLAGS.
+ *
+ * @param arm_cond ARM condition code (0-13)
+ * @return x86 condition code, or -1 if EFLAGS do not hold enough information
+ */
+static int
+flags_pending_skip_condition(uint32_t arm_cond)
+{
+	static const int skip_sub[14] = {
+		CC_NZ, CC_Z, CC_C, CC_NC, CC_NS, CC_S, CC_NO, CC_O,
+		CC_BE, CC_A, CC_L, CC_GE, CC_LE, CC_G
+	};
+
+	switch (flags_pending) {
+	case FLAGS_SUB:
+		return skip_sub[arm_cond];
+	case FLAGS_ADD:
+		if (arm_cond == 2 || arm_cond == 3) {
+			// CS/CC: ARM C is CF for an addition
+			return (arm_cond & 1) ? CC_C : CC_NC;
+		}
+		if (arm_cond == 8 || arm_cond == 9) {
+			// HI/LS need C and Z in a combination x86 does not test
+			return -1;
+		}
+		return skip_sub[arm_cond];
+	case FLAGS_LOGICAL:
+		if (arm_cond < 2 || arm_cond == 4 || arm_cond == 5) {
+			// EQ/NE/MI/PL
+			return skip_sub[arm_cond];
+		}
+		return -1;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * Test whether an opcode is a B (not BL), whose recompiled code leaves the
+ * host EFLAGS intact. A 26-bit branch that wraps the address space needs
+ * masking that does not.
+ *
+ * @param opcode Opcode of instruction
+ * @return Non-zero if a B instruction that keeps EFLAGS
+ */
+static inline int
+opcode_is_b(uint32_t opcode)
+{
+	uint32_t offset;
+
+	if ((opcode & 0x0f000000) != 0x0a000000) {
+		return 0;
+	}
+	offset = (uint32_t) ((int32_t) (opcode << 8) >> 6) + 4;
+	return ((PC + offset) & 0xfc000000) == 0 || arm.r15_mask == 0xfffffffc;
+}
+
+/**
+ * Generate an addition of a constant to R15 (in %r12d). Uses LEA while flags
+ * are pending so EFLAGS survive.
+ *
+ * @param value Constant to add
+ */
+static void
+gen_add_r15(uint32_t value)
+{
+	if (flags_pending != FLAGS_NONE) {
+		if (!(value & ~0x7f)) {
+			addbyte(0x45); addbyte(0x8d); addbyte(0x64); addbyte(0x24); addbyte(value); // LEA value(%r12),%r12d
+		} else {
+			addbyte(0x45); addbyte(0x8d); addbyte(0xa4); addbyte(0x24); addlong(value); // LEA value(%r12),%r12d
+		}
+	} else if (!(value & ~0x7f)) {
+		addbyte(0x41); addbyte(0x83); addbyte(0xc4); addbyte(value); // ADD $value,%r12d
+	} else {
+		addbyte(0x41); addbyte(0x81); addbyte(0xc4); addlong(value); // ADD $value,%r12d
+	}
+}
+
+/**
+ * Start building a superblock at the given address, replacing the ordinary
+ * block there.
+ *
+ * @param l Address of first instruction
+ */
+void
+initsuperblock(uint32_t l)
+{
+	initcodeblock(l);
+	codeblocksuper[blockpoint] = 1;
+	superblock = 1;
+	superblock_start = l;
+	superblock_branches = 0;
+	superblocks_formed++;
+}
+
+/**
+ * Check whether the block found for an address should be rebuilt as a
+ * superblock.
+ *
+ * @param l Address of block, which must be in the code cache
+ * @return Non-zero if hot and not yet a superblock
+ */
+int
+codeblockhot(uint32_t l)
+{
+	const int num = codeblocknum[HASH(l)];
+
+	return !codeblocksuper[num] && codeblockcount[num] >= SUPERBLOCK_THRESHOLD;
+}
+
+/**
+ * @return Non-zero if the current instruction was a branch that the
+ *         superblock being built carries on through
+ */
+int
+superblockcontinues(void)
+{
+	return branch_followed;
+}
+
+/**
+ * Get superblock statistics. Coverage is measured over the blocks currently
+ * in the code cache.
+ *
+ * @param stats Filled in with statistics
+ */
+void
+superblock_get_stats(SuperblockStats *stats)
+{
+	uint64_t entries = 0, super_entries = 0;
+	int c;
+
+	stats->formed = superblocks_formed;
+	stats->resident = 0;
+	for (c = 0; c < BLOCKS; c++) {
+		if (blocks[c] == 0xffffffff || codeblockpc[blocks[c]] == 0xffffffff ||
+		    codeblocknum[blocks[c]] != c)
+		{
+			continue;
+		}
+		entries += codeblockcount[c];
+		if (codeblocksuper[c]) {
+			stats->resident++;
+			super_entries += codeblockcount[c];
+		}
+	}
+	stats->coverage = entries ? (float) (100.0 * (double) super_entries / (double) entries) : 0.0f;
+}
+
+/**
+ * Find the code cache slot holding the block for an address.
+ *
+ * @param l Address of first instruction
+ * @return Slot, or -1 if the block is not in the code cache
+ */
+int
+codeblock_lookup(uint32_t l)
+{
+	const uint32_t hash = HASH(l);
+
+	return (codeblockpc[hash] == l) ? codeblocknum[hash] : -1;
+}
+
+/**
+ * Describe a code cache slot. The counts and code are filled in even when
+ * the block has since been discarded, until the slot is reused.
+ *
+ * @param slot Slot, 0 to BLOCKS - 1
+ * @param info Filled in with the slot's block
+ * @return Non-zero if the block is still in the code cache
+ */
+int
+codeblock_get_info(int slot, CodeBlockInfo *info)
+{
+	const uint32_t hash = blocks[slot];
+
+	info->code = &rcodeblock[slot][BLOCKSTART];
+	info->code_size = (codeblocksize[slot] > BLOCKSTART) ? codeblocksize[slot] - BLOCKSTART : 0;
+	info->entries = codeblockcount[slot];
+	info->fallbacks = codeblockfallbacks[slot];
+	info->fallback_sites = codeblockfallbacksites[slot];
+	info->superblock = codeblocksuper[slot];
+
+	if (hash == 0xffffffff || codeblockpc[hash & 0x7fff] == 0xffffffff ||
+	    codeblocknum[hash & 0x7fff] != slot)
+	{
+		info->pc = 0xffffffff;
+		return 0;
+	}
+	info->pc = codeblockpc[hash & 0x7fff];
+	return 1;
 }
 
 static const int canrecompile[256] = {
 	1,0,1,0,1,0,0,0,1,0,0,0,0,0,0,0, // 00
-	0,0,0,0,0,0,0,0,1,0,1,0,1,0,1,0, // 10
+	0,1,0,1,0,1,0,1,1,0,1,0,1,0,1,0, // 10
 	1,0,1,0,1,0,0,0,1,0,0,0,0,0,0,0, // 20
-	0,0,0,0,0,0,0,0,1,0,1,0,1,0,1,0, // 30
+	0,1,0,1,0,1,0,1,1,0,1,0,1,0,1,0, // 30
 
 	1,1,0,0,1,1,0,0,1,1,0,0,1,1,0,0, // 40
 	1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1, // 50
@@ -303,26 +1021,140 @@ static const int canrecompile[256] = {
 static void
 genstoreimm(int reg, uint32_t val)
 {
-	addbyte(0x41); addbyte(0xc7); addbyte(0x47); addbyte(reg<<2); addlong(val); // MOVL $val,R{reg}
+	const int host = reg_cache_get(reg, 0);
+
+	if (host >= 0) {
+		if (host >= 8) {
+			addbyte(0x41);
+		}
+		addbyte(0xb8 | (host & 7)); addlong(val); // MOV $val,%{host}
+		reg_cache_dirty |= (1u << reg);
+	} else {
+		addbyte(0x41); addbyte(0xc7); addbyte(0x47); addbyte(reg<<2); addlong(val); // MOVL $val,R{reg}
+	}
 }
 
 static void
 gen_load_reg(int reg, int x86reg)
 {
+	int host;
+
 	if (reg == 15) {
 		addbyte(0x44); addbyte(0x89); addbyte(0xe0 | x86reg); // MOV %r12d,%{x86reg}
+	} else if ((host = reg_cache_get(reg, 1)) >= 0) {
+		gen_x86_mov_reg32_reg32(x86reg, host);
 	} else {
-		addbyte(0x41); addbyte(0x8b); addbyte(0x47 | (x86reg << 3)); addbyte(reg<<2); // MOV R{reg},%{x86reg}
+		gen_load_reg_mem(reg, x86reg);
 	}
 }
 
 static void
 gen_save_reg(int reg, int x86reg)
 {
+	int host;
+
 	if (reg == 15) {
 		addbyte(0x41); addbyte(0x89); addbyte(0xc4 | (x86reg << 3)); // MOV %{x86reg},%r12d
+	} else if ((host = reg_cache_get(reg, 0)) >= 0) {
+		gen_x86_mov_reg32_reg32(host, x86reg);
+		reg_cache_dirty |= (1u << reg);
 	} else {
-		addbyte(0x41); addbyte(0x89); addbyte(0x47 | (x86reg << 3)); addbyte(reg<<2); // MOV %{x86reg},R{reg}
+		gen_save_reg_mem(reg, x86reg);
+	}
+}
+
+/**
+ * Generate an ALU operation with an ARM register as the source operand.
+ *
+ * @param op     X86_OP_* operation
+ * @param reg    ARM register number (0-14)
+ * @param x86reg x86 register operated on
+ */
+static void
+gen_op_reg_to_x86(uint8_t op, int reg, int x86reg)
+{
+	const int host = reg_cache_get(reg, 1);
+
+	if (host >= 0) {
+		if (host >= 8) {
+			addbyte(0x41);
+		}
+		addbyte(0x03|op); addbyte(0xc0 | (x86reg << 3) | (host & 7)); // OP %{host},%{x86reg}
+	} else {
+		addbyte(0x41); addbyte(0x03|op); addbyte(0x47 | (x86reg << 3)); addbyte(reg<<2); // OP R{reg},%{x86reg}
+	}
+}
+
+/**
+ * Generate an ALU operation with an ARM register as the destination operand.
+ *
+ * @param op     X86_OP_* operation
+ * @param x86reg x86 register used as source
+ * @param reg    ARM register number (0-14)
+ */
+static void
+gen_op_x86_to_reg(uint8_t op, int x86reg, int reg)
+{
+	const int host = reg_cache_get(reg, 1);
+
+	if (host >= 0) {
+		if (host >= 8) {
+			addbyte(0x41);
+		}
+		addbyte(0x01|op); addbyte(0xc0 | (x86reg << 3) | (host & 7)); // OP %{x86reg},%{host}
+		reg_cache_dirty |= (1u << reg);
+	} else {
+		addbyte(0x41); addbyte(0x01|op); addbyte(0x47 | (x86reg << 3)); addbyte(reg<<2); // OP %{x86reg},R{reg}
+	}
+}
+
+/**
+ * Generate an ALU operation with an immediate on an ARM register in place.
+ *
+ * @param op  X86_OP_* operation
+ * @param reg ARM register number (0-14)
+ * @param imm Immediate value
+ */
+static void
+gen_op_imm_to_reg(uint8_t op, int reg, uint32_t imm)
+{
+	const int host = reg_cache_get(reg, 1);
+	const int small = !(imm & ~0x7f);
+
+	if (host >= 0) {
+		if (host >= 8) {
+			addbyte(0x41);
+		}
+		addbyte(small ? 0x83 : 0x81); addbyte(0xc0 | op | (host & 7)); // OPL $imm,%{host}
+		reg_cache_dirty |= (1u << reg);
+	} else {
+		addbyte(0x41); addbyte(small ? 0x83 : 0x81); addbyte(0x47|op); addbyte(reg<<2); // OPL $imm,R{reg}
+	}
+	if (small) {
+		addbyte(imm);
+	} else {
+		addlong(imm);
+	}
+}
+
+/**
+ * Generate an unsigned multiply of %eax by an ARM register, result in
+ * %edx:%eax.
+ *
+ * @param reg ARM register number (0-14)
+ */
+static void
+gen_mul_reg(int reg)
+{
+	const int host = reg_cache_get(reg, 1);
+
+	if (host >= 0) {
+		if (host >= 8) {
+			addbyte(0x41);
+		}
+		addbyte(0xf7); addbyte(0xe0 | (host & 7)); // MULL %{host}
+	} else {
+		addbyte(0x41); addbyte(0xf7); addbyte(0x67); addbyte(reg<<2); // MULL R{reg}
 	}
 }
 
@@ -386,7 +1218,7 @@ gen_data_proc_reg(uint32_t opcode, uint8_t op, int dirmatters)
 		addbyte(0x01|op); addbyte(0xc2); // OP %eax,%edx
 		gen_save_reg(RD, EDX);
 	} else {
-		addbyte(0x41); addbyte(0x03|op); addbyte(0x47); addbyte(RN<<2); // OP RN,%eax
+		gen_op_reg_to_x86(op, RN, EAX); // OP RN,%eax
 		gen_save_reg(RD, EAX);
 	}
 }
@@ -396,11 +1228,7 @@ gen_data_proc_imm(uint32_t opcode, uint8_t op, uint32_t imm)
 {
 	if (RN == RD) {
 		// Can use RMW instruction
-		if (imm & ~0x7f) {
-			addbyte(0x41); addbyte(0x81); addbyte(0x47|op); addbyte(RD<<2); addlong(imm); // OPL $imm,RD
-		} else {
-			addbyte(0x41); addbyte(0x83); addbyte(0x47|op); addbyte(RD<<2); addbyte(imm); // OPL $imm,RD
-		}
+		gen_op_imm_to_reg(op, RD, imm); // OPL $imm,RD
 	} else {
 		// Load/modify/store
 		gen_load_reg(RN, EAX);
@@ -416,7 +1244,7 @@ static void
 gen_test_armirq(void)
 {
 	addbyte(0x41); addbyte(0xf7); addbyte(0x47); addbyte(offsetof(ARMState, event)); addlong(0x40); // TESTL $0x40,arm.event
-	gen_x86_jump(CC_NZ, 0);
+	gen_exit_jump(CC_NZ);
 }
 
 /**
@@ -440,7 +1268,7 @@ genldr(void)
 	jump_nextbit = gen_x86_jump_forward(CC_ALWAYS);
 	// .notinbuffer
 	gen_x86_jump_here(jump_notinbuffer);
-	gen_x86_call(readmemfl);
+	gen_call_preserving_cache(readmemfl);
 	if (arm.abort_base_restored) {
 		gen_test_armirq();
 	}
@@ -472,7 +1300,7 @@ genldrb(void)
 	jump_nextbit = gen_x86_jump_forward(CC_ALWAYS);
 	// .notinbuffer
 	gen_x86_jump_here(jump_notinbuffer);
-	gen_x86_call(readmemfb);
+	gen_call_preserving_cache(readmemfb);
 	if (arm.abort_base_restored) {
 		gen_test_armirq();
 	}
@@ -501,7 +1329,7 @@ genstr(void)
 	jump_nextbit = gen_x86_jump_forward(CC_ALWAYS);
 	// .notinbuffer
 	gen_x86_jump_here(jump_notinbuffer);
-	gen_x86_call(writememfl);
+	gen_call_preserving_cache(writememfl);
 	if (arm.abort_base_restored) {
 		gen_test_armirq();
 	}
@@ -529,7 +1357,7 @@ genstrb(void)
 	jump_nextbit = gen_x86_jump_forward(CC_ALWAYS);
 	// .notinbuffer
 	gen_x86_jump_here(jump_notinbuffer);
-	gen_x86_call(writememfb);
+	gen_call_preserving_cache(writememfb);
 	if (arm.abort_base_restored) {
 		gen_test_armirq();
 	}
@@ -600,12 +1428,22 @@ gen_arm_ldm_stm_increment(uint32_t opcode, uint32_t offset)
 static void
 gen_call_ldm_stm_helper(uint32_t opcode, const void *helper_fn)
 {
+	int c;
+
 	addbyte(0xbf); addlong(opcode); // MOV $opcode,%edi (argument 1)
 
 	addbyte(0x45); addbyte(0x89); addbyte(0x67); addbyte(15<<2); // MOV %r12d,R15
+	gen_reg_cache_store_dirty();
 	gen_x86_call(helper_fn);
 	addbyte(0x45); addbyte(0x8b); addbyte(0x67); addbyte(15<<2); // MOV R15,%r12d
 
+	// The helper may have loaded any register, so refresh all cached ones
+	for (c = 0; c < 15; c++) {
+		if (reg_cache_host[c] >= 0) {
+			gen_load_reg_mem(c, reg_cache_host[c]);
+		}
+	}
+
 	gen_test_armirq();
 }
 
@@ -629,6 +1467,10 @@ gen_arm_store_multiple(uint32_t opcode, uint32_t offset)
 	uint32_t mask, d;
 	int c;
 
+	// Registers not already cached stay in memory: the fast path is skipped
+	// when the helper is called
+	reg_cache_frozen = 1;
+
 	// Check if crossing Page boundary
 	addbyte(0x89); addbyte(0xf0); // MOV %esi,%eax
 	addbyte(0x0d); addlong(0xfffffc00); // OR $0xfffffc00,%eax
@@ -692,6 +1534,7 @@ gen_arm_store_multiple(uint32_t opcode, uint32_t offset)
 
 	// All done, continue here
 	gen_x86_jump_here(jump_done);
+	reg_cache_frozen = 0;
 }
 
 /**
@@ -715,6 +1558,10 @@ gen_arm_load_multiple(uint32_t opcode, uint32_t offset)
 	uint32_t mask, d;
 	int c;
 
+	// Registers not already cached stay in memory: the fast path is skipped
+	// when the helper is called
+	reg_cache_frozen = 1;
+
 	// Check if crossing Page boundary
 	addbyte(0x89); addbyte(0xf0); // MOV %esi,%eax
 	addbyte(0x0d); addlong(0xfffffc00); // OR $0xfffffc00,%eax
@@ -766,6 +1613,7 @@ gen_arm_load_multiple(uint32_t opcode, uint32_t offset)
 
 	// All done, continue here
 	gen_x86_jump_here(jump_done);
+	reg_cache_frozen = 0;
 }
 
 static int
@@ -774,8 +1622,6 @@ recompile(uint32_t opcode, uint32_t *pcpsr)
 	uint32_t rhs;
 	uint32_t offset;
 
-	NOT_USED(pcpsr);
-
 	if (arm.arch_v4) {
 		if ((opcode & 0xe0000f0) == 0xb0) {
 			// LDRH/STRH
@@ -794,7 +1640,7 @@ recompile(uint32_t opcode, uint32_t *pcpsr)
 				return 0;
 			}
 			gen_load_reg(MULRM, EAX);
-			addbyte(0x41); addbyte(0xf7); addbyte(0x67); addbyte(MULRS<<2); // MULL Rs
+			gen_mul_reg(MULRS); // MULL Rs
 			gen_save_reg(MULRD, EAX);
 			break;
 		}
@@ -812,8 +1658,8 @@ recompile(uint32_t opcode, uint32_t *pcpsr)
 				return 0;
 			}
 			gen_load_reg(MULRM, EAX);
-			addbyte(0x41); addbyte(0xf7); addbyte(0x67); addbyte(MULRS<<2); // MULL Rs
-			addbyte(0x41); addbyte(0x03); addbyte(0x47); addbyte(MULRN<<2); // ADD Rn,%eax
+			gen_mul_reg(MULRS); // MULL Rs
+			gen_op_reg_to_x86(X86_OP_ADD, MULRN, EAX); // ADD Rn,%eax
 			gen_save_reg(MULRD, EAX);
 			break;
 		}
@@ -836,7 +1682,7 @@ recompile(uint32_t opcode, uint32_t *pcpsr)
 		if (arm.arch_v4 && (opcode & 0xf0) == 0x90) {
 			// UMULL
 			gen_load_reg(MULRM, EAX);
-			addbyte(0x41); addbyte(0xf7); addbyte(0x67); addbyte(MULRS<<2); // MULL Rs
+			gen_mul_reg(MULRS); // MULL Rs
 			gen_save_reg(MULRN, EAX);
 			gen_save_reg(MULRD, EDX);
 			break;
@@ -867,6 +1713,34 @@ recompile(uint32_t opcode, uint32_t *pcpsr)
 		gen_data_proc_reg(opcode, X86_OP_OR, 0);
 		break;
 
+	case 0x11: // TST reg
+	case 0x13: // TEQ reg
+		if (RD == 15 || RN == 15 || pcpsr != &arm.reg[16]) return 0;
+		if ((opcode & 0xff0) != 0) {
+			// Shifter carry out would change C
+			return 0;
+		}
+		gen_load_reg(RM, EAX);
+		gen_op_reg_to_x86((opcode & 0x200000) ? X86_OP_XOR : X86_OP_AND, RN, EAX);
+		flags_pending = FLAGS_LOGICAL;
+		break;
+
+	case 0x15: // CMP reg
+	case 0x17: // CMN reg
+		if (RD == 15 || RN == 15 || pcpsr != &arm.reg[16]) return 0;
+		if (!generate_shift(opcode)) {
+			return 0;
+		}
+		gen_load_reg(RN, EDX);
+		if (opcode & 0x200000) {
+			addbyte(0x01); addbyte(0xc2); // ADD %eax,%edx
+			flags_pending = FLAGS_ADD;
+		} else {
+			addbyte(0x39); addbyte(0xc2); // CMP %eax,%edx
+			flags_pending = FLAGS_SUB;
+		}
+		break;
+
 	case 0x1a: // MOV reg
 		if (RD == 15) return 0;
 		if (!generate_shift(opcode)) {
@@ -926,6 +1800,36 @@ recompile(uint32_t opcode, uint32_t *pcpsr)
 		gen_data_proc_imm(opcode, X86_OP_ADC, rhs);
 		break;
 
+	case 0x31: // TST imm
+	case 0x33: // TEQ imm
+		if (RD == 15 || RN == 15 || pcpsr != &arm.reg[16]) return 0;
+		if ((opcode & 0xf00) != 0) {
+			// Rotated immediate would change C
+			return 0;
+		}
+		gen_load_reg(RN, EAX);
+		if (opcode & 0x200000) {
+			addbyte(0x35); addlong(opcode & 0xff); // XOR $imm,%eax
+		} else {
+			addbyte(0xa9); addlong(opcode & 0xff); // TEST $imm,%eax
+		}
+		flags_pending = FLAGS_LOGICAL;
+		break;
+
+	case 0x35: // CMP imm
+	case 0x37: // CMN imm
+		if (RD == 15 || RN == 15 || pcpsr != &arm.reg[16]) return 0;
+		rhs = arm_imm(opcode);
+		gen_load_reg(RN, EAX);
+		if (opcode & 0x200000) {
+			addbyte(0x05); addlong(rhs); // ADD $rhs,%eax
+			flags_pending = FLAGS_ADD;
+		} else {
+			addbyte(0x3d); addlong(rhs); // CMP $rhs,%eax
+			flags_pending = FLAGS_SUB;
+		}
+		break;
+
 	case 0x38: // ORR imm
 		if (RD == 15) return 0;
 		rhs = arm_imm(opcode);
@@ -969,20 +1873,15 @@ recompile(uint32_t opcode, uint32_t *pcpsr)
 		if (opcode & 0x2000000) {
 			gen_x86_mov_stack_reg32(EAX, 0);
 			if (opcode & 0x800000) {
-				addbyte(0x41); addbyte(0x01); addbyte(0x47); addbyte(RN<<2); // ADD %eax,Rn
+				gen_op_x86_to_reg(X86_OP_ADD, EAX, RN); // ADD %eax,Rn
 			} else {
-				addbyte(0x41); addbyte(0x29); addbyte(0x47); addbyte(RN<<2); // SUB %eax,Rn
+				gen_op_x86_to_reg(X86_OP_SUB, EAX, RN); // SUB %eax,Rn
 			}
 		} else {
 			offset = opcode & 0xfff;
 			if (offset != 0) {
-				addbyte(0x41); addbyte(0x81); // ADDL/SUBL $offset,Rn
-				if (opcode & 0x800000) {
-					addbyte(0x47); // ADD
-				} else {
-					addbyte(0x6f); // SUB
-				}
-				addbyte(RN<<2); addlong(offset);
+				// ADDL/SUBL $offset,Rn
+				gen_op_imm_to_reg((opcode & 0x800000) ? X86_OP_ADD : X86_OP_SUB, RN, offset);
 			}
 		}
 		if (!arm.abort_base_restored) {
@@ -1009,20 +1908,15 @@ recompile(uint32_t opcode, uint32_t *pcpsr)
 		if (opcode & 0x2000000) {
 			gen_x86_mov_stack_reg32(EAX, 0);
 			if (opcode & 0x800000) {
-				addbyte(0x41); addbyte(0x01); addbyte(0x47); addbyte(RN<<2); // ADD %eax,Rn
+				gen_op_x86_to_reg(X86_OP_ADD, EAX, RN); // ADD %eax,Rn
 			} else {
-				addbyte(0x41); addbyte(0x29); addbyte(0x47); addbyte(RN<<2); // SUB %eax,Rn
+				gen_op_x86_to_reg(X86_OP_SUB, EAX, RN); // SUB %eax,Rn
 			}
 		} else {
 			offset = opcode & 0xfff;
 			if (offset != 0) {
-				addbyte(0x41); addbyte(0x81); // ADDL/SUBL $offset,Rn
-				if (opcode & 0x800000) {
-					addbyte(0x47); // ADD
-				} else {
-					addbyte(0x6f); // SUB
-				}
-				addbyte(RN<<2); addlong(offset);
+				// ADDL/SUBL $offset,Rn
+				gen_op_imm_to_reg((opcode & 0x800000) ? X86_OP_ADD : X86_OP_SUB, RN, offset);
 			}
 		}
 		if (!arm.abort_base_restored) {
@@ -1048,20 +1942,15 @@ recompile(uint32_t opcode, uint32_t *pcpsr)
 		if (opcode & 0x2000000) {
 			gen_x86_mov_stack_reg32(EDX, 0);
 			if (opcode & 0x800000) {
-				addbyte(0x41); addbyte(0x01); addbyte(0x57); addbyte(RN<<2); // ADD %edx,Rn
+				gen_op_x86_to_reg(X86_OP_ADD, EDX, RN); // ADD %edx,Rn
 			} else {
-				addbyte(0x41); addbyte(0x29); addbyte(0x57); addbyte(RN<<2); // SUB %edx,Rn
+				gen_op_x86_to_reg(X86_OP_SUB, EDX, RN); // SUB %edx,Rn
 			}
 		} else {
 			offset = opcode & 0xfff;
 			if (offset != 0) {
-				addbyte(0x41); addbyte(0x81); // ADDL/SUBL $offset,Rn
-				if (opcode & 0x800000) {
-					addbyte(0x47); // ADD
-				} else {
-					addbyte(0x6f); // SUB
-				}
-				addbyte(RN<<2); addlong(offset);
+				// ADDL/SUBL $offset,Rn
+				gen_op_imm_to_reg((opcode & 0x800000) ? X86_OP_ADD : X86_OP_SUB, RN, offset);
 			}
 		}
 		if (!arm.abort_base_restored) {
@@ -1088,20 +1977,15 @@ recompile(uint32_t opcode, uint32_t *pcpsr)
 		if (opcode & 0x2000000) {
 			gen_x86_mov_stack_reg32(EDX, 0);
 			if (opcode & 0x800000) {
-				addbyte(0x41); addbyte(0x01); addbyte(0x57); addbyte(RN<<2); // ADD %edx,Rn
+				gen_op_x86_to_reg(X86_OP_ADD, EDX, RN); // ADD %edx,Rn
 			} else {
-				addbyte(0x41); addbyte(0x29); addbyte(0x57); addbyte(RN<<2); // SUB %edx,Rn
+				gen_op_x86_to_reg(X86_OP_SUB, EDX, RN); // SUB %edx,Rn
 			}
 		} else {
 			offset = opcode & 0xfff;
 			if (offset != 0) {
-				addbyte(0x41); addbyte(0x81); // ADDL/SUBL $offset,Rn
-				if (opcode & 0x800000) {
-					addbyte(0x47); // ADD
-				} else {
-					addbyte(0x6f); // SUB
-				}
-				addbyte(RN<<2); addlong(offset);
+				// ADDL/SUBL $offset,Rn
+				gen_op_imm_to_reg((opcode & 0x800000) ? X86_OP_ADD : X86_OP_SUB, RN, offset);
 			}
 		}
 		if (!arm.abort_base_restored) {
@@ -1318,7 +2202,7 @@ recompile(uint32_t opcode, uint32_t *pcpsr)
 		offset = (uint32_t) ((int32_t) offset >> 6);
 		offset += 4;
 		if (((PC + offset) & 0xfc000000) == 0 || arm.r15_mask == 0xfffffffc) {
-			addbyte(0x41); addbyte(0x81); addbyte(0xc4); addlong(offset); // ADD $offset,%r12d
+			gen_add_r15(offset); // ADD $offset,%r12d
 		} else {
 			gen_load_reg(15, EAX);
 			addbyte(0x89); addbyte(0xc2); // MOV %eax,%edx
@@ -1328,7 +2212,7 @@ recompile(uint32_t opcode, uint32_t *pcpsr)
 			addbyte(0x09); addbyte(0xd0); // OR %edx,%eax
 			gen_save_reg(15, EAX);
 		}
-		blockend = 1;
+		gen_branch_end(opcode, pcpsr, offset);
 		break;
 
 	case 0xb0: case 0xb1: case 0xb2: case 0xb3: // BL
@@ -1353,12 +2237,16 @@ recompile(uint32_t opcode, uint32_t *pcpsr)
 			addbyte(0x09); addbyte(0xd0); // OR %edx,%eax
 			gen_save_reg(15, EAX);
 		}
-		blockend = 1;
+		gen_branch_end(opcode, pcpsr, offset);
 		break;
 
 	default:
 		return 0;
 	}
+	if (lastjumppos != 0 && flags_pending != FLAGS_NONE && !opcode_is_b(opcode)) {
+		// Skipped path still has the CPSR flags
+		gen_flags_materialise();
+	}
 	lastrecompiled = 1;
 	if (lastjumppos != 0) {
 		gen_x86_jump_here_long(lastjumppos);
@@ -1371,12 +2259,28 @@ generatecall(OpFn addr, uint32_t opcode, uint32_t *pcpsr)
 {
 	lastrecompiled = 0;
 
+	if (!opcode_is_b(opcode)) {
+		gen_flags_materialise();
+	}
+
 	if (canrecompile[(opcode >> 20) & 0xff]) {
 		if (recompile(opcode, pcpsr)) {
 			return;
 		}
 	}
 
+	// The interpreter works on the ARMState, so hand it all registers
+	gen_reg_cache_flush();
+	reg_cache_reset();
+
+	codeblockfallbacksites[blockpoint2]++;
+	if (block_profiled) {
+		// Flag-preserving form, as EFLAGS may hold lazy flags for a B
+		addbyte(0x8b); addbyte(0x05); addrip(&codeblockfallbacks[blockpoint2]); // MOV codeblockfallbacks[blockpoint2](%rip),%eax
+		addbyte(0x8d); addbyte(0x40); addbyte(1); // LEA 1(%rax),%eax
+		addbyte(0x89); addbyte(0x05); addrip(&codeblockfallbacks[blockpoint2]); // MOV %eax,codeblockfallbacks[blockpoint2](%rip)
+	}
+
 	addbyte(0xbf); addlong(opcode); // MOV $opcode,%edi
 	addbyte(0x45); addbyte(0x89); addbyte(0x67); addbyte(15<<2); // MOV %r12d,R15
 	gen_x86_call(addr);
@@ -1400,7 +2304,7 @@ void
 generateupdatepc(void)
 {
 	if (pcinc != 0) {
-		addbyte(0x41); addbyte(0x83); addbyte(0xc4); addbyte(pcinc); // ADD $pcinc,%r12d
+		gen_add_r15(pcinc); // ADD $pcinc,%r12d
 		pcinc = 0;
 	}
 }
@@ -1409,7 +2313,12 @@ void
 generateupdateinscount(void)
 {
 	if (tempinscount != 0) {
-		if (tempinscount > 127) {
+		if (flags_pending != FLAGS_NONE) {
+			// Flag-preserving form
+			addbyte(0x8b); addbyte(0x05); addrip(&inscount); // MOV inscount(%rip),%eax
+			addbyte(0x8d); addbyte(0x80); addlong(tempinscount); // LEA tempinscount(%rax),%eax
+			addbyte(0x89); addbyte(0x05); addrip(&inscount); // MOV %eax,inscount(%rip)
+		} else if (tempinscount > 127) {
 			addbyte(0x81); addbyte(0x05); addrip_long(&inscount, tempinscount); // ADDL $tempinscount,inscount(%rip)
 		} else {
 			addbyte(0x83); addbyte(0x05); addrip_byte(&inscount, (uint8_t) tempinscount); // ADDL $tempinscount,inscount(%rip)
@@ -1422,6 +2331,7 @@ void
 generatepcinc(void)
 {
 	lastjumppos = 0;
+	branch_followed = 0;
 	tempinscount++;
 	pcinc += 4;
 	if (pcinc == 124) {
@@ -1432,11 +2342,15 @@ generatepcinc(void)
 	}
 }
 
-void
-endblock(uint32_t opcode)
+/**
+ * Generate the code that leaves a block: write back state, then chain to the
+ * block for the new PC if there is one, else return to the epilogue.
+ */
+static void
+gen_block_exit(void)
 {
-	NOT_USED(opcode);
-
+	gen_reg_cache_flush();
+	gen_flags_materialise();
 	generateupdatepc();
 	generateupdateinscount();
 
@@ -1467,6 +2381,79 @@ endblock(uint32_t opcode)
 	addbyte(0xff); addbyte(0xe0); // JMP *%rax
 }
 
+void
+endblock(uint32_t opcode)
+{
+	NOT_USED(opcode);
+
+	gen_block_exit();
+	codeblocksize[blockpoint2] = (uint16_t) codeblockpos;
+}
+
+/**
+ * Generate a side exit from the middle of a superblock. The compile-time
+ * state is kept, as code generation carries on after the exit.
+ */
+static void
+gen_side_exit(void)
+{
+	const int saved_pcinc = pcinc;
+	const int saved_tempinscount = tempinscount;
+	const uint32_t saved_dirty = reg_cache_dirty;
+	const FlagsPending saved_flags = flags_pending;
+
+	gen_block_exit();
+
+	pcinc = saved_pcinc;
+	tempinscount = saved_tempinscount;
+	reg_cache_dirty = saved_dirty;
+	flags_pending = saved_flags;
+}
+
+/**
+ * Finish a recompiled B or BL. In a superblock the branch may be followed,
+ * otherwise it ends the block.
+ *
+ * The direction followed is the one the branch takes while the superblock is
+ * built (the instruction is run straight after code generation). For a
+ * conditional branch the other direction becomes a side exit.
+ *
+ * @param opcode Opcode of branch
+ * @param pcpsr  Pointer to word holding the flags
+ * @param offset Value added to R15 when taken
+ */
+static void
+gen_branch_end(uint32_t opcode, const uint32_t *pcpsr, uint32_t offset)
+{
+	const uint32_t target = (PC + offset + 4) & arm.r15_mask;
+	int jump_continue;
+
+	if (!superblock || superblock_branches >= SUPERBLOCK_MAX_BRANCHES ||
+	    codeblockpos >= SUPERBLOCK_MAX_POS || target == superblock_start ||
+	    (target >> 12) != (superblock_start >> 12))
+	{
+		blockend = 1;
+		return;
+	}
+
+	if (lastjumppos != 0) {
+		if (flaglookup[opcode >> 28][(*pcpsr) >> 28]) {
+			// Taken: fall-through path leaves
+			jump_continue = gen_x86_jump_forward_long(CC_ALWAYS);
+			gen_x86_jump_here_long(lastjumppos);
+			lastjumppos = 0;
+			gen_side_exit();
+			gen_x86_jump_here_long(jump_continue);
+		} else {
+			// Not taken: taken path leaves, the skip jump is the
+			// way on
+			gen_side_exit();
+		}
+	}
+	superblock_branches++;
+	branch_followed = 1;
+}
+
 void
 generateflagtestandbranch(uint32_t opcode, uint32_t *pcpsr)
 {
@@ -1476,6 +2463,24 @@ generateflagtestandbranch(uint32_t opcode, uint32_t *pcpsr)
 		// No need if 'always' condition code
 		return;
 	}
+
+	// Make memory and the cache agree, so it does not matter whether the
+	// instruction runs (possibly through the interpreter) or is skipped
+	gen_reg_cache_flush();
+
+	if (flags_pending != FLAGS_NONE) {
+		if (opcode_is_b(opcode)) {
+			cond = flags_pending_skip_condition(opcode >> 28);
+			if (cond >= 0) {
+				// Branch on the compare result directly, flags stay
+				// pending until the end of the block
+				lastjumppos = gen_x86_jump_forward_long(cond);
+				return;
+			}
+		}
+		gen_flags_materialise();
+	}
+
 	switch (opcode >> 28) {
 	case 0: // EQ
 	case 1: // NE
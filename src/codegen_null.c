@@ -18,7 +18,10 @@
   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <string.h>
+
 #include "rpcemu.h"
+#include "arm.h"
 #include "mem.h"
 
 void initcodeblocks(void)
@@ -34,3 +37,18 @@ void cacheclearpage(uint32_t a)
 	NOT_USED(a);
 }
 
+int codeblock_lookup(uint32_t l)
+{
+	NOT_USED(l);
+
+	return -1;
+}
+
+int codeblock_get_info(int slot, CodeBlockInfo *info)
+{
+	NOT_USED(slot);
+
+	memset(info, 0, sizeof(CodeBlockInfo));
+	info->pc = 0xffffffff;
+	return 0;
+}
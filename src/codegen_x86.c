@@ -28,6 +28,7 @@
 #include "arm.h"
 #include "arm_common.h"
 #include "codegen_x86.h"
+#include "dynprof.h"
 #include "mem.h"
 
 int lastflagchange;
@@ -57,6 +58,16 @@ static int block_enter;
 
 static uint32_t currentblockpc, currentblockpc2;
 
+/*
+ * Profiling (dynprof.c). Blocks built while the profiler is recording
+ * count their entries and their calls into the interpreter.
+ */
+static uint32_t codeblockcount[BLOCKS];		/**< Entries into each block */
+static uint32_t codeblockfallbacks[BLOCKS];	/**< Interpreter calls from each block */
+static uint16_t codeblockfallbacksites[BLOCKS];	/**< Instructions compiled as interpreter calls */
+static uint16_t codeblocksize[BLOCKS];		/**< Bytes of code in each slot */
+static int block_profiled;			/**< Block being built is counted */
+
 static inline void
 addbyte(uint32_t a)
 {
@@ -160,11 +171,123 @@ cacheclearpage(uint32_t a)
 	d = HASH(a << 12);
 	for (c = 0; c < 0x400; c++) {
 		if ((codeblockpc[c + d] >> 12) == a) {
+			if (dynprof_active) {
+				dynprof_invalidate(codeblockpc[c + d]);
+			}
 			codeblockpc[c + d] = 0xffffffff;
 		}
 	}
 }
 
+/**
+ * Superblocks are not built by this backend; a hot block is never reported,
+ * so this is only a fallback.
+ *
+ * @param l Address of first instruction
+ */
+void
+initsuperblock(uint32_t l)
+{
+	initcodeblock(l);
+}
+
+/**
+ * @param l Address of block
+ * @return 0, blocks are not promoted to superblocks by this backend
+ */
+int
+codeblockhot(uint32_t l)
+{
+	NOT_USED(l);
+
+	return 0;
+}
+
+/**
+ * @return 0, branches are never followed by this backend
+ */
+int
+superblockcontinues(void)
+{
+	return 0;
+}
+
+/**
+ * @param l    Address of first instruction
+ * @param code Host pointer to first instruction
+ * @return 0, blocks are not cached by this backend
+ */
+int
+fetchcodeblock(uint32_t l, const uint32_t *code)
+{
+	NOT_USED(l);
+	NOT_USED(code);
+
+	return 0;
+}
+
+/**
+ * @param code Host pointer to first instruction
+ */
+void
+storecodeblock(const uint32_t *code)
+{
+	NOT_USED(code);
+}
+
+/**
+ * @param stats Filled in with zeroes
+ */
+void
+superblock_get_stats(SuperblockStats *stats)
+{
+	memset(stats, 0, sizeof(SuperblockStats));
+}
+
+/**
+ * Find the code cache slot holding the block for an address.
+ *
+ * @param l Address of first instruction
+ * @return Slot, or -1 if the block is not in the code cache
+ */
+int
+codeblock_lookup(uint32_t l)
+{
+	const uint32_t hash = HASH(l);
+
+	return (codeblockpc[hash] == l) ? codeblocknum[hash] : -1;
+}
+
+/**
+ * Describe a code cache slot. The counts and code are filled in even when
+ * the block has since been discarded, until the slot is reused.
+ *
+ * @param slot Slot, 0 to BLOCKS - 1
+ * @param info Filled in with the slot's block
+ * @return Non-zero if the block is still in the code cache
+ */
+int
+codeblock_get_info(int slot, CodeBlockInfo *info)
+{
+	const uint32_t hash = blocks[slot];
+
+	info->code = &rcodeblock[slot][BLOCKSTART];
+	info->code_size = (codeblocksize[slot] > BLOCKSTART) ? codeblocksize[slot] - BLOCKSTART : 0;
+	info->entries = codeblockcount[slot];
+	info->fallbacks = codeblockfallbacks[slot];
+	info->fallback_sites = codeblockfallbacksites[slot];
+	info->superblock = 0;
+
+	if (hash == 0xffffffff || codeblockpc[hash & 0x7fff] == 0xffffffff ||
+	    codeblocknum[hash & 0x7fff] != slot)
+	{
+		info->pc = 0xffffffff;
+		return 0;
+	}
+	info->pc = codeblockpc[hash & 0x7fff];
+	return 1;
+}
+
 void
 initcodeblock(uint32_t l)
 {
@@ -179,6 +302,11 @@ initcodeblock(uint32_t l)
 		codeblocknum[blocks[blockpoint] & 0x7fff] = 0xffffffff;
 	}
 	blocknum = HASH(l);
+	dynprof_slot_reused(blockpoint, codeblockcount[blockpoint], codeblockfallbacks[blockpoint]);
+	codeblockcount[blockpoint] = 0;
+	codeblockfallbacks[blockpoint] = 0;
+	codeblockfallbacksites[blockpoint] = 0;
+	block_profiled = dynprof_active;
 //        blockcount=0;//codeblockcount[blocknum];
 //        codeblockcount[blocknum]++;
 //        if (codeblockcount[blocknum]==3) codeblockcount[blocknum]=0;
@@ -214,6 +342,10 @@ initcodeblock(uint32_t l)
 	addbyte(0xbe); addptr(&arm); // MOV $(&arm),%esi
 	block_enter = codeblockpos;
 
+	if (block_profiled) {
+		addbyte(0x83); addbyte(0x05); addptr(&codeblockcount[blockpoint]); addbyte(1); // ADDL $1,codeblockcount[blockpoint]
+	}
+
 	currentblockpc = arm.reg[15] & arm.r15_mask;
 	currentblockpc2 = PC;
 }
@@ -2052,6 +2184,11 @@ generatecall(OpFn addr, uint32_t opcode, uint32_t *pcpsr)
 
 	codeblockpos = old;
 
+	codeblockfallbacksites[blockpoint2]++;
+	if (block_profiled) {
+		addbyte(0x83); addbyte(0x05); addptr(&codeblockfallbacks[blockpoint2]); addbyte(1); // ADDL $1,codeblockfallbacks[blockpoint2]
+	}
+
 	addbyte(0xc7); addbyte(0x04); addbyte(0x24); addlong(opcode); // MOVL $opcode,(%esp)
 	gen_x86_call(addr);
 
@@ -2138,6 +2275,8 @@ endblock(uint32_t opcode)
 	// Jump to next block bypassing function prologue
 	addbyte(0x83); addbyte(0xc0); addbyte(block_enter); // ADD $block_enter,%eax
 	addbyte(0xff); addbyte(0xe0); // JMP *%eax
+
+	codeblocksize[blockpoint2] = (uint16_t) codeblockpos;
 }
 
 void
@@ -51,8 +51,14 @@
 #define CC_NC		0x3	/* Not Carry (CF=0) */
 #define CC_Z		0x4	/* Zero (ZF=1) */
 #define CC_NZ		0x5	/* Not Zero (ZF=0) */
+#define CC_BE		0x6	/* Below or Equal (CF=1 or ZF=1) */
+#define CC_A		0x7	/* Above (CF=0 and ZF=0) */
 #define CC_S		0x8	/* Sign (SF=1) */
 #define CC_NS		0x9	/* Not Sign (SF=0) */
+#define CC_L		0xc	/* Less (SF!=OF) */
+#define CC_GE		0xd	/* Greater or Equal (SF=OF) */
+#define CC_LE		0xe	/* Less or Equal (ZF=1 or SF!=OF) */
+#define CC_G		0xf	/* Greater (ZF=0 and SF=OF) */
 
 #define CC_E		CC_Z	/* Equal */
 #define CC_NE		CC_NZ	/* Not Equal */
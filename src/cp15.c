@@ -163,6 +163,7 @@ cp15_reset(CPUModel cpu_model)
 	memset(vraddrls, 0xff, sizeof(vraddrls));
 	memset(vwaddrl, 0xff, sizeof(vwaddrl));
 	memset(vwaddrls, 0xff, sizeof(vwaddrls));
+	clearmemcache();
 }
 
 /**
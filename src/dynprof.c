@@ -0,0 +1,557 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * dynprof.c - Dynarec block profiler
+ *
+ * Records live in a table found through an open-addressed hash of the
+ * block address. The code generator counts entries and interpreter calls
+ * per code cache slot; those counts are folded into the block's record
+ * when the slot is reused, and read straight from the slot while the
+ * block is resident.
+ *
+ * Compile time runs from the start of a block to its end, and includes
+ * running each instruction once as it is compiled, as the dynarec does
+ * both in the same pass.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rpcemu.h"
+#include "arm.h"
+#include "arm_disasm.h"
+#include "dynprof.h"
+#include "mem.h"
+#include "replay.h"
+
+#define DYNPROF_MAX_BLOCKS	65536			/**< Records kept */
+#define DYNPROF_HASH_SIZE	(DYNPROF_MAX_BLOCKS * 2)	/**< Must be a power of two */
+#define DYNPROF_MAX_SLOTS	4096			/**< Code cache slots tracked */
+#define DYNPROF_DUMP_MAX_INSTRUCTIONS	1024		/**< Guest instructions shown per block */
+
+int dynprof_active = 0;
+
+static DynProfBlock *records;		/**< Totals exclude counts still held by a slot */
+static uint32_t record_count;
+static uint32_t dropped;
+static uint32_t *record_hash;		/**< Record index + 1, 0 for empty */
+static int32_t slot_record[DYNPROF_MAX_SLOTS];	/**< Record each slot was last compiled for, or -1 */
+
+static uint64_t compile_start;
+static uint32_t compile_pc;
+static uint32_t compile_low, compile_high;
+static uint32_t compile_instructions;
+
+/**
+ * @param pc Block address
+ * @return Start of the hash probe sequence for the address
+ */
+static inline uint32_t
+dynprof_hash(uint32_t pc)
+{
+	return ((pc >> 2) * 0x9e3779b1u) & (DYNPROF_HASH_SIZE - 1);
+}
+
+/**
+ * Find the record for a block.
+ *
+ * @param pc     Block address
+ * @param create Non-zero to add a record if there is none
+ * @return Record, or NULL if there is none (or the table is full)
+ */
+static DynProfBlock *
+dynprof_find(uint32_t pc, int create)
+{
+	uint32_t h;
+
+	if (records == NULL) {
+		return NULL;
+	}
+
+	for (h = dynprof_hash(pc); record_hash[h] != 0; h = (h + 1) & (DYNPROF_HASH_SIZE - 1)) {
+		DynProfBlock *r = &records[record_hash[h] - 1];
+
+		if (r->pc == pc) {
+			return r;
+		}
+	}
+
+	if (!create) {
+		return NULL;
+	}
+	if (record_count == DYNPROF_MAX_BLOCKS) {
+		dropped++;
+		return NULL;
+	}
+
+	record_hash[h] = record_count + 1;
+	memset(&records[record_count], 0, sizeof(DynProfBlock));
+	records[record_count].pc = pc;
+	records[record_count].pc_low = pc;
+	records[record_count].pc_high = pc;
+	records[record_count].slot = -1;
+	return &records[record_count++];
+}
+
+/**
+ * Forget everything recorded so far. While recording, the code cache is
+ * emptied too, so every block is compiled again and gets a new record;
+ * otherwise blocks already compiled would go on running uncounted.
+ */
+void
+dynprof_reset(void)
+{
+	int s;
+
+	if (dynprof_active) {
+		resetcodeblocks();
+	}
+
+	record_count = 0;
+	dropped = 0;
+	if (record_hash != NULL) {
+		memset(record_hash, 0, DYNPROF_HASH_SIZE * sizeof(uint32_t));
+	}
+	for (s = 0; s < DYNPROF_MAX_SLOTS; s++) {
+		slot_record[s] = -1;
+	}
+}
+
+/**
+ * Start or stop recording. Starting clears any earlier profile and
+ * empties the code cache, so every block is compiled with the profiling
+ * counters in place. Stopping keeps the profile for export.
+ *
+ * @param enable Non-zero to start recording
+ */
+void
+dynprof_set_enabled(int enable)
+{
+	if (enable && !dynprof_active) {
+		if (replay_mode != ReplayMode_Off) {
+			/* Flushing the code cache would move the recorded event points */
+			rpclog("Dynarec profiler: Not available while recording or replaying\n");
+			return;
+		}
+		if (records == NULL) {
+			records = malloc(DYNPROF_MAX_BLOCKS * sizeof(DynProfBlock));
+			record_hash = malloc(DYNPROF_HASH_SIZE * sizeof(uint32_t));
+			if (records == NULL || record_hash == NULL) {
+				free(records);
+				free(record_hash);
+				records = NULL;
+				record_hash = NULL;
+				error("Not enough memory for the dynarec profiler");
+				return;
+			}
+		}
+		dynprof_reset();
+		resetcodeblocks();
+		dynprof_active = 1;
+		rpclog("Dynarec profiler started\n");
+	} else if (!enable && dynprof_active) {
+		dynprof_active = 0;
+		rpclog("Dynarec profiler stopped, %u blocks recorded\n", record_count);
+	}
+}
+
+/**
+ * Called before a block is compiled, or installed from the translation
+ * cache.
+ *
+ * @param pc Address of first instruction
+ */
+void
+dynprof_compile_begin(uint32_t pc)
+{
+	compile_start = rpcemu_nsec_host_ticks();
+	compile_pc = pc;
+	compile_low = pc;
+	compile_high = pc;
+	compile_instructions = 0;
+}
+
+/**
+ * Called for each instruction added to the block being compiled.
+ *
+ * @param pc Address of instruction
+ */
+void
+dynprof_compile_instruction(uint32_t pc)
+{
+	if (pc < compile_low) {
+		compile_low = pc;
+	}
+	if (pc + 4 > compile_high) {
+		compile_high = pc + 4;
+	}
+	compile_instructions++;
+}
+
+/**
+ * Called once the block started by dynprof_compile_begin() is in the code
+ * cache.
+ *
+ * @param cached Non-zero if installed from the translation cache
+ */
+void
+dynprof_compile_end(int cached)
+{
+	const uint64_t elapsed = rpcemu_nsec_host_ticks() - compile_start;
+	const int slot = codeblock_lookup(compile_pc);
+	CodeBlockInfo info;
+	DynProfBlock *r;
+
+	if (slot < 0 || slot >= DYNPROF_MAX_SLOTS) {
+		// Thrown away while being compiled
+		return;
+	}
+	r = dynprof_find(compile_pc, 1);
+	if (r == NULL) {
+		return;
+	}
+
+	codeblock_get_info(slot, &info);
+
+	r->compiles++;
+	r->compile_ns += elapsed;
+	r->host_size = info.code_size;
+	r->fallback_sites = info.fallback_sites;
+	r->superblock = (uint8_t) info.superblock;
+	r->cached = (uint8_t) cached;
+	if (!cached) {
+		// The translation cache does not keep the guest range
+		r->pc_low = compile_low;
+		r->pc_high = compile_high;
+		r->instructions = compile_instructions;
+	}
+
+	slot_record[slot] = (int32_t) (r - records);
+}
+
+/**
+ * Called by the code generator before a code cache slot is reused, with
+ * the counts it holds for the block it is losing.
+ *
+ * @param slot      Code cache slot
+ * @param entries   Times the old block was entered
+ * @param fallbacks Interpreter calls made by the old block
+ */
+void
+dynprof_slot_reused(int slot, uint32_t entries, uint32_t fallbacks)
+{
+	if (records == NULL || slot < 0 || slot >= DYNPROF_MAX_SLOTS || slot_record[slot] < 0) {
+		return;
+	}
+	records[slot_record[slot]].executions += entries;
+	records[slot_record[slot]].fallback_calls += fallbacks;
+	slot_record[slot] = -1;
+}
+
+/**
+ * Called by cacheclearpage() for each block it discards.
+ *
+ * @param pc Address of first instruction
+ */
+void
+dynprof_invalidate(uint32_t pc)
+{
+	DynProfBlock *r = dynprof_find(pc, 0);
+
+	if (r != NULL) {
+		r->invalidations++;
+	}
+}
+
+/**
+ * Build the totals of every record.
+ *
+ * @param count Filled in with the number of blocks
+ * @return Array of blocks (free() it), or NULL if there are none
+ */
+static DynProfBlock *
+dynprof_collect(size_t *count)
+{
+	DynProfBlock *blocks;
+	int s;
+
+	*count = 0;
+	if (records == NULL || record_count == 0) {
+		return NULL;
+	}
+	blocks = malloc(record_count * sizeof(DynProfBlock));
+	if (blocks == NULL) {
+		return NULL;
+	}
+	memcpy(blocks, records, record_count * sizeof(DynProfBlock));
+
+	// Add the counts of blocks still in (or last in) a slot
+	for (s = 0; s < DYNPROF_MAX_SLOTS; s++) {
+		CodeBlockInfo info;
+		DynProfBlock *b;
+		int resident;
+
+		if (slot_record[s] < 0) {
+			continue;
+		}
+		b = &blocks[slot_record[s]];
+		resident = codeblock_get_info(s, &info) && info.pc == b->pc;
+		b->executions += info.entries;
+		b->fallback_calls += info.fallbacks;
+		if (resident) {
+			b->resident = 1;
+			b->slot = s;
+		}
+	}
+
+	*count = record_count;
+	return blocks;
+}
+
+static int
+dynprof_compare_executions(const void *a, const void *b)
+{
+	const DynProfBlock *ba = a;
+	const DynProfBlock *bb = b;
+
+	if (ba->executions != bb->executions) {
+		return ba->executions > bb->executions ? -1 : 1;
+	}
+	return ba->pc < bb->pc ? -1 : (ba->pc > bb->pc);
+}
+
+/**
+ * @param summary Filled in with totals over all blocks recorded
+ */
+void
+dynprof_get_summary(DynProfSummary *summary)
+{
+	DynProfBlock *blocks;
+	size_t count, i;
+
+	memset(summary, 0, sizeof(DynProfSummary));
+	summary->dropped = dropped;
+
+	blocks = dynprof_collect(&count);
+	for (i = 0; i < count; i++) {
+		summary->compiles += blocks[i].compiles;
+		summary->invalidations += blocks[i].invalidations;
+		summary->compile_ns += blocks[i].compile_ns;
+		summary->executions += blocks[i].executions;
+		summary->fallback_calls += blocks[i].fallback_calls;
+		if (blocks[i].resident) {
+			summary->resident++;
+			summary->host_bytes += blocks[i].host_size;
+		}
+	}
+	summary->blocks = (uint32_t) count;
+	free(blocks);
+}
+
+/**
+ * Get the most executed blocks.
+ *
+ * @param blocks Filled in with blocks, most executed first
+ * @param max    Room in blocks
+ * @return Number of blocks filled in
+ */
+size_t
+dynprof_get_blocks(DynProfBlock *blocks, size_t max)
+{
+	DynProfBlock *all;
+	size_t count;
+
+	all = dynprof_collect(&count);
+	if (all == NULL) {
+		return 0;
+	}
+	qsort(all, count, sizeof(DynProfBlock), dynprof_compare_executions);
+	if (count > max) {
+		count = max;
+	}
+	memcpy(blocks, all, count * sizeof(DynProfBlock));
+	free(all);
+	return count;
+}
+
+/**
+ * Write the profile as JSON, most executed blocks first.
+ *
+ * @param path File to write
+ * @return Non-zero on success
+ */
+int
+dynprof_export_json(const char *path)
+{
+	DynProfSummary summary;
+	DynProfBlock *blocks;
+	size_t count, i;
+	FILE *f;
+	int ok;
+
+	f = fopen(path, "w");
+	if (f == NULL) {
+		return 0;
+	}
+
+	dynprof_get_summary(&summary);
+	blocks = dynprof_collect(&count);
+	if (blocks != NULL) {
+		qsort(blocks, count, sizeof(DynProfBlock), dynprof_compare_executions);
+	}
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"recording\": %s,\n", dynprof_active ? "true" : "false");
+	fprintf(f, "  \"summary\": {\n");
+	fprintf(f, "    \"blocks\": %" PRIu32 ",\n", summary.blocks);
+	fprintf(f, "    \"dropped\": %" PRIu32 ",\n", summary.dropped);
+	fprintf(f, "    \"resident\": %" PRIu32 ",\n", summary.resident);
+	fprintf(f, "    \"compiles\": %" PRIu64 ",\n", summary.compiles);
+	fprintf(f, "    \"invalidations\": %" PRIu64 ",\n", summary.invalidations);
+	fprintf(f, "    \"compile_ns\": %" PRIu64 ",\n", summary.compile_ns);
+	fprintf(f, "    \"executions\": %" PRIu64 ",\n", summary.executions);
+	fprintf(f, "    \"fallback_calls\": %" PRIu64 ",\n", summary.fallback_calls);
+	fprintf(f, "    \"host_bytes\": %" PRIu64 "\n", summary.host_bytes);
+	fprintf(f, "  },\n");
+	fprintf(f, "  \"blocks\": [");
+
+	for (i = 0; i < count; i++) {
+		const DynProfBlock *b = &blocks[i];
+
+		fprintf(f, "%s\n    {", i ? "," : "");
+		fprintf(f, "\"pc\": \"0x%08" PRIx32 "\", ", b->pc);
+		fprintf(f, "\"pc_low\": \"0x%08" PRIx32 "\", ", b->pc_low);
+		fprintf(f, "\"pc_high\": \"0x%08" PRIx32 "\", ", b->pc_high);
+		fprintf(f, "\"instructions\": %" PRIu32 ", ", b->instructions);
+		fprintf(f, "\"host_size\": %" PRIu32 ", ", b->host_size);
+		fprintf(f, "\"compiles\": %" PRIu32 ", ", b->compiles);
+		fprintf(f, "\"compile_ns\": %" PRIu64 ", ", b->compile_ns);
+		fprintf(f, "\"invalidations\": %" PRIu32 ", ", b->invalidations);
+		fprintf(f, "\"executions\": %" PRIu64 ", ", b->executions);
+		fprintf(f, "\"fallback_sites\": %" PRIu32 ", ", b->fallback_sites);
+		fprintf(f, "\"fallback_calls\": %" PRIu64 ", ", b->fallback_calls);
+		fprintf(f, "\"superblock\": %s, ", b->superblock ? "true" : "false");
+		fprintf(f, "\"from_cache\": %s, ", b->cached ? "true" : "false");
+		fprintf(f, "\"resident\": %s}", b->resident ? "true" : "false");
+	}
+
+	fprintf(f, "%s]\n}\n", count ? "\n  " : "");
+	free(blocks);
+
+	ok = !ferror(f);
+	if (fclose(f) != 0) {
+		ok = 0;
+	}
+	return ok;
+}
+
+/**
+ * Write the guest and host code of the most executed blocks as text. The
+ * guest code is disassembled; the host code is given as bytes, starting
+ * at the block's entry point.
+ *
+ * @param path       File to write
+ * @param max_blocks Most blocks to write, 0 for all
+ * @return Non-zero on success
+ */
+int
+dynprof_dump_code(const char *path, size_t max_blocks)
+{
+	DynProfBlock *blocks;
+	size_t count, i;
+	char disasm[128];
+	FILE *f;
+	int ok;
+
+	f = fopen(path, "w");
+	if (f == NULL) {
+		return 0;
+	}
+
+	blocks = dynprof_collect(&count);
+	if (blocks != NULL) {
+		qsort(blocks, count, sizeof(DynProfBlock), dynprof_compare_executions);
+	}
+	if (max_blocks != 0 && count > max_blocks) {
+		count = max_blocks;
+	}
+
+	for (i = 0; i < count; i++) {
+		const DynProfBlock *b = &blocks[i];
+		uint32_t addr, end;
+
+		fprintf(f, "Block %08" PRIx32 "%s%s: %" PRIu64 " executions, %" PRIu32 " compiles, "
+		        "%" PRIu32 " invalidations, %" PRIu64 " ns compiling, %" PRIu64 " interpreter calls\n",
+		        b->pc, b->superblock ? " (superblock)" : "", b->cached ? " (from cache)" : "",
+		        b->executions, b->compiles, b->invalidations, b->compile_ns, b->fallback_calls);
+
+		// Guest code
+		addr = b->pc_low;
+		end = b->pc_high;
+		if (b->instructions == 0) {
+			// Range unknown, show the start
+			addr = b->pc;
+			end = b->pc + 8 * 4;
+		}
+		if (end - addr > DYNPROF_DUMP_MAX_INSTRUCTIONS * 4) {
+			end = addr + DYNPROF_DUMP_MAX_INSTRUCTIONS * 4;
+		}
+		fprintf(f, "  Guest (%" PRIu32 " instructions compiled):\n", b->instructions);
+		for (; addr != end; addr += 4) {
+			const uint32_t opcode = mem_read32(addr);
+
+			arm_disasm(opcode, addr, disasm, sizeof(disasm));
+			fprintf(f, "  %c %08" PRIx32 ": %08" PRIx32 "  %s\n",
+			        addr == b->pc ? '>' : ' ', addr, opcode, disasm);
+		}
+
+		// Host code
+		if (b->resident) {
+			CodeBlockInfo info;
+			uint32_t c;
+
+			codeblock_get_info(b->slot, &info);
+			fprintf(f, "  Host (%" PRIu32 " bytes at %p, %" PRIu32 " interpreter calls compiled):\n",
+			        info.code_size, (const void *) info.code, info.fallback_sites);
+			for (c = 0; c < info.code_size; c++) {
+				if ((c & 15) == 0) {
+					fprintf(f, "    %04" PRIx32 ":", c);
+				}
+				fprintf(f, " %02x", info.code[c]);
+				if ((c & 15) == 15 || c + 1 == info.code_size) {
+					fprintf(f, "\n");
+				}
+			}
+		} else {
+			fprintf(f, "  Host: not in the code cache\n");
+		}
+		fprintf(f, "\n");
+	}
+	free(blocks);
+
+	ok = !ferror(f);
+	if (fclose(f) != 0) {
+		ok = 0;
+	}
+	return ok;
+}
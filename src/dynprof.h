@@ -0,0 +1,96 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * dynprof.h - Dynarec block profiler
+ *
+ * While enabled, records every block the dynarec compiles, keyed by the
+ * address of its first instruction: the guest range it covers, the size
+ * of the host code, time spent compiling, how often it was entered, how
+ * often it called the interpreter and how often it was thrown away by
+ * cacheclearpage(). Records survive the block leaving the code cache, so
+ * a block that keeps being recompiled shows up as such.
+ *
+ * All functions must be called on the emulator thread.
+ */
+
+#ifndef DYNPROF_H
+#define DYNPROF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Profile of one guest block, across every time it was compiled */
+typedef struct {
+	uint32_t	pc;		/**< Address of first instruction */
+	uint32_t	pc_low;		/**< Lowest instruction address compiled */
+	uint32_t	pc_high;	/**< Address after the highest instruction compiled */
+	uint32_t	instructions;	/**< Instructions in the last compile */
+	uint32_t	host_size;	/**< Bytes of host code in the last compile */
+	uint32_t	fallback_sites;	/**< Instructions handed to the interpreter in the last compile */
+	uint32_t	compiles;	/**< Times compiled or installed from the translation cache */
+	uint32_t	invalidations;	/**< Times discarded by cacheclearpage() */
+	uint64_t	compile_ns;	/**< Time spent compiling, over all compiles */
+	uint64_t	executions;	/**< Times entered, including chained entries */
+	uint64_t	fallback_calls;	/**< Interpreter calls made from the block */
+	uint8_t		superblock;	/**< Last compile was a superblock */
+	uint8_t		cached;		/**< Last compile came from the translation cache */
+	uint8_t		resident;	/**< Currently in the code cache */
+	int		slot;		/**< Code cache slot if resident, else -1 */
+} DynProfBlock;
+
+typedef struct {
+	uint32_t	blocks;		/**< Guest blocks recorded */
+	uint32_t	dropped;	/**< Compiles not recorded because the table was full */
+	uint32_t	resident;	/**< Recorded blocks in the code cache */
+	uint64_t	compiles;
+	uint64_t	invalidations;
+	uint64_t	compile_ns;
+	uint64_t	executions;
+	uint64_t	fallback_calls;
+	uint64_t	host_bytes;	/**< Host code of resident blocks */
+} DynProfSummary;
+
+extern int dynprof_active;	/**< Non-zero while recording; the compile hooks are only called then */
+
+extern void dynprof_set_enabled(int enable);
+extern void dynprof_reset(void);
+
+/* Hooks called by the dynarec */
+extern void dynprof_compile_begin(uint32_t pc);
+extern void dynprof_compile_instruction(uint32_t pc);
+extern void dynprof_compile_end(int cached);
+extern void dynprof_slot_reused(int slot, uint32_t entries, uint32_t fallbacks);
+extern void dynprof_invalidate(uint32_t pc);
+
+extern void dynprof_get_summary(DynProfSummary *summary);
+extern size_t dynprof_get_blocks(DynProfBlock *blocks, size_t max);
+extern int dynprof_export_json(const char *path);
+extern int dynprof_dump_code(const char *path, size_t max_blocks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DYNPROF_H */
@@ -0,0 +1,199 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * fbexport.c - Export of the converted display into shared memory
+ *
+ * Each buffer is two frames behind when it is reused, so the rows
+ * copied into it are the union of the damage of this frame and the
+ * previous one. A buffer is only fully rewritten after a mode change.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rpcemu.h"
+#include "fbexport.h"
+
+/** Size of each buffer, rounded up to a whole page */
+#define FBEXPORT_BUFFER_SIZE \
+	((((size_t) FBEXPORT_MAX_WIDTH * FBEXPORT_MAX_HEIGHT * 4) + 4095) & ~(size_t) 4095)
+
+#define FBEXPORT_REGION_SIZE	(FBEXPORT_DATA_OFFSET + (2 * FBEXPORT_BUFFER_SIZE))
+
+static struct {
+	char		name[128];	/**< Name of the shared memory object */
+	uint8_t		*region;	/**< Mapping of the region, NULL when not exporting */
+	FBExportHeader	*header;
+	uint64_t	frame;		/**< Number of the last frame published */
+	int		last_yl;	/**< Damage of the last frame published */
+	int		last_yh;
+	int		too_large;	/**< Has an oversized mode been reported */
+} fbexport;
+
+/**
+ * Create the shared memory region if an export has been requested with
+ * the RPCEMU_FRAMEBUFFER_EXPORT environment variable.
+ */
+void
+fbexport_init(void)
+{
+	const char *name = getenv("RPCEMU_FRAMEBUFFER_EXPORT");
+	FBExportHeader *header;
+	int i;
+
+	if (name == NULL || name[0] == '\0' || fbexport.region != NULL) {
+		return;
+	}
+
+	/* Shared memory names must start with a single slash */
+	while (name[0] == '/') {
+		name++;
+	}
+	snprintf(fbexport.name, sizeof(fbexport.name), "/%s", name);
+
+	fbexport.region = rpcemu_shared_memory_create(fbexport.name, FBEXPORT_REGION_SIZE);
+	if (fbexport.region == NULL) {
+		error("Could not create framebuffer export '%s'", fbexport.name);
+		return;
+	}
+
+	header = (FBExportHeader *) fbexport.region;
+	memset(header, 0, sizeof(FBExportHeader));
+	header->version = FBEXPORT_VERSION;
+	header->header_size = sizeof(FBExportHeader);
+	header->buffer_size = (uint32_t) FBEXPORT_BUFFER_SIZE;
+	for (i = 0; i < 2; i++) {
+		header->buffers[i].format = FBEXPORT_FORMAT_XRGB8888;
+		header->buffers[i].offset = FBEXPORT_DATA_OFFSET + ((uint64_t) i * FBEXPORT_BUFFER_SIZE);
+	}
+
+	/* Magic last, so a consumer never sees a half initialised header */
+	atomic_thread_fence(memory_order_release);
+	header->magic = FBEXPORT_MAGIC;
+
+	fbexport.header = header;
+	fbexport.frame = 0;
+	fbexport.last_yl = 0;
+	fbexport.last_yh = 0;
+
+	rpclog("Framebuffer export: Publishing frames to '%s'\n", fbexport.name);
+}
+
+/**
+ * Remove the shared memory region's name at shutdown. The mapping itself
+ * is left in place, as the video thread may still be publishing a frame.
+ */
+void
+fbexport_close(void)
+{
+	if (fbexport.region == NULL) {
+		return;
+	}
+
+	rpcemu_shared_memory_remove(fbexport.name);
+}
+
+/**
+ * Publish a frame to the shared memory region.
+ *
+ * thread: video
+ *
+ * @param buffer      Converted display, xsize * ysize pixels
+ * @param xsize       Width in pixels
+ * @param ysize       Height in pixels
+ * @param yl          First row changed
+ * @param yh          Row after the last row changed
+ * @param double_size Current state of doubling X/Y values
+ */
+void
+fbexport_publish(const uint32_t *buffer, int xsize, int ysize, int yl, int yh, int double_size)
+{
+	FBExportHeader *header = fbexport.header;
+	FBExportBuffer *back;
+	uint32_t index;
+	int copy_yl, copy_yh;
+	int y;
+
+	if (header == NULL) {
+		return;
+	}
+
+	if (xsize <= 0 || ysize <= 0 || xsize > FBEXPORT_MAX_WIDTH || ysize > FBEXPORT_MAX_HEIGHT) {
+		if (!fbexport.too_large) {
+			rpclog("Framebuffer export: %dx%d is too large to export\n", xsize, ysize);
+			fbexport.too_large = 1;
+		}
+		return;
+	}
+	fbexport.too_large = 0;
+
+	if (yl < 0) {
+		yl = 0;
+	}
+	if (yh > ysize) {
+		yh = ysize;
+	}
+
+	index = header->front ^ 1;
+	back = &header->buffers[index];
+
+	/* The back buffer holds the frame before last, so it is also
+	   missing the previous frame's damage */
+	if (back->frame == 0 || back->width != (uint32_t) xsize || back->height != (uint32_t) ysize) {
+		copy_yl = 0;
+		copy_yh = ysize;
+	} else {
+		copy_yl = (yl < fbexport.last_yl) ? yl : fbexport.last_yl;
+		copy_yh = (yh > fbexport.last_yh) ? yh : fbexport.last_yh;
+		if (copy_yh > ysize) {
+			copy_yh = ysize;
+		}
+	}
+
+	back->sequence++;
+	atomic_thread_fence(memory_order_release);
+
+	back->width = (uint32_t) xsize;
+	back->height = (uint32_t) ysize;
+	back->stride = (uint32_t) xsize * 4;
+	back->double_size = (uint32_t) double_size;
+	back->dirty_yl = (uint32_t) yl;
+	back->dirty_yh = (uint32_t) yh;
+	back->frame = ++fbexport.frame;
+
+	for (y = copy_yl; y < copy_yh; y++) {
+		memcpy(fbexport.region + back->offset + ((size_t) y * back->stride),
+		       buffer + ((size_t) y * xsize), back->stride);
+	}
+
+	atomic_thread_fence(memory_order_release);
+	back->sequence++;
+
+	/* A consumer that sees the new 'front' must also see the even sequence */
+	atomic_thread_fence(memory_order_release);
+	header->front = index;
+	header->frame = fbexport.frame;
+
+	fbexport.last_yl = yl;
+	fbexport.last_yh = yh;
+}
@@ -0,0 +1,94 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * fbexport.h - Export of the converted display into shared memory
+ *
+ * When the RPCEMU_FRAMEBUFFER_EXPORT environment variable is set, every
+ * frame sent to the GUI is also written into a shared memory object of
+ * that name (on Linux, /dev/shm/<name>). Local consumers such as test
+ * harnesses and screen recorders can map it and read frames directly.
+ *
+ * The region holds an FBExportHeader followed by two pixel buffers. The
+ * emulator writes the buffer that is not 'front', then makes it 'front'.
+ * To read a frame a consumer:
+ *   1. reads 'front' and that buffer's 'sequence', retrying while odd
+ *   2. reads the pixels it needs from the buffer
+ *   3. re-reads 'sequence'; if it changed the buffer was reused, retry
+ *
+ * This header is self-contained so consumers can include it directly.
+ */
+
+#ifndef FBEXPORT_H
+#define FBEXPORT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FBEXPORT_MAGIC		0x42465052u	/**< "RPFB" when read little-endian */
+#define FBEXPORT_VERSION	1
+
+#define FBEXPORT_MAX_WIDTH	2048		/**< Largest frame that is exported */
+#define FBEXPORT_MAX_HEIGHT	2048
+
+#define FBEXPORT_DATA_OFFSET	4096		/**< Offset of the first pixel buffer */
+
+/** Pixel formats */
+#define FBEXPORT_FORMAT_XRGB8888	1	/**< 32bpp 0xffRRGGBB in host byte order */
+
+/** One of the two frame buffers in the region */
+typedef struct {
+	volatile uint32_t sequence;	/**< Odd while the buffer is being written */
+	uint32_t width;			/**< Width in pixels */
+	uint32_t height;		/**< Height in pixels */
+	uint32_t stride;		/**< Bytes per row */
+	uint32_t format;		/**< FBEXPORT_FORMAT_* */
+	uint32_t double_size;		/**< VIDC_DOUBLE_* flags used for the host display */
+	uint32_t dirty_yl;		/**< First row changed from the previous frame */
+	uint32_t dirty_yh;		/**< Row after the last row changed */
+	uint64_t frame;			/**< Frame number of the contents */
+	uint64_t offset;		/**< Offset of the pixels from the start of the region */
+} FBExportBuffer;
+
+/** Header at the start of the region */
+typedef struct {
+	uint32_t magic;			/**< FBEXPORT_MAGIC */
+	uint32_t version;		/**< FBEXPORT_VERSION */
+	uint32_t header_size;		/**< sizeof(FBExportHeader) */
+	uint32_t buffer_size;		/**< Bytes reserved for the pixels of each buffer */
+	volatile uint32_t front;	/**< Index of the buffer holding the newest frame */
+	uint32_t reserved;
+	volatile uint64_t frame;	/**< Number of the newest frame, 0 before the first */
+	FBExportBuffer buffers[2];
+} FBExportHeader;
+
+extern void fbexport_init(void);
+extern void fbexport_close(void);
+extern void fbexport_publish(const uint32_t *buffer, int xsize, int ysize,
+                             int yl, int yh, int double_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FBEXPORT_H */
@@ -37,6 +37,7 @@
 
 #include "arm.h"
 #include "mem.h"
+#include "swi.h"
 #include "hostfs.h"
 #include "hostfs_internal.h"
 
@@ -2115,6 +2116,26 @@ hostfs_register(ARMul_State *state)
   }
 }
 
+/**
+ * Host handler for the HostFS SWI.
+ *
+ * @param swinum SWI number
+ * @return Always 1, the SWI is never passed to RISC OS
+ */
+static int
+hostfs_swi(uint32_t swinum)
+{
+  ARMul_State state;
+
+  NOT_USED(swinum);
+
+  state.Reg = arm.reg;
+  hostfs(&state);
+  hostfs_activity_increment();
+
+  return 1;
+}
+
 /**
  * Initialise HostFS module. Called on program startup.
  */
@@ -2138,6 +2159,8 @@ hostfs_init(void)
       SHARED_ROOT[c] = '/';
     }
   }
+
+  swi_register(ARCEM_SWI_HOSTFS, hostfs_swi);
 }
 
 /**
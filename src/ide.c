@@ -133,6 +133,20 @@ static struct
         uint16_t buffer[65536];
 } ide;
 
+/** Number of sectors moved to or from the host image in one go */
+#define IDE_BURST_SECTORS	128
+
+/** Sectors of one drive held in memory, for burst reads and writes */
+typedef struct {
+	uint8_t data[IDE_BURST_SECTORS * 512];
+	int drive;		/**< Drive the sectors belong to */
+	off64_t sector;		/**< First sector held */
+	int count;		/**< Number of sectors held, 0 if empty */
+} IDEBurst;
+
+static IDEBurst ide_readahead;	/**< Sectors read ahead for WIN_READ */
+static IDEBurst ide_writebehind;	/**< Sectors of WIN_WRITE not yet written */
+
 static inline void
 ide_irq_raise(void)
 {
@@ -374,6 +388,85 @@ ide_next_sector(void)
 	}
 }
 
+/**
+ * Write out any sectors collected by ide_write_sector(), in one host write.
+ */
+static void
+ide_write_flush(void)
+{
+	if (ide_writebehind.count == 0) {
+		return;
+	}
+	fseeko64(ide.hdfile[ide_writebehind.drive], ide_writebehind.sector * 512, SEEK_SET);
+	fwrite(ide_writebehind.data, 512, (size_t) ide_writebehind.count, ide.hdfile[ide_writebehind.drive]);
+	ide_writebehind.count = 0;
+}
+
+/**
+ * Fill ide.buffer with a sector of the current drive. Sectors are read from
+ * the image IDE_BURST_SECTORS at a time (or fewer, if the command asks for
+ * fewer), so the rest of a multi-sector WIN_READ is served from memory.
+ *
+ * @param sector Sector number
+ */
+static void
+ide_read_sector(off64_t sector)
+{
+	if (ide_readahead.count == 0 || ide_readahead.drive != ide.drive ||
+	    sector < ide_readahead.sector ||
+	    sector >= ide_readahead.sector + ide_readahead.count)
+	{
+		int count = ide.secount;
+		size_t got;
+
+		if (count <= 0 || count > IDE_BURST_SECTORS) {
+			count = IDE_BURST_SECTORS;
+		}
+
+		ide_write_flush();
+		fseeko64(ide.hdfile[ide.drive], sector * 512, SEEK_SET);
+		got = fread(ide_readahead.data, 512, (size_t) count, ide.hdfile[ide.drive]);
+		if (got < (size_t) count) {
+			// Beyond current extent of file - return zero data
+			memset(ide_readahead.data + (got * 512), 0, (count - got) * 512);
+		}
+		ide_readahead.drive = ide.drive;
+		ide_readahead.sector = sector;
+		ide_readahead.count = count;
+	}
+	memcpy(ide.buffer, ide_readahead.data + ((sector - ide_readahead.sector) * 512), 512);
+}
+
+/**
+ * Queue the sector in ide.buffer to be written to the current drive.
+ * Consecutive sectors are collected and written together when the command
+ * completes, the buffer fills, or anything else touches the drive.
+ *
+ * @param sector Sector number
+ */
+static void
+ide_write_sector(off64_t sector)
+{
+	if (ide_writebehind.count != 0 &&
+	    (ide_writebehind.drive != ide.drive ||
+	     sector != ide_writebehind.sector + ide_writebehind.count ||
+	     ide_writebehind.count == IDE_BURST_SECTORS))
+	{
+		ide_write_flush();
+	}
+	if (ide_writebehind.count == 0) {
+		ide_writebehind.drive = ide.drive;
+		ide_writebehind.sector = sector;
+	}
+	memcpy(ide_writebehind.data + (ide_writebehind.count * 512), ide.buffer, 512);
+	ide_writebehind.count++;
+
+	/* Anything read ahead from this drive may now be stale */
+	if (ide_readahead.drive == ide.drive) {
+		ide_readahead.count = 0;
+	}
+}
+
 /**
  * Given an open harddisc image, attempt to use a heuristic to determine
  * if the image is one of the 'bugged' (offset by 512 bytes/1 sector)
@@ -472,6 +565,8 @@ void resetide(void)
         char hd_path[1024];
 
         /* Close hard disk image files (if previously open) */
+        ide_write_flush();
+        ide_readahead.count = 0;
         for (d = 0; d < 2; d++) {
                 if (ide.hdfile[d] != NULL) {
                         fclose(ide.hdfile[d]);
@@ -576,6 +671,7 @@ void writeide(uint16_t addr, uint8_t val)
                 ide.head=val&0xF;
                 if (((val>>4)&1)!=ide.drive)
                 {
+                        ide_write_flush();
                         idecallback=0;
                         ide.atastat = READY_STAT;
                         ide.error=0;
@@ -603,6 +699,7 @@ void writeide(uint16_t addr, uint8_t val)
                 return;
 
         case 0x1F7: /* Command register */
+                ide_write_flush();
                 ide.command=val;
                 ide.error=0;
                 switch (val)
@@ -668,6 +765,7 @@ void writeide(uint16_t addr, uint8_t val)
         case 0x3F6: /* Device control */
                 if ((ide.fdisk&4) && !(val&4))
                 {
+                        ide_write_flush();
                         idecallback=500;
                         ide.reset = 1;
                         ide.atastat = BUSY_STAT;
@@ -808,12 +906,7 @@ void callbackide(void)
                         goto abort_cmd;
                 }
                 ide_activity_increment();
-                addr = ide_get_sector() * 512;
-                fseeko64(ide.hdfile[ide.drive], addr, SEEK_SET);
-                if (fread(ide.buffer, 1, 512, ide.hdfile[ide.drive]) != 512) {
-                        // Beyond current extent of file - return zero data
-                        memset(ide.buffer, 0, 512);
-                }
+                ide_read_sector(ide_get_sector());
                 ide.pos=0;
                 ide.atastat = DRQ_STAT;
                 ide_irq_raise();
@@ -824,9 +917,7 @@ void callbackide(void)
                         goto abort_cmd;
                 }
                 ide_activity_increment();
-                addr = ide_get_sector() * 512;
-                fseeko64(ide.hdfile[ide.drive], addr, SEEK_SET);
-                fwrite(ide.buffer, 512, 1, ide.hdfile[ide.drive]);
+                ide_write_sector(ide_get_sector());
                 ide_irq_raise();
                 ide.secount--;
                 if (ide.secount != 0) {
@@ -834,6 +925,7 @@ void callbackide(void)
                         ide.pos=0;
                         ide_next_sector();
                 } else {
+                        ide_write_flush();
                         ide.atastat = READY_STAT;
                 }
                 return;
@@ -852,6 +944,7 @@ void callbackide(void)
                         goto abort_cmd;
                 }
                 addr = ide_get_sector() * 512;
+                ide_readahead.count = 0;
                 fseeko64(ide.hdfile[ide.drive], addr, SEEK_SET);
                 memset(ide.buffer, 0, 512);
                 for (c=0;c<ide.secount;c++)
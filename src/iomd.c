@@ -30,6 +30,8 @@
 #include "arm.h"
 #include "cmos.h"
 #include "podules.h"
+#include "serial.h"
+#include "superio.h"
 
 /* References -
    Acorn Risc PC - Technical Reference Manual
@@ -280,6 +282,11 @@ gentimerirq(uint64_t nsec_timer)
 
         /* Update Podule interrupts */
         runpoduletimers(2); /* 2ms * 500 = 1 sec */
+
+        /* Expire UART character timeouts, then let serial devices
+           deliver queued data */
+        superio_serial_timer(nsec_timer);
+        serial_bus_poll();
 }
 
 /**
@@ -39,7 +39,9 @@
 
 #include "rpcemu.h"
 #include "vidc20.h"
+#include "keyboard.h"
 #include "mem.h"
+#include "swi.h"
 #include "iomd.h"
 #include "arm.h"
 #include "i8042.h"
@@ -235,6 +237,92 @@ calculateparity(uint8_t v)
 	return 1;
 }
 
+/**
+ * Host handler for OS_Word, used by mousehack for OS_Word 21.
+ *
+ * OS_Word 21, 1 is intercepted regardless of whether or not we're in
+ * mousehack as it allows 'fullscreen' or 'mouse capture mode' risc os mode
+ * changes to have their boxes cached, allowing mousehack to work when you
+ * change back to it.
+ *
+ * @param swinum SWI number
+ * @return 1 if the call has been handled, 0 to pass it on to RISC OS
+ */
+static int
+mouse_hack_swi_os_word(uint32_t swinum)
+{
+	NOT_USED(swinum);
+
+	if (arm.reg[0] != 21) {
+		return 0;
+	}
+
+	switch (mem_read8(arm.reg[1])) {
+	case 0:
+		/* OS_Word 21, 0 Define pointer size, shape and active point */
+		if (mousehack) {
+			mouse_hack_osword_21_0(arm.reg[1]);
+		}
+		return 0;
+	case 1:
+		/* OS_Word 21, 1 Define Mouse Coordinate bounding box */
+		mouse_hack_osword_21_1(arm.reg[1]);
+		return 1;
+	case 3:
+		/* OS_Word 21, 3 Move mouse */
+		if (mousehack) {
+			mouse_hack_osword_21_3(arm.reg[1]);
+			return 1;
+		}
+		return 0;
+	case 4:
+		/* OS_Word 21, 4 Read unbuffered mouse position */
+		if (mousehack) {
+			mouse_hack_osword_21_4(arm.reg[1]);
+			return 1;
+		}
+		return 0;
+	}
+	return 0;
+}
+
+/**
+ * Host handler for OS_Mouse when in mousehack.
+ *
+ * @param swinum SWI number
+ * @return 1 if the call has been handled, 0 to pass it on to RISC OS
+ */
+static int
+mouse_hack_swi_os_mouse(uint32_t swinum)
+{
+	NOT_USED(swinum);
+
+	if (!mousehack) {
+		return 0;
+	}
+	mouse_hack_osmouse();
+	arm.reg[cpsr] &= ~VFLAG;
+	return 1;
+}
+
+/**
+ * Host handler for OS_Byte, used by mousehack to watch OS_Byte 106.
+ *
+ * @param swinum SWI number
+ * @return Always 0, RISC OS still handles the call
+ */
+static int
+mouse_hack_swi_os_byte(uint32_t swinum)
+{
+	NOT_USED(swinum);
+
+	if (mousehack && arm.reg[0] == 106) {
+		/* OS_Byte 106 Select pointer / activate mouse */
+		mouse_hack_osbyte_106(arm.reg[1]);
+	}
+	return 0;
+}
+
 void
 keyboard_reset(void)
 {
@@ -257,6 +345,10 @@ keyboard_reset(void)
 	/* Mousehack reset */
 	mouse_hack.pointer = 0;
 	mouse_hack.cursor_linked = 1;
+
+	swi_register(SWI_OS_Word, mouse_hack_swi_os_word);
+	swi_register(SWI_OS_Mouse, mouse_hack_swi_os_mouse);
+	swi_register(SWI_OS_Byte, mouse_hack_swi_os_byte);
 }
 
 static uint8_t
@@ -1087,6 +1179,29 @@ mouse_hack_get_pos(int *x, int *y)
 	}
 }
 
+/**
+ * Return the active point of the current pointer shape, relative to the
+ * top-left of the cursor image.
+ *
+ * Used by VIDC when passing the cursor image to the GUI.
+ *
+ * @param x Filled in with X offset of the active point in native units
+ * @param y Filled in with Y offset of the active point in native units
+ */
+void
+mouse_hack_get_active_point(int *x, int *y)
+{
+	assert(mousehack);
+
+	if (mouse_hack.cursor_linked) {
+		*x = mouse_hack.activex[mouse_hack.pointer];
+		*y = mouse_hack.activey[mouse_hack.pointer];
+	} else {
+		*x = 0;
+		*y = 0;
+	}
+}
+
 /**
  * OS_Word 21, 0 Define pointer size, shape and active point
  *
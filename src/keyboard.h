@@ -57,6 +57,7 @@ extern void mouse_hack_osword_21_4(uint32_t a);
 extern void mouse_hack_osbyte_106(uint32_t a);
 extern void mouse_hack_osmouse(void);
 extern void mouse_hack_get_pos(int *x, int *y);
+extern void mouse_hack_get_active_point(int *x, int *y);
 
 extern int kcallback;
 extern int mcallback;
@@ -60,11 +60,20 @@ static uint32_t writemembcache = 0,writemembcache2 = 0;
 
 static uint32_t phys_space_mask; /**< Mask used to convert to physical memory address space */
 
+static int rom_shared = 0; /**< Bool of whether rom[] is a read-only mapping shared between processes */
+
+/* Virtual addresses last seen to map to the IDE data port, so the PIO loops
+   that move a sector a word at a time can skip translation and dispatch */
+static uint32_t ide_data_read_addr = 0xffffffff;
+static uint32_t ide_data_write_addr = 0xffffffff;
+
 void clearmemcache(void)
 {
 	readmemcache = 0xffffffff;
 	writememcache = 0xffffffff;
 	writemembcache = 0xffffffff;
+	ide_data_read_addr = 0xffffffff;
+	ide_data_write_addr = 0xffffffff;
 }
 
 static int vraddrlpos, vwaddrlpos;
@@ -80,6 +89,134 @@ void mem_init(void)
 	vramb = (uint8_t *) vram;
 }
 
+/**
+ * Ensure rom[] is private, writable memory so that a new image can be
+ * loaded into it. The contents are undefined afterwards.
+ */
+void
+mem_rom_unshare(void)
+{
+	uint32_t *private_rom;
+
+	if (!rom_shared) {
+		return;
+	}
+
+	private_rom = malloc(ROMSIZE);
+	if (private_rom == NULL) {
+		fatal("Out of memory in mem_rom_unshare()");
+	}
+
+	rpcemu_mem_layout_lock();
+	rpcemu_shared_image_unmap(rom, ROMSIZE);
+	rom = private_rom;
+	romb = (uint8_t *) rom;
+	rom_shared = 0;
+	rpcemu_mem_layout_unlock();
+}
+
+/**
+ * Replace the private copy of the fully loaded and patched ROM with a
+ * read-only mapping shared with other RPCEmu processes running the same
+ * image. Keeps the private copy if the platform cannot share it.
+ *
+ * Sharing is between separate processes only; there is no pool of machines
+ * within one process sharing a ROM.
+ *
+ * @param name Content-derived name of the image
+ */
+void
+mem_rom_share(const char *name)
+{
+	void *shared;
+
+	if (rom_shared) {
+		return;
+	}
+
+	shared = rpcemu_shared_image_map(name, rom, ROMSIZE);
+	if (shared == NULL) {
+		return;
+	}
+
+	rpcemu_mem_layout_lock();
+	free(rom);
+	rom = shared;
+	romb = (uint8_t *) rom;
+	rom_shared = 1;
+	rpcemu_mem_layout_unlock();
+
+	rpclog("mem: ROM image shared as '%s'\n", name);
+}
+
+/**
+ * Release the ROM memory (called only once on program shutdown)
+ */
+void
+mem_rom_free(void)
+{
+	rpcemu_mem_layout_lock();
+	if (rom_shared) {
+		rpcemu_shared_image_unmap(rom, ROMSIZE);
+		rom_shared = 0;
+	} else {
+		free(rom);
+	}
+	rom = NULL;
+	romb = NULL;
+	rpcemu_mem_layout_unlock();
+}
+
+/**
+ * List the host memory backing ROM, VRAM and RAM, in physical address
+ * order. Used to scan memory directly, e.g. by the memory search. The
+ * pointers stay valid until the next mem_reset() or ROM change; callers
+ * on other threads must hold rpcemu_mem_layout_lock() off meanwhile.
+ *
+ * @param banks Filled in with up to MEM_MAX_BANKS entries
+ * @return Number of banks filled in
+ */
+int
+mem_get_banks(MemBank *banks)
+{
+	int n = 0;
+
+	if (romb != NULL) {
+		banks[n].base = 0x00000000;
+		banks[n].size = ROMSIZE;
+		banks[n].data = romb;
+		banks[n].name = "ROM";
+		n++;
+	}
+	if (vram != NULL && mem_vrammask != 0) {
+		banks[n].base = 0x02000000;
+		banks[n].size = mem_vrammask + 1;
+		banks[n].data = vramb;
+		banks[n].name = "VRAM";
+		n++;
+	}
+	if (ram00 != NULL && ram01 != NULL) {
+		banks[n].base = 0x10000000;
+		banks[n].size = mem_rammask + 1;
+		banks[n].data = ramb00;
+		banks[n].name = "SIMM 0 bank 0";
+		n++;
+		banks[n].base = 0x14000000;
+		banks[n].size = mem_rammask + 1;
+		banks[n].data = ramb01;
+		banks[n].name = "SIMM 0 bank 1";
+		n++;
+	}
+	if (ramb1 != NULL) {
+		banks[n].base = 0x18000000;
+		banks[n].size = 128 * 1024 * 1024;
+		banks[n].data = ramb1;
+		banks[n].name = "SIMM 1";
+		n++;
+	}
+	return n;
+}
+
 /**
  * Initialise/reset RAM (called on startup and emulated machine reset)
  *
@@ -96,6 +233,8 @@ mem_reset(uint32_t ramsize, uint32_t vram_size)
 	/* Convert ramsize from bytes to megabytes */
 	ramsize *= (1024 * 1024);
 
+	rpcemu_mem_layout_lock();
+
 	if (ramsize == (256 * 1024 * 1024)) {
 		ramsize = 128 * 1024 * 1024; /* 128MB for first SIMM */
 
@@ -137,6 +276,8 @@ mem_reset(uint32_t ramsize, uint32_t vram_size)
 		   physical memory map of 512M that repeats in the 4G address space */
 		phys_space_mask = 0x1fffffff;
 	}
+
+	rpcemu_mem_layout_unlock();
 }
 
 static inline void
@@ -170,6 +311,28 @@ vwadd(uint32_t a, const void *v, uint32_t f, uint32_t p)
 	vwaddrlpos = (vwaddrlpos + 1) & 0x3ff;
 }
 
+/**
+ * Check whether a physical address is the IDE data port, matching the
+ * decoding in mem_phys_read32() and mem_phys_write32().
+ *
+ * @param addr Physical address
+ * @return Non-zero if the address selects the IDE data port
+ */
+static inline int
+mem_phys_is_ide_data(uint32_t addr)
+{
+	if ((addr & 0xffc) != 0x7c0) {
+		return 0;
+	}
+	addr &= phys_space_mask;
+	if (addr >= 0x3010000 && addr < 0x3012000) {
+		return 1;
+	}
+	return (machine.model == Model_Phoebe) &&
+	       (addr & (phys_space_mask & 0xff000000)) == 0x03000000 &&
+	       (addr & 0xcffffc) == 0x8007c0;
+}
+
 /**
  * Read a 32-bit word from a physical address.
  *
@@ -675,6 +838,11 @@ readmemfl(uint32_t addr)
 	uint32_t phys_addr = addr;
 	uint32_t value = 0;
 
+	if ((addr & ~3u) == ide_data_read_addr) {
+		value = readidew();
+		goto out;
+	}
+
 	if (mmu) {
 		if ((addr >> 12) == readmemcache) {
 			phys_addr = readmemcache2 + (addr & 0xfff);
@@ -770,6 +938,9 @@ readmemfl(uint32_t addr)
 		}
 	}
 
+	if (mem_phys_is_ide_data(phys_addr)) {
+		ide_data_read_addr = virt_addr & ~3u;
+	}
 	value = mem_phys_read32(phys_addr);
 
 
@@ -874,6 +1045,12 @@ writememfl(uint32_t addr, uint32_t val)
 	const uint32_t virt_addr = addr;
 	uint32_t phys_addr = addr;
 
+	if ((addr & ~3u) == ide_data_write_addr) {
+		writeidew(val);
+		debugger_memory_access(virt_addr, 4, 1, val);
+		return;
+	}
+
 	if (mmu) {
 		if ((addr >> 12) == writememcache) {
 			phys_addr = writememcache2 + (addr & 0xfff);
@@ -921,6 +1098,9 @@ writememfl(uint32_t addr, uint32_t val)
 			break;
 		}
 	}
+	if (mem_phys_is_ide_data(phys_addr)) {
+		ide_data_write_addr = virt_addr & ~3u;
+	}
 	mem_phys_write32(phys_addr, val);
 	debugger_memory_access(virt_addr, 4, 1, val);
 }
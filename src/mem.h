@@ -35,6 +35,9 @@ extern void writememfl(uint32_t addr, uint32_t val);
 
 extern void clearmemcache(void);
 extern void mem_init(void);
+extern void mem_rom_unshare(void);
+extern void mem_rom_share(const char *name);
+extern void mem_rom_free(void);
 extern void mem_reset(uint32_t ramsize, uint32_t vram_size);
 
 extern uintptr_t vraddrl[0x100000];
@@ -61,6 +64,18 @@ extern void cacheclearpage(uint32_t a);
 extern uint32_t mem_rammask;
 extern uint32_t mem_vrammask;
 
+/** A block of host memory backing part of the physical address space */
+typedef struct {
+	uint32_t	base;	/**< Physical address of the first byte */
+	uint32_t	size;	/**< Size in bytes */
+	const uint8_t	*data;	/**< Host memory holding the bank */
+	const char	*name;	/**< Short description, e.g. "ROM" */
+} MemBank;
+
+#define MEM_MAX_BANKS	5	/**< Most banks mem_get_banks() can return */
+
+extern int mem_get_banks(MemBank *banks);
+
 /**
  * Read a 32-bit word from a virtual address.
  *
@@ -0,0 +1,363 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * memsearch.c - Search of the emulated machine's physical memory
+ *
+ * Each pattern is anchored on its first and last exactly-matched bytes.
+ * Where SSE2 is available, 16 candidate positions are tested against both
+ * anchors at once and only positions passing both are compared in full;
+ * otherwise memchr() finds the first anchor. The memory being searched
+ * belongs to a running machine, so hits reflect its contents at the
+ * moment each chunk was scanned.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "rpcemu.h"
+#include "memsearch.h"
+
+#define MEMSEARCH_CHUNK		(1024 * 1024)	/**< Bytes scanned between callbacks */
+#define MEMSEARCH_BATCH		1024		/**< Hits held before flushing to the callback */
+
+/** Per-pattern values worked out once per search */
+typedef struct {
+	const MemSearchPattern	*pattern;
+	uint32_t		first;		/**< Offset of first exactly-matched byte */
+	uint32_t		last;		/**< Offset of last exactly-matched byte */
+	int			anchored;	/**< Non-zero if there is an exact byte to anchor on */
+} MemSearchPlan;
+
+typedef struct {
+	MemSearchHit	hits[MEMSEARCH_BATCH];
+	size_t		count;
+	uint64_t	total_hits;
+	uint32_t	max_hits;
+} MemSearchHits;
+
+/**
+ * @param query Query to check
+ * @return Non-zero if the query can be passed to mem_search()
+ */
+int
+mem_search_query_valid(const MemSearchQuery *query)
+{
+	uint32_t p;
+
+	if (query->pattern_count == 0 || query->pattern_count > MEMSEARCH_MAX_PATTERNS) {
+		return 0;
+	}
+	if (query->alignment != 1 && query->alignment != 2 && query->alignment != 4) {
+		return 0;
+	}
+	for (p = 0; p < query->pattern_count; p++) {
+		const uint32_t length = query->patterns[p].length;
+
+		if (length == 0 || length > MEMSEARCH_MAX_LENGTH) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * @param pattern Pattern
+ * @param data    Candidate match
+ * @return Non-zero if the pattern matches at data
+ */
+static inline int
+memsearch_matches(const MemSearchPattern *pattern, const uint8_t *data)
+{
+	uint32_t i;
+
+	for (i = 0; i < pattern->length; i++) {
+		if (((data[i] ^ pattern->value[i]) & pattern->mask[i]) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Record a hit.
+ *
+ * @return Non-zero if the hit limit has been reached
+ */
+static inline int
+memsearch_add_hit(MemSearchHits *hits, uint32_t address, uint32_t pattern)
+{
+	hits->hits[hits->count].address = address;
+	hits->hits[hits->count].pattern = pattern;
+	hits->count++;
+	hits->total_hits++;
+	return hits->max_hits != 0 && hits->total_hits >= hits->max_hits;
+}
+
+/**
+ * Find matches of one pattern starting at data[0] to data[limit - 1].
+ * data[] must extend pattern->length - 1 bytes past limit.
+ *
+ * @param plan     Pattern to look for
+ * @param index    Pattern's index within the query
+ * @param data     Memory to scan
+ * @param limit    Number of start positions to try
+ * @param address  Physical address of data[0]
+ * @param align    Alignment of hits
+ * @param hits     Hits found are appended here
+ * @param space    Room left in hits before it must be flushed
+ * @return Number of start positions tried; less than limit if hits filled
+ *         up or the hit limit was reached
+ */
+static size_t
+memsearch_scan(const MemSearchPlan *plan, uint32_t index, const uint8_t *data, size_t limit,
+               uint32_t address, uint32_t align, MemSearchHits *hits, size_t space)
+{
+	const MemSearchPattern *pattern = plan->pattern;
+	size_t pos = 0;
+
+	if (!plan->anchored) {
+		/* Nothing to anchor on, e.g. all wildcards: try every position */
+		for (pos = 0; pos < limit && space != 0; pos += align) {
+			if (memsearch_matches(pattern, data + pos)) {
+				space--;
+				if (memsearch_add_hit(hits, address + (uint32_t) pos, index)) {
+					return limit;
+				}
+			}
+		}
+		return pos < limit ? pos : limit;
+	}
+
+#if defined(__SSE2__)
+	{
+		const __m128i first = _mm_set1_epi8((char) pattern->value[plan->first]);
+		const __m128i last = _mm_set1_epi8((char) pattern->value[plan->last]);
+		const unsigned align_mask = (align == 4) ? 0x1111 : (align == 2) ? 0x5555 : 0xffff;
+
+		for (; pos + 16 <= limit; pos += 16) {
+			const __m128i a = _mm_loadu_si128((const __m128i *) (data + pos + plan->first));
+			const __m128i b = _mm_loadu_si128((const __m128i *) (data + pos + plan->last));
+			unsigned bits = (unsigned) _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+			                                                           _mm_cmpeq_epi8(b, last)));
+
+			bits &= align_mask;
+			while (bits != 0) {
+				const size_t candidate = pos + (size_t) __builtin_ctz(bits);
+
+				bits &= bits - 1;
+				if (memsearch_matches(pattern, data + candidate)) {
+					if (space == 0) {
+						/* Resume from this position once flushed */
+						return candidate;
+					}
+					space--;
+					if (memsearch_add_hit(hits, address + (uint32_t) candidate, index)) {
+						return limit;
+					}
+				}
+			}
+		}
+	}
+#endif
+
+	/* Remaining positions (all of them without SSE2) */
+	while (pos < limit) {
+		const uint8_t *found = memchr(data + pos + plan->first, pattern->value[plan->first], limit - pos);
+		size_t candidate;
+
+		if (found == NULL) {
+			break;
+		}
+		candidate = (size_t) (found - data) - plan->first;
+		pos = candidate + 1;
+		if ((candidate & (align - 1)) != 0) {
+			continue;
+		}
+		if (memsearch_matches(pattern, data + candidate)) {
+			if (space == 0) {
+				return candidate;
+			}
+			space--;
+			if (memsearch_add_hit(hits, address + (uint32_t) candidate, index)) {
+				return limit;
+			}
+		}
+	}
+	return limit;
+}
+
+/**
+ * Sort a chunk's hits into address order; several patterns may have
+ * added hits to the same chunk.
+ */
+static int
+memsearch_hit_compare(const void *a, const void *b)
+{
+	const MemSearchHit *ha = a;
+	const MemSearchHit *hb = b;
+
+	if (ha->address != hb->address) {
+		return ha->address < hb->address ? -1 : 1;
+	}
+	return ha->pattern < hb->pattern ? -1 : (ha->pattern > hb->pattern);
+}
+
+/**
+ * Search memory for the patterns of a query.
+ *
+ * Hits are passed to the callback after each chunk, and whenever enough
+ * have built up in a chunk. Hits of a pattern that would run past the
+ * end of a bank are not reported.
+ *
+ * @param query      Patterns to find; must pass mem_search_query_valid()
+ * @param banks      Memory to search, as filled in by mem_get_banks()
+ * @param bank_count Number of banks
+ * @param callback   Called with hits and progress; returns 0 to stop
+ * @param opaque     Passed to callback
+ * @return Number of hits, or -1 if the query is invalid
+ */
+int64_t
+mem_search(const MemSearchQuery *query, const MemBank *banks, int bank_count,
+           MemSearchCallback callback, void *opaque)
+{
+	MemSearchPlan plans[MEMSEARCH_MAX_PATTERNS];
+	MemSearchHits *hits;
+	uint64_t total = 0, scanned = 0;
+	uint8_t *scratch = NULL;
+	uint32_t p;
+	int64_t result;
+	int b;
+
+	if (!mem_search_query_valid(query)) {
+		return -1;
+	}
+
+	for (p = 0; p < query->pattern_count; p++) {
+		const MemSearchPattern *pattern = &query->patterns[p];
+		uint32_t i;
+
+		plans[p].pattern = pattern;
+		plans[p].anchored = 0;
+		plans[p].first = plans[p].last = 0;
+		for (i = 0; i < pattern->length; i++) {
+			if (pattern->mask[i] == 0xff) {
+				if (!plans[p].anchored) {
+					plans[p].first = i;
+					plans[p].anchored = 1;
+				}
+				plans[p].last = i;
+			}
+		}
+	}
+
+	for (b = 0; b < bank_count; b++) {
+		total += banks[b].size;
+	}
+
+	hits = malloc(sizeof(MemSearchHits));
+	if (hits == NULL) {
+		return -1;
+	}
+	hits->count = 0;
+	hits->total_hits = 0;
+	hits->max_hits = query->max_hits;
+
+#ifdef _RPCEMU_BIG_ENDIAN
+	/* Memory is held as host-order words; search a byte-swapped copy */
+	scratch = malloc(MEMSEARCH_CHUNK + MEMSEARCH_MAX_LENGTH);
+	if (scratch == NULL) {
+		free(hits);
+		return -1;
+	}
+#endif
+
+	for (b = 0; b < bank_count; b++) {
+		const MemBank *bank = &banks[b];
+		uint32_t chunk;
+
+		for (chunk = 0; chunk < bank->size; chunk += MEMSEARCH_CHUNK) {
+			const uint32_t chunk_len = (bank->size - chunk < MEMSEARCH_CHUNK) ? bank->size - chunk : MEMSEARCH_CHUNK;
+			/* Bytes from the chunk start to the end of the bank, up to what the longest pattern needs */
+			const uint32_t view_len = (bank->size - chunk < chunk_len + MEMSEARCH_MAX_LENGTH) ?
+			                          bank->size - chunk : chunk_len + MEMSEARCH_MAX_LENGTH;
+			const uint8_t *view = bank->data + chunk;
+			int stop = 0;
+
+			if (scratch != NULL) {
+				uint32_t i;
+
+				for (i = 0; i < view_len; i++) {
+					scratch[i] = bank->data[(chunk + i) ^ 3];
+				}
+				view = scratch;
+			}
+
+			for (p = 0; p < query->pattern_count && !stop; p++) {
+				const uint32_t length = plans[p].pattern->length;
+				size_t limit, pos = 0;
+
+				if (length > view_len) {
+					continue;
+				}
+				limit = view_len - length + 1;
+				if (limit > chunk_len) {
+					limit = chunk_len;
+				}
+
+				while (pos < limit) {
+					pos += memsearch_scan(&plans[p], p, view + pos, limit - pos,
+					                      bank->base + chunk + (uint32_t) pos, query->alignment,
+					                      hits, MEMSEARCH_BATCH - hits->count);
+					if (hits->max_hits != 0 && hits->total_hits >= hits->max_hits) {
+						stop = 1;
+						break;
+					}
+					if (pos < limit) {
+						/* Batch full: pass it on and carry on from the same place */
+						qsort(hits->hits, hits->count, sizeof(MemSearchHit), memsearch_hit_compare);
+						if (!callback(opaque, hits->hits, hits->count, scanned, total)) {
+							stop = 2;
+							break;
+						}
+						hits->count = 0;
+					}
+				}
+			}
+
+			scanned += chunk_len;
+			qsort(hits->hits, hits->count, sizeof(MemSearchHit), memsearch_hit_compare);
+			if (stop == 2 || !callback(opaque, hits->hits, hits->count, scanned, total) || stop) {
+				goto done;
+			}
+			hits->count = 0;
+		}
+	}
+
+done:
+	result = (int64_t) hits->total_hits;
+	free(scratch);
+	free(hits);
+	return result;
+}
@@ -0,0 +1,85 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * memsearch.h - Search of the emulated machine's physical memory
+ *
+ * Scans the host memory behind ROM, VRAM and RAM (see mem_get_banks())
+ * for one or more byte patterns, each with an optional mask. Hits are
+ * passed back a chunk at a time so a caller on a worker thread can show
+ * progress and stop early.
+ */
+
+#ifndef MEMSEARCH_H
+#define MEMSEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MEMSEARCH_MAX_PATTERNS	8	/**< Most patterns in one query */
+#define MEMSEARCH_MAX_LENGTH	64	/**< Longest pattern, in bytes */
+
+/** A byte pattern; a byte matches where (byte & mask) == (value & mask) */
+typedef struct {
+	uint8_t		value[MEMSEARCH_MAX_LENGTH];
+	uint8_t		mask[MEMSEARCH_MAX_LENGTH];	/**< 0xff to match exactly, 0 for any */
+	uint32_t	length;				/**< Bytes used, 1 to MEMSEARCH_MAX_LENGTH */
+} MemSearchPattern;
+
+typedef struct {
+	MemSearchPattern	patterns[MEMSEARCH_MAX_PATTERNS];
+	uint32_t		pattern_count;
+	uint32_t		alignment;	/**< Only report hits at multiples of this: 1, 2 or 4 */
+	uint32_t		max_hits;	/**< Stop after this many hits, 0 for no limit */
+} MemSearchQuery;
+
+typedef struct {
+	uint32_t	address;	/**< Physical address of the first byte */
+	uint32_t	pattern;	/**< Index of the pattern that matched */
+} MemSearchHit;
+
+/**
+ * Called after each chunk of memory has been scanned.
+ *
+ * @param opaque  Caller's pointer passed to mem_search()
+ * @param hits    Hits found in the chunk, in address order
+ * @param count   Number of hits (may be 0)
+ * @param scanned Bytes scanned so far
+ * @param total   Bytes to scan in all
+ * @return Non-zero to carry on, 0 to stop the search
+ */
+typedef int (*MemSearchCallback)(void *opaque, const MemSearchHit *hits, size_t count,
+                                 uint64_t scanned, uint64_t total);
+
+extern int mem_search_query_valid(const MemSearchQuery *query);
+extern int64_t mem_search(const MemSearchQuery *query, const MemBank *banks, int bank_count,
+                          MemSearchCallback callback, void *opaque);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MEMSEARCH_H */
@@ -20,9 +20,19 @@
 
 /* RPCemu networking */
 
+/*
+ * Frames are received from the TAP device by a dedicated I/O thread, which
+ * reads everything pending each time the device becomes readable into a ring
+ * of pre-allocated buffers. The emulator thread raises the podule IRQ from
+ * network_plt_poll() while frames are waiting, and network_plt_rx() copies
+ * them out of the ring into the guest's mbufs.
+ */
+
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <errno.h>
-#include <signal.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -30,34 +40,54 @@
 
 #include <fcntl.h>
 #include <grp.h>
+#include <poll.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <linux/if_tun.h>
 #include <linux/sockios.h>
+#include <linux/virtio_net.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include "rpcemu.h"
 #include "mem.h"
 #include "network.h"
 #include "podules.h"
+#include "packet_ring.h"
+
+#define HEADERLEN	14
 
-#define HEADERLEN	18
+// Number of received frames buffered between the I/O thread and the guest (power of two)
+#define RX_RING_SIZE	64
 
 // The opened tunnel device
 static int tunfd = -1;
 
+// Size of the virtio-net header preceding each frame, 0 if IFF_VNET_HDR is unavailable
+static size_t vnet_hdr_len;
+
 // Pointer to a word in RMA, used as the IRQ status register
 static uint32_t irqstatus;
 
 // Max packet is 1500 bytes plus headers
 static uint8_t buffer[1522];
 
+// Receive I/O thread
+static pthread_t rx_thread;
+static int rx_thread_running;
+static atomic_int rx_thread_quit;
+static int rx_wake_fd = -1;		///< eventfd used to wake the I/O thread
+static atomic_int rx_blocked;		///< I/O thread is waiting for ring space
+static PacketRing rx_ring;		///< Received frames, including the virtio-net header
+
 /**
  * Given a system username, lookup their uid and gid
  *
@@ -119,12 +149,30 @@ tun_alloc(void)
 		return -1;
 	}
 
+	// Prefer frames prefixed with a virtio-net header; older kernels only
+	// offer plain frames
 	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_flags = IFF_TAP;
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+	vnet_hdr_len = sizeof(struct virtio_net_hdr);
 
 	if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
-		error("Error setting TAP on tunnel device: %s", strerror(errno));
-		return -1;
+		memset(&ifr, 0, sizeof(ifr));
+		ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+		vnet_hdr_len = 0;
+
+		if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+			error("Error setting TAP on tunnel device: %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	if (vnet_hdr_len != 0) {
+		int hdr_len = (int) vnet_hdr_len;
+
+		if (ioctl(fd, TUNSETVNETHDRSZ, &hdr_len) < 0) {
+			error("Error setting virtio-net header size: %s", strerror(errno));
+			return -1;
+		}
 	}
 
 	ioctl(fd, TUNSETNOCSUM, 1);
@@ -218,11 +266,12 @@ tun_alloc(void)
 uint32_t
 network_plt_tx(uint32_t errbuf, uint32_t mbufs, uint32_t dest, uint32_t src, uint32_t frametype)
 {
+	static const struct virtio_net_hdr vnet_hdr; // No offloads requested, so always zero
 	uint8_t *buf = buffer;
 	struct ro_mbuf_part txb;
+	struct iovec iov[2];
 	size_t packet_length;
-	int ret;
-	int i;
+	ssize_t ret;
 
 	if (tunfd == -1) {
 		strcpyfromhost(errbuf, "RPCEmu: Networking not available");
@@ -230,17 +279,12 @@ network_plt_tx(uint32_t errbuf, uint32_t mbufs, uint32_t dest, uint32_t src, uin
 	}
 
 	/* Ethernet packet is
-	   4 bytes preamble
 	   6 bytes destination MAC address
 	   6 bytes source MAC address
 	   2 bytes frame type (Ethernet II) or length (IEEE 802.3)
 	   up to 1500 bytes payload
 	*/
 
-	for (i = 0; i < 4; i++) {
-		*buf++ = 0;
-	}
-
 	memcpytohost(buf, dest, 6);
 	buf += 6;
 
@@ -269,8 +313,14 @@ network_plt_tx(uint32_t errbuf, uint32_t mbufs, uint32_t dest, uint32_t src, uin
 		mbufs = txb.m_next;
 	}
 
+	// The virtio-net header, if in use, goes in front of the frame
+	iov[0].iov_base = (void *) &vnet_hdr;
+	iov[0].iov_len = vnet_hdr_len;
+	iov[1].iov_base = buffer;
+	iov[1].iov_len = packet_length;
+
 	do {
-		ret = write(tunfd, buffer, packet_length);
+		ret = writev(tunfd, iov, 2);
 	} while ((ret == -1) && (errno == EAGAIN));
 	if (ret == -1) {
 		strcpyfromhost(errbuf, strerror(errno));
@@ -293,36 +343,38 @@ network_plt_tx(uint32_t errbuf, uint32_t mbufs, uint32_t dest, uint32_t src, uin
 uint32_t
 network_plt_rx(uint32_t errbuf, uint32_t mbuf, uint32_t rxhdr, uint32_t *data_avail)
 {
+	const PacketRingSlot *slot;
 	struct ro_mbuf_part rxb;
 	struct rx_hdr hdr;
-	int packet_length;
+	const uint8_t *frame;
+	uint32_t packet_length;
+	uint32_t result = 0;
 
 	*data_avail = 0;
 
-	if (tunfd == -1) {
+	if (tunfd == -1 || !rx_thread_running) {
 		// Networking not available
 		return errbuf;
 	}
 
+	slot = packet_ring_peek(&rx_ring);
+	if (slot == NULL) {
+		// No data
+		return 0;
+	}
+
 	memset(&hdr, 0, sizeof(hdr));
 
-	packet_length = read(tunfd, buffer, sizeof(buffer));
-	if (packet_length == -1) {
-		if (errno == EAGAIN) {
-			// No data
-			return 0;
-		}
-		// Other receive error
-		return errbuf;
-	}
+	frame = slot->data + vnet_hdr_len;
+	packet_length = slot->len - (uint32_t) vnet_hdr_len;
 
 	if (mbuf != 0 && packet_length > HEADERLEN) {
-		const uint8_t *payload = buffer + HEADERLEN;
+		const uint8_t *payload = frame + HEADERLEN;
 
 		// Fill in received header structure
-		memcpy(hdr.rx_dst_addr, buffer + 4, 6);
-		memcpy(hdr.rx_src_addr, buffer + 10, 6);
-		hdr.rx_frame_type = (buffer[16] << 8) | buffer[17];
+		memcpy(hdr.rx_dst_addr, frame + 0, 6);
+		memcpy(hdr.rx_src_addr, frame + 6, 6);
+		hdr.rx_frame_type = (frame[12] << 8) | frame[13];
 		hdr.rx_error_level = 0;
 		memcpyfromhost(rxhdr, &hdr, sizeof(hdr));
 
@@ -330,29 +382,48 @@ network_plt_rx(uint32_t errbuf, uint32_t mbuf, uint32_t rxhdr, uint32_t *data_av
 
 		memcpytohost(&rxb, mbuf, sizeof(rxb));
 
-		if ((size_t) packet_length > rxb.m_inilen) {
+		if (packet_length > rxb.m_inilen) {
 			// Mbuf too small for received packet
-			return errbuf;
+			result = errbuf;
+		} else {
+			// Copy payload in to the mbuf
+			rxb.m_off = rxb.m_inioff;
+			memcpyfromhost(mbuf + rxb.m_off, payload, packet_length);
+			rxb.m_len = packet_length;
+			memcpyfromhost(mbuf, &rxb, sizeof(rxb));
+
+			*data_avail = 1;
 		}
+	}
 
-		// Copy payload in to the mbuf
-		rxb.m_off = rxb.m_inioff;
-		memcpyfromhost(mbuf + rxb.m_off, payload, packet_length);
-		rxb.m_len = packet_length;
-		memcpyfromhost(mbuf, &rxb, sizeof(rxb));
+	// The frame is consumed whatever the outcome, as a read() would have
+	packet_ring_release(&rx_ring);
 
-		*data_avail = 1;
+	// Let the I/O thread resume reading if it ran out of buffers
+	if (rx_blocked) {
+		const uint64_t one = 1;
+
+		rx_blocked = 0;
+		(void) write(rx_wake_fd, &one, sizeof(one));
 	}
 
-	return 0;
+	return result;
 }
 
-static void
-sig_io(int sig)
+/**
+ * Raise the podule IRQ if received frames are waiting for the guest.
+ * Called regularly from the emulator thread.
+ */
+void
+network_plt_poll(void)
 {
-	NOT_USED(sig);
+	if (!rx_thread_running || irqstatus == 0 || network_poduleinfo == NULL) {
+		return;
+	}
 
-	network_irq_raise();
+	if (!network_poduleinfo->irq && packet_ring_count(&rx_ring) != 0) {
+		network_irq_raise();
+	}
 }
 
 /**
@@ -361,45 +432,137 @@ sig_io(int sig)
 void
 network_plt_setirqstatus(uint32_t address)
 {
-	struct sigaction sa;
-	int flags;
-
-	memset(&sa, 0, sizeof(sa));
+	irqstatus = address;
+}
 
-	if ((flags = fcntl(tunfd, F_GETFL)) == -1) {
-		error("Error getting flags for network device: %s", strerror(errno));
-		return;
-	}
+/**
+ * Read every frame currently pending on the TAP device into the ring.
+ */
+static void
+rx_thread_read_frames(void)
+{
+	for (;;) {
+		PacketRingSlot *slot = packet_ring_reserve(&rx_ring);
+		ssize_t len;
+
+		if (slot == NULL) {
+			// Ring full, wait for the guest to catch up. Check again
+			// after flagging, in case space was freed in between.
+			rx_blocked = 1;
+			slot = packet_ring_reserve(&rx_ring);
+			if (slot == NULL) {
+				return;
+			}
+			rx_blocked = 0;
+		}
 
-	if (irqstatus != 0) {
-		if (fcntl(tunfd, F_SETFL, flags & ~O_ASYNC) == -1) {
-			error("Error disabling SIGIO for network device: %s", strerror(errno));
+		len = read(tunfd, slot->data, sizeof(slot->data));
+		if (len < 0) {
+			// EAGAIN once drained; anything else is retried on the next wake
 			return;
 		}
 
-		sa.sa_handler = SIG_DFL;
-
-		if (sigaction(SIGIO, &sa, NULL) == -1) {
-			error("Error uninstalling SIGIO handler: %s", strerror(errno));
-			return;
+		if ((size_t) len > vnet_hdr_len + HEADERLEN) {
+			slot->len = (uint32_t) len;
+			packet_ring_commit(&rx_ring);
 		}
 	}
+}
 
-	irqstatus = address;
+/**
+ * I/O thread: wait for frames from the TAP device.
+ */
+static void *
+rx_thread_main(void *arg)
+{
+	NOT_USED(arg);
+
+	while (!rx_thread_quit) {
+		struct pollfd fds[2];
+
+		fds[0].fd = rx_wake_fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = tunfd;
+		fds[1].events = rx_blocked ? 0 : POLLIN;
+
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			rpclog("Networking: poll() failed: %s\n", strerror(errno));
+			break;
+		}
 
-	if (irqstatus != 0) {
-		sa.sa_handler = sig_io;
+		if (fds[0].revents & POLLIN) {
+			uint64_t count;
 
-		if (sigaction(SIGIO, &sa, NULL) == -1) {
-			error("Error installing SIGIO handler: %s", strerror(errno));
-			return;
+			(void) read(rx_wake_fd, &count, sizeof(count));
 		}
 
-		if (fcntl(tunfd, F_SETFL, flags | O_ASYNC) == -1) {
-			error("Error enabling SIGIO for network device: %s", strerror(errno));
-			return;
+		if (fds[1].revents & POLLIN) {
+			rx_thread_read_frames();
 		}
 	}
+
+	return NULL;
+}
+
+/**
+ * Start the receive I/O thread.
+ *
+ * @return 1 on success, 0 on failure
+ */
+static int
+rx_thread_start(void)
+{
+	if (!packet_ring_init(&rx_ring, RX_RING_SIZE)) {
+		error("Networking: out of memory for receive buffers");
+		return 0;
+	}
+
+	rx_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (rx_wake_fd < 0) {
+		error("Networking: unable to create eventfd: %s", strerror(errno));
+		packet_ring_free(&rx_ring);
+		return 0;
+	}
+
+	rx_thread_quit = 0;
+	rx_blocked = 0;
+
+	if (pthread_create(&rx_thread, NULL, rx_thread_main, NULL) != 0) {
+		error("Networking: unable to create receive thread");
+		close(rx_wake_fd);
+		rx_wake_fd = -1;
+		packet_ring_free(&rx_ring);
+		return 0;
+	}
+	(void) pthread_setname_np(rx_thread, "rpcemu: tap");
+
+	rx_thread_running = 1;
+	return 1;
+}
+
+/**
+ * Stop the receive I/O thread and discard any frames it buffered.
+ */
+static void
+rx_thread_stop(void)
+{
+	const uint64_t one = 1;
+
+	if (!rx_thread_running) {
+		return;
+	}
+
+	rx_thread_quit = 1;
+	(void) write(rx_wake_fd, &one, sizeof(one));
+	pthread_join(rx_thread, NULL);
+	rx_thread_running = 0;
+
+	close(rx_wake_fd);
+	rx_wake_fd = -1;
+	packet_ring_free(&rx_ring);
 }
 
 int
@@ -441,6 +604,11 @@ network_plt_init(void)
 	}
 
 	if (tunfd != -1) {
+		if (!rx_thread_start()) {
+			close(tunfd);
+			tunfd = -1;
+			return 0;
+		}
 		return 1;
 	} else {
 		return 0;
@@ -456,6 +624,8 @@ network_plt_init(void)
 void
 network_plt_reset(void)
 {
+	rx_thread_stop();
+
 	if (tunfd != -1) {
 		close(tunfd);
 		tunfd = -1;
@@ -1,5 +1,19 @@
+/*
+ * On Linux SLiRP's sockets are serviced by a dedicated thread, which sleeps
+ * in select() until a host socket is ready, a protocol timer is due or the
+ * guest transmits something. Frames for the guest are handed back through a
+ * lock-free ring, so network_nat_poll() on the emulator thread only has to
+ * check whether anything is waiting and raise the podule IRQ if so.
+ * Other platforms keep polling SLiRP from the emulator thread.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <assert.h>
 #include <errno.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -8,12 +22,19 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 
+#ifdef __linux__
+#define NAT_THREAD
+#include <pthread.h>
+#include <sys/eventfd.h>
+#endif
+
 #include "rpcemu.h"
 #include "mem.h"
 #include "network.h"
 #include "network-nat.h"
 #include "podules.h"
 #include "broadcast_relay.h"
+#include "packet_ring.h"
 
 #include "slirp/libslirp.h"
 
@@ -25,6 +46,9 @@
 #define PKT_QUEUE_SIZE  32      /* Number of packets in queue */
 #define PKT_MAX_SIZE    2048    /* Max size of each packet */
 
+/* Frames from SLiRP waiting for the guest (power of two) */
+#define NAT_RING_SIZE   64
+
 typedef struct {
 	uint8_t  data[PKT_MAX_SIZE];
 	size_t   len;
@@ -48,6 +72,16 @@ static struct {
 	int             pkt_queue_head;  /* Next slot to write */
 	int             pkt_queue_tail;  /* Next slot to read */
 	int             pkt_queue_count; /* Number of packets in queue */
+
+#ifdef NAT_THREAD
+	pthread_mutex_t	lock;		///< Serialises all calls into SLiRP
+	pthread_t	thread;
+	int		thread_running;
+	atomic_int	thread_quit;
+	int		wake_fd;	///< eventfd used to interrupt the thread's select()
+	atomic_int	output_blocked;	///< SLiRP was refused output because the ring was full
+	PacketRing	rx_ring;	///< Frames from SLiRP for the guest
+#endif
 } nat;
 
 /* Forward declarations */
@@ -120,6 +154,15 @@ slirp_output(void *opaque, const uint8_t *pkt, int pkt_len)
 {
 	NOT_USED(opaque);
 
+#ifdef NAT_THREAD
+	if (nat.thread_running) {
+		// Queue for the emulator thread, which owns the IRQ state and
+		// decides whether the frame can be delivered
+		(void) packet_ring_push(&nat.rx_ring, pkt, (uint32_t) pkt_len);
+		return;
+	}
+#endif
+
 	// Write to capture file for debug
 	write_packet(nat.capture, pkt, pkt_len);
 
@@ -141,9 +184,148 @@ slirp_can_output(void *opaque)
 {
 	NOT_USED(opaque);
 
+#ifdef NAT_THREAD
+	if (nat.thread_running) {
+		if (packet_ring_count(&nat.rx_ring) <= nat.rx_ring.mask) {
+			return 1;
+		}
+		// Ask the emulator thread to wake us once it has made space
+		nat.output_blocked = 1;
+		return 0;
+	}
+#endif
+
 	return (nat.buffer_len == 0);
 }
 
+#ifdef NAT_THREAD
+
+/**
+ * Interrupt the NAT thread's select(), so it rebuilds its descriptor sets
+ * and lets SLiRP retry any output it is holding.
+ */
+static void
+network_nat_wake(void)
+{
+	const uint64_t one = 1;
+
+	(void) write(nat.wake_fd, &one, sizeof(one));
+}
+
+/**
+ * NAT thread: service SLiRP's sockets and timers.
+ */
+static void *
+network_nat_thread(void *arg)
+{
+	NOT_USED(arg);
+
+	while (!nat.thread_quit) {
+		fd_set rfds, wfds, efds;
+		struct timeval tv, *ptv = NULL;
+		int fd_max, timeout, ret;
+
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		FD_ZERO(&efds);
+		fd_max = nat.wake_fd;
+		FD_SET(nat.wake_fd, &rfds);
+
+		pthread_mutex_lock(&nat.lock);
+		slirp_select_fill(nat.slirp, &fd_max, &rfds, &wfds, &efds);
+		timeout = slirp_select_timeout(nat.slirp);
+		pthread_mutex_unlock(&nat.lock);
+
+		if (timeout >= 0) {
+			tv.tv_sec = timeout / 1000;
+			tv.tv_usec = (timeout % 1000) * 1000;
+			ptv = &tv;
+		}
+
+		ret = select(fd_max + 1, &rfds, &wfds, &efds, ptv);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (ret > 0 && FD_ISSET(nat.wake_fd, &rfds)) {
+			uint64_t count;
+
+			(void) read(nat.wake_fd, &count, sizeof(count));
+			FD_CLR(nat.wake_fd, &rfds);
+		}
+
+		// On timeout, or if a descriptor was closed by the emulator thread
+		// while we slept (EBADF), only run the timers this pass
+		pthread_mutex_lock(&nat.lock);
+		slirp_select_poll(nat.slirp, &rfds, &wfds, &efds, ret <= 0);
+		pthread_mutex_unlock(&nat.lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * Start the NAT thread.
+ *
+ * @return 1 on success, 0 on failure
+ */
+static int
+network_nat_thread_start(void)
+{
+	if (nat.thread_running) {
+		return 1;
+	}
+
+	if (!packet_ring_init(&nat.rx_ring, NAT_RING_SIZE)) {
+		return 0;
+	}
+
+	nat.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (nat.wake_fd < 0) {
+		packet_ring_free(&nat.rx_ring);
+		return 0;
+	}
+
+	pthread_mutex_init(&nat.lock, NULL);
+	nat.thread_quit = 0;
+	nat.output_blocked = 0;
+
+	// Set before the thread runs so SLiRP output goes to the ring
+	nat.thread_running = 1;
+	if (pthread_create(&nat.thread, NULL, network_nat_thread, NULL) != 0) {
+		nat.thread_running = 0;
+		pthread_mutex_destroy(&nat.lock);
+		close(nat.wake_fd);
+		packet_ring_free(&nat.rx_ring);
+		return 0;
+	}
+	(void) pthread_setname_np(nat.thread, "rpcemu: nat");
+
+	return 1;
+}
+
+/**
+ * Stop the NAT thread and release its resources.
+ */
+static void
+network_nat_thread_stop(void)
+{
+	if (!nat.thread_running) {
+		return;
+	}
+
+	nat.thread_quit = 1;
+	network_nat_wake();
+	pthread_join(nat.thread, NULL);
+	nat.thread_running = 0;
+
+	pthread_mutex_destroy(&nat.lock);
+	close(nat.wake_fd);
+	packet_ring_free(&nat.rx_ring);
+}
+
+#endif /* NAT_THREAD */
+
 /**
  */
 static void
@@ -224,6 +406,12 @@ network_nat_init(void)
 
 	network_nat_open();
 
+#ifdef NAT_THREAD
+	if (!network_nat_thread_start()) {
+		rpclog("Networking: unable to start NAT thread, polling instead\n");
+	}
+#endif
+
 	// Open capture file if requested
 	if (config.network_capture != NULL) {
 		if ((nat.capture = fopen(config.network_capture, "wb")) != NULL) {
@@ -250,6 +438,15 @@ network_nat_reset(void)
 	nat.pkt_queue_head = 0;
 	nat.pkt_queue_tail = 0;
 	nat.pkt_queue_count = 0;
+
+#ifdef NAT_THREAD
+	if (nat.thread_running) {
+		while (packet_ring_peek(&nat.rx_ring) != NULL) {
+			packet_ring_release(&nat.rx_ring);
+		}
+		network_nat_wake();
+	}
+#endif
 }
 
 void
@@ -259,6 +456,16 @@ network_nat_poll(void)
 	int fd_max, ret;
 	struct timeval tv;
 
+#ifdef NAT_THREAD
+	if (nat.thread_running) {
+		// SLiRP is serviced by its own thread; just collect relay traffic
+		// and hand over anything waiting, raising the IRQ only if there is
+		broadcast_relay_poll();
+		deliver_queued_packet();
+		return;
+	}
+#endif
+
 	FD_ZERO(&rfds);
 	FD_ZERO(&wfds);
 	FD_ZERO(&efds);
@@ -335,6 +542,18 @@ network_nat_tx(uint32_t errbuf, uint32_t mbufs, uint32_t dest, uint32_t src, uin
 	// Check if this is a broadcast to relay to host network
 	broadcast_relay_tx(nat.buffer, packet_length);
 
+#ifdef NAT_THREAD
+	if (nat.thread_running) {
+		pthread_mutex_lock(&nat.lock);
+		slirp_input(nat.slirp, nat.buffer, packet_length);
+		pthread_mutex_unlock(&nat.lock);
+
+		// The frame may have created a socket the thread must watch
+		network_nat_wake();
+		return 0;
+	}
+#endif
+
 	slirp_input(nat.slirp, nat.buffer, packet_length);
 
 	return 0;
@@ -424,9 +643,22 @@ network_nat_forward_add(PortForwardRule rule)
 	struct in_addr bind = { 0 };
 	int retval;
 
+#ifdef NAT_THREAD
+	if (nat.thread_running) {
+		pthread_mutex_lock(&nat.lock);
+	}
+#endif
+
 	// Inform SLIRP of the rule added
 	retval = slirp_add_hostfwd(nat.slirp, rule.type == PORT_FORWARD_UDP ? 1 : 0,
 	    bind, rule.host_port, nat.forward_addr, rule.emu_port);
+
+#ifdef NAT_THREAD
+	if (nat.thread_running) {
+		pthread_mutex_unlock(&nat.lock);
+		network_nat_wake();
+	}
+#endif
 	if (retval != 0) {
 		error("Failed to add NAT Network port forwarding rule, %s emu_port %u host_port %u, %d %d %s",
 		    rule.type == PORT_FORWARD_UDP ? "UDP" : "TCP", rule.emu_port, rule.host_port,
@@ -444,9 +676,22 @@ network_nat_forward_remove(PortForwardRule rule)
 {
 	struct in_addr bind = { 0 };
 
+#ifdef NAT_THREAD
+	if (nat.thread_running) {
+		pthread_mutex_lock(&nat.lock);
+	}
+#endif
+
 	// Inform SLIRP of the rule removal
 	slirp_remove_hostfwd(nat.slirp, rule.type == PORT_FORWARD_UDP ? 1 : 0,
 	    bind, rule.host_port);
+
+#ifdef NAT_THREAD
+	if (nat.thread_running) {
+		pthread_mutex_unlock(&nat.lock);
+		network_nat_wake();
+	}
+#endif
 }
 
 /**
@@ -468,6 +713,10 @@ network_nat_forward_edit(PortForwardRule old_rule, PortForwardRule new_rule)
 void
 network_nat_close(void)
 {
+#ifdef NAT_THREAD
+	network_nat_thread_stop();
+#endif
+
 	broadcast_relay_close();
 
 	if (nat.capture != NULL) {
@@ -487,14 +736,50 @@ deliver_queued_packet(void)
 {
 	queued_packet_t *pkt;
 
-	if (nat.pkt_queue_count == 0) {
-		return;  // No packets queued
-	}
-
 	if (nat.buffer_len != 0) {
 		return;  // Buffer still busy
 	}
 
+#ifdef NAT_THREAD
+	if (nat.thread_running) {
+		const PacketRingSlot *slot = packet_ring_peek(&nat.rx_ring);
+
+		if (slot != NULL && (nat.irq_status == 0 || network_poduleinfo == NULL)) {
+			// Not set-up to generate IRQ; discard what the thread queued
+			while (packet_ring_peek(&nat.rx_ring) != NULL) {
+				packet_ring_release(&nat.rx_ring);
+			}
+			slot = NULL;
+			if (nat.output_blocked) {
+				nat.output_blocked = 0;
+				network_nat_wake();
+			}
+		}
+
+		if (slot != NULL) {
+			memcpy(nat.buffer, slot->data, slot->len);
+			nat.buffer_len = slot->len;
+			packet_ring_release(&nat.rx_ring);
+
+			// Write to capture file for debug
+			write_packet(nat.capture, nat.buffer, nat.buffer_len);
+
+			// Let SLiRP resume output it held back while the ring was full
+			if (nat.output_blocked) {
+				nat.output_blocked = 0;
+				network_nat_wake();
+			}
+
+			network_irq_raise();
+			return;
+		}
+	}
+#endif
+
+	if (nat.pkt_queue_count == 0) {
+		return;  // No packets queued
+	}
+
 	// Get packet from queue
 	pkt = &nat.pkt_queue[nat.pkt_queue_tail];
 
@@ -26,10 +26,14 @@
 #include <string.h>
 
 #include "rpcemu.h"
+#include "arm.h"
 #include "mem.h"
+#include "swi.h"
+#include "hostfs.h"
 #include "network.h"
 #include "network-nat.h"
 #include "podules.h"
+#include "replay.h"
 
 /* Variables for supporting a podule header data */
 static uint8_t *romdata = NULL; /**< Podule header data and the like */
@@ -161,16 +165,31 @@ readpoduleetherrpcem(podule *p, PoduleIoType io_type, uint32_t addr)
 }
 
 /**
- * Raise an interrupt request from the network podule.
+ * Raise an interrupt request from the network podule now.
  */
 void
-network_irq_raise(void)
+network_irq_deliver(void)
 {
 	if (network_poduleinfo != NULL) {
 		podule_irq_raise(network_poduleinfo);
 	}
 }
 
+/**
+ * Raise an interrupt request from the network podule. Called by the
+ * backends when they have a frame for the guest.
+ */
+void
+network_irq_raise(void)
+{
+	if (replay_mode != ReplayMode_Off) {
+		// Raised at an event point instead, where it can be logged or replayed
+		replay_network_irq();
+		return;
+	}
+	network_irq_deliver();
+}
+
 /**
  * Clear an interrupt request from the network podule.
  */
@@ -185,6 +204,10 @@ network_irq_lower(void)
 /**
  * Copy bytes from emulated memory map to host
  *
+ * Works a page at a time; once the first byte of a page has been read (which
+ * fills in the TLB), the rest of the page is copied in bulk if it is directly
+ * mapped.
+ *
  * @param dest Pointer to storage in host memory
  * @param src  Memory address in emulated memory map
  * @param len  Amount in bytes to copy
@@ -192,17 +215,42 @@ network_irq_lower(void)
 void
 memcpytohost(void *dest, uint32_t src, uint32_t len)
 {
-	char *dst = dest;
+	uint8_t *dst = dest;
+
+	while (len != 0) {
+		uint32_t chunk = 0x1000 - (src & 0xfff);
+
+		if (chunk > len) {
+			chunk = len;
+		}
+		len -= chunk;
 
-	while (len--) {
 		*dst++ = mem_read8(src);
 		src++;
+		chunk--;
+
+#ifndef _RPCEMU_BIG_ENDIAN
+		if (chunk != 0 && !(vraddrl[src >> 12] & 1)) {
+			memcpy(dst, (const uint8_t *) (src + vraddrl[src >> 12]), chunk);
+			debugger_memory_access(src, chunk, 0, 0);
+			dst += chunk;
+			src += chunk;
+			chunk = 0;
+		}
+#endif
+
+		while (chunk--) {
+			*dst++ = mem_read8(src);
+			src++;
+		}
 	}
 }
 
 /**
  * Copy bytes from host to emulated memory
  *
+ * Works a page at a time, in the same way as memcpytohost().
+ *
  * @param dest   Memory address in emulated memory map
  * @param source Pointer to storage in host memory
  * @param len    Amount in bytes to copy
@@ -210,12 +258,34 @@ memcpytohost(void *dest, uint32_t src, uint32_t len)
 void
 memcpyfromhost(uint32_t dest, const void *source, uint32_t len)
 {
-	const char *src = source;
+	const uint8_t *src = source;
 
-	while (len--) {
-		mem_write8(dest, *src);
-		src++;
+	while (len != 0) {
+		uint32_t chunk = 0x1000 - (dest & 0xfff);
+
+		if (chunk > len) {
+			chunk = len;
+		}
+		len -= chunk;
+
+		mem_write8(dest, *src++);
 		dest++;
+		chunk--;
+
+#ifndef _RPCEMU_BIG_ENDIAN
+		if (chunk != 0 && !(vwaddrl[dest >> 12] & 3)) {
+			memcpy((uint8_t *) (dest + vwaddrl[dest >> 12]), src, chunk);
+			debugger_memory_access(dest, chunk, 1, 0);
+			src += chunk;
+			dest += chunk;
+			chunk = 0;
+		}
+#endif
+
+		while (chunk--) {
+			mem_write8(dest, *src++);
+			dest++;
+		}
 	}
 }
 
@@ -344,6 +414,93 @@ network_init(void)
 	}
 }
 
+/**
+ * While recording, log what a receive call gave the guest: whether it
+ * returned the error buffer, whether it delivered a frame, and the rx_hdr
+ * and payload it wrote.
+ */
+static void
+network_rx_record(uint32_t mbuf, uint32_t rxhdr, uint32_t result, uint32_t data_avail)
+{
+	uint8_t frame[sizeof(struct rx_hdr) + 2048]; /* No backend passes on larger frames */
+	uint32_t length = 0;
+
+	if (mbuf != 0 && (result != 0 || data_avail)) {
+		// Written by the backend if it had a frame, unchanged otherwise
+		memcpytohost(frame, rxhdr, sizeof(struct rx_hdr));
+		length = sizeof(struct rx_hdr);
+	}
+	if (data_avail) {
+		struct ro_mbuf_part rxb;
+
+		memcpytohost(&rxb, mbuf, sizeof(rxb));
+		if (rxb.m_len > sizeof(frame) - length) {
+			rxb.m_len = sizeof(frame) - length;
+		}
+		memcpytohost(frame + length, mbuf + rxb.m_off, rxb.m_len);
+		length += rxb.m_len;
+	}
+
+	replay_record_data(ReplayEvent_NetworkRx, result != 0, (int32_t) data_avail, frame, length);
+}
+
+/**
+ * While replaying, give the guest what a receive call gave it when
+ * recorded, in the same way as the backends do.
+ *
+ * @return Value for r0
+ */
+static uint32_t
+network_rx_replay(uint32_t errbuf, uint32_t mbuf, uint32_t rxhdr, uint32_t *data_avail)
+{
+	ReplayEvent event;
+	const uint8_t *frame = replay_pull(ReplayEvent_NetworkRx, &event);
+
+	*data_avail = 0;
+
+	if (frame == NULL) {
+		// Not in the log; as if no frame had arrived
+		return 0;
+	}
+
+	if (event.length >= sizeof(struct rx_hdr)) {
+		memcpyfromhost(rxhdr, frame, sizeof(struct rx_hdr));
+	}
+	if (event.b && event.length >= sizeof(struct rx_hdr)) {
+		const uint32_t packet_length = event.length - sizeof(struct rx_hdr);
+		struct ro_mbuf_part rxb;
+
+		memcpytohost(&rxb, mbuf, sizeof(rxb));
+		rxb.m_off = rxb.m_inioff;
+		memcpyfromhost(mbuf + rxb.m_off, frame + sizeof(struct rx_hdr), packet_length);
+		rxb.m_len = packet_length;
+		memcpyfromhost(mbuf, &rxb, sizeof(rxb));
+
+		*data_avail = 1;
+	}
+
+	return event.a ? errbuf : 0;
+}
+
+/**
+ * Host handler for the network SWI.
+ *
+ * @param swinum SWI number
+ * @return Always 1, the SWI is never passed to RISC OS
+ */
+static int
+network_swi_handler(uint32_t swinum)
+{
+	NOT_USED(swinum);
+
+	if (config.network_type != NetworkType_Off) {
+		network_swi(arm.reg[0], arm.reg[1], arm.reg[2], arm.reg[3],
+		            arm.reg[4], arm.reg[5], &arm.reg[0], &arm.reg[1]);
+		network_activity_increment();
+	}
+	return 1;
+}
+
 /**
  * Shutdown any running network components.
  *
@@ -353,6 +510,9 @@ network_init(void)
 void
 network_reset(void)
 {
+	/* The SWI is claimed even when networking is off */
+	swi_register(ARCEM_SWI_NETWORK, network_swi_handler);
+
 	if (config.network_type == NetworkType_NAT) {
 		// Call NAT reset code
 		network_nat_reset();
@@ -383,18 +543,28 @@ network_swi(uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3, uint32_t r4, uin
 #endif
 	switch (r0) {
 	case 0: // Transmit
-		if (config.network_type == NetworkType_NAT) {
+		if (replay_mode == ReplayMode_Play) {
+			// The frame went out when recorded
+			*retr0 = 0;
+		} else if (config.network_type == NetworkType_NAT) {
 			*retr0 = network_nat_tx(r1, r2, r3, r4, r5);
 		} else {
 			*retr0 = network_plt_tx(r1, r2, r3, r4, r5);
 		}
 		break;
 	case 1: // Receive
+		if (replay_mode == ReplayMode_Play) {
+			*retr0 = network_rx_replay(r1, r2, r3, retr1);
+			break;
+		}
 		if (config.network_type == NetworkType_NAT) {
 			*retr0 = network_nat_rx(r1, r2, r3, retr1);
 		} else {
 			*retr0 = network_plt_rx(r1, r2, r3, retr1);
 		}
+		if (replay_mode == ReplayMode_Record) {
+			network_rx_record(r2, r3, *retr0, *retr1);
+		}
 		break;
 	case 2:
 		if (config.network_type == NetworkType_NAT) {
@@ -406,7 +576,7 @@ network_swi(uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3, uint32_t r4, uin
 		break;
 	case 3:
 		if (r2 != 0) {
-			network_irq_raise();
+			network_irq_deliver();
 		} else {
 			network_irq_lower();
 		}
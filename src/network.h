@@ -41,6 +41,7 @@ void network_init(void);
 void network_reset(void);
 
 /* Functions shared between each platform, in network.c */
+void network_irq_deliver(void);
 void network_irq_raise(void);
 void network_irq_lower(void);
 
@@ -58,6 +59,7 @@ int network_plt_init(void);
 uint32_t network_plt_tx(uint32_t errbuf, uint32_t mbufs, uint32_t dest, uint32_t src, uint32_t frametype);
 uint32_t network_plt_rx(uint32_t errbuf, uint32_t mbuf, uint32_t rxhdr, uint32_t *dataavail);
 void network_plt_setirqstatus(uint32_t address);
+void network_plt_poll(void);
 
 /* Structures and variables shared between each host platform's network code */
 extern podule *network_poduleinfo;
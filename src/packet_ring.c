@@ -0,0 +1,180 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * packet_ring.c - Bounded lock-free packet queue between two threads
+ *
+ * head and tail are free running counters; the producer publishes a slot
+ * with a release store of head, the consumer hands it back with a release
+ * store of tail. Each side only ever writes its own counter.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rpcemu.h"
+#include "packet_ring.h"
+
+/**
+ * Initialise a packet ring.
+ *
+ * @param ring Ring to initialise
+ * @param size Number of slots, must be a power of two
+ * @return 1 on success, 0 on failure
+ */
+int
+packet_ring_init(PacketRing *ring, uint32_t size)
+{
+	if (size == 0 || (size & (size - 1)) != 0) {
+		return 0;
+	}
+
+	ring->slots = calloc(size, sizeof(PacketRingSlot));
+	if (ring->slots == NULL) {
+		return 0;
+	}
+
+	ring->mask = size - 1;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+
+	return 1;
+}
+
+/**
+ * Release the memory held by a packet ring. Neither side may be using it.
+ *
+ * @param ring Ring to free
+ */
+void
+packet_ring_free(PacketRing *ring)
+{
+	free(ring->slots);
+	ring->slots = NULL;
+}
+
+/**
+ * Get the next free slot for the producer to fill in place.
+ *
+ * @param ring Ring
+ * @return Slot to fill, or NULL if the ring is full
+ */
+PacketRingSlot *
+packet_ring_reserve(PacketRing *ring)
+{
+	const unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	const unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	if (head - tail > ring->mask) {
+		return NULL;
+	}
+
+	return &ring->slots[head & ring->mask];
+}
+
+/**
+ * Publish the slot returned by packet_ring_reserve() to the consumer.
+ *
+ * @param ring Ring
+ */
+void
+packet_ring_commit(PacketRing *ring)
+{
+	const unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * Copy a frame into the ring.
+ *
+ * @param ring Ring
+ * @param data Frame data
+ * @param len  Length of frame in bytes
+ * @return 1 if queued, 0 if the ring is full or the frame too large
+ */
+int
+packet_ring_push(PacketRing *ring, const void *data, uint32_t len)
+{
+	PacketRingSlot *slot;
+
+	if (len > PACKET_RING_FRAME_MAX) {
+		return 0;
+	}
+
+	slot = packet_ring_reserve(ring);
+	if (slot == NULL) {
+		return 0;
+	}
+
+	memcpy(slot->data, data, len);
+	slot->len = len;
+	packet_ring_commit(ring);
+
+	return 1;
+}
+
+/**
+ * Get the oldest queued slot without removing it.
+ *
+ * @param ring Ring
+ * @return Oldest slot, or NULL if the ring is empty
+ */
+PacketRingSlot *
+packet_ring_peek(PacketRing *ring)
+{
+	const unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	const unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	if (head == tail) {
+		return NULL;
+	}
+
+	return &ring->slots[tail & ring->mask];
+}
+
+/**
+ * Hand the slot returned by packet_ring_peek() back to the producer.
+ *
+ * @param ring Ring
+ */
+void
+packet_ring_release(PacketRing *ring)
+{
+	const unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/**
+ * Number of frames currently queued. Exact for the consumer, a lower bound
+ * of the free space for the producer.
+ *
+ * @param ring Ring
+ * @return Number of queued frames
+ */
+uint32_t
+packet_ring_count(PacketRing *ring)
+{
+	const unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	const unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	return head - tail;
+}
@@ -0,0 +1,74 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * packet_ring.h - Bounded lock-free packet queue between two threads
+ *
+ * A single-producer, single-consumer ring of fixed size frame slots.
+ * Used to hand network frames between host I/O threads and the emulator
+ * thread without locks or system calls. Slots are filled in place, so
+ * a frame is copied once on each side at most.
+ */
+
+#ifndef PACKET_RING_H
+#define PACKET_RING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Largest frame a slot can hold */
+#define PACKET_RING_FRAME_MAX	2048
+
+typedef struct {
+	uint8_t		data[PACKET_RING_FRAME_MAX];
+	uint32_t	len;		///< Length of frame in data[]
+	uint32_t	meta[3];	///< Optional producer-defined values (e.g. destination)
+} PacketRingSlot;
+
+typedef struct {
+	PacketRingSlot	*slots;
+	uint32_t	mask;		///< Number of slots minus one
+	atomic_uint	head;		///< Next slot to fill, only written by the producer
+	atomic_uint	tail;		///< Next slot to drain, only written by the consumer
+} PacketRing;
+
+extern int packet_ring_init(PacketRing *ring, uint32_t size);
+extern void packet_ring_free(PacketRing *ring);
+
+/* Producer side */
+extern PacketRingSlot *packet_ring_reserve(PacketRing *ring);
+extern void packet_ring_commit(PacketRing *ring);
+extern int packet_ring_push(PacketRing *ring, const void *data, uint32_t len);
+
+/* Consumer side */
+extern PacketRingSlot *packet_ring_peek(PacketRing *ring);
+extern void packet_ring_release(PacketRing *ring);
+
+extern uint32_t packet_ring_count(PacketRing *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACKET_RING_H */
@@ -26,22 +26,56 @@
  *
  * The printer behaves like a simple Centronics-compatible printer:
  * - Accepts data on strobe
- * - Always ready (never busy)
+ * - Busy only while the spool buffer is full
  * - Generates ACK after each byte
+ *
+ * Bytes are placed in a bounded ring buffer by the emulator thread and
+ * streamed to the job's file, or to the standard input of a command, by a
+ * spool writer thread. A job ends when the host stops sending data for
+ * PRINTER_JOB_TIMEOUT seconds, when the printer is reset, or when it is
+ * flushed explicitly.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <stdint.h>
 
+#include <pthread.h>
+
 #include "rpcemu.h"
 #include "printer.h"
 #include "parallel.h"
 
-/* Buffer size for print data (1MB) */
-#define PRINTER_BUFFER_SIZE (1024 * 1024)
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+/* The Windows CRT opens pipes in text mode unless told otherwise, which
+   would translate line endings and stop at 0x1A in binary printer data */
+#define PRINTER_PIPE_MODE "wb"
+#else
+#define PRINTER_PIPE_MODE "w"
+#endif
+
+/* Size of the spool ring buffer (256KB, must be a power of two) */
+#define PRINTER_SPOOL_SIZE (256 * 1024)
+
+/* Seconds without data after which the current job is complete */
+#define PRINTER_JOB_TIMEOUT 5
+
+/* How often the writer thread checks for data it was not woken for (ms) */
+#define PRINTER_POLL_MS 100
+
+/* Value of spool.end_job when no end of job has been requested */
+#define SPOOL_NO_END SIZE_MAX
 
 /* ========================================================================
  * Printer State
@@ -49,13 +83,279 @@
 
 static PrinterOutputMode output_mode = PrinterOutput_Disabled;
 static char output_path[512] = "";
-
-static uint8_t *print_buffer = NULL;
-static size_t buffer_pos = 0;
+static char output_command[512] = "";
 static int job_number = 1;
 
 static int attached_port = -1;  /* Which port we're attached to, or -1 */
 
+/* Spool shared between the emulator thread (producer) and the writer
+   thread (consumer). head and tail are free-running byte counts. */
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;       /* Protects output settings, used with cond */
+    pthread_cond_t cond;        /* Wakes the writer thread */
+    int started;
+
+    uint8_t *ring;
+    atomic_size_t head;         /* Bytes accepted, written by emulator thread */
+    atomic_size_t tail;         /* Bytes consumed, written by writer thread */
+    atomic_size_t job_start;    /* Value of tail when the current job began */
+    atomic_size_t end_job;      /* Value of head where the current job ends,
+                                   or SPOOL_NO_END */
+    atomic_int quit;            /* Finish the current job and exit */
+} spool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* ========================================================================
+ * Spool Writer Thread
+ * ======================================================================== */
+
+static void generate_filename(char *filename, size_t size);
+
+/** Destination of the job being written by the spool thread */
+typedef struct {
+    FILE *f;
+    int is_pipe;
+    size_t bytes;
+    char name[1024];
+} PrinterJob;
+
+/**
+ * Open the destination for a new job, based on the current output mode.
+ * Called on the writer thread.
+ *
+ * @param job Filled in with the open destination
+ * @return 0 on success, -1 if the job's data should be discarded
+ */
+static int
+spool_job_open(PrinterJob *job)
+{
+    PrinterOutputMode mode;
+
+    pthread_mutex_lock(&spool.lock);
+    mode = output_mode;
+    if (mode == PrinterOutput_Command) {
+        snprintf(job->name, sizeof(job->name), "%s", output_command);
+    } else {
+        generate_filename(job->name, sizeof(job->name));
+    }
+    pthread_mutex_unlock(&spool.lock);
+
+    job->bytes = 0;
+    job->is_pipe = (mode == PrinterOutput_Command);
+
+    if (mode == PrinterOutput_Disabled ||
+        (job->is_pipe && job->name[0] == '\0')) {
+        job->f = NULL;
+        return -1;
+    }
+
+    if (job->is_pipe) {
+        job->f = popen(job->name, PRINTER_PIPE_MODE);
+    } else {
+        job->f = fopen(job->name, "wb");
+    }
+    if (job->f == NULL) {
+        rpclog("Printer: Failed to open '%s': %s\n", job->name, strerror(errno));
+        return -1;
+    }
+
+    rpclog("Printer: Job %d started, writing to %s'%s'\n", job_number,
+           job->is_pipe ? "command " : "", job->name);
+    return 0;
+}
+
+/**
+ * Finish the current job. Called on the writer thread.
+ *
+ * @param job Job to close
+ */
+static void
+spool_job_close(PrinterJob *job)
+{
+    if (job->f != NULL) {
+        if (job->is_pipe) {
+            int status = pclose(job->f);
+
+            rpclog("Printer: Job %d complete, %zu bytes sent to '%s' (exit status %d)\n",
+                   job_number, job->bytes, job->name, status);
+        } else {
+            fclose(job->f);
+            rpclog("Printer: Job %d complete, wrote %zu bytes to '%s'\n",
+                   job_number, job->bytes, job->name);
+        }
+        job_number++;
+    } else if (job->bytes > 0) {
+        rpclog("Printer: Discarded %zu bytes\n", job->bytes);
+    }
+
+    job->f = NULL;
+    job->bytes = 0;
+    atomic_store(&spool.job_start, atomic_load(&spool.tail));
+}
+
+/**
+ * Stop sending the current job after a write failed. The rest of its data
+ * is discarded. Called on the writer thread.
+ *
+ * @param job Job whose write failed
+ */
+static void
+spool_job_abandon(PrinterJob *job)
+{
+    if (job->is_pipe && errno == EPIPE) {
+        /* The command stopped reading, which ends the job */
+        rpclog("Printer: Command '%s' exited before the end of the job\n", job->name);
+    } else {
+        rpclog("Printer: Write to '%s' failed: %s\n", job->name, strerror(errno));
+    }
+    if (job->is_pipe) {
+        pclose(job->f);
+    } else {
+        fclose(job->f);
+    }
+    job->f = NULL;
+}
+
+/**
+ * Spool writer thread. Streams data from the ring buffer to the current
+ * job's destination and detects the end of each job.
+ */
+static void *
+spool_thread(void *arg)
+{
+    PrinterJob job;
+    int job_open = 0;
+    time_t last_data = 0;
+
+    (void)arg;
+
+#ifndef _WIN32
+    {
+        sigset_t set;
+
+        /* A print command that exits early must end the job with EPIPE,
+           not kill the emulator with SIGPIPE */
+        sigemptyset(&set);
+        sigaddset(&set, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &set, NULL);
+    }
+#endif
+
+    memset(&job, 0, sizeof(job));
+
+    for (;;) {
+        /* Read the end of job marker before head, so head is never behind
+           it, and write no further than the marker in this job */
+        const size_t end = atomic_load(&spool.end_job);
+        size_t head = atomic_load_explicit(&spool.head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&spool.tail, memory_order_relaxed);
+        const int quit = atomic_load(&spool.quit);
+
+        if (end != SPOOL_NO_END && end - tail < head - tail) {
+            head = end;
+        }
+
+        if (head != tail) {
+            if (!job_open) {
+                (void)spool_job_open(&job);
+                job_open = 1;
+            }
+
+            /* Write out what is in the ring, in at most two contiguous pieces */
+            while (tail != head) {
+                const size_t offset = tail & (PRINTER_SPOOL_SIZE - 1);
+                size_t len = head - tail;
+
+                if (len > PRINTER_SPOOL_SIZE - offset) {
+                    len = PRINTER_SPOOL_SIZE - offset;
+                }
+                if (job.f != NULL && fwrite(spool.ring + offset, 1, len, job.f) != len) {
+                    spool_job_abandon(&job);
+                }
+                job.bytes += len;
+                tail += len;
+                atomic_store_explicit(&spool.tail, tail, memory_order_release);
+            }
+            if (job.f != NULL && fflush(job.f) != 0) {
+                spool_job_abandon(&job);
+            }
+            last_data = time(NULL);
+        }
+
+        if (end != SPOOL_NO_END && tail == head) {
+            /* All data up to the marker is written. A later flush may have
+               moved the marker, in which case it is handled next time. */
+            size_t expected = end;
+
+            if (job_open) {
+                spool_job_close(&job);
+                job_open = 0;
+            }
+            atomic_compare_exchange_strong(&spool.end_job, &expected, SPOOL_NO_END);
+        }
+        if (job_open && (quit || time(NULL) - last_data >= PRINTER_JOB_TIMEOUT)) {
+            spool_job_close(&job);
+            job_open = 0;
+        }
+
+        if (quit) {
+            break;
+        }
+
+        pthread_mutex_lock(&spool.lock);
+        if (atomic_load(&spool.head) == atomic_load(&spool.tail) &&
+            atomic_load(&spool.end_job) == SPOOL_NO_END && !atomic_load(&spool.quit))
+        {
+            struct timespec ts;
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += PRINTER_POLL_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&spool.cond, &spool.lock, &ts);
+        }
+        pthread_mutex_unlock(&spool.lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * Wake the writer thread. Never blocks the caller.
+ */
+static void
+spool_wake(void)
+{
+    pthread_cond_signal(&spool.cond);
+}
+
+/**
+ * Ask the writer thread to finish the current job once the data already
+ * accepted has been written. Data accepted after this call goes into the
+ * next job.
+ */
+static void
+spool_end_job(void)
+{
+    atomic_store(&spool.end_job, atomic_load(&spool.head));
+    spool_wake();
+}
+
+/**
+ * Number of bytes free in the spool ring buffer.
+ */
+static size_t
+spool_free(void)
+{
+    return PRINTER_SPOOL_SIZE - (atomic_load_explicit(&spool.head, memory_order_relaxed) -
+                                 atomic_load_explicit(&spool.tail, memory_order_acquire));
+}
+
 /* ========================================================================
  * Parallel Device Callbacks
  * ======================================================================== */
@@ -66,24 +366,28 @@ static int attached_port = -1;  /* Which port we're attached to, or -1 */
 static void
 printer_on_write(uint8_t data, void *userdata)
 {
+    size_t head;
+
     (void)userdata;
     
-    if (output_mode == PrinterOutput_Disabled || print_buffer == NULL) {
+    if (output_mode == PrinterOutput_Disabled || spool.ring == NULL) {
         return;
     }
     
-    if (buffer_pos < PRINTER_BUFFER_SIZE) {
-        print_buffer[buffer_pos++] = data;
-        
-        /* Log first 10 bytes and periodic updates */
-        if (buffer_pos <= 10 || (buffer_pos % 1000) == 0) {
-            rpclog("Printer: Captured byte %zu: 0x%02X '%c'\n", 
-                   buffer_pos, data, (data >= 32 && data < 127) ? data : '.');
-        }
-    } else {
-        /* Buffer full - auto flush */
-        printer_flush();
-        print_buffer[buffer_pos++] = data;
+    if (spool_free() == 0) {
+        /* The host should have waited while BUSY was shown */
+        rpclog("Printer: Spool full, byte 0x%02X lost\n", data);
+        return;
+    }
+
+    head = atomic_load_explicit(&spool.head, memory_order_relaxed);
+    spool.ring[head & (PRINTER_SPOOL_SIZE - 1)] = data;
+    atomic_store_explicit(&spool.head, head + 1, memory_order_release);
+
+    /* Wake the writer when the buffer is getting full; otherwise it
+       picks the data up when it next polls */
+    if (spool_free() < PRINTER_SPOOL_SIZE / 2) {
+        spool_wake();
     }
     
     /* Signal ACK to the host (byte accepted) */
@@ -111,7 +415,10 @@ printer_get_status(void *userdata)
 {
     (void)userdata;
     
-    /* Always ready: not busy, ACK idle, paper present, online, no error */
+    /* Ready unless the spool is full: ACK idle, paper present, online, no error */
+    if (spool.ring != NULL && spool_free() == 0) {
+        return PARALLEL_STAT_ACK | PARALLEL_STAT_SELECT | PARALLEL_STAT_ERROR;
+    }
     return PARALLEL_STAT_BUSY | PARALLEL_STAT_ACK | 
            PARALLEL_STAT_SELECT | PARALLEL_STAT_ERROR;
 }
@@ -126,10 +433,8 @@ printer_on_reset(void *userdata)
     
     rpclog("Printer: Reset via parallel bus\n");
     
-    /* Flush any pending data */
-    if (buffer_pos > 0) {
-        printer_flush();
-    }
+    /* End the current job */
+    printer_flush();
 }
 
 /* Printer device descriptor */
@@ -149,15 +454,33 @@ static const ParallelDevice printer_device = {
 void
 printer_init(void)
 {
-    if (print_buffer == NULL) {
-        print_buffer = malloc(PRINTER_BUFFER_SIZE);
-        if (print_buffer == NULL) {
+    if (spool.ring == NULL) {
+        spool.ring = malloc(PRINTER_SPOOL_SIZE);
+        if (spool.ring == NULL) {
             rpclog("Printer: Failed to allocate buffer\n");
             return;
         }
     }
+
+    if (!spool.started) {
+        atomic_store(&spool.head, 0);
+        atomic_store(&spool.tail, 0);
+        atomic_store(&spool.job_start, 0);
+        atomic_store(&spool.end_job, SPOOL_NO_END);
+        atomic_store(&spool.quit, 0);
+
+        if (pthread_create(&spool.thread, NULL, spool_thread, NULL) != 0) {
+            rpclog("Printer: Failed to start spool thread\n");
+            free(spool.ring);
+            spool.ring = NULL;
+            return;
+        }
+#ifdef __linux__
+        (void) pthread_setname_np(spool.thread, "rpcemu: printer");
+#endif
+        spool.started = 1;
+    }
     
-    buffer_pos = 0;
     attached_port = -1;
     
     rpclog("Printer: Initialized\n");
@@ -166,24 +489,25 @@ printer_init(void)
 void
 printer_reset(void)
 {
-    if (buffer_pos > 0) {
-        printer_flush();
-    }
-    buffer_pos = 0;
+    printer_flush();
 }
 
 void
 printer_shutdown(void)
 {
-    if (buffer_pos > 0) {
-        printer_flush();
-    }
-    
     printer_detach();
+
+    if (spool.started) {
+        /* The writer finishes the current job before exiting */
+        atomic_store(&spool.quit, 1);
+        spool_wake();
+        pthread_join(spool.thread, NULL);
+        spool.started = 0;
+    }
     
-    if (print_buffer != NULL) {
-        free(print_buffer);
-        print_buffer = NULL;
+    if (spool.ring != NULL) {
+        free(spool.ring);
+        spool.ring = NULL;
     }
     
     rpclog("Printer: Shutdown\n");
@@ -242,52 +566,29 @@ generate_filename(char *filename, size_t size)
     }
 }
 
+/**
+ * End the current print job. Data already accepted is still written out
+ * by the spool thread; this does not wait for it.
+ */
 void
 printer_flush(void)
 {
-    char filename[1024];
-    FILE *f;
-    
-    if (buffer_pos == 0) {
-        return;
-    }
-    
-    if (output_mode == PrinterOutput_Disabled) {
-        rpclog("Printer: Discarding %zu bytes (disabled)\n", buffer_pos);
-        buffer_pos = 0;
+    if (!spool.started || printer_get_buffer_size() == 0) {
         return;
     }
-    
-    if (print_buffer == NULL) {
-        buffer_pos = 0;
-        return;
-    }
-    
-    generate_filename(filename, sizeof(filename));
-    
-    f = fopen(filename, "wb");
-    if (f == NULL) {
-        rpclog("Printer: Failed to open '%s'\n", filename);
-        buffer_pos = 0;
-        return;
-    }
-    
-    fwrite(print_buffer, 1, buffer_pos, f);
-    fclose(f);
-    
-    rpclog("Printer: Wrote %zu bytes to '%s'\n", buffer_pos, filename);
-    
-    job_number++;
-    buffer_pos = 0;
+
+    spool_end_job();
 }
 
 void
 printer_set_output_mode(PrinterOutputMode mode)
 {
-    if (mode != output_mode && buffer_pos > 0) {
+    if (mode != output_mode) {
         printer_flush();
     }
+    pthread_mutex_lock(&spool.lock);
     output_mode = mode;
+    pthread_mutex_unlock(&spool.lock);
     rpclog("Printer: Output mode = %d\n", mode);
 }
 
@@ -300,12 +601,14 @@ printer_get_output_mode(void)
 void
 printer_set_output_path(const char *path)
 {
+    pthread_mutex_lock(&spool.lock);
     if (path != NULL) {
         strncpy(output_path, path, sizeof(output_path) - 1);
         output_path[sizeof(output_path) - 1] = '\0';
     } else {
         output_path[0] = '\0';
     }
+    pthread_mutex_unlock(&spool.lock);
     rpclog("Printer: Output path = '%s'\n", output_path);
 }
 
@@ -315,16 +618,36 @@ printer_get_output_path(void)
     return output_path;
 }
 
+void
+printer_set_output_command(const char *command)
+{
+    pthread_mutex_lock(&spool.lock);
+    if (command != NULL) {
+        strncpy(output_command, command, sizeof(output_command) - 1);
+        output_command[sizeof(output_command) - 1] = '\0';
+    } else {
+        output_command[0] = '\0';
+    }
+    pthread_mutex_unlock(&spool.lock);
+    rpclog("Printer: Output command = '%s'\n", output_command);
+}
+
+const char *
+printer_get_output_command(void)
+{
+    return output_command;
+}
+
 size_t
 printer_get_buffer_size(void)
 {
-    return buffer_pos;
+    return atomic_load(&spool.head) - atomic_load(&spool.job_start);
 }
 
 int
 printer_has_pending_data(void)
 {
-    return (buffer_pos > 0) ? 1 : 0;
+    return (printer_get_buffer_size() > 0) ? 1 : 0;
 }
 
 /* ========================================================================
@@ -349,6 +672,6 @@ printer_set_strobe(int strobe)
 int
 printer_is_busy(void)
 {
-    /* Never busy */
-    return 0;
+    /* Busy only while the spool is full */
+    return (spool.ring != NULL && spool_free() == 0) ? 1 : 0;
 }
@@ -22,7 +22,8 @@
  * Virtual Printer Device
  *
  * This module implements a virtual printer that can be attached to
- * the parallel bus. It captures all data sent to it and saves to files.
+ * the parallel bus. It captures all data sent to it and streams each job
+ * to a file or to the standard input of a host command.
  */
 
 #ifndef PRINTER_H
@@ -43,6 +44,7 @@ extern "C" {
 typedef enum {
     PrinterOutput_Disabled = 0,  /* Printer not attached */
     PrinterOutput_File = 1,      /* Output to raw file */
+    PrinterOutput_Command = 2,   /* Output piped to a host command */
 } PrinterOutputMode;
 
 /* ========================================================================
@@ -83,7 +85,7 @@ void printer_detach(void);
 int printer_get_port(void);
 
 /**
- * Flush the current print job to file.
+ * End the current print job. Does not wait for it to be written.
  */
 void printer_flush(void);
 
@@ -112,8 +114,20 @@ void printer_set_output_path(const char *path);
 const char *printer_get_output_path(void);
 
 /**
- * Get the current buffer size.
- * @return Bytes in buffer
+ * Set the command each print job is piped to in PrinterOutput_Command mode.
+ * @param command  Command line, run by the host shell
+ */
+void printer_set_output_command(const char *command);
+
+/**
+ * Get the current output command.
+ * @return Output command
+ */
+const char *printer_get_output_command(void);
+
+/**
+ * Get the size of the current print job.
+ * @return Bytes received for the job that has not yet ended
  */
 size_t printer_get_buffer_size(void);
 
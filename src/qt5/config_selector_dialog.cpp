@@ -28,6 +28,7 @@
 #include <QGridLayout>
 #include <QGroupBox>
 #include <QMessageBox>
+#include <QProgressDialog>
 #include <QSettings>
 #include <QInputDialog>
 #include <QFormLayout>
@@ -36,6 +37,7 @@
 #include <QUrl>
 
 #include "config_selector_dialog.h"
+#include "machine_clone.h"
 
 extern "C" {
 #include "rpcemu.h"
@@ -123,12 +125,12 @@ void ConfigSelectorDialog::ensureDirectoriesExist()
     dir.mkpath(getMachinesDirectory());
 }
 
-QString ConfigSelectorDialog::getConfigsDirectory() const
+QString ConfigSelectorDialog::getConfigsDirectory()
 {
     return QCoreApplication::applicationDirPath() + "/configs/";
 }
 
-QString ConfigSelectorDialog::getMachinesDirectory() const
+QString ConfigSelectorDialog::getMachinesDirectory()
 {
     return QCoreApplication::applicationDirPath() + "/machines/";
 }
@@ -142,7 +144,7 @@ QStringList ConfigSelectorDialog::findConfigFiles() const
     return dir.entryList(filters, QDir::Files, QDir::Name);
 }
 
-QString ConfigSelectorDialog::readConfigName(const QString &filePath) const
+QString ConfigSelectorDialog::readConfigName(const QString &filePath)
 {
     QSettings settings(filePath, QSettings::IniFormat);
     QString name = settings.value("name", "").toString();
@@ -156,7 +158,7 @@ QString ConfigSelectorDialog::readConfigName(const QString &filePath) const
     return name;
 }
 
-QString ConfigSelectorDialog::sanitizeName(const QString &name) const
+QString ConfigSelectorDialog::sanitizeName(const QString &name)
 {
     QString sanitized = name;
     // Remove invalid filename characters
@@ -166,7 +168,7 @@ QString ConfigSelectorDialog::sanitizeName(const QString &name) const
     return sanitized;
 }
 
-bool ConfigSelectorDialog::isNameUnique(const QString &name) const
+bool ConfigSelectorDialog::isNameUnique(const QString &name)
 {
     QString sanitized = sanitizeName(name);
     QString configPath = getConfigsDirectory() + sanitized + ".cfg";
@@ -210,30 +212,6 @@ bool ConfigSelectorDialog::createBlankHardDisc(const QString &path, int sizeMB)
     return true;
 }
 
-void ConfigSelectorDialog::copyDirectory(const QString &srcPath, const QString &dstPath)
-{
-    QDir srcDir(srcPath);
-    QDir dstDir(dstPath);
-    
-    if (!dstDir.exists()) {
-        dstDir.mkpath(".");
-    }
-    
-    // Copy files
-    QStringList files = srcDir.entryList(QDir::Files);
-    for (const QString &file : files) {
-        QString srcFile = srcPath + "/" + file;
-        QString dstFile = dstPath + "/" + file;
-        QFile::copy(srcFile, dstFile);
-    }
-    
-    // Recursively copy subdirectories
-    QStringList dirs = srcDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
-    for (const QString &dir : dirs) {
-        copyDirectory(srcPath + "/" + dir, dstPath + "/" + dir);
-    }
-}
-
 bool ConfigSelectorDialog::createDefaultConfigIfNeeded()
 {
     QStringList configs = findConfigFiles();
@@ -464,36 +442,44 @@ void ConfigSelectorDialog::onCloneClicked()
         return;
     }
     
-    QString newConfigPath = getConfigsDirectory() + sanitized + ".cfg";
-    
-    // Copy the config file
-    QFile::copy(sourcePath, newConfigPath);
-    
-    // Update the name in the new config
-    QSettings settings(newConfigPath, QSettings::IniFormat);
-    settings.setValue("name", sanitized);
-    settings.sync();
-    
-    // Copy the machine directory (full clone including HD images)
-    QString srcMachineDir = getMachinesDirectory() + sourceName;
-    QString dstMachineDir = getMachinesDirectory() + sanitized;
-    
-    if (QDir(srcMachineDir).exists()) {
-        copyDirectory(srcMachineDir, dstMachineDir);
-    } else {
-        // Source machine dir doesn't exist, create empty one
-        createMachineDirectory(sanitized);
-    }
-    
-    refreshConfigList();
-    
-    // Select the cloned config
-    for (int i = 0; i < configList->count(); i++) {
-        if (configList->item(i)->data(Qt::UserRole).toString() == newConfigPath) {
-            configList->setCurrentRow(i);
-            break;
+    // Copy the config file and machine directory (including HD images) on a
+    // worker thread; large images are reflinked or sparse-copied
+    MachineClone *clone = new MachineClone(sourcePath, sourceName, sanitized, this);
+    QProgressDialog *progressDialog = new QProgressDialog(QString("Cloning '%1'...").arg(sourceName),
+                                                          "Cancel", 0, 1000, this);
+    progressDialog->setWindowTitle("Clone Machine");
+    progressDialog->setWindowModality(Qt::WindowModal);
+    progressDialog->setAutoReset(false);
+    progressDialog->setMinimumDuration(300);
+    progressDialog->setValue(0);
+
+    connect(clone, &MachineClone::progress, progressDialog,
+            [progressDialog, sourceName](qint64 done, qint64 total, const QString &file) {
+        progressDialog->setLabelText(QString("Cloning '%1'...\n%2").arg(sourceName, file));
+        progressDialog->setValue(total > 0 ? (int) ((done * 1000) / total) : 0);
+    });
+    connect(progressDialog, &QProgressDialog::canceled, clone, &MachineClone::cancel);
+    connect(clone, &QThread::finished, this, [this, clone, progressDialog]() {
+        progressDialog->hide();
+        if (!clone->succeeded() && !clone->wasCancelled()) {
+            QMessageBox::warning(this, "Clone Failed", clone->errorString());
         }
-    }
+
+        refreshConfigList();
+
+        // Select the cloned config
+        for (int i = 0; i < configList->count(); i++) {
+            if (configList->item(i)->data(Qt::UserRole).toString() == clone->newConfigPath()) {
+                configList->setCurrentRow(i);
+                break;
+            }
+        }
+
+        progressDialog->deleteLater();
+        clone->deleteLater();
+    });
+
+    clone->start();
 }
 
 void ConfigSelectorDialog::onStartClicked()
@@ -70,20 +70,22 @@ private slots:
     void onListDoubleClicked(QListWidgetItem *item);
     void onSelectionChanged();
 
+public:
+    /* Locations and naming of machines, shared with MachineClone */
+    static QString getConfigsDirectory();
+    static QString getMachinesDirectory();
+    static QString readConfigName(const QString &filePath);
+    static QString sanitizeName(const QString &name);
+    static bool isNameUnique(const QString &name);
+
 private:
     void setupUI();
     void refreshConfigList();
     void ensureDirectoriesExist();
-    QString getConfigsDirectory() const;
-    QString getMachinesDirectory() const;
     QStringList findConfigFiles() const;
-    QString readConfigName(const QString &filePath) const;
     bool createDefaultConfigIfNeeded();
-    QString sanitizeName(const QString &name) const;
-    bool isNameUnique(const QString &name) const;
     bool createMachineDirectory(const QString &machineName);
     bool createBlankHardDisc(const QString &path, int sizeMB);
-    void copyDirectory(const QString &srcPath, const QString &dstPath);
 
     QListWidget *configList;
     QPushButton *newButton;
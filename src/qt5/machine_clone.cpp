@@ -0,0 +1,347 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * machine_clone.cpp - Copying a machine's config and data directory
+ */
+
+#include "machine_clone.h"
+#include "config_selector_dialog.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+
+extern "C" {
+#include "rpcemu.h"
+}
+
+/**
+ * @param sourceConfigPath Full path of the machine's .cfg file
+ * @param sourceName       Machine name; its data lives in machines/<sourceName>/
+ * @param newName          Sanitised name of the clone
+ * @param parent           Owner
+ */
+MachineClone::MachineClone(const QString &sourceConfigPath, const QString &sourceName,
+                           const QString &newName, QObject *parent)
+    : QThread(parent),
+      source_config(sourceConfigPath),
+      source_name(sourceName),
+      new_name(newName),
+      cancel_requested(0),
+      ok(false),
+      bytes_done(0),
+      bytes_total(0)
+{
+}
+
+MachineClone::~MachineClone()
+{
+	cancel();
+	wait();
+}
+
+/**
+ * @return Full path of the clone's .cfg file
+ */
+QString
+MachineClone::newConfigPath() const
+{
+	return ConfigSelectorDialog::getConfigsDirectory() + new_name + ".cfg";
+}
+
+/**
+ * Ask the clone to stop after the chunk it is copying. Anything already
+ * copied is removed. Does not wait.
+ */
+void
+MachineClone::cancel()
+{
+	cancel_requested.storeRelease(1);
+}
+
+void
+MachineClone::run()
+{
+	cloneNow();
+}
+
+/**
+ * Copy the config file and machine directory, on the calling thread.
+ *
+ * @return true on success; otherwise errorString() says why and nothing
+ *         of the clone is left behind
+ */
+bool
+MachineClone::cloneNow()
+{
+	const QString srcDir = ConfigSelectorDialog::getMachinesDirectory() + source_name;
+	const QString dstDir = ConfigSelectorDialog::getMachinesDirectory() + new_name;
+	const QString dstConfig = newConfigPath();
+
+	ok = false;
+	error.clear();
+
+	if (!ConfigSelectorDialog::isNameUnique(new_name)) {
+		error = QString("A machine named '%1' already exists.").arg(new_name);
+		return false;
+	}
+
+	bytes_done = 0;
+	bytes_total = QFileInfo(source_config).size() + directorySize(srcDir);
+	current_file = QFileInfo(source_config).fileName();
+	emit progress(0, bytes_total, current_file);
+
+	if (!QFile::copy(source_config, dstConfig)) {
+		error = QString("Failed to copy configuration file '%1'.").arg(source_config);
+		return false;
+	}
+	bytes_done += QFileInfo(source_config).size();
+
+	// Update the name in the cloned config
+	{
+		QSettings settings(dstConfig, QSettings::IniFormat);
+		settings.setValue("name", new_name);
+		settings.sync();
+	}
+
+	if (!QDir().mkpath(dstDir) || !cloneDirectory(srcDir, dstDir)) {
+		if (error.isEmpty()) {
+			error = QString("Failed to create machine directory '%1'.").arg(dstDir);
+		}
+		removeClone();
+		return false;
+	}
+
+	emit progress(bytes_total, bytes_total, QString());
+	ok = true;
+	return true;
+}
+
+/**
+ * Copy the contents of one directory into another (which exists), recursing
+ * into subdirectories.
+ */
+bool
+MachineClone::cloneDirectory(const QString &srcPath, const QString &dstPath)
+{
+	QDir srcDir(srcPath);
+
+	if (!srcDir.exists()) {
+		// A machine that has never been started may have no directory yet
+		return true;
+	}
+
+	for (const QFileInfo &info : srcDir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden)) {
+		const QString dst = dstPath + "/" + info.fileName();
+
+		if (cancel_requested.loadAcquire() != 0) {
+			error = "Clone cancelled.";
+			return false;
+		}
+
+		if (info.isDir()) {
+			if (!QDir().mkpath(dst) || !cloneDirectory(info.filePath(), dst)) {
+				if (error.isEmpty()) {
+					error = QString("Failed to create directory '%1'.").arg(dst);
+				}
+				return false;
+			}
+		} else if (!cloneFile(info.filePath(), dst)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Copy one file, sharing its extents with the source where possible.
+ */
+bool
+MachineClone::cloneFile(const QString &srcPath, const QString &dstPath)
+{
+	const QByteArray src = QFile::encodeName(srcPath);
+	const QByteArray dst = QFile::encodeName(dstPath);
+	const qint64 size = QFileInfo(srcPath).size();
+
+	current_file = QDir(ConfigSelectorDialog::getMachinesDirectory() + source_name).relativeFilePath(srcPath);
+
+	if (!rpcemu_file_clone(src.constData(), dst.constData(), &MachineClone::fileProgress, this)) {
+		const int err = errno;
+
+		if (err == ECANCELED) {
+			error = "Clone cancelled.";
+			return false;
+		}
+
+		// Only fall back to a plain copy where cloning is not supported
+		// (e.g. on Windows); any other error would just happen again
+		if (!isCloneUnsupported(err)) {
+			error = QString("Failed to clone '%1': %2").arg(srcPath, QString::fromLocal8Bit(strerror(err)));
+			return false;
+		}
+		if (!QFile::copy(srcPath, dstPath)) {
+			error = QString("Failed to copy '%1': %2").arg(srcPath, QString::fromLocal8Bit(strerror(err)));
+			return false;
+		}
+	}
+
+	bytes_done += size;
+	emit progress(bytes_done, bytes_total, current_file);
+	return true;
+}
+
+/**
+ * @param err errno from a failed rpcemu_file_clone()
+ * @return true if the failure means this host or filesystem cannot clone
+ */
+bool
+MachineClone::isCloneUnsupported(int err)
+{
+	switch (err) {
+	case ENOSYS:
+	case EXDEV:
+#ifdef EOPNOTSUPP
+	case EOPNOTSUPP:
+#endif
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Called by rpcemu_file_clone() after each chunk, on the cloning thread.
+ */
+int
+MachineClone::fileProgress(void *opaque, uint64_t done, uint64_t total)
+{
+	MachineClone *self = static_cast<MachineClone *>(opaque);
+
+	NOT_USED(total);
+
+	emit self->progress(self->bytes_done + static_cast<qint64>(done), self->bytes_total, self->current_file);
+
+	return self->cancel_requested.loadAcquire() == 0;
+}
+
+/**
+ * Remove whatever part of the clone has been written.
+ */
+void
+MachineClone::removeClone()
+{
+	QFile::remove(newConfigPath());
+	QDir(ConfigSelectorDialog::getMachinesDirectory() + new_name).removeRecursively();
+}
+
+/**
+ * @return Total size in bytes of the files under a directory
+ */
+qint64
+MachineClone::directorySize(const QString &path)
+{
+	QDirIterator it(path, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+	qint64 total = 0;
+
+	while (it.hasNext()) {
+		it.next();
+		total += it.fileInfo().size();
+	}
+	return total;
+}
+
+/**
+ * Handle 'rpcemu --provision <machine> <new name> [count]' without starting
+ * the GUI: clone a machine once, or count times as <new name>-1 to
+ * <new name>-<count>, printing progress to stdout.
+ *
+ * @param argc command line arguments
+ * @param argv command line arguments; argv[1] is "--provision"
+ * @return Process exit code
+ */
+int
+machine_provision_main(int argc, char **argv)
+{
+	QCoreApplication app(argc, argv);
+	int count = 1;
+
+	if (argc < 4 || argc > 5) {
+		fprintf(stderr, "Usage: %s --provision <machine> <new name> [count]\n", argv[0]);
+		return 1;
+	}
+	if (argc == 5) {
+		count = atoi(argv[4]);
+		if (count < 1) {
+			fprintf(stderr, "Invalid count '%s'\n", argv[4]);
+			return 1;
+		}
+	}
+
+	const QString sourceName = QString::fromLocal8Bit(argv[2]);
+	const QString sourceConfig = ConfigSelectorDialog::getConfigsDirectory() +
+	                             ConfigSelectorDialog::sanitizeName(sourceName) + ".cfg";
+	const QString baseName = ConfigSelectorDialog::sanitizeName(QString::fromLocal8Bit(argv[3]));
+
+	if (!QFile::exists(sourceConfig)) {
+		fprintf(stderr, "No machine named '%s' (looked for %s)\n", argv[2],
+		        QFile::encodeName(sourceConfig).constData());
+		return 1;
+	}
+
+	// The data directory is named after the machine's display name
+	const QString sourceMachine = ConfigSelectorDialog::readConfigName(sourceConfig);
+
+	for (int i = 1; i <= count; i++) {
+		const QString newName = (count == 1) ? baseName : QString("%1-%2").arg(baseName).arg(i);
+		const QByteArray newNameBytes = newName.toLocal8Bit();
+		MachineClone clone(sourceConfig, sourceMachine, newName);
+		int lastPercent = -1;
+
+		QObject::connect(&clone, &MachineClone::progress,
+		                 [&lastPercent, &newNameBytes](qint64 done, qint64 total, const QString &) {
+			const int percent = total > 0 ? static_cast<int>((done * 100) / total) : 100;
+
+			if (percent != lastPercent) {
+				lastPercent = percent;
+				printf("\r%s: %3d%%", newNameBytes.constData(), percent);
+				fflush(stdout);
+			}
+		});
+
+		if (!clone.cloneNow()) {
+			printf("\n");
+			fprintf(stderr, "%s: %s\n", newNameBytes.constData(),
+			        clone.errorString().toLocal8Bit().constData());
+			return 1;
+		}
+		printf("\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,86 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * machine_clone.h - Copying a machine's config and data directory
+ *
+ * Each file is copied with rpcemu_file_clone(), which shares extents with
+ * the source where the filesystem supports it and otherwise keeps hard
+ * disc images sparse. A clone can run on its own thread (start()) with
+ * progress signalled as it goes, or synchronously (cloneNow()) as used by
+ * the --provision command line option.
+ */
+
+#ifndef MACHINE_CLONE_H
+#define MACHINE_CLONE_H
+
+#include <QAtomicInt>
+#include <QString>
+#include <QThread>
+
+class MachineClone : public QThread
+{
+	Q_OBJECT
+
+public:
+	MachineClone(const QString &sourceConfigPath, const QString &sourceName,
+	             const QString &newName, QObject *parent = nullptr);
+	~MachineClone() override;
+
+	bool cloneNow();
+	void cancel();
+
+	bool succeeded() const { return ok; }
+	bool wasCancelled() const { return cancel_requested.loadAcquire() != 0; }
+	QString errorString() const { return error; }
+	QString newConfigPath() const;
+
+signals:
+	/// Bytes copied so far out of total, and the file being copied
+	void progress(qint64 done, qint64 total, const QString &file);
+
+protected:
+	void run() override;
+
+private:
+	bool cloneDirectory(const QString &srcPath, const QString &dstPath);
+	bool cloneFile(const QString &srcPath, const QString &dstPath);
+	void removeClone();
+
+	static qint64 directorySize(const QString &path);
+	static bool isCloneUnsupported(int err);
+	static int fileProgress(void *opaque, uint64_t done, uint64_t total);
+
+	const QString source_config;
+	const QString source_name;
+	const QString new_name;
+
+	QAtomicInt cancel_requested;
+	bool ok;
+	QString error;
+
+	qint64 bytes_done;		///< Bytes of completed files
+	qint64 bytes_total;
+	QString current_file;		///< Path relative to the machine directory
+};
+
+extern int machine_provision_main(int argc, char **argv);
+
+#endif /* MACHINE_CLONE_H */
@@ -28,9 +28,12 @@
 
 #include "machine_inspector_window.h"
 
+#include <string.h>
+
 #include <QCheckBox>
 #include <QClipboard>
 #include <QComboBox>
+#include <QFileDialog>
 #include <QAbstractItemView>
 #include <QtGlobal>
 #include <QFontDatabase>
@@ -54,7 +57,9 @@
 #include <QSet>
 
 #include "rpc-qt5.h"
+#include "memory_search.h"
 #include "arm.h"
+#include "replay.h"
 
 namespace {
 
@@ -185,6 +190,12 @@ MachineInspectorWindow::MachineInspectorWindow(Emulator &emulator, QWidget *pare
 	memory_jump_pc_button(nullptr),
 	memory_search_input(nullptr),
 	memory_search_button(nullptr),
+	memory_search_aligned_checkbox(nullptr),
+	memory_search_results(nullptr),
+	memory_search_status(nullptr),
+	memory_search(new MemorySearch(this)),
+	memory_search_pattern_count(0),
+	memory_search_generation(0),
 	memory_copy_button(nullptr),
 	memory_current_address(0),
 	memory_word_size(1)
@@ -360,8 +371,16 @@ MachineInspectorWindow::MachineInspectorWindow(Emulator &emulator, QWidget *pare
 	memory_search_input = new QLineEdit(this);
 	memory_search_input->setPlaceholderText(tr("Search hex bytes..."));
 	memory_search_input->setMaximumWidth(150);
-	memory_search_input->setToolTip(tr("Enter hex bytes to find (e.g., 'EF 00 00 00')"));
+	memory_search_input->setToolTip(tr("Enter hex bytes to find in all RAM, VRAM and ROM (e.g., 'EF 00 00 00').\n"
+	                                   "Use ?? for any byte, and | between alternative patterns."));
 	memory_search_button = new QPushButton(tr("Find"), this);
+	memory_search_aligned_checkbox = new QCheckBox(tr("Aligned"), this);
+	memory_search_aligned_checkbox->setToolTip(tr("Only find matches starting on a word boundary"));
+	memory_search_results = new QListWidget(this);
+	memory_search_results->setFont(mono);
+	memory_search_results->setMaximumHeight(100);
+	memory_search_results->setToolTip(tr("Search hits; activate one to view it"));
+	memory_search_status = new QLabel(this);
 	memory_copy_button = new QPushButton(tr("Copy"), this);
 	memory_copy_button->setToolTip(tr("Copy memory view to clipboard"));
 
@@ -377,12 +396,15 @@ MachineInspectorWindow::MachineInspectorWindow(Emulator &emulator, QWidget *pare
 	memory_controls2->addSpacing(10);
 	memory_controls2->addWidget(memory_search_input);
 	memory_controls2->addWidget(memory_search_button);
+	memory_controls2->addWidget(memory_search_aligned_checkbox);
 	memory_controls2->addWidget(memory_copy_button);
 	memory_controls2->addStretch(1);
 
 	memory_layout->addLayout(memory_controls);
 	memory_layout->addLayout(memory_controls2);
 	memory_layout->addWidget(memory_view);
+	memory_layout->addWidget(memory_search_status);
+	memory_layout->addWidget(memory_search_results);
 	memory_tab->setLayout(memory_layout);
 	tabs->addTab(memory_tab, tr("Memory"));
 
@@ -397,6 +419,40 @@ MachineInspectorWindow::MachineInspectorWindow(Emulator &emulator, QWidget *pare
 	peripheral_tab->setLayout(peripheral_layout);
 	tabs->addTab(peripheral_tab, tr("Peripherals"));
 
+	/* Dynarec profile tab */
+	QWidget *dynprof_tab = new QWidget(this);
+	QVBoxLayout *dynprof_layout = new QVBoxLayout(dynprof_tab);
+
+	dynprof_record_checkbox = new QCheckBox(tr("Record block profile"), this);
+	dynprof_record_checkbox->setToolTip(tr("Starting flushes the code cache so every block is recompiled with counters"));
+	// Recompiling every block would change where a recorded session's
+	// events land, so the profiler is unavailable while one is in use
+	dynprof_record_checkbox->setEnabled(arm_is_dynarec() && replay_mode == ReplayMode_Off);
+	dynprof_refresh_button = new QPushButton(tr("Refresh"), this);
+	dynprof_reset_button = new QPushButton(tr("Reset"), this);
+	dynprof_export_button = new QPushButton(tr("Export JSON..."), this);
+	dynprof_dump_button = new QPushButton(tr("Dump code..."), this);
+	dynprof_view = new QPlainTextEdit(this);
+	dynprof_view->setFont(mono);
+	dynprof_view->setReadOnly(true);
+	dynprof_view->setLineWrapMode(QPlainTextEdit::NoWrap);
+	if (!arm_is_dynarec()) {
+		dynprof_view->setPlainText(tr("The block profile needs the dynarec core."));
+	}
+
+	QHBoxLayout *dynprof_controls = new QHBoxLayout;
+	dynprof_controls->addWidget(dynprof_record_checkbox);
+	dynprof_controls->addStretch(1);
+	dynprof_controls->addWidget(dynprof_refresh_button);
+	dynprof_controls->addWidget(dynprof_reset_button);
+	dynprof_controls->addWidget(dynprof_export_button);
+	dynprof_controls->addWidget(dynprof_dump_button);
+
+	dynprof_layout->addLayout(dynprof_controls);
+	dynprof_layout->addWidget(dynprof_view);
+	dynprof_tab->setLayout(dynprof_layout);
+	tabs->addTab(dynprof_tab, tr("Dynarec"));
+
 	QWidget *debug_tab = new QWidget(this);
 	QVBoxLayout *debug_layout = new QVBoxLayout(debug_tab);
 	debug_layout->addWidget(debug_status_label);
@@ -464,6 +520,7 @@ MachineInspectorWindow::MachineInspectorWindow(Emulator &emulator, QWidget *pare
 	connect(watchpoint_add_button, &QPushButton::clicked, this, &MachineInspectorWindow::onAddWatchpoint);
 	connect(watchpoint_remove_button, &QPushButton::clicked, this, &MachineInspectorWindow::onRemoveWatchpoint);
 	connect(&emulator, &Emulator::debugger_state_changed_signal, this, &MachineInspectorWindow::refreshSnapshot);
+	connect(&emulator, &Emulator::telemetry_detail_ready_signal, this, &MachineInspectorWindow::applyTelemetry);
 	connect(breakpoint_list, &QListWidget::itemSelectionChanged, this, [this]() {
 		breakpoint_remove_button->setEnabled(!breakpoint_list->selectedItems().isEmpty());
 	});
@@ -478,6 +535,11 @@ MachineInspectorWindow::MachineInspectorWindow(Emulator &emulator, QWidget *pare
 
 	/* Memory viewer connections */
 	connect(memory_go_button, &QPushButton::clicked, this, &MachineInspectorWindow::onMemoryGoToAddress);
+	connect(dynprof_record_checkbox, &QCheckBox::toggled, this, &MachineInspectorWindow::onDynprofRecordToggled);
+	connect(dynprof_refresh_button, &QPushButton::clicked, this, &MachineInspectorWindow::onDynprofRefresh);
+	connect(dynprof_reset_button, &QPushButton::clicked, this, &MachineInspectorWindow::onDynprofReset);
+	connect(dynprof_export_button, &QPushButton::clicked, this, &MachineInspectorWindow::onDynprofExport);
+	connect(dynprof_dump_button, &QPushButton::clicked, this, &MachineInspectorWindow::onDynprofDump);
 	connect(memory_address_input, &QLineEdit::returnPressed, this, &MachineInspectorWindow::onMemoryGoToAddress);
 	connect(memory_refresh_button, &QPushButton::clicked, this, &MachineInspectorWindow::onMemoryRefresh);
 	connect(memory_prev_button, &QPushButton::clicked, this, &MachineInspectorWindow::onMemoryPrevPage);
@@ -490,6 +552,12 @@ MachineInspectorWindow::MachineInspectorWindow(Emulator &emulator, QWidget *pare
 	connect(memory_jump_pc_button, &QPushButton::clicked, this, &MachineInspectorWindow::onMemoryJumpPC);
 	connect(memory_search_input, &QLineEdit::returnPressed, this, &MachineInspectorWindow::onMemorySearch);
 	connect(memory_search_button, &QPushButton::clicked, this, &MachineInspectorWindow::onMemorySearch);
+	connect(memory_search, &MemorySearch::hits_found, this, &MachineInspectorWindow::onMemorySearchHits);
+	connect(memory_search, &MemorySearch::progress, this, &MachineInspectorWindow::onMemorySearchProgress);
+	connect(memory_search, &MemorySearch::search_finished, this, &MachineInspectorWindow::onMemorySearchFinished);
+	connect(memory_search_results, &QListWidget::itemActivated, this, [this](QListWidgetItem *item) {
+		refreshMemoryView(item->data(Qt::UserRole).toUInt());
+	});
 	connect(memory_copy_button, &QPushButton::clicked, this, &MachineInspectorWindow::onMemoryCopy);
 
 	refresh_timer.start();
@@ -509,12 +577,24 @@ MachineInspectorWindow::showAndRaise()
 void
 MachineInspectorWindow::refreshSnapshot()
 {
+	if (!isVisible()) {
+		return;
+	}
+
+	/* The emulator thread gathers the detailed sections on its next pass
+	   and signals when they are published; see applyTelemetry() */
+	emulator.requestTelemetryDetail();
+}
+
+void
+MachineInspectorWindow::applyTelemetry()
+{
+	if (!isVisible()) {
+		return;
+	}
+
 	MachineSnapshot snapshot;
-	bool ok = QMetaObject::invokeMethod(&emulator,
-	                                   "takeSnapshot",
-	                                   Qt::BlockingQueuedConnection,
-	                                   Q_RETURN_ARG(MachineSnapshot, snapshot));
-	if (!ok) {
+	if (!emulator.readTelemetry(snapshot)) {
 		summary_label->setText(tr("Snapshot failed"));
 		return;
 	}
@@ -583,9 +663,17 @@ MachineInspectorWindow::formatRegisters(const MachineSnapshot &snapshot) const
 	lines << tr("Core: %1 | CPU idle: %2")
 	            .arg(snapshot.dynarec ? tr("Dynarec") : tr("Interpreter"))
 	            .arg(snapshot.cpu_idle_enabled ? tr("enabled") : tr("disabled"));
+	if (snapshot.dynarec) {
+		lines << tr("Superblocks: %1 resident, %2 formed | Coverage: %3%")
+		            .arg(snapshot.dynarec_superblocks)
+		            .arg(snapshot.dynarec_superblocks_formed)
+		            .arg(snapshot.dynarec_superblock_coverage, 0, 'f', 1);
+	}
 
-	lines << tr("Performance: MIPS=%1")
-	            .arg(snapshot.perf_mips, 0, 'f', 2);
+	lines << tr("Performance: MIPS=%1 | Video: %2 fps, %3 dropped")
+	            .arg(snapshot.perf_mips, 0, 'f', 2)
+	            .arg(snapshot.perf_video_fps, 0, 'f', 0)
+	            .arg(snapshot.perf_video_dropped, 0, 'f', 0);
 	return lines.join(QLatin1Char('\n'));
 }
 
@@ -1444,57 +1532,137 @@ MachineInspectorWindow::onMemoryJumpPC()
 void
 MachineInspectorWindow::onMemorySearch()
 {
+	/* The Find button doubles as Stop while a search is running */
+	if (memory_search->isRunning()) {
+		memory_search->cancel();
+		return;
+	}
+
 	QString search_text = memory_search_input->text().trimmed();
 	if (search_text.isEmpty()) {
 		QMessageBox::warning(this, tr("Search"), tr("Please enter a hex pattern to search for."));
 		return;
 	}
 
-	/* Parse hex string into bytes */
-	QByteArray pattern;
-	QStringList parts = search_text.split(QRegExp(QStringLiteral("[\\s,]+")), Qt::SkipEmptyParts);
-	for (const QString &part : parts) {
-		bool ok = false;
-		int byte_val = part.toInt(&ok, 16);
-		if (!ok || byte_val < 0 || byte_val > 255) {
+	/* Parse 'EF 00 ?? 00 | 12 34' into patterns of bytes and masks */
+	MemSearchQuery query;
+	memset(&query, 0, sizeof(query));
+
+	const QStringList alternatives = search_text.split(QLatin1Char('|'), Qt::SkipEmptyParts);
+	for (const QString &alternative : alternatives) {
+		if (query.pattern_count == MEMSEARCH_MAX_PATTERNS) {
 			QMessageBox::warning(this, tr("Search"),
-			                    tr("Invalid hex byte: %1").arg(part));
+			                    tr("At most %1 patterns can be searched for at once.").arg(MEMSEARCH_MAX_PATTERNS));
 			return;
 		}
-		pattern.append(static_cast<char>(byte_val));
+
+		MemSearchPattern &pattern = query.patterns[query.pattern_count];
+		QStringList parts = alternative.split(QRegExp(QStringLiteral("[\\s,]+")), Qt::SkipEmptyParts);
+		for (const QString &part : parts) {
+			if (pattern.length == MEMSEARCH_MAX_LENGTH) {
+				QMessageBox::warning(this, tr("Search"),
+				                    tr("Patterns can be at most %1 bytes long.").arg(MEMSEARCH_MAX_LENGTH));
+				return;
+			}
+			if (part == QLatin1String("??")) {
+				pattern.value[pattern.length] = 0;
+				pattern.mask[pattern.length] = 0;
+				pattern.length++;
+				continue;
+			}
+
+			bool ok = false;
+			int byte_val = part.toInt(&ok, 16);
+			if (!ok || byte_val < 0 || byte_val > 255) {
+				QMessageBox::warning(this, tr("Search"),
+				                    tr("Invalid hex byte: %1").arg(part));
+				return;
+			}
+			pattern.value[pattern.length] = static_cast<uint8_t>(byte_val);
+			pattern.mask[pattern.length] = 0xff;
+			pattern.length++;
+		}
+		if (pattern.length != 0) {
+			query.pattern_count++;
+		}
 	}
 
-	if (pattern.isEmpty()) {
+	if (query.pattern_count == 0) {
 		QMessageBox::warning(this, tr("Search"), tr("No valid bytes to search for."));
 		return;
 	}
 
-	/* Search from current address + 1 */
-	uint32_t search_start = memory_current_address + 1;
-	const uint32_t search_size = 0x100000; /* Search 1MB at a time */
+	query.alignment = memory_search_aligned_checkbox->isChecked() ? 4 : 1;
+	query.max_hits = 10000;
 
-	QByteArray data;
-	bool ok = QMetaObject::invokeMethod(&emulator,
-	                                   "readMemory",
-	                                   Qt::BlockingQueuedConnection,
-	                                   Q_RETURN_ARG(QByteArray, data),
-	                                   Q_ARG(quint32, search_start),
-	                                   Q_ARG(quint32, search_size));
-	if (!ok || data.isEmpty()) {
-		QMessageBox::warning(this, tr("Search"), tr("Failed to read memory for search."));
+	memory_search_pattern_count = query.pattern_count;
+	memory_search_results->clear();
+	memory_search_status->setText(tr("Searching..."));
+	memory_search_button->setText(tr("Stop"));
+	memory_search_generation = memory_search->startSearch(query);
+}
+
+void
+MachineInspectorWindow::onMemorySearchHits(quint32 generation, QVector<quint32> addresses, QVector<quint32> patterns)
+{
+	if (generation != memory_search_generation) {
 		return;
 	}
+	for (int i = 0; i < addresses.size(); i++) {
+		QString text = QStringLiteral("0x%1").arg(addresses[i], 8, 16, QLatin1Char('0'));
+		if (memory_search_pattern_count > 1) {
+			text += tr("  pattern %1").arg(patterns[i] + 1);
+		}
 
-	int found_offset = data.indexOf(pattern);
-	if (found_offset >= 0) {
-		uint32_t found_address = search_start + static_cast<uint32_t>(found_offset);
-		refreshMemoryView(found_address);
-		QMessageBox::information(this, tr("Search"),
-		                        tr("Found at address 0x%1").arg(found_address, 8, 16, QLatin1Char('0')));
+		QListWidgetItem *item = new QListWidgetItem(text, memory_search_results);
+		item->setData(Qt::UserRole, addresses[i]);
+	}
+}
+
+void
+MachineInspectorWindow::onMemorySearchProgress(quint32 generation, quint64 scanned, quint64 total)
+{
+	if (generation != memory_search_generation || total == 0) {
+		return;
+	}
+	memory_search_status->setText(tr("Searching... %1% (%2 hits)")
+	                                  .arg(static_cast<int>((scanned * 100) / total))
+	                                  .arg(memory_search_results->count()));
+}
+
+void
+MachineInspectorWindow::onMemorySearchFinished(quint32 generation, qint64 hits, bool cancelled)
+{
+	if (generation != memory_search_generation) {
+		return;
+	}
+	memory_search_button->setText(tr("Find"));
+
+	if (cancelled) {
+		memory_search_status->setText(tr("Search stopped after %1 hits").arg(hits));
+	} else if (hits >= 10000) {
+		memory_search_status->setText(tr("Search stopped at the first %1 hits").arg(hits));
 	} else {
-		QMessageBox::information(this, tr("Search"),
-		                        tr("Pattern not found in the next %1 bytes.").arg(search_size));
+		memory_search_status->setText(tr("%1 hits").arg(hits));
+	}
+
+	if (memory_search_results->count() == 0) {
+		if (!cancelled) {
+			QMessageBox::information(this, tr("Search"), tr("Pattern not found."));
+		}
+		return;
+	}
+
+	/* Show the first hit after the current address, wrapping round */
+	int row = 0;
+	for (int i = 0; i < memory_search_results->count(); i++) {
+		if (memory_search_results->item(i)->data(Qt::UserRole).toUInt() > memory_current_address) {
+			row = i;
+			break;
+		}
 	}
+	memory_search_results->setCurrentRow(row);
+	refreshMemoryView(memory_search_results->item(row)->data(Qt::UserRole).toUInt());
 }
 
 void
@@ -1505,3 +1673,79 @@ MachineInspectorWindow::onMemoryCopy()
 		QGuiApplication::clipboard()->setText(text);
 	}
 }
+
+void
+MachineInspectorWindow::onDynprofRecordToggled(bool checked)
+{
+	QMetaObject::invokeMethod(&emulator,
+	                          "setDynarecProfiling",
+	                          Qt::BlockingQueuedConnection,
+	                          Q_ARG(bool, checked));
+	onDynprofRefresh();
+}
+
+void
+MachineInspectorWindow::onDynprofRefresh()
+{
+	QString report;
+	bool ok = QMetaObject::invokeMethod(&emulator,
+	                                   "dynarecProfileReport",
+	                                   Qt::BlockingQueuedConnection,
+	                                   Q_RETURN_ARG(QString, report),
+	                                   Q_ARG(int, 100));
+	if (ok) {
+		dynprof_view->setPlainText(report);
+	} else {
+		dynprof_view->setPlainText(tr("Failed to read the block profile"));
+	}
+}
+
+void
+MachineInspectorWindow::onDynprofReset()
+{
+	QMetaObject::invokeMethod(&emulator, "resetDynarecProfile", Qt::BlockingQueuedConnection);
+	onDynprofRefresh();
+}
+
+void
+MachineInspectorWindow::onDynprofExport()
+{
+	const QString path = QFileDialog::getSaveFileName(this, tr("Export Block Profile"),
+	                                                  QStringLiteral("dynarec-profile.json"),
+	                                                  tr("JSON files (*.json)"));
+	if (path.isEmpty()) {
+		return;
+	}
+
+	bool written = false;
+	bool ok = QMetaObject::invokeMethod(&emulator,
+	                                   "exportDynarecProfile",
+	                                   Qt::BlockingQueuedConnection,
+	                                   Q_RETURN_ARG(bool, written),
+	                                   Q_ARG(QString, path));
+	if (!ok || !written) {
+		QMessageBox::warning(this, tr("Export Block Profile"), tr("Failed to write %1").arg(path));
+	}
+}
+
+void
+MachineInspectorWindow::onDynprofDump()
+{
+	const QString path = QFileDialog::getSaveFileName(this, tr("Dump Block Code"),
+	                                                  QStringLiteral("dynarec-blocks.txt"),
+	                                                  tr("Text files (*.txt)"));
+	if (path.isEmpty()) {
+		return;
+	}
+
+	bool written = false;
+	bool ok = QMetaObject::invokeMethod(&emulator,
+	                                   "dumpDynarecCode",
+	                                   Qt::BlockingQueuedConnection,
+	                                   Q_RETURN_ARG(bool, written),
+	                                   Q_ARG(QString, path),
+	                                   Q_ARG(int, 200));
+	if (!ok || !written) {
+		QMessageBox::warning(this, tr("Dump Block Code"), tr("Failed to write %1").arg(path));
+	}
+}
@@ -31,6 +31,7 @@
 
 #include <QWidget>
 #include <QTimer>
+#include <QVector>
 
 #include "machine_snapshot.h"
 
@@ -45,6 +46,7 @@ class QSpinBox;
 class QTabWidget;
 
 class Emulator;
+class MemorySearch;
 
 class MachineInspectorWindow : public QWidget
 {
@@ -57,6 +59,7 @@ public:
 
 public slots:
 	void refreshSnapshot();
+	void applyTelemetry();
 	void setAutoRefresh(bool enabled);
 	void onRunClicked();
 	void onPauseClicked();
@@ -78,7 +81,15 @@ public slots:
 	void onMemoryJumpSP();
 	void onMemoryJumpPC();
 	void onMemorySearch();
+	void onMemorySearchHits(quint32 generation, QVector<quint32> addresses, QVector<quint32> patterns);
+	void onMemorySearchProgress(quint32 generation, quint64 scanned, quint64 total);
+	void onMemorySearchFinished(quint32 generation, qint64 hits, bool cancelled);
 	void onMemoryCopy();
+	void onDynprofRecordToggled(bool checked);
+	void onDynprofRefresh();
+	void onDynprofReset();
+	void onDynprofExport();
+	void onDynprofDump();
 
 private:
 	void applySnapshot(const MachineSnapshot &snapshot);
@@ -152,7 +163,19 @@ private:
 	QPushButton *memory_jump_pc_button;
 	QLineEdit *memory_search_input;
 	QPushButton *memory_search_button;
+	QCheckBox *memory_search_aligned_checkbox;
+	QListWidget *memory_search_results;
+	QLabel *memory_search_status;
+	MemorySearch *memory_search;
+	uint32_t memory_search_pattern_count;	/**< Patterns in the running or last search */
+	quint32 memory_search_generation;	/**< Of the running or last search; signals from others are dropped */
 	QPushButton *memory_copy_button;
+	QCheckBox *dynprof_record_checkbox;
+	QPushButton *dynprof_refresh_button;
+	QPushButton *dynprof_reset_button;
+	QPushButton *dynprof_export_button;
+	QPushButton *dynprof_dump_button;
+	QPlainTextEdit *dynprof_view;
 	uint32_t memory_current_address;
 	int memory_word_size;           /**< 1=bytes, 2=16-bit, 4=32-bit */
 	MachineSnapshot last_snapshot;  /**< Cached for quick jump to SP/PC */
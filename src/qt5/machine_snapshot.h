@@ -9,14 +9,24 @@
 #include "../peripheral_snapshot.h"
 
 /**
- * Lightweight view of the emulator state captured on the emulator thread
- * and marshalled to the GUI. All fields are POD types to simplify copying
+ * Lightweight view of the emulator state published by the emulator thread
+ * and copied by the GUI. All fields are POD types to simplify copying
  * between threads.
+ *
+ * The pipeline, superblock and peripheral sections cost more to gather, so
+ * they are only refreshed when a reader asks; detail_sequence says which
+ * publication last refreshed them.
  */
 typedef struct MachineSnapshot {
+    uint32_t sequence;          /**< Number of this publication */
+    uint32_t detail_sequence;   /**< Publication that last refreshed the detailed sections, 0 if none */
+
     char model_name[64];
     char cpu_name[64];
     int dynarec;                /**< Non-zero when dynarec core is active */
+    uint32_t dynarec_superblocks;        /**< Superblocks in the code cache */
+    uint32_t dynarec_superblocks_formed; /**< Superblocks built since start-up */
+    float dynarec_superblock_coverage;   /**< % of block entries into superblocks */
 
     uint32_t regs[16];          /**< General-purpose registers R0-R15 */
     uint32_t cpsr;              /**< Current program status register */
@@ -52,6 +62,8 @@ typedef struct MachineSnapshot {
     float perf_mhz;
     float perf_tlb_sec;
     float perf_flush_sec;
+    float perf_video_fps;       /**< Frames converted per second */
+    float perf_video_dropped;   /**< Frames dropped per second */
 
     uint32_t config_mem_size;   /**< RAM size in MB */
     uint32_t config_vram_size;  /**< VRAM size in MB */
@@ -53,6 +53,10 @@
 
 #include "serial_dialog.h"
 #include "parallel_dialog.h"
+#include "printer_dialog.h"
+#if defined(Q_OS_UNIX)
+#include "serial_host.h"
+#endif
 
 
 
@@ -63,6 +67,7 @@ MainDisplay::MainDisplay(Emulator &emulator, QWidget *parent)
     : QWidget(parent),
       emulator(emulator),
       double_size(VIDC_DOUBLE_NONE),
+      cursor_visible(false),
       full_screen(false),
       integer_scaling(false)
 {
@@ -187,6 +192,16 @@ MainDisplay::paintEvent(QPaintEvent *event)
 	} else {
 		painter.drawImage(dest, *image, source);
 	}
+
+	// Hardware cursor is overlaid, clipped to the emulated display
+	if (cursor_visible && !cursor_image.isNull()) {
+		const QRect target = cursor_rect();
+
+		if (target.intersects(dest)) {
+			painter.setClipRect(display_rect() & dest);
+			painter.drawImage(target, cursor_image);
+		}
+	}
 }
 
 void
@@ -296,6 +311,82 @@ MainDisplay::update_image(const QImage& img, int yl, int yh, int double_size)
 	}
 }
 
+/**
+ * Called from the emulator thread (via the GUI thread) when the hardware
+ * cursor changes shape or moves. Only the areas under the old and new
+ * cursor are repainted; the display image itself is untouched.
+ *
+ * @param cursor_update New cursor state
+ */
+void
+MainDisplay::update_cursor(const CursorUpdate& cursor_update)
+{
+	// Repaint where the cursor was (one pixel larger to cover smoothing)
+	if (cursor_visible) {
+		this->update(cursor_rect().adjusted(-1, -1, 1, 1));
+	}
+
+	if (cursor_update.shape_changed) {
+		cursor_image = cursor_update.image;
+	}
+	cursor_pos = QPoint(cursor_update.x, cursor_update.y);
+	cursor_visible = cursor_update.visible;
+
+	// ...and where it is now
+	if (cursor_visible) {
+		this->update(cursor_rect().adjusted(-1, -1, 1, 1));
+	}
+}
+
+/**
+ * Area of the widget covered by the emulated display.
+ *
+ * @return rectangle in widget coordinates
+ */
+QRect
+MainDisplay::display_rect() const
+{
+	if (full_screen || integer_scaling) {
+		return QRect(offset_x, offset_y, scaled_x, scaled_y);
+	}
+	return QRect(0, 0, host_xsize, host_ysize);
+}
+
+/**
+ * Area of the widget covered by the hardware cursor, taking into account
+ * pixel doubling and any full screen or integer scaling.
+ *
+ * @return rectangle in widget coordinates
+ */
+QRect
+MainDisplay::cursor_rect() const
+{
+	int x = cursor_pos.x();
+	int y = cursor_pos.y();
+	int width = cursor_image.width();
+	int height = cursor_image.height();
+
+	if (double_size & VIDC_DOUBLE_X) {
+		x *= 2;
+		width *= 2;
+	}
+	if (double_size & VIDC_DOUBLE_Y) {
+		y *= 2;
+		height *= 2;
+	}
+
+	if ((full_screen || integer_scaling) && host_xsize > 0 && host_ysize > 0) {
+		const int x1 = (x * scaled_x) / host_xsize;
+		const int y1 = (y * scaled_y) / host_ysize;
+		const int x2 = (((x + width) * scaled_x) + host_xsize - 1) / host_xsize;
+		const int y2 = (((y + height) * scaled_y) + host_ysize - 1) / host_ysize;
+
+		return QRect(offset_x + x1, offset_y + y1, x2 - x1, y2 - y1);
+	}
+
+	return QRect(x, y, width, height);
+}
+
 /**
  * Called to update the image scaling.
  *
@@ -373,6 +464,17 @@ MainDisplay::get_double_size()
 bool
 MainDisplay::save_screenshot(QString filename)
 {
+	// Composite the hardware cursor so the screenshot matches the display
+	if (cursor_visible && !cursor_image.isNull()) {
+		QImage screenshot = this->image->copy();
+		QPainter painter(&screenshot);
+
+		painter.drawImage(cursor_pos, cursor_image);
+		painter.end();
+
+		return screenshot.save(filename, "png");
+	}
+
 	return this->image->save(filename, "png");
 }
 
@@ -455,10 +557,15 @@ MainWindow::MainWindow(Emulator &emulator)
 	nat_list_dialog = new NatListDialog(emulator, this);
 	about_dialog = new AboutDialog(this);
 
+	// Attach the printer if it was left enabled
+	printer_dialog = new PrinterDialog(emulator, this);
+	printer_dialog->apply_settings();
+
 #ifdef RPCEMU_VNC
 	// VNC Server
 	vnc_server = new VncServer(&emulator, this);
 	g_vncServer = vnc_server;
+	vnc_server->setMaxFrameRate(config_copy.vnc_max_fps);
 	
 	// Auto-start VNC if enabled in config
 	if (config_copy.vnc_enabled) {
@@ -531,6 +638,7 @@ MainWindow::~MainWindow()
 #endif /* RPCEMU_NETWORKING */
 	delete configure_dialog;
 	delete about_dialog;
+	delete printer_dialog;
 }
 
 /**
@@ -1150,6 +1258,7 @@ MainWindow::menu_vnc_server()
 	if (config_copy.vnc_port == 0) {
 		config_copy.vnc_port = 5900;
 	}
+	config_copy.vnc_max_fps = vnc_server->getMaxFrameRate();
 	
 	// Save password from dialog
 	QByteArray pwdBytes = dialog.getPassword().toUtf8();
@@ -1168,14 +1277,94 @@ MainWindow::menu_serial()
 	if (!serial_dialog) {
 		serial_dialog = new SerialDialog(this);
 	}
-	
+
+#if defined(Q_OS_UNIX)
+	// Show the ports as they are now connected
+	for (int port = 0; port < 2; port++) {
+		const QString path = QString::fromUtf8(config_copy.serial_host_path[port]);
+		SerialPortSettings s;
+
+		s.mode = SerialPortMode::Disabled;
+		switch ((SerialHostType) config_copy.serial_host_type[port]) {
+		case SerialHost_None:
+			break;
+		case SerialHost_Pty:
+			s.mode = SerialPortMode::PseudoTerminal;
+			break;
+		case SerialHost_UnixSocket:
+			s.mode = SerialPortMode::UnixSocket;
+			s.socketPath = path;
+			break;
+		case SerialHost_File:
+			s.mode = SerialPortMode::LogToFile;
+			s.logFilePath = path;
+			break;
+		case SerialHost_Device:
+			s.mode = SerialPortMode::PhysicalDevice;
+			s.physicalDevice = path;
+			break;
+		}
+
+		if (port == 0) {
+			serial_dialog->setCom1Settings(s);
+		} else {
+			serial_dialog->setCom2Settings(s);
+		}
+	}
+#endif /* Q_OS_UNIX */
+
 	if (serial_dialog->exec() == QDialog::Accepted) {
-		// Settings are stored in the dialog for now
-		// In future, save to config and apply to serial bus
-		SerialPortSettings com1 = serial_dialog->getCom1Settings();
-		SerialPortSettings com2 = serial_dialog->getCom2Settings();
-		(void)com1;
-		(void)com2;
+#if defined(Q_OS_UNIX)
+		const SerialPortSettings settings[2] = {
+			serial_dialog->getCom1Settings(),
+			serial_dialog->getCom2Settings(),
+		};
+
+		for (int port = 0; port < 2; port++) {
+			const SerialPortSettings &s = settings[port];
+			SerialHostType type = SerialHost_None;
+			QString path;
+
+			switch (s.mode) {
+			case SerialPortMode::LogToFile:
+				type = SerialHost_File;
+				path = s.logFilePath;
+				break;
+			case SerialPortMode::PhysicalDevice:
+				type = SerialHost_Device;
+				path = s.physicalDevice;
+				break;
+			case SerialPortMode::PseudoTerminal:
+				type = SerialHost_Pty;
+				break;
+			case SerialPortMode::UnixSocket:
+				type = SerialHost_UnixSocket;
+				path = s.socketPath;
+				break;
+			case SerialPortMode::TcpModem:
+				rpclog("Serial: COM%d TCP modem mode is not supported yet\n", port + 1);
+				break;
+			case SerialPortMode::Disabled:
+				break;
+			}
+
+			// Leave a port that has not changed connected, rather than
+			// dropping its client and reopening it
+			QByteArray ba_path = path.toUtf8();
+			if (config_copy.serial_host_type[port] == (int) type &&
+			    strcmp(config_copy.serial_host_path[port], ba_path.constData()) == 0)
+			{
+				continue;
+			}
+
+			// Keep the GUI copy of the configuration in step
+			config_copy.serial_host_type[port] = type;
+			snprintf(config_copy.serial_host_path[port], sizeof(config_copy.serial_host_path[port]),
+			         "%s", ba_path.constData());
+
+			emit this->emulator.serial_config_updated_signal(port, type, path);
+		}
+#endif /* Q_OS_UNIX */
 	}
 }
 
@@ -1198,6 +1387,16 @@ MainWindow::menu_parallel()
 	}
 }
 
+/**
+ * Handle clicking on the Settings->Printer... option
+ * Opens the virtual printer dialog
+ */
+void
+MainWindow::menu_printer()
+{
+	printer_dialog->exec();
+}
+
 
 
 void
@@ -1521,6 +1720,8 @@ MainWindow::create_actions()
 	connect(serial_action, &QAction::triggered, this, &MainWindow::menu_serial);
 	parallel_action = new QAction(tr("Parallel..."), this);
 	connect(parallel_action, &QAction::triggered, this, &MainWindow::menu_parallel);
+	printer_action = new QAction(tr("Printer..."), this);
+	connect(printer_action, &QAction::triggered, this, &MainWindow::menu_printer);
 
 	cpu_idle_action = new QAction(tr("Reduce CPU Usage"), this);
 	cpu_idle_action->setCheckable(true);
@@ -1565,6 +1766,7 @@ MainWindow::create_actions()
 	connect(debug_step5_action, &QAction::triggered, this, &MainWindow::menu_debug_step5);
 
 	connect(this, &MainWindow::main_display_signal, this, &MainWindow::main_display_update, Qt::BlockingQueuedConnection);
+	connect(this, &MainWindow::cursor_update_signal, this, &MainWindow::cursor_update);
 //	connect(this, &MainWindow::main_display_signal, this, &MainWindow::main_display_update);
 	connect(this, &MainWindow::move_host_mouse_signal, this, &MainWindow::move_host_mouse);
 	connect(this, &MainWindow::send_nat_rule_to_gui_signal, this, &MainWindow::send_nat_rule_to_gui);
@@ -1693,6 +1895,7 @@ MainWindow::create_menus()
 	settings_menu->addSeparator();
 	settings_menu->addAction(serial_action);
 	settings_menu->addAction(parallel_action);
+	settings_menu->addAction(printer_action);
 	settings_menu->addSeparator();
 	settings_menu->addAction(cpu_idle_action);
 	settings_menu->addSeparator();
@@ -2309,11 +2512,7 @@ MainWindow::update_debugger_action_states()
 	}
 
 	MachineSnapshot snapshot;
-	bool ok = QMetaObject::invokeMethod(&emulator,
-	                                   "takeSnapshot",
-	                                   Qt::BlockingQueuedConnection,
-	                                   Q_RETURN_ARG(MachineSnapshot, snapshot));
-	if (!ok) {
+	if (!emulator.readTelemetry(snapshot)) {
 		return;
 	}
 
@@ -2366,6 +2565,17 @@ MainWindow::main_display_update(VideoUpdate video_update)
 	    video_update.double_size);
 }
 
+/**
+ * Received a hardware cursor change from the video thread
+ *
+ * @param cursor_update message struct containing the cursor shape and position
+ */
+void
+MainWindow::cursor_update(CursorUpdate cursor_update)
+{
+	display->update_cursor(cursor_update);
+}
+
 /**
  * Received a request from the emulator thread to position the host mouse pointer
  * Used in sections of Follows host mouse/mousehack code
@@ -2456,6 +2666,12 @@ MainWindow::mips_timer_timeout()
 	// Update global perf structure for Machine Inspector
 	perf.mips = (float) mips;
 
+	// Video frames converted and dropped over the last second
+	unsigned frames_converted, frames_dropped;
+	vidc_get_frame_stats(&frames_converted, &frames_dropped);
+	perf.video_fps = (float) frames_converted;
+	perf.video_dropped = (float) frames_dropped;
+
 	// Read (and zero atomically) the activity counters
 	const int fdc_ops = fdc_activity.fetchAndStoreRelease(0);
 	const int ide_ops = ide_activity.fetchAndStoreRelease(0);
@@ -56,6 +56,18 @@ struct VideoUpdate {
 	int		host_ysize;
 };
 
+/**
+ * Used to pass data from Emulator thread to GUI thread
+ * when the hardware cursor changes shape or moves
+ */
+struct CursorUpdate {
+	QImage		image;		///< New cursor shape, null if unchanged
+	int		x;		///< Top-left of cursor in VIDC pixels
+	int		y;
+	bool		visible;
+	bool		shape_changed;
+};
+
 /**
  * Used to pass data from Emulator thread to GUI thread
  * when in mousehack wants to move the host mouse
@@ -77,6 +89,7 @@ public:
 	void set_integer_scaling(bool integer_scaling);
 	bool get_integer_scaling() const;
 	void update_image(const QImage& img, int yl, int yh, int double_size);
+	void update_cursor(const CursorUpdate& cursor_update);
 	int get_double_size();
 	bool save_screenshot(QString filename);
 
@@ -90,12 +103,18 @@ protected:
 
 private:
 	void calculate_scaling();
+	QRect cursor_rect() const;
+	QRect display_rect() const;
 
 	Emulator &emulator;
 
 	QImage *image;
 	int double_size;
 
+	QImage cursor_image;		///< Hardware cursor, drawn over image
+	QPoint cursor_pos;		///< Top-left of cursor in VIDC pixels
+	bool cursor_visible;
+
 	bool full_screen;
 	bool integer_scaling;
 	int host_xsize, host_ysize;
@@ -152,6 +171,7 @@ private slots:
 #endif
 	void menu_serial();
 	void menu_parallel();
+	void menu_printer();
 
 	void menu_cpu_idle();
 	void menu_mouse_hack();
@@ -180,6 +200,7 @@ private slots:
 	void menu_aboutToHide();
 
 	void main_display_update(VideoUpdate video_update);
+	void cursor_update(CursorUpdate cursor_update);
 	void move_host_mouse(MouseMoveUpdate mouse_update);
 	void send_nat_rule_to_gui(PortForwardRule rule);
 	void on_machine_switched(QString machine_name);
@@ -190,6 +211,7 @@ private slots:
 	void application_state_changed(Qt::ApplicationState state);
 signals:
 	void main_display_signal(VideoUpdate video_update);
+	void cursor_update_signal(CursorUpdate cursor_update);
 	void move_host_mouse_signal(MouseMoveUpdate mouse_update);
 	void send_nat_rule_to_gui_signal(PortForwardRule rule);
 
@@ -281,6 +303,7 @@ private:
 #endif
 	QAction *serial_action;
 	QAction *parallel_action;
+	QAction *printer_action;
 
 	QAction *cpu_idle_action;
 	QAction *mouse_hack_action;
@@ -303,6 +326,7 @@ private:
  	MachineInspectorWindow *machine_inspector_window;
 	class SerialDialog *serial_dialog;
 	class ParallelDialog *parallel_dialog;
+	class PrinterDialog *printer_dialog;
 
 #ifdef RPCEMU_VNC
 	// VNC Server
@@ -0,0 +1,179 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * memory_search.cpp - Physical memory search on a worker thread
+ */
+
+#include "memory_search.h"
+
+#include <string.h>
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QReadLocker>
+#include <QReadWriteLock>
+#include <QSet>
+
+extern "C" {
+#include "rpcemu.h"
+}
+
+static QReadWriteLock layout_lock;		///< Held shared by searches, exclusively while memory moves
+static QMutex searches_mutex;			///< Guards 'searches'
+static QSet<MemorySearch *> searches;		///< Every MemorySearch in existence
+
+MemorySearch::MemorySearch(QObject *parent)
+    : QThread(parent),
+      generation(0),
+      cancel_requested(0),
+      last_progress(0)
+{
+	memset(&query, 0, sizeof(query));
+
+	qRegisterMetaType<QVector<quint32>>("QVector<quint32>");
+
+	QMutexLocker locker(&searches_mutex);
+	searches.insert(this);
+}
+
+MemorySearch::~MemorySearch()
+{
+	{
+		QMutexLocker locker(&searches_mutex);
+		searches.remove(this);
+	}
+	cancel();
+	wait();
+}
+
+/**
+ * Start a search, cancelling any this object is already running.
+ *
+ * @param new_query Patterns to search for; must pass mem_search_query_valid()
+ * @return Generation number carried by this search's signals
+ */
+quint32
+MemorySearch::startSearch(const MemSearchQuery &new_query)
+{
+	if (isRunning()) {
+		cancel();
+		wait();
+	}
+	query = new_query;
+	generation++;
+	cancel_requested.storeRelease(0);
+	start(QThread::LowPriority);
+	return generation;
+}
+
+/**
+ * Ask the search to stop at the end of the chunk it is scanning. Does not wait.
+ */
+void
+MemorySearch::cancel()
+{
+	cancel_requested.storeRelease(1);
+}
+
+/**
+ * Cancel every search in progress.
+ */
+void
+MemorySearch::cancelAll()
+{
+	QMutexLocker locker(&searches_mutex);
+
+	for (MemorySearch *search : searches) {
+		search->cancel();
+	}
+}
+
+void
+MemorySearch::run()
+{
+	QReadLocker locker(&layout_lock);
+	MemBank banks[MEM_MAX_BANKS];
+	int64_t hits = 0;
+
+	search_timer.start();
+	last_progress = 0;
+
+	if (cancel_requested.loadAcquire() == 0) {
+		const int bank_count = mem_get_banks(banks);
+
+		hits = mem_search(&query, banks, bank_count, &MemorySearch::searchCallback, this);
+	}
+
+	emit search_finished(generation, hits, cancel_requested.loadAcquire() != 0);
+}
+
+/**
+ * Called by mem_search() after each chunk, on the search thread.
+ */
+int
+MemorySearch::searchCallback(void *opaque, const MemSearchHit *hits, size_t count,
+                             uint64_t scanned, uint64_t total)
+{
+	MemorySearch *self = static_cast<MemorySearch *>(opaque);
+
+	if (count != 0) {
+		QVector<quint32> addresses(static_cast<int>(count));
+		QVector<quint32> patterns(static_cast<int>(count));
+
+		for (size_t i = 0; i < count; i++) {
+			addresses[static_cast<int>(i)] = hits[i].address;
+			patterns[static_cast<int>(i)] = hits[i].pattern;
+		}
+		emit self->hits_found(self->generation, addresses, patterns);
+	}
+
+	/* Progress every 100ms is plenty for a progress bar */
+	const qint64 now = self->search_timer.elapsed();
+	if (now - self->last_progress >= 100 || scanned == total) {
+		self->last_progress = now;
+		emit self->progress(self->generation, scanned, total);
+	}
+
+	return self->cancel_requested.loadAcquire() == 0;
+}
+
+/**
+ * Called by the emulator before RAM or ROM is reallocated or freed. Stops
+ * any memory search and keeps new ones waiting until
+ * rpcemu_mem_layout_unlock().
+ */
+extern "C" void
+rpcemu_mem_layout_lock(void)
+{
+	/* Keep cancelling, in case a search starts while we wait */
+	do {
+		MemorySearch::cancelAll();
+	} while (!layout_lock.tryLockForWrite(10));
+}
+
+/**
+ * Called by the emulator once RAM or ROM pointers are valid again.
+ */
+extern "C" void
+rpcemu_mem_layout_unlock(void)
+{
+	layout_lock.unlock();
+}
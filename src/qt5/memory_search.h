@@ -0,0 +1,80 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * memory_search.h - Physical memory search on a worker thread
+ *
+ * Runs mem_search() away from both the GUI and emulator threads. Hits and
+ * progress are signalled as they are found. A search holds a shared lock
+ * on the memory layout; the emulator takes it exclusively (through
+ * rpcemu_mem_layout_lock()) before reallocating RAM or ROM, which first
+ * cancels any search in progress.
+ *
+ * Every signal carries the generation number of the search that sent it.
+ * Signals are queued, so some from a cancelled search can still arrive
+ * after the next one has started; the receiver drops those.
+ */
+
+#ifndef MEMORY_SEARCH_H
+#define MEMORY_SEARCH_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QVector>
+
+extern "C" {
+#include "memsearch.h"
+}
+
+class MemorySearch : public QThread
+{
+	Q_OBJECT
+
+public:
+	explicit MemorySearch(QObject *parent = nullptr);
+	~MemorySearch() override;
+
+	quint32 startSearch(const MemSearchQuery &query);
+	void cancel();
+
+	static void cancelAll();
+
+signals:
+	/// Hits found since the last signal, in address order
+	void hits_found(quint32 generation, QVector<quint32> addresses, QVector<quint32> patterns);
+	void progress(quint32 generation, quint64 scanned, quint64 total);
+	void search_finished(quint32 generation, qint64 hits, bool cancelled);
+
+protected:
+	void run() override;
+
+private:
+	static int searchCallback(void *opaque, const MemSearchHit *hits, size_t count,
+	                          uint64_t scanned, uint64_t total);
+
+	MemSearchQuery query;
+	quint32 generation;		///< Of the running or last search; only changed while stopped
+	QAtomicInt cancel_requested;
+	qint64 last_progress;		///< When progress was last signalled, in ms since the search began
+	QElapsedTimer search_timer;
+};
+
+#endif /* MEMORY_SEARCH_H */
@@ -32,8 +32,9 @@ extern "C" {
 #include "printer.h"
 }
 
-PrinterDialog::PrinterDialog(QWidget *parent)
-    : QDialog(parent)
+PrinterDialog::PrinterDialog(Emulator &emulator, QWidget *parent)
+    : QDialog(parent),
+      emulator(emulator)
 {
 	setWindowTitle(tr("Printer Settings"));
 	setMinimumWidth(450);
@@ -58,9 +59,18 @@ PrinterDialog::PrinterDialog(QWidget *parent)
 	path_layout->addWidget(browse_button);
 	output_layout->addLayout(path_layout);
 
+	QHBoxLayout *command_layout = new QHBoxLayout();
+	QLabel *command_label = new QLabel(tr("Pipe to command:"));
+	output_command_edit = new QLineEdit();
+	output_command_edit->setPlaceholderText(tr("Leave empty to save to files (e.g. lpr)"));
+	command_layout->addWidget(command_label);
+	command_layout->addWidget(output_command_edit, 1);
+	output_layout->addLayout(command_layout);
+
 	QLabel *info_label = new QLabel(
-		tr("Print jobs will be saved as timestamped .prn files.\n"
-		   "These can be viewed with a PostScript viewer or converted to PDF."));
+		tr("Print jobs will be saved as timestamped .prn files, or sent to the\n"
+		   "standard input of the command if one is given. A job ends after\n"
+		   "a few seconds without data."));
 	info_label->setWordWrap(true);
 	info_label->setStyleSheet("color: #666;");
 	output_layout->addWidget(info_label);
@@ -71,9 +81,9 @@ PrinterDialog::PrinterDialog(QWidget *parent)
 	QGroupBox *status_group = new QGroupBox(tr("Current Status"));
 	QHBoxLayout *status_layout = new QHBoxLayout(status_group);
 
-	buffer_status_label = new QLabel(tr("Buffer: 0 bytes"));
+	buffer_status_label = new QLabel(tr("Current job: none"));
 	flush_button = new QPushButton(tr("Flush Now"));
-	flush_button->setToolTip(tr("Save any pending print data to file immediately"));
+	flush_button->setToolTip(tr("End the current print job immediately"));
 	status_layout->addWidget(buffer_status_label, 1);
 	status_layout->addWidget(flush_button);
 
@@ -118,9 +128,11 @@ PrinterDialog::load_settings()
 
 	bool enabled = settings.value("printer/enabled", false).toBool();
 	QString path = settings.value("printer/output_path", "").toString();
+	QString command = settings.value("printer/output_command", "").toString();
 
 	enabled_checkbox->setChecked(enabled);
 	output_path_edit->setText(path);
+	output_command_edit->setText(command);
 }
 
 void
@@ -130,19 +142,28 @@ PrinterDialog::save_settings()
 
 	settings.setValue("printer/enabled", enabled_checkbox->isChecked());
 	settings.setValue("printer/output_path", output_path_edit->text());
+	settings.setValue("printer/output_command", output_command_edit->text());
 }
 
+/**
+ * Send the settings shown in the dialog to the emulator thread, which
+ * attaches or detaches the printer
+ */
 void
 PrinterDialog::apply_settings()
 {
-	// Apply to printer module
-	if (enabled_checkbox->isChecked()) {
-		printer_set_output_mode(PrinterOutput_File);
+	PrinterOutputMode mode;
+
+	if (!enabled_checkbox->isChecked()) {
+		mode = PrinterOutput_Disabled;
+	} else if (!output_command_edit->text().trimmed().isEmpty()) {
+		mode = PrinterOutput_Command;
 	} else {
-		printer_set_output_mode(PrinterOutput_Disabled);
+		mode = PrinterOutput_File;
 	}
 
-	printer_set_output_path(output_path_edit->text().toUtf8().constData());
+	emit this->emulator.printer_config_updated_signal(mode, output_path_edit->text(),
+	                                                  output_command_edit->text().trimmed());
 }
 
 void
@@ -174,7 +195,7 @@ PrinterDialog::on_flush_clicked()
 	update_buffer_status();
 
 	QMessageBox::information(this, tr("Flush Print Buffer"),
-		tr("Saved %1 bytes to file.").arg(bytes));
+		tr("Ended print job of %1 bytes.").arg(bytes));
 }
 
 void
@@ -188,6 +209,8 @@ PrinterDialog::on_ok_clicked()
 void
 PrinterDialog::on_cancel_clicked()
 {
+	// Show the saved settings next time
+	load_settings();
 	reject();
 }
 
@@ -197,13 +220,13 @@ PrinterDialog::update_buffer_status()
 	size_t bytes = printer_get_buffer_size();
 	
 	if (bytes == 0) {
-		buffer_status_label->setText(tr("Buffer: empty"));
+		buffer_status_label->setText(tr("Current job: none"));
 		flush_button->setEnabled(false);
 	} else if (bytes < 1024) {
-		buffer_status_label->setText(tr("Buffer: %1 bytes").arg(bytes));
+		buffer_status_label->setText(tr("Current job: %1 bytes").arg(bytes));
 		flush_button->setEnabled(true);
 	} else {
-		buffer_status_label->setText(tr("Buffer: %1 KB").arg(bytes / 1024));
+		buffer_status_label->setText(tr("Current job: %1 KB").arg(bytes / 1024));
 		flush_button->setEnabled(true);
 	}
 }
@@ -26,15 +26,20 @@
 #include <QLineEdit>
 #include <QPushButton>
 #include <QLabel>
+#include <QTimer>
+
+#include "rpc-qt5.h"
 
 class PrinterDialog : public QDialog
 {
 	Q_OBJECT
 
 public:
-	PrinterDialog(QWidget *parent = nullptr);
+	PrinterDialog(Emulator &emulator, QWidget *parent = nullptr);
 	virtual ~PrinterDialog();
 
+	void apply_settings();
+
 private slots:
 	void on_browse_clicked();
 	void on_flush_clicked();
@@ -45,10 +50,12 @@ private slots:
 private:
 	void load_settings();
 	void save_settings();
-	void apply_settings();
+
+	Emulator &emulator;
 
 	QCheckBox *enabled_checkbox;
 	QLineEdit *output_path_edit;
+	QLineEdit *output_command_edit;
 	QPushButton *browse_button;
 	QLabel *buffer_status_label;
 	QPushButton *flush_button;
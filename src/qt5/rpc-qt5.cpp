@@ -34,6 +34,7 @@
 #include "main_window.h"
 #include "rpc-qt5.h"
 #include "config_selector_dialog.h"
+#include "machine_clone.h"
 
 #include <pthread.h>
 #include <sys/types.h>
@@ -42,6 +43,7 @@ extern "C" {
 #include "rpcemu.h"
 #include "arm.h"
 #include "arm_disasm.h"
+#include "dynprof.h"
 #include "mem.h"
 #include "sound.h"
 #include "vidc20.h"
@@ -56,6 +58,11 @@ extern "C" {
 #include "cmos.h"
 #include "romload.h"
 #include "hostfs.h"
+#include "replay.h"
+#include "printer.h"
+#if defined(Q_OS_UNIX)
+#include "serial_host.h"
+#endif
 }
 
 #ifdef RPCEMU_VNC
@@ -98,8 +105,11 @@ static pthread_mutex_t sound_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static pthread_t video_thread;
 static pthread_cond_t video_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t video_idle_cond = PTHREAD_COND_INITIALIZER;	///< Signalled when the video thread finishes a frame
 static pthread_mutex_t video_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+static const qint64 iomd_timer_interval = 2000000; ///< 2000000 ns = 2 ms (500 Hz)
+
 int mouse_captured = 0;		///< Have we captured the mouse in mouse capture mode
 Config *pconfig_copy = NULL;	///< Pointer to frontend copy of config
 
@@ -294,6 +304,7 @@ vidcthreadrunner(void *threadid)
 		}
 		if (!quited) {
 			vidcthread();
+			pthread_cond_broadcast(&video_idle_cond);
 		}
 	}
 
@@ -358,6 +369,9 @@ vidcstartthread(void)
 		fatal("Couldn't set vidc thread name");
 	}
 #endif // _GNU_SOURCE
+
+	// Large frames are converted in bands across the spare host cores
+	vidc_start_band_workers(QThread::idealThreadCount());
 }
 
 /**
@@ -399,6 +413,25 @@ vidctrymutex(void)
 	return 1;
 }
 
+/**
+ * Take the vidc mutex, waiting until the video thread has cleared *pending
+ * (i.e. finished the frame it was last given).
+ *
+ * @param pending Flag the video thread clears with the mutex held
+ */
+void
+vidcwaitmutex(const int *pending)
+{
+	if (pthread_mutex_lock(&video_mutex)) {
+		fatal("Getting vidc mutex failed");
+	}
+	while (*pending) {
+		if (pthread_cond_wait(&video_idle_cond, &video_mutex)) {
+			fatal("pthread_cond_wait failed");
+		}
+	}
+}
+
 void
 vidcreleasemutex(void)
 {
@@ -449,6 +482,67 @@ rpcemu_video_update(const uint32_t *buffer, int xsize, int ysize,
 	emit emulator->video_flyback_signal();
 }
 
+/**
+ * Tell the VNC server the screen mode has changed, so it drops any dirty
+ * row state from the previous mode
+ *
+ * Called from the video thread, before the first update in the new mode
+ */
+void
+rpcemu_video_mode_changed(void)
+{
+#ifdef RPCEMU_VNC
+	if (g_vncServer) {
+		g_vncServer->resetFrame();
+	}
+#endif
+}
+
+/**
+ * Send the hardware cursor to the GUI and VNC server, which draw it over
+ * the display rather than having it composited into the framebuffer
+ *
+ * Called from the video thread, only when the cursor has changed
+ *
+ * @param image         ARGB cursor data, colour 0 is transparent
+ * @param width         Width of cursor in pixels
+ * @param height        Height of cursor in pixels, 0 if hidden
+ * @param x             X coordinate of top-left of cursor
+ * @param y             Y coordinate of top-left of cursor
+ * @param activex       X offset of the pointer active point within the cursor
+ * @param activey       Y offset of the pointer active point within the cursor
+ * @param shape_changed Non-zero if the image differs from the last call
+ */
+void
+rpcemu_video_cursor(const uint32_t *image, int width, int height, int x, int y,
+                    int activex, int activey, int shape_changed)
+{
+	CursorUpdate cursor_update;
+
+	// The video thread reuses its buffer, so the GUI gets its own copy
+	if (shape_changed && height > 0) {
+		cursor_update.image = QImage((const uchar *) image, width, height,
+		    QImage::Format_ARGB32).copy();
+	}
+	cursor_update.x = x;
+	cursor_update.y = y;
+	cursor_update.visible = (height > 0);
+	cursor_update.shape_changed = (shape_changed != 0);
+
+	emit pMainWin->cursor_update_signal(cursor_update);
+
+#ifdef RPCEMU_VNC
+	// Stored even while stopped, so the server starts with the current shape
+	if (g_vncServer) {
+		g_vncServer->updateCursor(image, width, height, x, y, activex, activey,
+		    shape_changed != 0);
+	}
+#else
+	NOT_USED(activex);
+	NOT_USED(activey);
+#endif
+}
+
 /**
  * Prepare and send a message from the emulator thread to the GUI
  * thread that we want to move the host OS mouse pointer
@@ -495,16 +589,55 @@ rpcemu_idle_process_events(void)
 }
 
 /**
- * Helper function to allow reading of the nanosecond timer
+ * Helper function to allow reading of the nanosecond timer that drives the
+ * emulated machine. While recording or replaying, it only moves on at
+ * timer events.
  */
 uint64_t
 rpcemu_nsec_timer_ticks(void)
+{
+	if (replay_mode != ReplayMode_Off) {
+		return (uint64_t) replay_clock;
+	}
+	return (uint64_t) emulator->get_emulated_time();
+}
+
+/**
+ * Helper function to read the host's nanosecond timer, for measuring how
+ * long things take
+ */
+uint64_t
+rpcemu_nsec_host_ticks(void)
 {
 	return (uint64_t) emulator->get_elapsed_timer();
 }
 
 } // extern "C"
 
+/**
+ * Print the command line options to stderr
+ *
+ * @param program Program name, argv[0]
+ */
+static void
+usage(const char *program)
+{
+	fprintf(stderr,
+	        "Usage: %s [options]\n"
+	        "       %s --provision <machine> <new name> [count]\n"
+	        "\n"
+	        "  --provision         Clone <machine> as <new name>, or count times as\n"
+	        "                      <new name>-1 to <new name>-<count>, without the GUI;\n"
+	        "                      must be the first option\n"
+	        "  --record <file>     Record the session, from power-on, to <file>\n"
+	        "  --replay <file>     Replay a recorded session; the machine chosen must\n"
+	        "                      match the one it was recorded on\n"
+	        "  --fast-forward      With --replay, run as fast as possible rather than\n"
+	        "                      at the recorded pace\n"
+	        "  --help              Show this message\n",
+	        program, program);
+}
+
 /**
  * Program entry point
  *
@@ -518,6 +651,40 @@ int main (int argc, char ** argv)
 //		return 1;
 //	}
 
+	const char *record_path = NULL;
+	const char *replay_path = NULL;
+	int fast_forward = 0;
+
+	// Clone machines from the command line, without the GUI
+	if (argc >= 2 && strcmp(argv[1], "--provision") == 0) {
+		return machine_provision_main(argc, argv);
+	}
+
+	// Record a session, or replay one: '--record <file>', '--replay <file> [--fast-forward]'
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			record_path = argv[++i];
+		} else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			replay_path = argv[++i];
+		} else if (strcmp(argv[i], "--fast-forward") == 0) {
+			fast_forward = 1;
+		} else if (strcmp(argv[i], "--help") == 0) {
+			usage(argv[0]);
+			return 0;
+		} else if (strcmp(argv[i], "--record") == 0 || strcmp(argv[i], "--replay") == 0) {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (record_path != NULL && replay_path != NULL) {
+		fprintf(stderr, "--record and --replay cannot be used together\n");
+		return 1;
+	}
+	if (fast_forward && replay_path == NULL) {
+		fprintf(stderr, "--fast-forward only applies to --replay\n");
+		return 1;
+	}
+
 	// Initialise QT app
 	QApplication app(argc, argv);
 
@@ -544,6 +711,7 @@ int main (int argc, char ** argv)
 	// Allow additional types to be passed in slots and signals
 	qRegisterMetaType<Model>("Model");
 	qRegisterMetaType<VideoUpdate>("VideoUpdate");
+	qRegisterMetaType<CursorUpdate>("CursorUpdate");
 	qRegisterMetaType<MouseMoveUpdate>("MouseMoveUpdate");
 	qRegisterMetaType<NetworkType>("NetworkType");
 	qRegisterMetaType<PortForwardRule>("PortForwardRule");
@@ -572,6 +740,14 @@ int main (int argc, char ** argv)
 	// in the GUI
 	gui_thread = QThread::currentThread();
 
+	// Recording and replay cover the machine from power-on
+	if (record_path != NULL && !replay_record_start(record_path)) {
+		return 1;
+	}
+	if (replay_path != NULL && !replay_play_start(replay_path, fast_forward)) {
+		return 1;
+	}
+
 	// Initialise emulator system
 	rpcemu_start();
 
@@ -631,15 +807,34 @@ Emulator::Emulator()
 	connect(this, &Emulator::nat_rule_add_signal, this, &Emulator::nat_rule_add);
 	connect(this, &Emulator::nat_rule_edit_signal, this, &Emulator::nat_rule_edit);
 	connect(this, &Emulator::nat_rule_remove_signal, this, &Emulator::nat_rule_remove);
+#if defined(Q_OS_UNIX)
+	connect(this, &Emulator::serial_config_updated_signal, this, &Emulator::serial_config_updated);
+#endif // unix
+	connect(this, &Emulator::printer_config_updated_signal, this, &Emulator::printer_config_updated);
+
+	telemetry_next = 0;
+	telemetry_sequence = 0;
+	memset(&telemetry_staging, 0, sizeof(telemetry_staging));
+
+	clock_offset = 0;
+	replay_dispatching = false;
 
 	elapsed_timer.start();
 }
 
-MachineSnapshot
-Emulator::takeSnapshot()
+/**
+ * Publish the machine state for other threads to read with readTelemetry().
+ * Called on the emulator thread only.
+ *
+ * @param detail Also refresh the pipeline, superblock and peripheral
+ *               sections; otherwise they keep their previous contents
+ */
+void
+Emulator::publish_telemetry(bool detail)
 {
-	MachineSnapshot snapshot;
-	memset(&snapshot, 0, sizeof(snapshot));
+	MachineSnapshot &snapshot = telemetry_staging;
+
+	snapshot.sequence = ++telemetry_sequence;
 
 	const Model_Details *details = NULL;
 	if (machine.model >= 0 && machine.model < Model_MAX) {
@@ -666,12 +861,6 @@ Emulator::takeSnapshot()
 	const uint32_t pc = PC;
 	snapshot.pc = pc;
 
-	for (int i = 0; i < 8; i++) {
-		const uint32_t addr = (pc + (uint32_t) (i * 4)) & arm.r15_mask;
-		snapshot.pipeline_addr[i] = addr;
-		snapshot.pipeline_data[i] = mem_read32(addr);
-	}
-
 	snapshot.mmu_enabled = mmu;
 	snapshot.privileged_mode = ((arm.mode & 0x1f) != USER) ? 1 : 0;
 
@@ -698,6 +887,8 @@ Emulator::takeSnapshot()
 	snapshot.perf_mhz       = perf.mhz;
 	snapshot.perf_tlb_sec   = perf.tlb_sec;
 	snapshot.perf_flush_sec = perf.flush_sec;
+	snapshot.perf_video_fps     = perf.video_fps;
+	snapshot.perf_video_dropped = perf.video_dropped;
 
 	snapshot.config_mem_size  = config.mem_size;
 	snapshot.config_vram_size = config.vram_size;
@@ -741,17 +932,68 @@ Emulator::takeSnapshot()
 		       wp_count * sizeof(DebugWatchpointInfo));
 	}
 
-	vidc_get_snapshot(&snapshot.vidc);
-	int double_x = 0;
-	int double_y = 0;
-	vidc_get_doublesize(&double_x, &double_y);
-	snapshot.vidc_double_x = (uint8_t) double_x;
-	snapshot.vidc_double_y = (uint8_t) double_y;
-	superio_get_snapshot(&snapshot.superio);
-	ide_get_snapshot(&snapshot.ide);
-	podules_get_snapshot(&snapshot.podules);
+	if (detail) {
+		for (int i = 0; i < 8; i++) {
+			const uint32_t addr = (pc + (uint32_t) (i * 4)) & arm.r15_mask;
+			snapshot.pipeline_addr[i] = addr;
+			snapshot.pipeline_data[i] = mem_read32(addr);
+		}
+
+		if (snapshot.dynarec) {
+			SuperblockStats sb_stats;
 
-	return snapshot;
+			superblock_get_stats(&sb_stats);
+			snapshot.dynarec_superblocks = sb_stats.resident;
+			snapshot.dynarec_superblocks_formed = sb_stats.formed;
+			snapshot.dynarec_superblock_coverage = sb_stats.coverage;
+		}
+
+		vidc_get_snapshot(&snapshot.vidc);
+		int double_x = 0;
+		int double_y = 0;
+		vidc_get_doublesize(&double_x, &double_y);
+		snapshot.vidc_double_x = (uint8_t) double_x;
+		snapshot.vidc_double_y = (uint8_t) double_y;
+		superio_get_snapshot(&snapshot.superio);
+		ide_get_snapshot(&snapshot.ide);
+		podules_get_snapshot(&snapshot.podules);
+
+		snapshot.detail_sequence = snapshot.sequence;
+	}
+
+	telemetry.write(snapshot);
+}
+
+/**
+ * Publish telemetry if the publication interval has passed, or straight
+ * away if a reader has asked for the detailed sections.
+ *
+ * @param elapsed Current value of elapsed_timer
+ */
+void
+Emulator::poll_telemetry(qint64 elapsed)
+{
+	const qint64 telemetry_interval = 100000000; // 100000000 ns = 100 ms (10 Hz)
+	const bool detail = (telemetry_detail_wanted.loadAcquire() != 0) &&
+	                    (telemetry_detail_wanted.fetchAndStoreAcquire(0) != 0);
+
+	if (detail || elapsed >= telemetry_next) {
+		publish_telemetry(detail);
+		telemetry_next = elapsed + telemetry_interval;
+		if (detail) {
+			emit telemetry_detail_ready_signal();
+		}
+	}
+}
+
+/**
+ * Publish telemetry reflecting a debugger state change, then tell the GUI.
+ */
+void
+Emulator::notify_debugger_state_changed()
+{
+	publish_telemetry(false);
+	emit debugger_state_changed_signal();
 }
 
 /**
@@ -819,21 +1061,126 @@ Emulator::disassembleAt(quint32 address, int count)
 	return lines.join(QLatin1Char('\n'));
 }
 
+/**
+ * Start or stop the dynarec block profiler. Starting empties the code
+ * cache and clears any earlier profile.
+ *
+ * @param enable true to start recording
+ */
+void
+Emulator::setDynarecProfiling(bool enable)
+{
+	dynprof_set_enabled(enable ? 1 : 0);
+}
+
+/**
+ * Clear the dynarec block profile, leaving the profiler running or not.
+ */
+void
+Emulator::resetDynarecProfile()
+{
+	dynprof_reset();
+}
+
+/**
+ * Describe the dynarec block profile as text.
+ *
+ * @param count Number of blocks to list, most executed first
+ * @return Totals followed by one line per block
+ */
+QString
+Emulator::dynarecProfileReport(int count)
+{
+	DynProfSummary summary;
+	QStringList lines;
+
+	if (count < 1) {
+		count = 1;
+	}
+	if (count > 1000) {
+		count = 1000;
+	}
+
+	dynprof_get_summary(&summary);
+	lines << QStringLiteral("%1 | %2 blocks (%3 resident, %4 not recorded) | %5 compiles, %6 ms | %7 invalidations")
+	            .arg(dynprof_active ? QStringLiteral("Recording") : QStringLiteral("Stopped"))
+	            .arg(summary.blocks)
+	            .arg(summary.resident)
+	            .arg(summary.dropped)
+	            .arg(summary.compiles)
+	            .arg(static_cast<double>(summary.compile_ns) / 1e6, 0, 'f', 1)
+	            .arg(summary.invalidations);
+	lines << QStringLiteral("%1 block entries | %2 interpreter calls | %3 KB host code resident")
+	            .arg(summary.executions)
+	            .arg(summary.fallback_calls)
+	            .arg(static_cast<double>(summary.host_bytes) / 1024.0, 0, 'f', 1);
+	lines << QString();
+	lines << QStringLiteral("Address   Entries      Interp.calls  Compiles  Invalid.  Host bytes  Guest instrs");
+
+	QVector<DynProfBlock> blocks(count);
+	const size_t found = dynprof_get_blocks(blocks.data(), static_cast<size_t>(count));
+
+	for (size_t i = 0; i < found; i++) {
+		const DynProfBlock &b = blocks[static_cast<int>(i)];
+
+		lines << QStringLiteral("%1  %2  %3  %4  %5  %6  %7%8")
+		            .arg(b.pc, 8, 16, QLatin1Char('0'))
+		            .arg(b.executions, 11)
+		            .arg(b.fallback_calls, 12)
+		            .arg(b.compiles, 8)
+		            .arg(b.invalidations, 8)
+		            .arg(b.host_size, 10)
+		            .arg(b.instructions, 12)
+		            .arg(b.superblock ? QStringLiteral("  super") : QString());
+	}
+
+	return lines.join(QLatin1Char('\n'));
+}
+
+/**
+ * Write the dynarec block profile as JSON.
+ *
+ * @param path File to write
+ * @return true on success
+ */
+bool
+Emulator::exportDynarecProfile(const QString &path)
+{
+	return dynprof_export_json(QFile::encodeName(path).constData()) != 0;
+}
+
+/**
+ * Write the guest disassembly and host code of the most executed blocks.
+ *
+ * @param path       File to write
+ * @param max_blocks Most blocks to write, 0 for all
+ * @return true on success
+ */
+bool
+Emulator::dumpDynarecCode(const QString &path, int max_blocks)
+{
+	return dynprof_dump_code(QFile::encodeName(path).constData(),
+	                         static_cast<size_t>(max_blocks > 0 ? max_blocks : 0)) != 0;
+}
+
 /**
  * Main thread function of the Emulator thread
  */
 void
 Emulator::mainemuloop()
 {
-	const int32_t iomd_timer_interval = 2000000; // 2000000 ns = 2 ms (500 Hz)
 	video_timer_interval = 1000000000 / config.refresh;
 
-	iomd_timer_next = (qint64) iomd_timer_interval; // Time after which the IOMD timer should trigger
+	iomd_timer_next = iomd_timer_interval; // Time after which the IOMD timer should trigger
 	video_timer_next = (qint64) video_timer_interval;
+	telemetry_next = 0;
 
 	unsigned network_nat_rate = 0;
 	bool last_paused = debugger_is_paused();
 
+	// Anything arriving before the first run of guest code
+	event_point();
+
 	while (!quited) {
 		// Handle qt events and messages
 		QCoreApplication::processEvents();
@@ -841,15 +1188,16 @@ Emulator::mainemuloop()
 		const bool paused = debugger_is_paused();
 		if (paused) {
 			if (!last_paused) {
-				emit debugger_state_changed_signal();
+				notify_debugger_state_changed();
 				last_paused = true;
 			}
+			poll_telemetry(get_elapsed_timer());
 			QThread::msleep(1);
 			continue;
 		}
 
 		if (last_paused) {
-			emit debugger_state_changed_signal();
+			notify_debugger_state_changed();
 			last_paused = false;
 		}
 
@@ -858,7 +1206,7 @@ Emulator::mainemuloop()
 
 		if (debugger_is_paused()) {
 			if (!last_paused) {
-				emit debugger_state_changed_signal();
+				notify_debugger_state_changed();
 				last_paused = true;
 			}
 			continue;
@@ -866,35 +1214,31 @@ Emulator::mainemuloop()
 
 		// Handle windows networking receiving data
 #if defined(Q_OS_WIN32)
-		if (handle_sigio) {
+		if (handle_sigio && replay_mode != ReplayMode_Play) {
 			handle_sigio = 0;
 			sig_io(1);
 		}
 #endif // defined(Q_OS_WIN32);
-		
-		const qint64 elapsed = elapsed_timer.nsecsElapsed();
 
-		// If we have passed the time the IOMD timer event should occur, trigger it
-		if (elapsed >= iomd_timer_next) {
-			iomd_timer_count.fetchAndAddRelease(1);
-			gentimerirq(elapsed);
-			iomd_timer_next += (qint64) iomd_timer_interval;
-		}
+		// Trigger the timers, and anything else due before the next run of guest code
+		event_point();
 
-		// If we have passed the time the Video timer event should occur, trigger it
-		if (elapsed >= video_timer_next) {
-			video_timer_count.fetchAndAddRelease(1);
-			vblupdate();
-			video_timer_next += (qint64) video_timer_interval;
-		}
+		poll_telemetry(get_elapsed_timer());
 
 		// If the instruction count is greater than or equal to 0x20000, update the shared counter
 		// 'instruction_count' is in multiples of 65536
 		if (inscount >= 0x20000) {
 			instruction_count.fetchAndAddRelease((int) (inscount >> 16));
+			replay_inscount_base += inscount & ~0xffffu;
 			inscount &= 0xffff;
 		}
 
+		// When replaying, the network backend is left alone; the log
+		// holds everything it gave the guest
+		if (replay_mode == ReplayMode_Play) {
+			continue;
+		}
+
 		// If NAT networking, poll, but not too often
 		if (config.network_type == NetworkType_NAT) {
 			network_nat_rate++;
@@ -902,6 +1246,12 @@ Emulator::mainemuloop()
 				network_nat_poll();
 			}
 		}
+#if defined(Q_OS_LINUX)
+		// Raise the IRQ for frames queued by the TAP receive thread
+		else if (config.network_type != NetworkType_Off) {
+			network_plt_poll();
+		}
+#endif // defined(Q_OS_LINUX)
 	}
 
 	// Perform clean-up and finalising actions
@@ -916,26 +1266,155 @@ Emulator::mainemuloop()
 void
 Emulator::idle_process_events()
 {
-	const int32_t iomd_timer_interval = 2000000; // 2000000 ns = 2 ms (500 Hz)
+	// Trigger the timers, and anything else due
+	event_point();
 
 	// Handle qt events and messages
 	QCoreApplication::processEvents();
 
-	const qint64 elapsed = elapsed_timer.nsecsElapsed();
+	poll_telemetry(get_elapsed_timer());
+}
+
+/**
+ * Called wherever the emulator thread is between runs of guest code. Marks
+ * an event point for recording and replay, then triggers the IOMD and
+ * video timers if they are due, or when replaying, whatever the log has
+ * for this point. Input and flyback signals handled by the following
+ * processEvents() belong to the same point.
+ */
+void
+Emulator::event_point()
+{
+	replay_event_point();
+
+	if (replay_mode == ReplayMode_Play) {
+		replay_dispatch();
+		return;
+	}
+
+	const qint64 elapsed = get_emulated_time();
 
 	// If we have passed the time the IOMD timer event should occur, trigger it
 	if (elapsed >= iomd_timer_next) {
 		iomd_timer_count.fetchAndAddRelease(1);
+		if (replay_mode == ReplayMode_Record) {
+			replay_clock = elapsed;
+			replay_record(ReplayEvent_Timer, elapsed, 0, 0);
+		}
 		gentimerirq(elapsed);
-		iomd_timer_next += (qint64) iomd_timer_interval;
+		iomd_timer_next += iomd_timer_interval;
 	}
 
 	// If we have passed the time the Video timer event should occur, trigger it
 	if (elapsed >= video_timer_next) {
 		video_timer_count.fetchAndAddRelease(1);
+		replay_record(ReplayEvent_VSync, elapsed, 0, 0);
 		vblupdate();
 		video_timer_next += (qint64) video_timer_interval;
 	}
+
+	// A network interrupt the backend raised since the last point
+	if (replay_mode == ReplayMode_Record && replay_take_network_irq()) {
+		replay_record(ReplayEvent_NetworkIRQ, elapsed, 0, 0);
+		network_irq_deliver();
+	}
+}
+
+/**
+ * Apply the events the log has for this event point. Unless fast-forwarding,
+ * waits until each is due on the host clock, so the replay runs at the
+ * pace it was recorded at.
+ */
+void
+Emulator::replay_dispatch()
+{
+	ReplayEvent event;
+	int result;
+
+	while ((result = replay_next_due(&event)) > 0) {
+		if (!replay_fast_forward) {
+			const qint64 ahead = event.time - get_elapsed_timer();
+
+			if (ahead > 0) {
+				QThread::usleep((unsigned long) (ahead / 1000));
+			}
+		}
+
+		replay_dispatching = true;
+
+		switch (event.type) {
+		case ReplayEvent_Timer:
+			iomd_timer_count.fetchAndAddRelease(1);
+			replay_clock = event.time;
+			gentimerirq((uint64_t) event.time);
+			break;
+		case ReplayEvent_VSync:
+			video_timer_count.fetchAndAddRelease(1);
+			vblupdate();
+			break;
+		case ReplayEvent_Flyback:
+			video_flyback();
+			break;
+		case ReplayEvent_KeyPress:
+			key_press((unsigned) event.a);
+			break;
+		case ReplayEvent_KeyRelease:
+			key_release((unsigned) event.a);
+			break;
+		case ReplayEvent_MouseMove:
+			mouse_move(event.a, event.b);
+			break;
+		case ReplayEvent_MouseMoveRelative:
+			mouse_move_relative(event.a, event.b);
+			break;
+		case ReplayEvent_MousePress:
+			mouse_press(event.a);
+			break;
+		case ReplayEvent_MouseRelease:
+			mouse_release(event.a);
+			break;
+		case ReplayEvent_MouseWheel:
+			mouse_wheel(event.a);
+			break;
+		case ReplayEvent_NetworkIRQ:
+			network_irq_deliver();
+			break;
+		case ReplayEvent_Reset:
+			reset();
+			break;
+		default:
+			break;
+		}
+
+		replay_dispatching = false;
+	}
+
+	if (result < 0) {
+		// Finished: carry on live from the emulated time reached, which
+		// is ahead of the host's if fast-forwarded
+		clock_offset = replay_clock - elapsed_timer.nsecsElapsed();
+		iomd_timer_next = replay_clock + iomd_timer_interval;
+		video_timer_next = replay_clock + (qint64) video_timer_interval;
+	}
+}
+
+/**
+ * Check whether input from the GUI (or another source the guest cannot
+ * predict) should be applied, and log it if recording.
+ *
+ * @param type Event
+ * @param a    Event dependent
+ * @param b    Event dependent
+ * @return false if replaying, when only the logged input is applied
+ */
+bool
+Emulator::replay_input(int type, int32_t a, int32_t b)
+{
+	if (replay_mode == ReplayMode_Play) {
+		return replay_dispatching;
+	}
+	replay_record((ReplayEventType) type, get_emulated_time(), a, b);
+	return true;
 }
 
 /**
@@ -946,6 +1425,9 @@ Emulator::idle_process_events()
 void
 Emulator::video_flyback()
 {
+	if (!replay_input(ReplayEvent_Flyback, 0, 0)) {
+		return;
+	}
 	iomd_flyback(1);
 }
 
@@ -957,6 +1439,10 @@ Emulator::video_flyback()
 void
 Emulator::key_press(unsigned scan_code)
 {
+	if (!replay_input(ReplayEvent_KeyPress, (int32_t) scan_code, 0)) {
+		return;
+	}
+
 	const uint8_t *scan_codes = keyboard_map_key(scan_code);
 	if (scan_codes == NULL) {
 		rpclog("Unknown keyboard mapping for host keycode 0x%08x\n", scan_code);
@@ -972,6 +1458,10 @@ Emulator::key_press(unsigned scan_code)
 void
 Emulator::key_release(unsigned scan_code)
 {
+	if (!replay_input(ReplayEvent_KeyRelease, (int32_t) scan_code, 0)) {
+		return;
+	}
+
 	const uint8_t *scan_codes = keyboard_map_key(scan_code);
 
 	// Break key has no release code
@@ -991,6 +1481,9 @@ Emulator::key_release(unsigned scan_code)
 void
 Emulator::mouse_move(int x, int y)
 {
+	if (!replay_input(ReplayEvent_MouseMove, x, y)) {
+		return;
+	}
 	mouse_mouse_move(x, y);
 }
 /**
@@ -1002,6 +1495,9 @@ Emulator::mouse_move(int x, int y)
 void
 Emulator::mouse_move_relative(int dx, int dy)
 {
+	if (!replay_input(ReplayEvent_MouseMoveRelative, dx, dy)) {
+		return;
+	}
 	mouse_mouse_move_relative(dx, dy);
 }
 
@@ -1013,6 +1509,9 @@ Emulator::mouse_move_relative(int dx, int dy)
 void
 Emulator::mouse_press(int buttons)
 {
+	if (!replay_input(ReplayEvent_MousePress, buttons, 0)) {
+		return;
+	}
 	mouse_mouse_press(buttons);
 }
 
@@ -1024,6 +1523,9 @@ Emulator::mouse_press(int buttons)
 void
 Emulator::mouse_release(int buttons)
 {
+	if (!replay_input(ReplayEvent_MouseRelease, buttons, 0)) {
+		return;
+	}
 	mouse_mouse_release(buttons);
 }
 
@@ -1035,6 +1537,9 @@ Emulator::mouse_release(int buttons)
 void
 Emulator::mouse_wheel(int dy)
 {
+	if (!replay_input(ReplayEvent_MouseWheel, dy, 0)) {
+		return;
+	}
 	podulerom_mouse_wheel_change(dy);
 }
 
@@ -1044,6 +1549,10 @@ Emulator::mouse_wheel(int dy)
 void
 Emulator::reset()
 {
+	if (!replay_input(ReplayEvent_Reset, 0, 0)) {
+		return;
+	}
+
 	// Obtain the Video mutex, to ensure the Video thread is idle
 	pthread_mutex_lock(&video_mutex);
 
@@ -1140,6 +1649,9 @@ Emulator::switch_machine(QString config_path)
 	char old_rom_dir[512];
 	
 	rpclog("RPCEmu: Switching machine to: %s\n", config_path.toUtf8().constData());
+
+	// A recording or replay only covers one machine
+	replay_stop();
 	
 	// Save current CMOS before switching
 	savecmos();
@@ -1169,6 +1681,11 @@ Emulator::switch_machine(QString config_path)
 	
 	// Full system reset with new configuration
 	resetrpc();
+
+#if defined(Q_OS_UNIX)
+	// Reconnect the serial ports as the new machine has them
+	serial_host_start();
+#endif
 	
 	// Notify GUI of the machine switch so it can update window title etc.
 	emit machine_switched_signal(QString::fromUtf8(config.name));
@@ -1269,6 +1786,59 @@ Emulator::cdrom_load_iso(QString discname)
 	iso_open(config.isoname);
 }
 
+#if defined(Q_OS_UNIX)
+/**
+ * GUI has changed the host connection of a serial port
+ *
+ * @param port Serial port (SerialPortID)
+ * @param type Kind of host backend (SerialHostType)
+ * @param path Socket, file or device path
+ */
+void
+Emulator::serial_config_updated(int port, int type, QString path)
+{
+	QByteArray ba_path = path.toUtf8();
+
+	// Host serial data is not in the log, so it cannot join a recording or replay
+	if (replay_mode != ReplayMode_Off && type != SerialHost_None) {
+		error("COM%d cannot be connected to the host while recording or replaying", port + 1);
+		return;
+	}
+
+	config.serial_host_type[port] = type;
+	snprintf(config.serial_host_path[port], sizeof(config.serial_host_path[port]), "%s", ba_path.constData());
+
+	// Save the settings to the rpc.cfg file
+	config_save(&config);
+
+	if (serial_host_open((SerialPortID) port, (SerialHostType) type, ba_path.constData()) != 0) {
+		error("Could not connect COM%d to '%s'", port + 1, ba_path.constData());
+	}
+}
+#endif /* unix */
+
+/**
+ * GUI has changed the printer settings. The printer is on LPT1 while it
+ * is enabled, and the port has nothing attached while it is disabled.
+ *
+ * @param mode    Output mode (PrinterOutputMode)
+ * @param path    Directory print jobs are written to
+ * @param command Command print jobs are piped to
+ */
+void
+Emulator::printer_config_updated(int mode, QString path, QString command)
+{
+	printer_set_output_path(path.toUtf8().constData());
+	printer_set_output_command(command.toUtf8().constData());
+	printer_set_output_mode((PrinterOutputMode) mode);
+
+	if (mode == PrinterOutput_Disabled) {
+		printer_detach();
+	} else if (printer_get_port() < 0) {
+		printer_attach(PARALLEL_PORT_LPT1);
+	}
+}
+
 #if defined(Q_OS_LINUX)
 /**
  * GUI wants to use Linux real cdrom drive
@@ -1448,21 +2018,21 @@ void
 Emulator::debugger_pause()
 {
 	::debugger_request_pause(DebugPauseReason_User);
-	emit debugger_state_changed_signal();
+	notify_debugger_state_changed();
 }
 
 void
 Emulator::debugger_resume()
 {
 	::debugger_resume();
-	emit debugger_state_changed_signal();
+	notify_debugger_state_changed();
 }
 
 void
 Emulator::debugger_step()
 {
 	::debugger_single_step(1);
-	emit debugger_state_changed_signal();
+	notify_debugger_state_changed();
 }
 
 void
@@ -1472,14 +2042,14 @@ Emulator::debugger_step_n(quint32 instruction_count)
 		instruction_count = 1;
 	}
 	::debugger_single_step(instruction_count);
-	emit debugger_state_changed_signal();
+	notify_debugger_state_changed();
 }
 
 void
 Emulator::debugger_add_breakpoint(quint32 address)
 {
 	if (::debugger_add_breakpoint(address)) {
-		emit debugger_state_changed_signal();
+		notify_debugger_state_changed();
 	}
 }
 
@@ -1487,7 +2057,7 @@ void
 Emulator::debugger_remove_breakpoint(quint32 address)
 {
 	if (::debugger_remove_breakpoint(address)) {
-		emit debugger_state_changed_signal();
+		notify_debugger_state_changed();
 	}
 }
 
@@ -1495,14 +2065,14 @@ void
 Emulator::debugger_clear_breakpoints()
 {
 	::debugger_clear_breakpoints();
-	emit debugger_state_changed_signal();
+	notify_debugger_state_changed();
 }
 
 void
 Emulator::debugger_add_watchpoint(quint32 address, quint32 size, bool on_read, bool on_write)
 {
 	if (::debugger_add_watchpoint(address, size, on_read ? 1 : 0, on_write ? 1 : 0)) {
-		emit debugger_state_changed_signal();
+		notify_debugger_state_changed();
 	}
 }
 
@@ -1510,7 +2080,7 @@ void
 Emulator::debugger_remove_watchpoint(quint32 address, quint32 size, bool on_read, bool on_write)
 {
 	if (::debugger_remove_watchpoint(address, size, on_read ? 1 : 0, on_write ? 1 : 0)) {
-		emit debugger_state_changed_signal();
+		notify_debugger_state_changed();
 	}
 }
 
@@ -1518,7 +2088,7 @@ void
 Emulator::debugger_clear_watchpoints()
 {
 	::debugger_clear_watchpoints();
-	emit debugger_state_changed_signal();
+	notify_debugger_state_changed();
 }
 
 #ifdef __cplusplus
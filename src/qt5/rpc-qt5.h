@@ -28,6 +28,7 @@
 
 #include "rpcemu.h"
 #include "machine_snapshot.h"
+#include "seqlock.h"
 
 /// Instruction counter shared between Emulator and GUI threads
 extern QAtomicInt instruction_count;
@@ -48,12 +49,26 @@ public:
 
 	void idle_process_events();
 
+	/// Nanoseconds since start-up on the host clock
 	int64_t get_elapsed_timer() const { return elapsed_timer.nsecsElapsed(); }
+	/// Nanoseconds on the emulated clock, which a fast-forwarded replay leaves ahead of the host clock
+	int64_t get_emulated_time() const { return elapsed_timer.nsecsElapsed() + clock_offset; }
+
+	/// Copy the latest machine state published by the emulator thread; never blocks
+	bool readTelemetry(MachineSnapshot &snapshot) const { return telemetry.read(snapshot); }
+	/// Ask for the pipeline and peripheral sections to be refreshed in the next publication
+	void requestTelemetryDetail() { telemetry_detail_wanted.storeRelease(1); }
 
-	Q_INVOKABLE MachineSnapshot takeSnapshot();
 	Q_INVOKABLE QByteArray readMemory(quint32 address, quint32 length);
 	Q_INVOKABLE QString disassembleAt(quint32 address, int count);
 
+	// Dynarec block profiler (dynprof.c)
+	Q_INVOKABLE void setDynarecProfiling(bool enable);
+	Q_INVOKABLE void resetDynarecProfile();
+	Q_INVOKABLE QString dynarecProfileReport(int count);
+	Q_INVOKABLE bool exportDynarecProfile(const QString &path);
+	Q_INVOKABLE bool dumpDynarecCode(const QString &path, int max_blocks);
+
 signals:
 	void finished();
 
@@ -94,6 +109,11 @@ signals:
 	void nat_rule_edit_signal(PortForwardRule old_rule, PortForwardRule new_rule);
 	void nat_rule_remove_signal(PortForwardRule rule);
 	void debugger_state_changed_signal();
+	void telemetry_detail_ready_signal();
+#if defined(Q_OS_UNIX)
+	void serial_config_updated_signal(int port, int type, QString path);
+#endif /* unix */
+	void printer_config_updated_signal(int mode, QString path, QString command);
 
 public slots:
 	void mainemuloop();
@@ -137,6 +157,10 @@ public slots:
 	void nat_rule_add(PortForwardRule rule);
 	void nat_rule_edit(PortForwardRule old_rule, PortForwardRule new_rule);
 	void nat_rule_remove(PortForwardRule rule);
+#if defined(Q_OS_UNIX)
+	void serial_config_updated(int port, int type, QString path);
+#endif /* unix */
+	void printer_config_updated(int mode, QString path, QString command);
 
 	// Debugger controls
 	void debugger_pause();
@@ -151,10 +175,24 @@ public slots:
 	void debugger_clear_watchpoints();
 
 private:
+	void poll_telemetry(qint64 elapsed);
+	void publish_telemetry(bool detail);
+	void notify_debugger_state_changed();
+	void event_point();
+	void replay_dispatch();
+	bool replay_input(int type, int32_t a, int32_t b);
+
 	QElapsedTimer elapsed_timer;
+	qint64 clock_offset;			///< Emulated clock minus host clock, set when a replay finishes
+	bool replay_dispatching;		///< Applying an event from a replay, rather than live input
 	int32_t video_timer_interval;		///< Interval between video timer events (in nanoseconds)
 	qint64 iomd_timer_next;			///< Time after which the IOMD timer should trigger
 	qint64 video_timer_next;		///< Time after which the video timer should trigger
+	qint64 telemetry_next;			///< Time after which telemetry should next be published
+	quint32 telemetry_sequence;		///< Number of the last telemetry publication
+	QAtomicInt telemetry_detail_wanted;	///< Set by readers wanting the detailed sections refreshed
+	MachineSnapshot telemetry_staging;	///< Built up on the emulator thread before publication
+	SeqLock<MachineSnapshot> telemetry;	///< Latest published machine state
 };
 
 #endif /* RPC_QT5_H */
@@ -29,7 +29,13 @@ HEADERS =	../superio.h \
 		../mem.h \
 		../sound.h \
 		../vidc20.h \
+		../fbexport.h \
+		../transcache.h \
+		../memsearch.h \
+		../dynprof.h \
+		../replay.h \
 		../arm_common.h \
+		../swi.h \
 		../arm.h \
 		../arm_disasm.h \
 		../disc.h \
@@ -39,20 +45,26 @@ HEADERS =	../superio.h \
 		main_window.h \
 		configure_dialog.h \
 		config_selector_dialog.h \
+		machine_clone.h \
 		about_dialog.h \
 		rpc-qt5.h \
 		plt_sound.h \
 		machine_snapshot.h \
+		seqlock.h \
 		machine_inspector_window.h \
+		memory_search.h \
 		../vnc_server.h \
 		vnc_dialog.h \
 		serial_dialog.h \
 		parallel_dialog.h \
+		printer_dialog.h \
 		../parallel.h \
+		../printer.h \
 		../serial.h
 
 SOURCES =	../superio.c \
 		../parallel.c \
+		../printer.c \
 		../serial.c \
 		../cdrom-iso.c \
 		../cmos.c \
@@ -68,11 +80,17 @@ SOURCES =	../superio.c \
 		../rpcemu.c \
 		../sound.c \
 		../vidc20.c \
+		../fbexport.c \
+		../transcache.c \
+		../memsearch.c \
+		../dynprof.c \
+		../replay.c \
 		../podules.c \
 		../podulerom.c \
 		../icside.c \
 		../rpc-machdep.c \
 		../arm_common.c \
+		../swi.c \
 		../arm_disasm.c \
 		../i8042.c \
 		../disc.c \
@@ -85,21 +103,26 @@ SOURCES =	../superio.c \
 		main_window.cpp \
 		configure_dialog.cpp \
 		config_selector_dialog.cpp \
+		machine_clone.cpp \
 		about_dialog.cpp \
 		plt_sound.cpp \
 		machine_inspector_window.cpp \
+		memory_search.cpp \
 		vnc_dialog.cpp \
 		serial_dialog.cpp \
-		parallel_dialog.cpp
+		parallel_dialog.cpp \
+		printer_dialog.cpp
 
 # NAT Networking
 linux | win32 {
 	HEADERS +=	../network-nat.h \
 			../broadcast_relay.h \
+			../packet_ring.h \
 			nat_edit_dialog.h \
 			nat_list_dialog.h
 	SOURCES += 	../network-nat.c \
 			../broadcast_relay.c \
+			../packet_ring.c \
 			nat_edit_dialog.cpp \
 			nat_list_dialog.cpp
 
@@ -187,7 +210,9 @@ linux {
 unix {
 	SOURCES +=	keyboard_x.c \
 			../hostfs-unix.c \
-			../rpc-linux.c
+			../rpc-linux.c \
+			../serial_host.c
+	DEFINES += RPCEMU_SERIAL_HOST
 }
 
 # Place exes in top level directory
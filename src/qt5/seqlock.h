@@ -0,0 +1,91 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <atomic>
+#include <string.h>
+
+#include <QAtomicInt>
+#include <QThread>
+
+/**
+ * A plain-data value published by one thread and copied by others, guarded
+ * by a sequence count instead of a lock. The writer never waits for
+ * readers; a reader whose copy overlapped a write notices the count has
+ * moved and copies again.
+ *
+ * T must be safe to copy with memcpy().
+ */
+template <typename T>
+class SeqLock {
+public:
+	SeqLock() : sequence(0)
+	{
+		memset(&value, 0, sizeof(value));
+	}
+
+	/**
+	 * Publish a new value. Only one thread may write.
+	 *
+	 * @param v Value to publish
+	 */
+	void write(const T &v)
+	{
+		const int seq = sequence.loadAcquire();
+
+		sequence.storeRelease(seq + 1);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(&value, &v, sizeof(value));
+		sequence.storeRelease(seq + 2);
+	}
+
+	/**
+	 * Copy the most recently published value.
+	 *
+	 * @param out Filled in with the value
+	 * @return false if nothing has been published yet, or if a write was
+	 *         overlapping every attempt (out is then undefined)
+	 */
+	bool read(T &out) const
+	{
+		for (int attempt = 0; attempt < 100; attempt++) {
+			const int seq = sequence.loadAcquire();
+
+			if (seq & 1) {
+				QThread::yieldCurrentThread();
+				continue;
+			}
+			memcpy(&out, &value, sizeof(out));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence.loadAcquire() == seq) {
+				return seq != 0;
+			}
+		}
+		return false;
+	}
+
+private:
+	QAtomicInt sequence;	///< Odd while a write is in progress
+	T value;
+};
+
+#endif /* SEQLOCK_H */
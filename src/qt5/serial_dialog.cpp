@@ -76,11 +76,15 @@ QGroupBox* SerialDialog::createPortGroup(const QString &title, int portIndex)
     QRadioButton *logfileRadio = new QRadioButton(tr("Log to File"), group);
     QRadioButton *tcpmodemRadio = new QRadioButton(tr("TCP Modem (AT commands)"), group);
     QRadioButton *physicalRadio = new QRadioButton(tr("Physical Device"), group);
+    QRadioButton *ptyRadio = new QRadioButton(tr("Pseudo-terminal (path shown in log)"), group);
+    QRadioButton *socketRadio = new QRadioButton(tr("Unix Socket"), group);
     
     modeGroup->addButton(disabledRadio, 0);
     modeGroup->addButton(logfileRadio, 1);
     modeGroup->addButton(tcpmodemRadio, 2);
     modeGroup->addButton(physicalRadio, 3);
+    modeGroup->addButton(ptyRadio, 4);
+    modeGroup->addButton(socketRadio, 5);
     
     disabledRadio->setChecked(true);
     
@@ -124,6 +128,23 @@ QGroupBox* SerialDialog::createPortGroup(const QString &title, int portIndex)
     physLayout->addStretch();
     layout->addLayout(physLayout);
     
+    // Pseudo-terminal option (the slave device is created when applied)
+    layout->addWidget(ptyRadio);
+    
+    // Unix socket options
+    QHBoxLayout *socketLayout = new QHBoxLayout();
+    socketLayout->addWidget(socketRadio);
+    QLineEdit *socketEdit = new QLineEdit(group);
+    socketEdit->setPlaceholderText(tr("Path to socket..."));
+    socketEdit->setEnabled(false);
+    socketLayout->addWidget(socketEdit);
+    layout->addLayout(socketLayout);
+    
+#ifdef Q_OS_WIN
+    ptyRadio->setEnabled(false);
+    socketRadio->setEnabled(false);
+#endif
+    
     // Store widget references
     if (portIndex == 1) {
         com1_mode_group = modeGroup;
@@ -131,7 +152,10 @@ QGroupBox* SerialDialog::createPortGroup(const QString &title, int portIndex)
         com1_logfile_radio = logfileRadio;
         com1_tcpmodem_radio = tcpmodemRadio;
         com1_physical_radio = physicalRadio;
+        com1_pty_radio = ptyRadio;
+        com1_socket_radio = socketRadio;
         com1_logfile_edit = logEdit;
+        com1_socket_edit = socketEdit;
         com1_browse_btn = browseBtn;
         com1_device_combo = deviceCombo;
         
@@ -144,7 +168,10 @@ QGroupBox* SerialDialog::createPortGroup(const QString &title, int portIndex)
         com2_logfile_radio = logfileRadio;
         com2_tcpmodem_radio = tcpmodemRadio;
         com2_physical_radio = physicalRadio;
+        com2_pty_radio = ptyRadio;
+        com2_socket_radio = socketRadio;
         com2_logfile_edit = logEdit;
+        com2_socket_edit = socketEdit;
         com2_browse_btn = browseBtn;
         com2_device_combo = deviceCombo;
         
@@ -162,6 +189,7 @@ void SerialDialog::onCom1ModeChanged()
     com1_logfile_edit->setEnabled(mode == 1);
     com1_browse_btn->setEnabled(mode == 1);
     com1_device_combo->setEnabled(mode == 3);
+    com1_socket_edit->setEnabled(mode == 5);
 }
 
 void SerialDialog::onCom2ModeChanged()
@@ -170,6 +198,7 @@ void SerialDialog::onCom2ModeChanged()
     com2_logfile_edit->setEnabled(mode == 1);
     com2_browse_btn->setEnabled(mode == 1);
     com2_device_combo->setEnabled(mode == 3);
+    com2_socket_edit->setEnabled(mode == 5);
 }
 
 void SerialDialog::onBrowseLogFile1()
@@ -197,6 +226,7 @@ SerialPortSettings SerialDialog::getCom1Settings() const
     settings.mode = static_cast<SerialPortMode>(mode);
     settings.logFilePath = com1_logfile_edit->text();
     settings.physicalDevice = com1_device_combo->currentText();
+    settings.socketPath = com1_socket_edit->text();
     return settings;
 }
 
@@ -207,6 +237,7 @@ SerialPortSettings SerialDialog::getCom2Settings() const
     settings.mode = static_cast<SerialPortMode>(mode);
     settings.logFilePath = com2_logfile_edit->text();
     settings.physicalDevice = com2_device_combo->currentText();
+    settings.socketPath = com2_socket_edit->text();
     return settings;
 }
 
@@ -225,8 +256,15 @@ void SerialDialog::setCom1Settings(const SerialPortSettings &settings)
     case SerialPortMode::PhysicalDevice:
         com1_physical_radio->setChecked(true);
         break;
+    case SerialPortMode::PseudoTerminal:
+        com1_pty_radio->setChecked(true);
+        break;
+    case SerialPortMode::UnixSocket:
+        com1_socket_radio->setChecked(true);
+        break;
     }
     com1_logfile_edit->setText(settings.logFilePath);
+    com1_socket_edit->setText(settings.socketPath);
     int idx = com1_device_combo->findText(settings.physicalDevice);
     if (idx >= 0) {
         com1_device_combo->setCurrentIndex(idx);
@@ -251,8 +289,15 @@ void SerialDialog::setCom2Settings(const SerialPortSettings &settings)
     case SerialPortMode::PhysicalDevice:
         com2_physical_radio->setChecked(true);
         break;
+    case SerialPortMode::PseudoTerminal:
+        com2_pty_radio->setChecked(true);
+        break;
+    case SerialPortMode::UnixSocket:
+        com2_socket_radio->setChecked(true);
+        break;
     }
     com2_logfile_edit->setText(settings.logFilePath);
+    com2_socket_edit->setText(settings.socketPath);
     int idx = com2_device_combo->findText(settings.physicalDevice);
     if (idx >= 0) {
         com2_device_combo->setCurrentIndex(idx);
@@ -37,7 +37,9 @@ enum class SerialPortMode {
     Disabled,       // Port is disabled
     LogToFile,      // Log all TX data to a file
     TcpModem,       // Emulated TCP modem (AT command set)
-    PhysicalDevice  // Pass through to host serial port
+    PhysicalDevice, // Pass through to host serial port
+    PseudoTerminal, // New host pseudo-terminal
+    UnixSocket      // Listening Unix domain socket
 };
 
 /**
@@ -47,6 +49,7 @@ struct SerialPortSettings {
     SerialPortMode mode;
     QString logFilePath;        // For LogToFile mode
     QString physicalDevice;     // For PhysicalDevice mode (e.g., /dev/ttyUSB0)
+    QString socketPath;         // For UnixSocket mode
 };
 
 /**
@@ -84,7 +87,10 @@ private:
     QRadioButton *com1_logfile_radio;
     QRadioButton *com1_tcpmodem_radio;
     QRadioButton *com1_physical_radio;
+    QRadioButton *com1_pty_radio;
+    QRadioButton *com1_socket_radio;
     QLineEdit *com1_logfile_edit;
+    QLineEdit *com1_socket_edit;
     QPushButton *com1_browse_btn;
     QComboBox *com1_device_combo;
     
@@ -94,7 +100,10 @@ private:
     QRadioButton *com2_logfile_radio;
     QRadioButton *com2_tcpmodem_radio;
     QRadioButton *com2_physical_radio;
+    QRadioButton *com2_pty_radio;
+    QRadioButton *com2_socket_radio;
     QLineEdit *com2_logfile_edit;
+    QLineEdit *com2_socket_edit;
     QPushButton *com2_browse_btn;
     QComboBox *com2_device_combo;
     
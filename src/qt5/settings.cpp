@@ -22,6 +22,7 @@
 #include <string.h>
 
 #include "rpcemu.h"
+#include "serial_host.h"
 
 /* Current config file path - can be overridden by config selector */
 static char current_config_path[512] = "";
@@ -116,6 +117,60 @@ config_nat_rules_save(QSettings &settings)
 	settings.endArray();
 }
 
+/**
+ * Parse the host backend of each serial port
+ */
+static void
+config_serial_host_load(QSettings &settings, Config *config)
+{
+	for (int port = 0; port < SERIAL_PORT_COUNT; port++) {
+		const QString prefix = QString("com%1_").arg(port + 1);
+		QString sText = settings.value(prefix + "host", "none").toString();
+		QByteArray ba;
+
+		if (!QString::compare(sText, "none", Qt::CaseInsensitive)) {
+			config->serial_host_type[port] = SerialHost_None;
+		} else if (!QString::compare(sText, "pty", Qt::CaseInsensitive)) {
+			config->serial_host_type[port] = SerialHost_Pty;
+		} else if (!QString::compare(sText, "socket", Qt::CaseInsensitive)) {
+			config->serial_host_type[port] = SerialHost_UnixSocket;
+		} else if (!QString::compare(sText, "file", Qt::CaseInsensitive)) {
+			config->serial_host_type[port] = SerialHost_File;
+		} else if (!QString::compare(sText, "device", Qt::CaseInsensitive)) {
+			config->serial_host_type[port] = SerialHost_Device;
+		} else {
+			ba = sText.toUtf8();
+			rpclog("Unknown %shost '%s', defaulting to none\n", prefix.toUtf8().constData(), ba.constData());
+			config->serial_host_type[port] = SerialHost_None;
+		}
+
+		ba = settings.value(prefix + "host_path", "").toString().toUtf8();
+		snprintf(config->serial_host_path[port], sizeof(config->serial_host_path[port]), "%s", ba.constData());
+	}
+}
+
+/**
+ * Store the host backend of each serial port
+ */
+static void
+config_serial_host_save(QSettings &settings, const Config *config)
+{
+	for (int port = 0; port < SERIAL_PORT_COUNT; port++) {
+		const QString prefix = QString("com%1_").arg(port + 1);
+		const char *type = "none";
+
+		switch ((SerialHostType) config->serial_host_type[port]) {
+		case SerialHost_None:       type = "none"; break;
+		case SerialHost_Pty:        type = "pty"; break;
+		case SerialHost_UnixSocket: type = "socket"; break;
+		case SerialHost_File:       type = "file"; break;
+		case SerialHost_Device:     type = "device"; break;
+		}
+		settings.setValue(prefix + "host", type);
+		settings.setValue(prefix + "host_path", config->serial_host_path[port]);
+	}
+}
+
 
 /**
  * Load the user's previous chosen configuration. Will fill in sensible
@@ -318,6 +373,11 @@ config_load_from_path(Config *config, const char *path)
 
 	config->vnc_enabled = settings.value("vnc_enabled", "0").toInt();
 	config->vnc_port = settings.value("vnc_port", "5900").toInt();
+	config->vnc_max_fps = settings.value("vnc_max_fps", "30").toInt();
+	if (config->vnc_max_fps < 1 || config->vnc_max_fps > 60) {
+		rpclog("Invalid vnc_max_fps %d, defaulting to 30\n", config->vnc_max_fps);
+		config->vnc_max_fps = 30;
+	}
 	sText = settings.value("vnc_password", "").toString();
 	if (!sText.isEmpty()) {
 		ba = sText.toUtf8();
@@ -336,6 +396,7 @@ config_load_from_path(Config *config, const char *path)
 	}
 
 	config_nat_rules_load(settings);
+	config_serial_host_load(settings, config);
 }
 
 
@@ -431,6 +492,7 @@ config_save_to_path(Config *config, const char *path)
 
 	settings.setValue("vnc_enabled", config->vnc_enabled);
 	settings.setValue("vnc_port", config->vnc_port);
+	settings.setValue("vnc_max_fps", config->vnc_max_fps);
 	settings.setValue("vnc_password", config->vnc_password);
 
 	if (config->network_capture) {
@@ -438,4 +500,5 @@ config_save_to_path(Config *config, const char *path)
 	}
 
 	config_nat_rules_save(settings);
+	config_serial_host_save(settings, config);
 }
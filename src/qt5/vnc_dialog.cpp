@@ -69,6 +69,18 @@ VncDialog::VncDialog(VncServer *server, const QString &currentPassword, QWidget
     passwordLayout->addWidget(passwordEdit);
     serverLayout->addLayout(passwordLayout);
 
+    // Frame rate limit, which can be changed while clients are connected
+    QHBoxLayout *frameRateLayout = new QHBoxLayout();
+    QLabel *frameRateLabel = new QLabel(tr("Maximum frame rate:"), this);
+    frameRateSpinBox = new QSpinBox(this);
+    frameRateSpinBox->setRange(1, 60);
+    frameRateSpinBox->setSuffix(tr(" fps"));
+    frameRateSpinBox->setValue(vncServer ? vncServer->getMaxFrameRate() : 30);
+    frameRateLayout->addWidget(frameRateLabel);
+    frameRateLayout->addWidget(frameRateSpinBox);
+    frameRateLayout->addStretch();
+    serverLayout->addLayout(frameRateLayout);
+
     mainLayout->addWidget(serverGroup);
 
     // Status group
@@ -77,8 +89,10 @@ VncDialog::VncDialog(VncServer *server, const QString &currentPassword, QWidget
 
     statusLabel = new QLabel(this);
     clientsLabel = new QLabel(this);
+    trafficLabel = new QLabel(this);
     statusLayout->addRow(tr("Server:"), statusLabel);
     statusLayout->addRow(tr("Clients:"), clientsLabel);
+    statusLayout->addRow(tr("Traffic:"), trafficLabel);
 
     mainLayout->addWidget(statusGroup);
 
@@ -115,6 +129,12 @@ VncDialog::VncDialog(VncServer *server, const QString &currentPassword, QWidget
                 this, &VncDialog::onClientDisconnected);
     }
 
+    // Per-client statistics are resampled once a second by the server
+    trafficTimer = new QTimer(this);
+    trafficTimer->setInterval(1000);
+    connect(trafficTimer, &QTimer::timeout, this, &VncDialog::updateTraffic);
+    trafficTimer->start();
+
     updateStatus();
 }
 
@@ -137,6 +157,8 @@ void VncDialog::onApply()
         return;
     }
 
+    vncServer->setMaxFrameRate(frameRateSpinBox->value());
+
     if (enableCheckBox->isChecked()) {
         if (!vncServer->isRunning()) {
             int port = portSpinBox->value();
@@ -181,6 +203,7 @@ void VncDialog::updateStatus()
     if (!vncServer) {
         statusLabel->setText(tr("<span style='color: gray;'>Not available</span>"));
         clientsLabel->setText("-");
+        trafficLabel->setText("-");
         return;
     }
 
@@ -198,10 +221,36 @@ void VncDialog::updateStatus()
         clientsLabel->setText("-");
     }
 
+    updateTraffic();
+
     // Update checkbox state
     enableCheckBox->setChecked(vncServer->isRunning());
     portSpinBox->setEnabled(!vncServer->isRunning());
     passwordEdit->setEnabled(!vncServer->isRunning());
 }
 
+void VncDialog::updateTraffic()
+{
+    if (!vncServer || !vncServer->isRunning()) {
+        trafficLabel->setText("-");
+        return;
+    }
+
+    const QVector<VncClientStats> stats = vncServer->getClientStats();
+    if (stats.isEmpty()) {
+        trafficLabel->setText("-");
+        return;
+    }
+
+    QStringList lines;
+    for (const VncClientStats &entry : stats) {
+        lines << tr("%1: %2 KB/s, %3 updates/s, %4 ms/update")
+                     .arg(entry.address)
+                     .arg(entry.bytesPerSecond / 1024.0, 0, 'f', 1)
+                     .arg(entry.updatesPerSecond, 0, 'f', 1)
+                     .arg(entry.encodeMsec, 0, 'f', 2);
+    }
+    trafficLabel->setText(lines.join(QLatin1Char('\n')));
+}
+
 #endif // RPCEMU_VNC
\ No newline at end of file
@@ -34,6 +34,7 @@
 #include <QHBoxLayout>
 #include <QFormLayout>
 #include <QLineEdit>
+#include <QTimer>
 
 class VncServer;
 
@@ -59,6 +60,7 @@ private slots:
     void onServerStatusChanged(bool running, int port);
     void onClientConnected(const QString &address);
     void onClientDisconnected(const QString &address);
+    void updateTraffic();
 
 private:
     void updateStatus();
@@ -68,8 +70,11 @@ private:
     QCheckBox *enableCheckBox;
     QSpinBox *portSpinBox;
     QLineEdit *passwordEdit;
+    QSpinBox *frameRateSpinBox;
     QLabel *statusLabel;
     QLabel *clientsLabel;
+    QLabel *trafficLabel;
+    QTimer *trafficTimer;
     QPushButton *applyButton;
     QDialogButtonBox *buttonBox;
 };
@@ -39,23 +39,78 @@ void vnc_kbd_callback(rfbBool down, rfbKeySym keysym, rfbClientPtr cl);
 void vnc_ptr_callback(int buttonMask, int x, int y, rfbClientPtr cl);
 enum rfbNewClientAction vnc_new_client_callback(rfbClientPtr cl);
 void vnc_client_gone_callback(rfbClientPtr cl);
+void vnc_display_callback(rfbClientPtr cl);
+void vnc_display_finished_callback(rfbClientPtr cl, int result);
+
+// How long the encoder thread may block waiting for client traffic
+static const long VNC_SELECT_TIMEOUT_USEC = 5000;
+
+// Interval between per-client statistics samples
+static const qint64 VNC_STATS_INTERVAL_NSEC = 1000000000;
+
+/**
+ * Per-client bookkeeping, stored in rfbClientRec::clientData.
+ * Only touched from the encoder thread.
+ */
+struct VncClientData {
+    QString address;
+    QElapsedTimer encodeTimer;
+    qint64 encodeNsec;      // Time spent in updates this interval
+    int updates;            // Updates sent this interval
+    int lastSentBytes;      // rfbStatGetSentBytes() at the last sample
+    int pointerX;           // Last pointer position reported by the client
+    int pointerY;
+};
+
+/**
+ * Thread running the libvncserver event loop and all encoding
+ */
+class VncEncoderThread : public QThread
+{
+public:
+    explicit VncEncoderThread(VncServer *server)
+        : server(server)
+    {
+        setObjectName("rpcemu: vnc");
+    }
+
+protected:
+    void run() override
+    {
+        server->encoderLoop();
+    }
+
+private:
+    VncServer *server;
+};
 
 VncServer::VncServer(Emulator *emulator, QObject *parent)
     : QObject(parent)
     , emulator(emulator)
     , rfbScreen(nullptr)
-    , eventTimer(nullptr)
+    , encoderThread(nullptr)
+    , backIndex(0)
+    , frameWidth(0)
+    , frameHeight(0)
+    , framePending(false)
+    , fullFrameNeeded(true)
+    , dirtyRowsReset(false)
+    , cursorWidth(0)
+    , cursorHeight(0)
+    , cursorX(0)
+    , cursorY(0)
+    , cursorHotX(0)
+    , cursorHotY(0)
+    , cursorShapePending(false)
+    , cursorMovePending(false)
     , currentWidth(640)
     , currentHeight(480)
     , listenPort(5900)
     , running(false)
 {
     clientCount.storeRelease(0);
-
-    // Set up event processing timer
-    eventTimer = new QTimer(this);
-    eventTimer->setInterval(20); // 50 Hz - process VNC events
-    connect(eventTimer, &QTimer::timeout, this, &VncServer::processEvents);
+    stopRequested.storeRelease(0);
+    maxFrameRate.storeRelease(30);
 
     // Connect input injection signals to emulator slots
     connect(this, &VncServer::injectKeyPress,
@@ -149,6 +204,8 @@ bool VncServer::start(int port, const QString &password)
     rfbScreen->kbdAddEvent = vnc_kbd_callback;
     rfbScreen->ptrAddEvent = vnc_ptr_callback;
     rfbScreen->newClientHook = vnc_new_client_callback;
+    rfbScreen->displayHook = vnc_display_callback;
+    rfbScreen->displayFinishedHook = vnc_display_finished_callback;
 
     // Store 'this' pointer for callbacks
     rfbScreen->screenData = this;
@@ -170,10 +227,23 @@ bool VncServer::start(int port, const QString &password)
     rfbInitServer(rfbScreen);
 
     listenPort = port;
-    running = true;
 
-    // Start event processing
-    eventTimer->start();
+    {
+        QMutexLocker frameLocker(&frameMutex);
+        framePending = false;
+        fullFrameNeeded = true;
+        running = true;
+
+        // Replace libvncserver's default arrow with the emulated cursor
+        cursorShapePending = (cursorWidth > 0);
+        cursorMovePending = cursorShapePending;
+        sentCursorRect = QRect();
+    }
+
+    // Start event processing and encoding
+    stopRequested.storeRelease(0);
+    encoderThread = new VncEncoderThread(this);
+    encoderThread->start();
 
     qInfo("VNC: Server started on port %d", port);
     emit statusChanged(true, port);
@@ -189,7 +259,19 @@ void VncServer::stop()
         return;
     }
 
-    eventTimer->stop();
+    // Stop accepting frames from the video thread
+    {
+        QMutexLocker frameLocker(&frameMutex);
+        running = false;
+        framePending = false;
+    }
+
+    if (encoderThread) {
+        stopRequested.storeRelease(1);
+        encoderThread->wait();
+        delete encoderThread;
+        encoderThread = nullptr;
+    }
 
     if (rfbScreen) {
         rfbShutdownServer(rfbScreen, TRUE);
@@ -207,8 +289,11 @@ void VncServer::stop()
     }
     currentPassword.clear();
 
-    running = false;
     clientCount.storeRelease(0);
+    {
+        QMutexLocker statsLocker(&statsMutex);
+        clientStats.clear();
+    }
 
     qInfo("VNC: Server stopped");
     emit statusChanged(false, 0);
@@ -229,13 +314,303 @@ int VncServer::getClientCount() const
     return clientCount.loadAcquire();
 }
 
+QVector<VncClientStats> VncServer::getClientStats() const
+{
+    QMutexLocker locker(&statsMutex);
+    return clientStats;
+}
+
+void VncServer::setMaxFrameRate(int fps)
+{
+    maxFrameRate.storeRelease(qBound(1, fps, 60));
+}
+
+int VncServer::getMaxFrameRate() const
+{
+    return maxFrameRate.loadAcquire();
+}
+
 void VncServer::updateFramebuffer(const uint32_t *buffer, int width, int height, int yl, int yh)
 {
-    if (!running || !rfbScreen || !buffer) {
+    if (!running || !buffer || width <= 0 || height <= 0) {
         return;
     }
 
-    QMutexLocker locker(&mutex);
+    QMutexLocker locker(&frameMutex);
+
+    if (!running) {
+        return;
+    }
+
+    // Nobody is watching, so skip the copy; the next client gets a full frame
+    if (clientCount.loadAcquire() == 0) {
+        fullFrameNeeded = true;
+        return;
+    }
+
+    // A mode change invalidates the back buffer, take the whole frame.
+    // The front buffer belongs to the encoder thread and is resized when
+    // it is next swapped back in.
+    if (width != frameWidth || height != frameHeight) {
+        frameBuffers[backIndex].resize(width * height);
+        backDirtyRows.fill(0, height);
+        frameWidth = width;
+        frameHeight = height;
+        fullFrameNeeded = true;
+    }
+
+    int startY = qMax(0, yl);
+    int endY = qMin(height, yh + 1);
+    if (fullFrameNeeded) {
+        startY = 0;
+        endY = height;
+        fullFrameNeeded = false;
+    }
+
+    // Copy the dirty region into the back buffer, merging with any rows
+    // not yet picked up by the encoder thread
+    // Note: Both buffers are RGB32/XRGB format, so direct copy works
+    uint32_t *back = frameBuffers[backIndex].data();
+    uint8_t *dirty = backDirtyRows.data();
+
+    for (int y = startY; y < endY; y++) {
+        memcpy(back + (y * width), buffer + (y * width), width * sizeof(uint32_t));
+        dirty[y] = 1;
+    }
+
+    if (startY < endY) {
+        framePending = true;
+    }
+}
+
+void VncServer::resetFrame()
+{
+    QMutexLocker locker(&frameMutex);
+
+    backDirtyRows.fill(0);
+    fullFrameNeeded = true;
+    dirtyRowsReset = true;
+}
+
+void VncServer::updateCursor(const uint32_t *image, int width, int height, int x, int y,
+                             int hotX, int hotY, bool shapeChanged)
+{
+    if (!image || width <= 0) {
+        return;
+    }
+
+    // Kept even while stopped, so a restarted server has the current shape
+    QMutexLocker locker(&frameMutex);
+
+    if (shapeChanged || cursorWidth == 0) {
+        cursorPixels.resize(width * qMax(height, 0));
+        if (height > 0) {
+            memcpy(cursorPixels.data(), image, width * height * sizeof(uint32_t));
+        }
+        cursorWidth = width;
+        cursorHeight = qMax(height, 0);
+        cursorShapePending = running;
+    }
+
+    cursorX = x;
+    cursorY = y;
+    cursorHotX = hotX;
+    cursorHotY = hotY;
+    cursorMovePending = running;
+}
+
+/**
+ * Build a libvncserver cursor from ARGB pixels. libvncserver frees it
+ * when it is replaced or the screen is cleaned up.
+ */
+static rfbCursorPtr vnc_make_cursor(const uint32_t *pixels, int width, int height,
+                                    int hotX, int hotY)
+{
+    // A hidden cursor is sent as a single transparent pixel
+    if (height <= 0) {
+        pixels = nullptr;
+        width = 1;
+        height = 1;
+        hotX = 0;
+        hotY = 0;
+    }
+
+    const int maskBytesPerRow = (width + 7) / 8;
+    rfbCursorPtr cursor = static_cast<rfbCursorPtr>(calloc(1, sizeof(rfbCursor)));
+    unsigned char *mask = static_cast<unsigned char *>(calloc(maskBytesPerRow * height, 1));
+    unsigned char *richSource = static_cast<unsigned char *>(calloc(width * height, 4));
+
+    if (!cursor || !mask || !richSource) {
+        free(cursor);
+        free(mask);
+        free(richSource);
+        return nullptr;
+    }
+
+    // richSource is in the server pixel format, which matches RGB32
+    if (pixels) {
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                const uint32_t pixel = pixels[(y * width) + x];
+
+                if (pixel >> 24) {
+                    mask[(y * maskBytesPerRow) + (x / 8)] |= 0x80 >> (x & 7);
+                    memcpy(richSource + (((y * width) + x) * 4), &pixel, 4);
+                }
+            }
+        }
+    }
+
+    cursor->width = width;
+    cursor->height = height;
+    cursor->xhot = qBound(0, hotX, width - 1);
+    cursor->yhot = qBound(0, hotY, height - 1);
+    cursor->mask = mask;
+    cursor->richSource = richSource;
+    cursor->foreRed = cursor->foreGreen = cursor->foreBlue = 0xffff;
+    cursor->cleanup = TRUE;
+    cursor->cleanupSource = TRUE;
+    cursor->cleanupMask = TRUE;
+    cursor->cleanupRichSource = TRUE;
+
+    return cursor;
+}
+
+void VncServer::publishPendingCursor()
+{
+    QVector<uint32_t> pixels;
+    int width, height, x, y, hotX, hotY;
+    bool shapeChanged;
+
+    {
+        QMutexLocker locker(&frameMutex);
+
+        if (!cursorShapePending && !cursorMovePending) {
+            return;
+        }
+
+        shapeChanged = cursorShapePending;
+        if (shapeChanged) {
+            pixels = cursorPixels;
+        }
+        width = cursorWidth;
+        height = cursorHeight;
+        x = cursorX;
+        y = cursorY;
+        hotX = cursorHotX;
+        hotY = cursorHotY;
+        cursorShapePending = false;
+        cursorMovePending = false;
+    }
+
+    if (shapeChanged) {
+        rfbCursorPtr cursor = vnc_make_cursor(pixels.constData(), width, height, hotX, hotY);
+        if (cursor) {
+            // Flags cursorWasChanged on every client
+            rfbSetCursor(rfbScreen, cursor);
+        }
+    }
+
+    // libvncserver tracks the position of the active point
+    const int pointerX = qBound(0, x + hotX, currentWidth - 1);
+    const int pointerY = qBound(0, y + hotY, currentHeight - 1);
+    rfbScreen->cursorX = pointerX;
+    rfbScreen->cursorY = pointerY;
+
+    bool drawnByServer = false;
+    rfbClientIteratorPtr iter = rfbGetClientIterator(rfbScreen);
+    rfbClientPtr cl;
+
+    while ((cl = rfbClientIteratorNext(iter)) != nullptr) {
+        VncClientData *data = static_cast<VncClientData *>(cl->clientData);
+
+        // Don't echo back a position the client has just sent us
+        if (cl->enableCursorPosUpdates &&
+            (!data || data->pointerX != pointerX || data->pointerY != pointerY)) {
+            cl->cursorWasMoved = TRUE;
+        }
+        if (!cl->enableCursorShapeUpdates) {
+            drawnByServer = true;
+        }
+    }
+    rfbReleaseClientIterator(iter);
+
+    // Clients without the cursor pseudo-encoding have the cursor drawn into
+    // their updates by libvncserver, so resend the old and new areas
+    const QRect screen(0, 0, currentWidth, currentHeight);
+    const QRect cursorRect = (height > 0) ? QRect(x, y, width, height) & screen : QRect();
+
+    if (drawnByServer && cursorRect != sentCursorRect) {
+        if (!sentCursorRect.isEmpty()) {
+            rfbMarkRectAsModified(rfbScreen, sentCursorRect.left(), sentCursorRect.top(),
+                                  sentCursorRect.right() + 1, sentCursorRect.bottom() + 1);
+        }
+        if (!cursorRect.isEmpty()) {
+            rfbMarkRectAsModified(rfbScreen, cursorRect.left(), cursorRect.top(),
+                                  cursorRect.right() + 1, cursorRect.bottom() + 1);
+        }
+    }
+    sentCursorRect = cursorRect;
+}
+
+void VncServer::encoderLoop()
+{
+    QElapsedTimer clock;
+    clock.start();
+
+    qint64 lastPublish = 0;
+    qint64 lastStats = 0;
+
+    while (!stopRequested.loadAcquire()) {
+        const qint64 now = clock.nsecsElapsed();
+        const qint64 frameInterval = 1000000000LL / maxFrameRate.loadAcquire();
+
+        // Damage keeps coalescing in the back buffer until the frame
+        // interval has passed
+        if (now - lastPublish >= frameInterval) {
+            publishPendingFrame();
+            publishPendingCursor();
+            lastPublish = now;
+        }
+
+        // Wait for client traffic, then encode and send any updates that
+        // clients have requested; libvncserver accumulates the modified
+        // region per client, so a slow client just receives fewer, larger
+        // updates
+        rfbProcessEvents(rfbScreen, VNC_SELECT_TIMEOUT_USEC);
+
+        if (now - lastStats >= VNC_STATS_INTERVAL_NSEC) {
+            sampleClientStats(now - lastStats);
+            lastStats = now;
+        }
+    }
+}
+
+void VncServer::publishPendingFrame()
+{
+    int width, height;
+
+    // Swap the buffers while holding the lock, copy outside it
+    {
+        QMutexLocker locker(&frameMutex);
+
+        if (!framePending) {
+            return;
+        }
+
+        backIndex ^= 1;
+        backDirtyRows.swap(frontDirtyRows);
+        width = frameWidth;
+        height = frameHeight;
+        framePending = false;
+
+        // The buffer handed back to the video thread must match the mode
+        if (dirtyRowsReset || frameBuffers[backIndex].size() != width * height) {
+            frameBuffers[backIndex].resize(width * height);
+            backDirtyRows.fill(0, height);
+            dirtyRowsReset = false;
+        }
+    }
 
     // Check if we need to resize
     if (width != currentWidth || height != currentHeight) {
@@ -248,52 +623,84 @@ void VncServer::updateFramebuffer(const uint32_t *buffer, int width, int height,
         return;
     }
 
-    // Copy the dirty region
-    // Note: Both buffers are RGB32/XRGB format, so direct copy works
+    const uint32_t *front = frameBuffers[backIndex ^ 1].constData();
+    uint8_t *dirty = frontDirtyRows.data();
     int bytesPerRow = width * 4;
-    int startY = qMax(0, yl);
-    int endY = qMin(height, yh + 1);
-
-    for (int y = startY; y < endY; y++) {
-        memcpy(rfbScreen->frameBuffer + (y * bytesPerRow),
-               buffer + (y * width),
-               bytesPerRow);
+    int runStart = -1;
+
+    for (int y = 0; y <= height; y++) {
+        if (y < height && dirty[y]) {
+            memcpy(rfbScreen->frameBuffer + (y * bytesPerRow),
+                   front + (y * width),
+                   bytesPerRow);
+            dirty[y] = 0;
+            if (runStart == -1) {
+                runStart = y;
+            }
+        } else if (runStart != -1) {
+            // Mark each contiguous run of rows as modified
+            rfbMarkRectAsModified(rfbScreen, 0, runStart, width, y);
+            runStart = -1;
+        }
     }
-
-    // Mark the region as modified
-    rfbMarkRectAsModified(rfbScreen, 0, startY, width, endY);
 }
 
-void VncServer::processEvents()
+void VncServer::sampleClientStats(qint64 intervalNsec)
 {
-    if (!running || !rfbScreen) {
-        return;
+    QVector<VncClientStats> stats;
+    const double seconds = (double) intervalNsec / 1e9;
+
+    rfbClientIteratorPtr iter = rfbGetClientIterator(rfbScreen);
+    rfbClientPtr cl;
+
+    while ((cl = rfbClientIteratorNext(iter)) != nullptr) {
+        VncClientData *data = static_cast<VncClientData *>(cl->clientData);
+        if (!data) {
+            continue;
+        }
+
+        const int sentBytes = rfbStatGetSentBytes(cl);
+
+        VncClientStats entry;
+        entry.address = data->address;
+        entry.bytesPerSecond = (sentBytes - data->lastSentBytes) / seconds;
+        entry.updatesPerSecond = data->updates / seconds;
+        entry.encodeMsec = data->updates
+            ? (double) data->encodeNsec / data->updates / 1e6
+            : 0.0;
+        stats.append(entry);
+
+        data->lastSentBytes = sentBytes;
+        data->encodeNsec = 0;
+        data->updates = 0;
     }
+    rfbReleaseClientIterator(iter);
 
-    // Process VNC events with a short timeout (non-blocking)
-    rfbProcessEvents(rfbScreen, 0);
+    QMutexLocker locker(&statsMutex);
+    clientStats = stats;
 }
 
 bool VncServer::resizeFramebuffer(int width, int height)
 {
-    // This is called with mutex held
+    // This is called on the encoder thread
     if (!rfbScreen) {
         return false;
     }
 
     qInfo("VNC: Resizing framebuffer to %dx%d", width, height);
 
-    char *newBuffer = (char *)realloc(rfbScreen->frameBuffer, width * height * 4);
+    char *newBuffer = (char *)malloc(width * height * 4);
     if (!newBuffer) {
         qWarning("VNC: Failed to resize framebuffer");
         return false;
     }
+    memset(newBuffer, 0, width * height * 4);
 
-    rfbScreen->frameBuffer = newBuffer;
-    memset(rfbScreen->frameBuffer, 0, width * height * 4);
-
-    // Update screen dimensions
-    rfbNewFramebuffer(rfbScreen, rfbScreen->frameBuffer, width, height, 8, 3, 4);
+    // Update screen dimensions; libvncserver still references the old
+    // buffer until this returns
+    char *oldBuffer = rfbScreen->frameBuffer;
+    rfbNewFramebuffer(rfbScreen, newBuffer, width, height, 8, 3, 4);
+    free(oldBuffer);
 
     currentWidth = width;
     currentHeight = height;
@@ -518,6 +925,12 @@ void vnc_ptr_callback(int buttonMask, int x, int y, rfbClientPtr cl)
         return;
     }
 
+    VncClientData *data = static_cast<VncClientData *>(cl->clientData);
+    if (data) {
+        data->pointerX = x;
+        data->pointerY = y;
+    }
+
     // Send mouse position
     emit server->injectMouseMove(x, y);
 
@@ -538,15 +951,24 @@ enum rfbNewClientAction vnc_new_client_callback(rfbClientPtr cl)
     // Set up client gone callback
     cl->clientGoneHook = vnc_client_gone_callback;
 
-    // Increment client count
-    server->clientCount.fetchAndAddRelease(1);
-
     // Get client address
     QString address;
     if (cl->host) {
         address = QString::fromLatin1(cl->host);
     }
 
+    VncClientData *data = new VncClientData;
+    data->address = address;
+    data->encodeNsec = 0;
+    data->updates = 0;
+    data->lastSentBytes = 0;
+    data->pointerX = -1;
+    data->pointerY = -1;
+    cl->clientData = data;
+
+    // Increment client count; the video thread then sends a full frame
+    server->clientCount.fetchAndAddRelease(1);
+
     qInfo("VNC: Client connected from %s", qPrintable(address));
     emit server->clientConnected(address);
 
@@ -570,8 +992,33 @@ void vnc_client_gone_callback(rfbClientPtr cl)
         address = QString::fromLatin1(cl->host);
     }
 
+    delete static_cast<VncClientData *>(cl->clientData);
+    cl->clientData = nullptr;
+
     qInfo("VNC: Client disconnected from %s", qPrintable(address));
     emit server->clientDisconnected(address);
 }
 
+// Called by libvncserver before it encodes an update for a client
+void vnc_display_callback(rfbClientPtr cl)
+{
+    VncClientData *data = static_cast<VncClientData *>(cl->clientData);
+    if (data) {
+        data->encodeTimer.start();
+    }
+}
+
+// Called by libvncserver once an update has been encoded and sent
+void vnc_display_finished_callback(rfbClientPtr cl, int result)
+{
+    Q_UNUSED(result);
+
+    VncClientData *data = static_cast<VncClientData *>(cl->clientData);
+    if (data && data->encodeTimer.isValid()) {
+        data->encodeNsec += data->encodeTimer.nsecsElapsed();
+        data->updates++;
+        data->encodeTimer.invalidate();
+    }
+}
+
 #endif // RPCEMU_VNC
\ No newline at end of file
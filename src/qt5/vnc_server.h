@@ -27,19 +27,37 @@
 #include <QThread>
 #include <QMutex>
 #include <QImage>
-#include <QTimer>
 #include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QVector>
 
 #include <rfb/rfb.h>
 #include <rfb/keysym.h>
 
 class Emulator;
+class VncEncoderThread;
+
+/**
+ * Traffic statistics for one connected VNC client,
+ * sampled once a second by the encoder thread
+ */
+struct VncClientStats {
+    QString address;        ///< IP address of the client
+    double bytesPerSecond;  ///< Bytes sent to the client over the last interval
+    double updatesPerSecond;///< Framebuffer updates sent over the last interval
+    double encodeMsec;      ///< Mean time to encode and send one update
+};
 
 /**
  * VNC Server wrapper class
  * 
  * Provides remote desktop access to the emulated RISC OS display.
  * Uses libvncserver for the RFB protocol implementation.
+ *
+ * All libvncserver event handling and encoding runs on a dedicated
+ * encoder thread. The video thread only copies dirty scanlines into a
+ * back buffer, which the encoder thread swaps out at most once per
+ * frame interval, so slow clients never stall the GUI or the emulator.
  */
 class VncServer : public QObject
 {
@@ -80,9 +98,28 @@ public:
      */
     int getClientCount() const;
 
+    /**
+     * Get traffic statistics for each connected client
+     * @return one entry per client, refreshed once a second
+     */
+    QVector<VncClientStats> getClientStats() const;
+
+    /**
+     * Limit the rate at which frames are offered to clients
+     * @param fps maximum frames per second (1-60)
+     */
+    void setMaxFrameRate(int fps);
+
+    /**
+     * Get the current frame rate limit
+     * @return maximum frames per second
+     */
+    int getMaxFrameRate() const;
+
     /**
      * Update the framebuffer from the emulator
-     * Called from the video update path
+     * Called from the video update path; only copies the dirty rows
+     * into the back buffer, encoding happens on the encoder thread
      * @param buffer Pointer to RGB32 pixel data
      * @param width Image width
      * @param height Image height
@@ -91,6 +128,30 @@ public:
      */
     void updateFramebuffer(const uint32_t *buffer, int width, int height, int yl, int yh);
 
+    /**
+     * Discard the dirty row state after a screen mode change, even one
+     * that keeps the same size; the next update sends the whole frame
+     * Called from the video thread
+     */
+    void resetFrame();
+
+    /**
+     * Update the hardware cursor shape and position
+     * Called from the video thread; clients that support the cursor
+     * pseudo-encoding draw the pointer themselves, so pointer motion
+     * causes no framebuffer updates
+     * @param image ARGB cursor pixels, colour 0 is transparent
+     * @param width Cursor width
+     * @param height Cursor height, 0 when the cursor is hidden
+     * @param x X of top-left of cursor
+     * @param y Y of top-left of cursor
+     * @param hotX X offset of the pointer active point
+     * @param hotY Y offset of the pointer active point
+     * @param shapeChanged true if the image differs from the last call
+     */
+    void updateCursor(const uint32_t *image, int width, int height, int x, int y,
+                      int hotX, int hotY, bool shapeChanged);
+
 signals:
     /**
      * Emitted when a client connects
@@ -117,15 +178,16 @@ signals:
     void injectMouseMove(int x, int y);
     void injectMouseButton(int buttonMask);
 
-private slots:
-    void processEvents();
-
 private:
+    friend class VncEncoderThread;
+
     // libvncserver callback friends
     friend void vnc_kbd_callback(rfbBool down, rfbKeySym keysym, rfbClientPtr cl);
     friend void vnc_ptr_callback(int buttonMask, int x, int y, rfbClientPtr cl);
     friend enum rfbNewClientAction vnc_new_client_callback(rfbClientPtr cl);
     friend void vnc_client_gone_callback(rfbClientPtr cl);
+    friend void vnc_display_callback(rfbClientPtr cl);
+    friend void vnc_display_finished_callback(rfbClientPtr cl, int result);
 
     // Convert X11 keysym to Acorn scan code
     unsigned int keysymToScanCode(rfbKeySym keysym);
@@ -133,10 +195,54 @@ private:
     // Resize the VNC framebuffer if needed
     bool resizeFramebuffer(int width, int height);
 
+    // Encoder thread body: process client events and publish frames
+    void encoderLoop();
+
+    // Swap the back buffer out and mark its dirty rows as modified
+    void publishPendingFrame();
+
+    // Hand a pending cursor shape or position change to libvncserver
+    void publishPendingCursor();
+
+    // Recalculate per-client statistics for the last interval
+    void sampleClientStats(qint64 intervalNsec);
+
     Emulator *emulator;
     rfbScreenInfoPtr rfbScreen;
-    QTimer *eventTimer;
-    QMutex mutex;
+    VncEncoderThread *encoderThread;
+    QAtomicInt stopRequested;
+    QAtomicInt maxFrameRate;
+    QMutex mutex;           // Serialises start() and stop()
+
+    // Double-buffered frame handoff between the video and encoder threads.
+    // Rows are only valid in a buffer where the matching dirty flag is set.
+    QMutex frameMutex;
+    QVector<uint32_t> frameBuffers[2];
+    QVector<uint8_t> backDirtyRows;
+    QVector<uint8_t> frontDirtyRows;
+    int backIndex;
+    int frameWidth;
+    int frameHeight;
+    bool framePending;
+    bool fullFrameNeeded;
+    bool dirtyRowsReset;    // Clear the rows handed back at the next swap
+
+    // Latest hardware cursor from the video thread, also guarded by frameMutex
+    QVector<uint32_t> cursorPixels;
+    int cursorWidth;
+    int cursorHeight;
+    int cursorX;
+    int cursorY;
+    int cursorHotX;
+    int cursorHotY;
+    bool cursorShapePending;
+    bool cursorMovePending;
+
+    // Cursor area last drawn for clients without cursor shape support
+    QRect sentCursorRect;
+
+    mutable QMutex statsMutex;
+    QVector<VncClientStats> clientStats;
 
     int currentWidth;
     int currentHeight;
@@ -0,0 +1,545 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * replay.c - Deterministic record and replay of a session
+ *
+ * The log is a header followed by events, each a fixed-size record then
+ * any data. All fields are little-endian:
+ *
+ *   Header: magic[8], version u32, model u32, mem_size u32, vram_size u32,
+ *           start time i64, config name[256]
+ *   Event:  position u64, time i64, sequence u32, type u16, length u16,
+ *           a i32, b i32, data[length]
+ *
+ * A replay reads one event ahead; events are applied when the emulator
+ * thread reaches their event point and data is handed out when the guest
+ * asks for it.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rpcemu.h"
+#include "replay.h"
+#include "serial_host.h"
+
+#define REPLAY_MAGIC		"RPCEMREC"
+#define REPLAY_VERSION		1
+#define REPLAY_NAME_SIZE	256
+#define REPLAY_HEADER_SIZE	(8 + 4 * 4 + 8 + REPLAY_NAME_SIZE)
+#define REPLAY_EVENT_SIZE	32
+#define REPLAY_DATA_MAX		65535		/**< Limited by the 16-bit length field */
+
+ReplayMode replay_mode = ReplayMode_Off;
+int replay_fast_forward = 0;
+uint64_t replay_inscount_base = 0;
+int64_t replay_clock = 0;
+time_t replay_time_base = 0;
+
+static FILE *replay_file;
+static uint64_t replay_events;		/**< Events written or applied */
+static uint64_t replay_host_start;	/**< Host time the replay started */
+
+static uint64_t point_position = UINT64_MAX;	/**< Position of the last event point */
+static uint32_t point_sequence;		/**< Event points passed at point_position before the last */
+
+static int network_irq_pending;
+
+/* Replay read-ahead */
+static ReplayEvent next_event;
+static int next_valid;
+static uint8_t next_data[REPLAY_DATA_MAX];
+static uint8_t pulled_data[REPLAY_DATA_MAX];
+static int diverged;
+
+static void
+put_le32(uint8_t *p, uint32_t val)
+{
+	p[0] = (uint8_t) val;
+	p[1] = (uint8_t) (val >> 8);
+	p[2] = (uint8_t) (val >> 16);
+	p[3] = (uint8_t) (val >> 24);
+}
+
+static void
+put_le64(uint8_t *p, uint64_t val)
+{
+	put_le32(p, (uint32_t) val);
+	put_le32(p + 4, (uint32_t) (val >> 32));
+}
+
+static uint32_t
+get_le32(const uint8_t *p)
+{
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) |
+	       ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint64_t
+get_le64(const uint8_t *p)
+{
+	return (uint64_t) get_le32(p) | ((uint64_t) get_le32(p + 4) << 32);
+}
+
+/**
+ * Put the emulated clock and event points back to where a fresh machine
+ * starts them.
+ */
+static void
+replay_reset_state(void)
+{
+	replay_clock = 0;
+	replay_events = 0;
+	point_position = UINT64_MAX;
+	point_sequence = 0;
+	network_irq_pending = 0;
+	next_valid = 0;
+	diverged = 0;
+}
+
+/**
+ * Host serial data is not logged, so a session with a host serial backend
+ * attached cannot be replayed faithfully; refuse to record or replay one.
+ *
+ * @param path Log file, for the error message
+ * @return 1 if a host serial backend is configured (which has been reported)
+ */
+static int
+replay_serial_host_attached(const char *path)
+{
+	int port;
+
+	for (port = 0; port < 2; port++) {
+		if (config.serial_host_type[port] != SerialHost_None) {
+			error("Cannot record or replay '%s' while COM%d is connected to the host", path, port + 1);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Start recording to a new log. Must be called before the machine starts,
+ * so that the recording covers everything since power-on.
+ *
+ * @param path Log file to create
+ * @return 1 on success, 0 on failure (which has been reported)
+ */
+int
+replay_record_start(const char *path)
+{
+	uint8_t header[REPLAY_HEADER_SIZE];
+	size_t name_length;
+
+	if (replay_serial_host_attached(path)) {
+		return 0;
+	}
+
+	replay_file = fopen(path, "wb");
+	if (replay_file == NULL) {
+		error("Cannot create recording '%s': %s", path, strerror(errno));
+		return 0;
+	}
+
+	replay_time_base = time(NULL);
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, REPLAY_MAGIC, 8);
+	put_le32(header + 8, REPLAY_VERSION);
+	put_le32(header + 12, (uint32_t) machine.model);
+	put_le32(header + 16, config.mem_size);
+	put_le32(header + 20, config.vram_size);
+	put_le64(header + 24, (uint64_t) (int64_t) replay_time_base);
+	name_length = strlen(config.name);
+	if (name_length > REPLAY_NAME_SIZE - 1) {
+		name_length = REPLAY_NAME_SIZE - 1;
+	}
+	memcpy(header + 32, config.name, name_length);
+
+	if (fwrite(header, sizeof(header), 1, replay_file) != 1) {
+		error("Cannot write recording '%s': %s", path, strerror(errno));
+		fclose(replay_file);
+		replay_file = NULL;
+		return 0;
+	}
+
+	replay_reset_state();
+	replay_mode = ReplayMode_Record;
+	rpclog("Replay: recording to '%s'\n", path);
+	return 1;
+}
+
+/**
+ * Read the next event of a replay into next_event, or clear next_valid at
+ * the end of the log.
+ */
+static void
+replay_read_next(void)
+{
+	uint8_t record[REPLAY_EVENT_SIZE];
+
+	next_valid = 0;
+
+	if (fread(record, sizeof(record), 1, replay_file) != 1) {
+		return;
+	}
+
+	next_event.position = get_le64(record);
+	next_event.time = (int64_t) get_le64(record + 8);
+	next_event.sequence = get_le32(record + 16);
+	next_event.type = get_le32(record + 20) & 0xffff;
+	next_event.length = get_le32(record + 20) >> 16;
+	next_event.a = (int32_t) get_le32(record + 24);
+	next_event.b = (int32_t) get_le32(record + 28);
+
+	if (next_event.length != 0 &&
+	    fread(next_data, next_event.length, 1, replay_file) != 1)
+	{
+		// Truncated, e.g. the recording process was killed
+		return;
+	}
+
+	next_valid = 1;
+}
+
+/**
+ * Start replaying a log. Must be called before the machine starts, with
+ * the configuration the log was recorded with.
+ *
+ * @param path         Log file to replay
+ * @param fast_forward Run as fast as possible, rather than at the recorded pace
+ * @return 1 on success, 0 on failure (which has been reported)
+ */
+int
+replay_play_start(const char *path, int fast_forward)
+{
+	uint8_t header[REPLAY_HEADER_SIZE];
+	char name[REPLAY_NAME_SIZE];
+
+	if (replay_serial_host_attached(path)) {
+		return 0;
+	}
+
+	replay_file = fopen(path, "rb");
+	if (replay_file == NULL) {
+		error("Cannot open recording '%s': %s", path, strerror(errno));
+		return 0;
+	}
+
+	if (fread(header, sizeof(header), 1, replay_file) != 1 ||
+	    memcmp(header, REPLAY_MAGIC, 8) != 0 ||
+	    get_le32(header + 8) != REPLAY_VERSION)
+	{
+		error("'%s' is not a recording this version of RPCEmu can replay", path);
+		fclose(replay_file);
+		replay_file = NULL;
+		return 0;
+	}
+
+	memcpy(name, header + 32, sizeof(name));
+	name[sizeof(name) - 1] = '\0';
+
+	if (get_le32(header + 12) != (uint32_t) machine.model ||
+	    get_le32(header + 16) != config.mem_size ||
+	    get_le32(header + 20) != config.vram_size)
+	{
+		error("'%s' was recorded on machine '%s', which had a different model or memory size",
+		      path, name);
+		fclose(replay_file);
+		replay_file = NULL;
+		return 0;
+	}
+
+	replay_time_base = (time_t) (int64_t) get_le64(header + 24);
+	replay_fast_forward = fast_forward;
+
+	replay_reset_state();
+	replay_read_next();
+	replay_mode = ReplayMode_Play;
+	replay_host_start = rpcemu_nsec_host_ticks();
+
+	rpclog("Replay: replaying '%s' recorded on '%s'%s\n", path, name,
+	       fast_forward ? ", fast-forward" : "");
+	return 1;
+}
+
+/**
+ * Report how long the replay took, for comparing builds.
+ */
+static void
+replay_report(const char *what)
+{
+	const uint64_t host_ns = rpcemu_nsec_host_ticks() - replay_host_start;
+	const uint64_t instructions = replay_position();
+	const double seconds = (double) host_ns / 1e9;
+
+	rpclog("Replay: %s after %" PRIu64 " events, %" PRIu64 " instructions, "
+	       "%.3f s emulated, %.3f s host (%.1f MIPS)%s\n",
+	       what, replay_events, instructions, (double) replay_clock / 1e9, seconds,
+	       seconds > 0.0 ? (double) instructions / seconds / 1e6 : 0.0,
+	       diverged ? ", diverged from the recording" : "");
+	printf("Replay %s: %" PRIu64 " instructions in %.3f s host (%.1f MIPS)%s\n",
+	       what, instructions, seconds,
+	       seconds > 0.0 ? (double) instructions / seconds / 1e6 : 0.0,
+	       diverged ? ", diverged from the recording" : "");
+	fflush(stdout);
+}
+
+/**
+ * Stop recording or replaying. The emulator carries on with live input.
+ */
+void
+replay_stop(void)
+{
+	switch (replay_mode) {
+	case ReplayMode_Record:
+		// Mark where the recording stopped, so a replay runs to the same point
+		replay_record(ReplayEvent_End, rpcemu_nsec_host_ticks(), 0, 0);
+		if (replay_mode == ReplayMode_Record) {
+			if (fclose(replay_file) != 0) {
+				error("Cannot write recording: %s", strerror(errno));
+			}
+			rpclog("Replay: recorded %" PRIu64 " events, %" PRIu64 " instructions\n",
+			       replay_events, replay_position());
+		}
+		break;
+	case ReplayMode_Play:
+		replay_report("stopped");
+		fclose(replay_file);
+		break;
+	case ReplayMode_Off:
+		return;
+	}
+
+	replay_file = NULL;
+	replay_mode = ReplayMode_Off;
+}
+
+/**
+ * Mark an event point: the emulator thread has stopped running guest code
+ * and may apply events. Must be called at each one, whether or not
+ * recording or replaying, so that the points line up between runs.
+ */
+void
+replay_event_point(void)
+{
+	const uint64_t position = replay_position();
+
+	if (position != point_position) {
+		point_position = position;
+		point_sequence = 0;
+	} else {
+		point_sequence++;
+	}
+}
+
+/**
+ * Write an event to the log. Events asked for by the guest are placed
+ * where the guest is; others at the last event point.
+ */
+static void
+replay_write(ReplayEventType type, int64_t time, int32_t a, int32_t b,
+             const void *data, uint32_t length)
+{
+	uint8_t record[REPLAY_EVENT_SIZE];
+	uint64_t position = replay_position();
+	uint32_t sequence = 0;
+
+	if (replay_mode != ReplayMode_Record) {
+		return;
+	}
+	if (length > REPLAY_DATA_MAX) {
+		length = REPLAY_DATA_MAX;
+	}
+	if (type != ReplayEvent_Cmos && type != ReplayEvent_NetworkRx &&
+	    point_position != UINT64_MAX)
+	{
+		position = point_position;
+		sequence = point_sequence;
+	}
+
+	put_le64(record, position);
+	put_le64(record + 8, (uint64_t) time);
+	put_le32(record + 16, sequence);
+	put_le32(record + 20, (uint32_t) type | (length << 16));
+	put_le32(record + 24, (uint32_t) a);
+	put_le32(record + 28, (uint32_t) b);
+
+	if (fwrite(record, sizeof(record), 1, replay_file) != 1 ||
+	    (length != 0 && fwrite(data, length, 1, replay_file) != 1))
+	{
+		error("Recording stopped, cannot write it: %s", strerror(errno));
+		fclose(replay_file);
+		replay_file = NULL;
+		replay_mode = ReplayMode_Off;
+		return;
+	}
+	replay_events++;
+}
+
+/**
+ * Log an event applied at the current event point.
+ *
+ * @param type Event
+ * @param time Emulated time it was applied at, in nanoseconds
+ * @param a    Event dependent
+ * @param b    Event dependent
+ */
+void
+replay_record(ReplayEventType type, int64_t time, int32_t a, int32_t b)
+{
+	replay_write(type, time, a, b, NULL, 0);
+}
+
+/**
+ * Log data the guest asked for, where it is now.
+ *
+ * @param type   Event
+ * @param a      Event dependent
+ * @param b      Event dependent
+ * @param data   Data given to the guest
+ * @param length Bytes of data
+ */
+void
+replay_record_data(ReplayEventType type, int32_t a, int32_t b,
+                   const void *data, uint32_t length)
+{
+	replay_write(type, replay_clock, a, b, data, length);
+}
+
+/**
+ * Called instead of raising the network podule IRQ while recording or
+ * replaying. The backend raises it whenever its host thread has a frame,
+ * so when recording, the raise is put off to the next event point, where
+ * it is logged; when replaying, the log says when to raise it.
+ */
+void
+replay_network_irq(void)
+{
+	if (replay_mode == ReplayMode_Record) {
+		network_irq_pending = 1;
+	}
+}
+
+/**
+ * @return Non-zero if the network IRQ should be raised at this event point
+ */
+int
+replay_take_network_irq(void)
+{
+	const int pending = network_irq_pending;
+
+	network_irq_pending = 0;
+	return pending;
+}
+
+/**
+ * Note that the replay no longer matches the recording. It carries on, so
+ * the guest keeps running, but a run that diverges is no use for timing.
+ */
+static void
+replay_diverge(const char *why)
+{
+	if (!diverged) {
+		diverged = 1;
+		rpclog("Replay: diverged from the recording at instruction %" PRIu64 ": %s\n",
+		       replay_position(), why);
+	}
+}
+
+/**
+ * Return the next event to apply at this event point, if any.
+ *
+ * @param[out] event Filled in with the event
+ * @return 1 if an event is due, 0 if none, -1 if the replay has finished
+ *         (and live input has taken over)
+ */
+int
+replay_next_due(ReplayEvent *event)
+{
+	for (;;) {
+		if (replay_mode != ReplayMode_Play) {
+			return -1;
+		}
+		if (!next_valid) {
+			break;
+		}
+
+		if (next_event.type == ReplayEvent_Cmos || next_event.type == ReplayEvent_NetworkRx) {
+			// Waiting for the guest to ask for it, which must be before
+			// it retires any more instructions than it had when recorded
+			if (next_event.position >= point_position) {
+				return 0;
+			}
+			replay_diverge("the guest did not ask for logged data");
+			replay_read_next();
+			continue;
+		}
+
+		if (next_event.position > point_position ||
+		    (next_event.position == point_position && next_event.sequence > point_sequence))
+		{
+			return 0;
+		}
+		if (next_event.type == ReplayEvent_End) {
+			break;
+		}
+
+		*event = next_event;
+		replay_events++;
+		replay_read_next();
+		return 1;
+	}
+
+	replay_report("finished");
+	fclose(replay_file);
+	replay_file = NULL;
+	replay_mode = ReplayMode_Off;
+	return -1;
+}
+
+/**
+ * Hand back data the guest asked for when recorded.
+ *
+ * @param      type  Event expected
+ * @param[out] event Filled in with the event
+ * @return Data of the event (valid until the next call), or NULL if not
+ *         replaying or the log has something else next
+ */
+const uint8_t *
+replay_pull(ReplayEventType type, ReplayEvent *event)
+{
+	if (replay_mode != ReplayMode_Play) {
+		return NULL;
+	}
+	if (!next_valid || next_event.type != (uint32_t) type) {
+		replay_diverge("the guest asked for data that was not logged");
+		return NULL;
+	}
+
+	*event = next_event;
+	memcpy(pulled_data, next_data, next_event.length);
+	replay_events++;
+	replay_read_next();
+	return pulled_data;
+}
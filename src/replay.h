@@ -0,0 +1,130 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * replay.h - Deterministic record and replay of a session
+ *
+ * Everything that reaches the guest from outside (IOMD timer ticks, video
+ * refresh, flyback, keyboard and mouse input, network interrupts, received
+ * frames, resets) is applied at an "event point": a place where the
+ * emulator thread is between runs of guest code. A recording logs each
+ * event against the point it was applied at, identified by the number of
+ * instructions retired and how many points have passed since that number
+ * last changed (the CPU idle loop passes many points without retiring
+ * any). A replay applies each event at the same point, so the guest sees
+ * exactly what it saw when recorded, whatever the speed of the host.
+ *
+ * Data the guest asks for in the middle of guest code (the CMOS contents
+ * at start-up, network receive calls) is logged in the order it was asked
+ * for and handed back in the same order.
+ *
+ * While recording or replaying, the emulated clock (IOMD timers and the
+ * RTC) only moves on at timer events, so reading it gives the same answer
+ * on every run.
+ *
+ * All functions must be called on the emulator thread, apart from the
+ * start functions, which are called before the machine starts.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "rpcemu.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	ReplayMode_Off,
+	ReplayMode_Record,
+	ReplayMode_Play
+} ReplayMode;
+
+/** Types of logged event. The values are stored in the log file. */
+typedef enum {
+	ReplayEvent_Timer = 1,		/**< IOMD timer tick; time is the new emulated clock */
+	ReplayEvent_VSync,		/**< Video refresh timer */
+	ReplayEvent_Flyback,		/**< Video thread finished a frame */
+	ReplayEvent_KeyPress,		/**< a = host key code */
+	ReplayEvent_KeyRelease,		/**< a = host key code */
+	ReplayEvent_MouseMove,		/**< a, b = x, y */
+	ReplayEvent_MouseMoveRelative,	/**< a, b = dx, dy */
+	ReplayEvent_MousePress,		/**< a = buttons (Qt format) */
+	ReplayEvent_MouseRelease,	/**< a = buttons (Qt format) */
+	ReplayEvent_MouseWheel,		/**< a = dy */
+	ReplayEvent_NetworkIRQ,		/**< Network backend raised the podule IRQ */
+	ReplayEvent_Reset,		/**< User reset the machine */
+	ReplayEvent_End,		/**< Recording stopped here */
+	ReplayEvent_Cmos,		/**< Asked for: CMOS RAM at start-up */
+	ReplayEvent_NetworkRx		/**< Asked for: a network receive call; a = returned the error buffer,
+					     b = delivered a frame, data = rx_hdr then payload */
+} ReplayEventType;
+
+typedef struct {
+	uint64_t	position;	/**< Instructions retired */
+	uint32_t	sequence;	/**< Event points passed at this position before this one */
+	uint32_t	type;		/**< ReplayEventType */
+	int64_t		time;		/**< Emulated time applied at, in nanoseconds */
+	int32_t		a;		/**< Event dependent */
+	int32_t		b;		/**< Event dependent */
+	uint32_t	length;		/**< Bytes of data following the event */
+} ReplayEvent;
+
+extern ReplayMode replay_mode;
+extern int replay_fast_forward;		/**< Replay without waiting for the recorded times */
+extern uint64_t replay_inscount_base;	/**< Instructions retired and folded out of inscount */
+extern int64_t replay_clock;		/**< Emulated clock in nanoseconds while recording or replaying */
+extern time_t replay_time_base;		/**< Host time the recording started, for the RTC */
+
+/**
+ * @return Instructions retired since the machine started
+ */
+static inline uint64_t
+replay_position(void)
+{
+	return replay_inscount_base + inscount;
+}
+
+extern int replay_record_start(const char *path);
+extern int replay_play_start(const char *path, int fast_forward);
+extern void replay_stop(void);
+
+extern void replay_event_point(void);
+
+/* Recording */
+extern void replay_record(ReplayEventType type, int64_t time, int32_t a, int32_t b);
+extern void replay_record_data(ReplayEventType type, int32_t a, int32_t b,
+                               const void *data, uint32_t length);
+extern void replay_network_irq(void);
+extern int replay_take_network_irq(void);
+
+/* Replaying */
+extern int replay_next_due(ReplayEvent *event);
+extern const uint8_t *replay_pull(ReplayEventType type, ReplayEvent *event);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REPLAY_H */
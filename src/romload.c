@@ -20,6 +20,7 @@
 
 /* ROM loader */
 #include <errno.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -48,6 +49,8 @@ typedef struct {
 	const char	*comment;	///< Comment that will be added to logfile
 } rom_patch_t;
 
+static uint64_t rom_hash = 0; ///< Hash of the loaded and patched ROM image
+
 static const rom_patch_t rom_patch[] = {
 	// Patching for 8MB VRAM
 	{ 0x138c0, { 0xe3a00402, 0xe2801004, 0xeb000128, 0x03a06002 }, 0x138cc, 0x03a06008, "8MB VRAM RISC OS 3.50" },
@@ -91,6 +94,39 @@ romload_patch(void)
 	}
 }
 
+/**
+ * Calculate a 64-bit FNV-1a hash of the whole ROM area, as stored in
+ * host memory.
+ *
+ * @return Hash value
+ */
+static uint64_t
+romload_calculate_hash(void)
+{
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	size_t i;
+
+	for (i = 0; i < ROMSIZE / 4; i++) {
+		hash ^= rom[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+
+	return hash;
+}
+
+/**
+ * Return the hash of the currently loaded ROM image, including any patches
+ * applied by the loader. Identical images on any machine give the same
+ * value, so it can be used to key caches of ROM derived data.
+ *
+ * @return Hash value
+ */
+uint64_t
+romload_get_hash(void)
+{
+	return rom_hash;
+}
+
 /**
  * qsort comparison function for alphabetical sorting of
  *  C char *pointers. From the qsort() manpage
@@ -122,9 +158,13 @@ void loadroms(void)
         char dirname[280];
         char *romfilenames[MAXROMS];
 	char romdirectory[512];
+	char shared_name[64];
 	DIR *dir;
 	const struct dirent *d;
 
+	/* A previous image may be mapped read-only, get a writable copy */
+	mem_rom_unshare();
+
 	/* Build rom directory path */
 	snprintf(romdirectory, sizeof(romdirectory), "%sroms/", rpcemu_get_datadir());
 
@@ -235,6 +275,9 @@ void loadroms(void)
 
 	rpclog("romload: Total ROM size %d MB\n", pos / 1048576);
 
+	/* Clear the unused area, so identical images hash identically */
+	memset(&romb[pos], 0, ROMSIZE - pos);
+
 #ifdef _RPCEMU_BIG_ENDIAN
 	/* Endian swap */
 	for (c = 0; c < pos; c += 4) {
@@ -262,4 +305,9 @@ void loadroms(void)
 		rom[0x26f0 >> 2] = 0xe3b00000; /* MOVS r0, #0 */
 		rom[0x2750 >> 2] = 0xe3b00000; /* MOVS r0, #0 */
 	}
+
+	/* Share the final image with other processes running the same ROM */
+	rom_hash = romload_calculate_hash();
+	snprintf(shared_name, sizeof(shared_name), "rom-%016" PRIx64 ".bin", rom_hash);
+	mem_rom_share(shared_name);
 }
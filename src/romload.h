@@ -21,6 +21,9 @@
 #ifndef ROMLOAD_H
 #define ROMLOAD_H
 
+#include <stdint.h>
+
 void loadroms(void);
+uint64_t romload_get_hash(void);
 
 #endif /* ROMLOAD_H */
@@ -20,15 +20,25 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <sys/types.h>
 #include <sys/utsname.h>
 #include <sys/wait.h>
 
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
+
 #include "rpcemu.h"
 #include "mem.h"
 #include "sound.h"
@@ -86,4 +96,585 @@ rpcemu_log_os(void)
 	rpclog("OS: Machine = %s\n", u.machine);
 }
 
+/**
+ * Try to map a shared image file, optionally checking it matches the
+ * expected contents.
+ *
+ * @param path Pathname of the image file
+ * @param data Expected contents, or NULL to skip the check for a file
+ *             this process has just written
+ * @param size Size of the image in bytes
+ * @return Pointer to read-only mapping, or NULL if missing or different
+ */
+static void *
+shared_image_open(const char *path, const void *data, size_t size)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size != size) {
+		close(fd);
+		return NULL;
+	}
+
+	p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return NULL;
+	}
+
+	/* The name is only a hash, so guard against collisions and stale files */
+	if (data != NULL && memcmp(p, data, size) != 0) {
+		munmap(p, size);
+		return NULL;
+	}
+
+	return p;
+}
+
+/**
+ * Map a read-only copy of an image that is shared between all RPCEmu
+ * processes on this host using the same data directory.
+ *
+ * The image is stored in the "cache" subdirectory under a content derived
+ * name; every process mapping the same file shares its page cache pages.
+ * The mapping is read-only, so the image cannot be modified through it.
+ *
+ * @param name Content-derived filename for the image
+ * @param data Image contents
+ * @param size Size of the image in bytes
+ * @return Pointer to read-only mapping, or NULL if sharing is not possible
+ */
+void *
+rpcemu_shared_image_map(const char *name, const void *data, size_t size)
+{
+	char dir[512], path[768], temp_path[800];
+	const uint8_t *src = data;
+	size_t done = 0;
+	void *p;
+	int fd;
+
+	snprintf(dir, sizeof(dir), "%scache", rpcemu_get_datadir());
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	p = shared_image_open(path, data, size);
+	if (p != NULL) {
+		return p;
+	}
+
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		rpclog("Shared image: Could not create '%s': %s\n", dir, strerror(errno));
+		return NULL;
+	}
+
+	/* Write to a temporary file and rename, so other processes never
+	   see a partial image */
+	snprintf(temp_path, sizeof(temp_path), "%s.%ld.tmp", path, (long) getpid());
+	fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		rpclog("Shared image: Could not create '%s': %s\n", temp_path, strerror(errno));
+		return NULL;
+	}
+
+	while (done < size) {
+		ssize_t ret = write(fd, src + done, size - done);
+
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			rpclog("Shared image: Write to '%s' failed: %s\n", temp_path, strerror(errno));
+			close(fd);
+			unlink(temp_path);
+			return NULL;
+		}
+		done += (size_t) ret;
+	}
+	close(fd);
+
+	if (rename(temp_path, path) != 0) {
+		rpclog("Shared image: Could not rename '%s': %s\n", temp_path, strerror(errno));
+		unlink(temp_path);
+		return NULL;
+	}
+
+	/* Freshly written from data, so no need to compare it again */
+	return shared_image_open(path, NULL, size);
+}
+
+/**
+ * Release a mapping returned by rpcemu_shared_image_map().
+ *
+ * @param p    Pointer to mapping
+ * @param size Size of the image in bytes
+ */
+void
+rpcemu_shared_image_unmap(void *p, size_t size)
+{
+	munmap(p, size);
+}
+
+/**
+ * Map a file from the "cache" subdirectory of the data directory read-only.
+ *
+ * @param name Filename within the cache directory
+ * @param size Filled in with the size of the file in bytes
+ * @return Pointer to read-only mapping, or NULL if missing or empty
+ */
+void *
+rpcemu_cache_file_map(const char *name, size_t *size)
+{
+	char path[768];
+	struct stat st;
+	void *p;
+	int fd;
+
+	snprintf(path, sizeof(path), "%scache/%s", rpcemu_get_datadir(), name);
 
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		return NULL;
+	}
+
+	p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return NULL;
+	}
+
+	*size = (size_t) st.st_size;
+	return p;
+}
+
+/**
+ * Release a mapping returned by rpcemu_cache_file_map().
+ *
+ * @param p    Pointer to mapping
+ * @param size Size of the file in bytes
+ */
+void
+rpcemu_cache_file_unmap(void *p, size_t size)
+{
+	munmap(p, size);
+}
+
+/**
+ * Replace a file in the "cache" subdirectory of the data directory,
+ * creating the directory if needed. Existing mappings of the old file
+ * stay valid.
+ *
+ * @param name Filename within the cache directory
+ * @param data Data to write
+ * @param size Size of data in bytes
+ * @return 1 on success, 0 on failure (errno is set)
+ */
+int
+rpcemu_cache_file_write(const char *name, const void *data, size_t size)
+{
+	char dir[512], path[768];
+
+	snprintf(dir, sizeof(dir), "%scache", rpcemu_get_datadir());
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		return 0;
+	}
+
+	return rpcemu_file_write_atomic(path, data, size);
+}
+
+/**
+ * Calculate a 64-bit FNV-1a hash of the running executable's file, so data
+ * tied to one build (such as generated code) can be recognised.
+ *
+ * Only implemented on Linux, where the file is /proc/self/exe.
+ *
+ * @param hash Filled in with the hash value
+ * @return 1 on success, 0 if the executable could not be read
+ */
+int
+rpcemu_executable_hash(uint64_t *hash)
+{
+#if defined(__linux__)
+	struct stat st;
+	const uint8_t *p;
+	uint64_t h = UINT64_C(0xcbf29ce484222325);
+	size_t size, i;
+	int fd;
+
+	fd = open("/proc/self/exe", O_RDONLY);
+	if (fd == -1) {
+		return 0;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		return 0;
+	}
+	size = (size_t) st.st_size;
+
+	p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return 0;
+	}
+
+	for (i = 0; i + 4 <= size; i += 4) {
+		uint32_t word;
+
+		memcpy(&word, p + i, 4);
+		h ^= word;
+		h *= UINT64_C(0x100000001b3);
+	}
+	for (; i < size; i++) {
+		h ^= p[i];
+		h *= UINT64_C(0x100000001b3);
+	}
+	munmap((void *) p, size);
+
+	*hash = h;
+	return 1;
+#else
+	NOT_USED(hash);
+
+	return 0;
+#endif
+}
+
+/**
+ * Create a named shared memory region that other processes on this host
+ * can map, replacing any stale region of the same name.
+ *
+ * @param name Name of the region, starting with '/'
+ * @param size Size of the region in bytes
+ * @return Pointer to read-write mapping, or NULL on failure
+ */
+void *
+rpcemu_shared_memory_create(const char *name, size_t size)
+{
+	void *p;
+	int fd;
+
+	shm_unlink(name);
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd == -1) {
+		rpclog("Shared memory: Could not create '%s': %s\n", name, strerror(errno));
+		return NULL;
+	}
+
+	if (ftruncate(fd, (off_t) size) != 0) {
+		rpclog("Shared memory: Could not size '%s': %s\n", name, strerror(errno));
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		rpclog("Shared memory: Could not map '%s': %s\n", name, strerror(errno));
+		shm_unlink(name);
+		return NULL;
+	}
+
+	return p;
+}
+
+/**
+ * Remove the name of a region made by rpcemu_shared_memory_create().
+ * Existing mappings stay valid until they are unmapped or the process exits.
+ *
+ * @param name Name of the region
+ */
+void
+rpcemu_shared_memory_remove(const char *name)
+{
+	shm_unlink(name);
+}
+
+/**
+ * Replace the contents of a file so that after a crash it holds either
+ * the old or the new contents, never a mixture.
+ *
+ * The data is written to a temporary file alongside, flushed to disc and
+ * renamed over the original.
+ *
+ * @param path Pathname of file
+ * @param data Data to write
+ * @param size Size of data in bytes
+ * @return 1 on success, 0 on failure (errno is set)
+ */
+int
+rpcemu_file_write_atomic(const char *path, const void *data, size_t size)
+{
+	char tmp[1024];
+	char dir[1024];
+	const char *slash;
+	const uint8_t *p = data;
+	int saved_errno;
+	int fd;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		return 0;
+	}
+
+	while (size > 0) {
+		ssize_t written = write(fd, p, size);
+
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			goto fail;
+		}
+		p += written;
+		size -= (size_t) written;
+	}
+
+	if (fsync(fd) != 0) {
+		goto fail;
+	}
+	if (close(fd) != 0) {
+		fd = -1;
+		goto fail;
+	}
+	fd = -1;
+
+	if (rename(tmp, path) != 0) {
+		goto fail;
+	}
+
+	/* Make the rename itself durable */
+	slash = strrchr(path, '/');
+	if (slash != NULL) {
+		snprintf(dir, sizeof(dir), "%.*s", (int) (slash - path + 1), path);
+	} else {
+		strcpy(dir, ".");
+	}
+	fd = open(dir, O_RDONLY);
+	if (fd != -1) {
+		(void) fsync(fd);
+		close(fd);
+	}
+
+	return 1;
+
+fail:
+	saved_errno = errno;
+	if (fd != -1) {
+		close(fd);
+	}
+	unlink(tmp);
+	errno = saved_errno;
+	return 0;
+}
+
+#define FILE_CLONE_CHUNK	(8 * 1024 * 1024)	/**< Bytes copied between progress reports */
+
+/**
+ * Copy part of one file to the same offset in another, in chunks, using
+ * copy_file_range() where the kernel can, so the data need not pass
+ * through user space (and network or COW filesystems can share it).
+ * Falls back to read() and write(), leaving all-zero blocks as holes.
+ *
+ * @return 1 on success, 0 on failure (errno is set)
+ */
+static int
+file_clone_range(int in, int out, off_t start, off_t end, uint64_t total,
+                 int (*progress)(void *opaque, uint64_t done, uint64_t total), void *opaque,
+                 int *use_copy_range, char *buffer)
+{
+	off_t pos = start;
+
+	while (pos < end) {
+		const size_t len = (end - pos > FILE_CLONE_CHUNK) ? FILE_CLONE_CHUNK : (size_t) (end - pos);
+		ssize_t done = -1;
+
+#if defined(__linux__) && defined(SYS_copy_file_range)
+		if (*use_copy_range) {
+			loff_t in_off = pos, out_off = pos;
+
+			done = syscall(SYS_copy_file_range, in, &in_off, out, &out_off, len, 0);
+			if (done == -1 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+			                   errno == EOPNOTSUPP))
+			{
+				*use_copy_range = 0;
+			} else if (done == -1 && errno != EINTR) {
+				return 0;
+			}
+		}
+#else
+		NOT_USED(use_copy_range);
+#endif
+		if (done == -1) {
+			size_t i;
+
+			done = pread(in, buffer, len, pos);
+			if (done == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return 0;
+			}
+			/* Leave blocks of zeroes as holes; the file was sized beforehand */
+			for (i = 0; i < (size_t) done && buffer[i] == 0; i++)
+				;
+			if (i < (size_t) done) {
+				ssize_t written = 0;
+
+				while (written < done) {
+					ssize_t w = pwrite(out, buffer + written, (size_t) (done - written), pos + written);
+
+					if (w == -1) {
+						if (errno == EINTR) {
+							continue;
+						}
+						return 0;
+					}
+					written += w;
+				}
+			}
+		}
+		if (done == 0) {
+			/* Source shrank under us */
+			break;
+		}
+		pos += done;
+
+		if (progress != NULL && !progress(opaque, (uint64_t) pos, total)) {
+			errno = ECANCELED;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Copy a file as cheaply as the filesystem allows. Where it supports
+ * reflinks (e.g. Btrfs, XFS) the copy shares the original's blocks until
+ * either is written. Otherwise only the source's data regions are copied,
+ * so holes in sparse disc images stay holes.
+ *
+ * @param src      Pathname of the file to copy
+ * @param dst      Pathname of the copy, which must not exist
+ * @param progress If not NULL, called with bytes done and total as the
+ *                 copy proceeds; return 0 to cancel
+ * @param opaque   Passed to progress
+ * @return 1 on success, 0 on failure or if cancelled (errno is set, to
+ *         ECANCELED if cancelled); a partial copy is removed
+ */
+int
+rpcemu_file_clone(const char *src, const char *dst,
+                  int (*progress)(void *opaque, uint64_t done, uint64_t total), void *opaque)
+{
+	struct stat st;
+	char *buffer = NULL;
+	int use_copy_range = 1;
+	int created = 0;
+	int saved_errno;
+	int in, out = -1;
+	off_t pos;
+
+	in = open(src, O_RDONLY);
+	if (in == -1) {
+		return 0;
+	}
+	if (fstat(in, &st) != 0) {
+		goto fail;
+	}
+	out = open(dst, O_WRONLY | O_CREAT | O_EXCL, st.st_mode & 0777);
+	if (out == -1) {
+		goto fail;
+	}
+	created = 1;
+
+#if defined(__linux__) && defined(FICLONE)
+	if (ioctl(out, FICLONE, in) == 0) {
+		close(in);
+		close(out);
+		if (progress != NULL) {
+			progress(opaque, (uint64_t) st.st_size, (uint64_t) st.st_size);
+		}
+		return 1;
+	}
+#endif
+
+	/* Size the copy first, so that anything not written is a hole */
+	if (ftruncate(out, st.st_size) != 0) {
+		goto fail;
+	}
+
+	buffer = malloc(FILE_CLONE_CHUNK);
+	if (buffer == NULL) {
+		errno = ENOMEM;
+		goto fail;
+	}
+
+	pos = 0;
+	while (pos < st.st_size) {
+		off_t data = pos, hole = st.st_size;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+		data = lseek(in, pos, SEEK_DATA);
+		if (data == -1) {
+			if (errno == ENXIO) {
+				/* Only a hole remains */
+				break;
+			}
+			/* Not supported here: treat the rest as data */
+			data = pos;
+		} else {
+			hole = lseek(in, data, SEEK_HOLE);
+			if (hole == -1) {
+				hole = st.st_size;
+			}
+		}
+#endif
+		if (!file_clone_range(in, out, data, hole, (uint64_t) st.st_size,
+		                      progress, opaque, &use_copy_range, buffer))
+		{
+			goto fail;
+		}
+		pos = hole;
+	}
+
+	free(buffer);
+	buffer = NULL;
+	/* A delayed write error can first be reported here */
+	if (close(out) != 0) {
+		out = -1;
+		goto fail;
+	}
+	close(in);
+	if (progress != NULL) {
+		progress(opaque, (uint64_t) st.st_size, (uint64_t) st.st_size);
+	}
+	return 1;
+
+fail:
+	saved_errno = errno;
+	free(buffer);
+	close(in);
+	if (out != -1) {
+		close(out);
+	}
+	if (created) {
+		unlink(dst);
+	}
+	errno = saved_errno;
+	return 0;
+}
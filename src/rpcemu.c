@@ -58,6 +58,14 @@
 #include "disc_hfe.h"
 #include "disc_mfm_common.h"
 #include "parallel.h"
+#include "printer.h"
+#include "swi.h"
+#include "transcache.h"
+#include "replay.h"
+
+#ifdef RPCEMU_SERIAL_HOST
+#include "serial_host.h"
+#endif
 
 #ifdef RPCEMU_NETWORKING
 #include "network.h"
@@ -104,6 +112,9 @@ Config config = {
 	0,			/* vnc_enabled */
 	5900,			/* vnc_port */
 	"",			/* vnc_password */
+	30,			/* vnc_max_fps */
+	{ 0, 0 },		/* serial_host_type (SerialHost_None) */
+	{ "", "" },		/* serial_host_path */
 };
 
 /* Performance measuring variables */
@@ -114,7 +125,9 @@ Perf perf = {
 	0.0f, /* tlb_sec */
 	0.0f, /* flush_sec */
 	0,    /* mips_count */
-	0.0f  /* mips_total */
+	0.0f, /* mips_total */
+	0.0f, /* video_fps */
+	0.0f  /* video_dropped */
 };
 
 PortForwardRule port_forward_rules[MAX_PORT_FORWARDS]; ///< Port forward rules accross the NAT
@@ -548,6 +561,7 @@ resetrpc(void)
         mem_reset(config.mem_size, config.vram_size);
         cp15_reset(machine.cpu_model);
 	arm_reset(machine.cpu_model);
+	transcache_reset();
 	resetfpa();
         keyboard_reset();
 	iomd_reset(machine.iomd_type);
@@ -632,6 +646,29 @@ rpcemu_log_information(void)
 	}
 }
 
+/**
+ * Host handler for the RISC OS Portable SWIs, intercepted to enable RPCEmu
+ * to sleep when RISC OS is idle.
+ *
+ * @param swinum SWI number
+ * @return 1 if the call has been handled, 0 to pass it on to RISC OS
+ */
+static int
+rpcemu_portable_swi(uint32_t swinum)
+{
+	if (!config.cpu_idle) {
+		return 0;
+	}
+
+	if (swinum == SWI_Portable_ReadFeatures) {
+		arm.reg[1] = (1u << 4);	/* Idle supported flag */
+	} else {
+		rpcemu_idle();
+	}
+	arm.reg[cpsr] &= ~VFLAG;
+	return 1;
+}
+
 /**
  * Start enough of the emulator system to allow
  * the GUI to initialise (e.g. load the config to init
@@ -659,8 +696,14 @@ rpcemu_prestart(void)
 void
 rpcemu_start(void)
 {
+	/* Before any subsystem registers its SWI handlers */
+	swi_init();
+	swi_register(SWI_Portable_ReadFeatures, rpcemu_portable_swi);
+	swi_register(SWI_Portable_Idle, rpcemu_portable_swi);
+
 	hostfs_init();
 	parallel_bus_init();
+	printer_init();
 	mem_init();
 	cp15_init();
 	arm_init();
@@ -676,6 +719,7 @@ rpcemu_start(void)
 
         sound_init();
 
+        transcache_init();
         initcodeblocks();
         iso_init();
         if (config.cdromtype == 2) /* ISO */
@@ -685,6 +729,10 @@ rpcemu_start(void)
 	/* Other components are initialised in the same way as the hardware
 	   being reset */
 	resetrpc();
+
+#ifdef RPCEMU_SERIAL_HOST
+	serial_host_start();
+#endif
 }
 
 /**
@@ -798,8 +846,8 @@ rpcemu_idle(void)
 			iomd.irqa.status |= IOMD_IRQA_FLOPPY_INDEX;
 			updateirqs();
 		}
-		/* Sleep if no interrupts pending */
-		if (!arm.event) {
+		/* Sleep if no interrupts pending, unless replaying flat out */
+		if (!arm.event && !(replay_mode == ReplayMode_Play && replay_fast_forward)) {
 #ifdef RPCEMU_WIN
 			Sleep(1);
 #else
@@ -832,17 +880,31 @@ rpcemu_idle(void)
 void
 endrpcemu(void)
 {
+	replay_stop();
+	/* Finish the print job being written */
+	printer_shutdown();
+#ifdef RPCEMU_SERIAL_HOST
+	/* Join the I/O threads and remove any listening sockets */
+	serial_host_close(SERIAL_PORT_COM1);
+	serial_host_close(SERIAL_PORT_COM2);
+#endif
         sound_thread_close();
         closevideo();
         iomd_end();
         fdc_image_save(discname[0], 0);
         fdc_image_save(discname[1], 1);
+        rpcemu_mem_layout_lock();
         free(vram);
         free(ram00);
         free(ram01);
-        free(rom);
+        vram = ram00 = ram01 = NULL;
+        rpcemu_mem_layout_unlock();
+        transcache_close();
+        mem_rom_free();
         savecmos();
+        cmos_close();
         config_save(&config);
+	swi_profile_log();
 
 #ifdef RPCEMU_NETWORKING
 	network_reset();
@@ -180,6 +180,9 @@ typedef struct {
 	int vnc_enabled;	/**< Enable the built-in VNC server */
 	int vnc_port;		/**< Port for the VNC server (default 5900) */
 	char vnc_password[64];	/**< Password for VNC authentication (empty = no auth) */
+	int vnc_max_fps;	/**< Highest rate frames are sent to VNC clients (1-60) */
+	int serial_host_type[2];	/**< Host backend of COM1 and COM2 (SerialHostType) */
+	char serial_host_path[2][512];	/**< Socket, file or device path of each port's backend */
 } Config;
 
 extern Config config;
@@ -255,6 +258,17 @@ extern void error(const char *format, ...)
 	__attribute__((format(printf, 1, 2)));
 
 extern int path_disk_info(const char *path, disk_info *d);
+extern void *rpcemu_shared_image_map(const char *name, const void *data, size_t size);
+extern void rpcemu_shared_image_unmap(void *p, size_t size);
+extern void *rpcemu_cache_file_map(const char *name, size_t *size);
+extern void rpcemu_cache_file_unmap(void *p, size_t size);
+extern int rpcemu_cache_file_write(const char *name, const void *data, size_t size);
+extern int rpcemu_executable_hash(uint64_t *hash);
+extern void *rpcemu_shared_memory_create(const char *name, size_t size);
+extern void rpcemu_shared_memory_remove(const char *name);
+extern int rpcemu_file_write_atomic(const char *path, const void *data, size_t size);
+extern int rpcemu_file_clone(const char *src, const char *dst,
+                             int (*progress)(void *opaque, uint64_t done, uint64_t total), void *opaque);
 
 extern void updateirqs(void);
 
@@ -263,6 +277,8 @@ extern void sound_thread_start(void);
 extern void sound_thread_close(void);
 extern void plt_sound_set_muted(int muted);
 extern int plt_sound_is_muted(void);
+extern void rpcemu_mem_layout_lock(void);
+extern void rpcemu_mem_layout_unlock(void);
 
 /* Additional logging functions (optional) */
 extern void rpcemu_log_os(void);
@@ -303,10 +319,13 @@ extern void debugger_after_instruction(uint32_t pc, uint32_t opcode);
 
 /* rpc-qt5.cpp */
 extern void rpcemu_video_update(const uint32_t *buffer, int xsize, int ysize, int yl, int yh, int double_size, int host_xsize, int host_ysize);
+extern void rpcemu_video_mode_changed(void);
+extern void rpcemu_video_cursor(const uint32_t *image, int width, int height, int x, int y, int activex, int activey, int shape_changed);
 extern void rpcemu_move_host_mouse(uint16_t x, uint16_t y);
 extern void rpcemu_idle_process_events(void);
 extern void rpcemu_send_nat_rule_to_gui(PortForwardRule rule);
 extern uint64_t rpcemu_nsec_timer_ticks(void);
+extern uint64_t rpcemu_nsec_host_ticks(void);
 
 extern int drawscre;
 extern int quited;
@@ -321,6 +340,8 @@ typedef struct {
 	float flush_sec;
 	uint32_t mips_count;
 	float mips_total;
+	float video_fps;	/**< Frames converted by the video thread per second */
+	float video_dropped;	/**< Frames dropped per second as the video thread was busy */
 } Perf;
 extern Perf perf;
 
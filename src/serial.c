@@ -186,6 +186,36 @@ serial_bus_get_status(SerialPortID port)
     return p->status;
 }
 
+void
+serial_bus_rx_space(SerialPortID port)
+{
+    SerialBusPort *p;
+
+    if (port >= SERIAL_PORT_COUNT) {
+        return;
+    }
+
+    p = &ports[port];
+
+    if (p->has_device && p->device.on_rx_space) {
+        p->device.on_rx_space(p->device.userdata);
+    }
+}
+
+void
+serial_bus_poll(void)
+{
+    int i;
+
+    for (i = 0; i < SERIAL_PORT_COUNT; i++) {
+        if (ports[i].has_device && ports[i].device.on_rx_space &&
+            superio_serial_rx_space((SerialPortID) i) > 0)
+        {
+            ports[i].device.on_rx_space(ports[i].device.userdata);
+        }
+    }
+}
+
 /* ========================================================================
  * Device -> Host (called by attached devices)
  * ======================================================================== */
@@ -201,6 +231,17 @@ serial_bus_device_write_data(SerialPortID port, uint8_t data)
     superio_serial_rx(port, data);
 }
 
+int
+serial_bus_device_write_block(SerialPortID port, const uint8_t *data, int len)
+{
+    if (port >= SERIAL_PORT_COUNT) {
+        return 0;
+    }
+
+    /* Fill UART's RX FIFO */
+    return superio_serial_rx_block(port, data, len);
+}
+
 void
 serial_bus_device_status(SerialPortID port, uint8_t status)
 {
@@ -98,6 +98,14 @@ typedef uint8_t (*serial_status_cb)(void *userdata);
  */
 typedef void (*serial_reset_cb)(void *userdata);
 
+/**
+ * Callback type for when the UART can accept more received data.
+ * Devices that queue data use this to send it in blocks with
+ * serial_bus_device_write_block().
+ * @param userdata  Device-specific context
+ */
+typedef void (*serial_rx_space_cb)(void *userdata);
+
 /**
  * Serial device descriptor
  */
@@ -107,6 +115,7 @@ typedef struct {
     serial_ctrl_cb on_ctrl;        /* Called when Host MCR changes */
     serial_status_cb get_status;   /* Get Device MSR status */
     serial_reset_cb on_reset;      /* Called on bus reset */
+    serial_rx_space_cb on_rx_space; /* Called when UART RX FIFO has room (optional) */
     void *userdata;                /* Device-specific context */
 } SerialDevice;
 
@@ -181,6 +190,19 @@ void serial_bus_set_ctrl(SerialPortID port, uint8_t ctrl);
  */
 uint8_t serial_bus_get_status(SerialPortID port);
 
+/**
+ * Tell the attached device the UART's receive FIFO has room.
+ * Called by SuperIO when the host empties the FIFO.
+ * @param port  Which port
+ */
+void serial_bus_rx_space(SerialPortID port);
+
+/**
+ * Give attached devices a chance to send queued data.
+ * Called periodically from the IOMD timer.
+ */
+void serial_bus_poll(void);
+
 /* ---- Called by attached devices ---- */
 
 /**
@@ -191,6 +213,17 @@ uint8_t serial_bus_get_status(SerialPortID port);
  */
 void serial_bus_device_write_data(SerialPortID port, uint8_t data);
 
+/**
+ * Device sends a block of bytes to Host.
+ * Fills the UART receive FIFO with as many as fit, with one interrupt
+ * update for the block.
+ * @param port  Which port
+ * @param data  Bytes sent
+ * @param len   Number of bytes
+ * @return Number of bytes accepted
+ */
+int serial_bus_device_write_block(SerialPortID port, const uint8_t *data, int len);
+
 /**
  * Device updates its status lines (CTS, DSR, RI, DCD).
  * Changes may trigger Modem Status interrupts.
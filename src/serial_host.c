@@ -0,0 +1,663 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 RPCEmu contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Host Serial Backends Implementation
+ *
+ * Each attached port has an I/O thread and two single-producer,
+ * single-consumer byte rings:
+ *
+ *   rx: filled by the I/O thread with whatever read() returns, drained by
+ *       the emulator thread into the UART receive FIFO whenever the FIFO
+ *       has room (when the guest empties it, and from the IOMD timer).
+ *   tx: filled by the emulator thread as the guest writes THR, drained by
+ *       the I/O thread with one write() per contiguous block.
+ *
+ * The emulator thread only wakes the I/O thread (through a pipe) on the
+ * first byte of each transmit batch, or when the receive ring had filled.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "rpcemu.h"
+#include "serial.h"
+#include "serial_host.h"
+#include "superio.h"
+
+/* Size of each direction's ring buffer (must be a power of two) */
+#define SERIAL_HOST_RING_SIZE (64 * 1024)
+
+/* How often to retry reading a pseudo-terminal with no slave open (ms) */
+#define SERIAL_HOST_PTY_RETRY_MS 100
+
+/* Report a closed socket peer through errno rather than SIGPIPE */
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+/* ========================================================================
+ * Byte Ring
+ * ======================================================================== */
+
+/* head and tail are free-running byte counts */
+typedef struct {
+    uint8_t *data;
+    atomic_size_t head;         /* Only written by the producer */
+    atomic_size_t tail;         /* Only written by the consumer */
+} ByteRing;
+
+static size_t
+ring_used(ByteRing *r)
+{
+    return atomic_load_explicit(&r->head, memory_order_acquire) -
+           atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+static size_t
+ring_free(ByteRing *r)
+{
+    return SERIAL_HOST_RING_SIZE - ring_used(r);
+}
+
+/**
+ * Contiguous bytes available to the consumer, starting at the tail.
+ */
+static size_t
+ring_read_span(ByteRing *r, uint8_t **p)
+{
+    const size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    const size_t offset = tail & (SERIAL_HOST_RING_SIZE - 1);
+    size_t len = ring_used(r);
+
+    if (len > SERIAL_HOST_RING_SIZE - offset) {
+        len = SERIAL_HOST_RING_SIZE - offset;
+    }
+    *p = r->data + offset;
+    return len;
+}
+
+/**
+ * Contiguous space available to the producer, starting at the head.
+ */
+static size_t
+ring_write_span(ByteRing *r, uint8_t **p)
+{
+    const size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    const size_t offset = head & (SERIAL_HOST_RING_SIZE - 1);
+    size_t len = ring_free(r);
+
+    if (len > SERIAL_HOST_RING_SIZE - offset) {
+        len = SERIAL_HOST_RING_SIZE - offset;
+    }
+    *p = r->data + offset;
+    return len;
+}
+
+static void
+ring_consume(ByteRing *r, size_t n)
+{
+    atomic_fetch_add_explicit(&r->tail, n, memory_order_release);
+}
+
+static void
+ring_produce(ByteRing *r, size_t n)
+{
+    atomic_fetch_add_explicit(&r->head, n, memory_order_release);
+}
+
+/* ========================================================================
+ * Per-Port State
+ * ======================================================================== */
+
+typedef struct {
+    int open;
+    SerialPortID port;
+    SerialHostType type;
+    char path[256];
+
+    int fd;                     /* Data stream, -1 if no peer connected */
+    int listen_fd;              /* Unix socket listener, -1 if unused */
+    int wake_fd[2];             /* Pipe used to wake the I/O thread */
+
+    pthread_t thread;
+    atomic_int quit;
+    atomic_int connected;       /* A peer is connected (drives CTS/DSR/DCD) */
+    atomic_int wake_pending;    /* A wake byte is in the pipe */
+    atomic_int rx_blocked;      /* I/O thread stopped reading, rx ring full */
+
+    ByteRing rx;                /* Host -> guest */
+    ByteRing tx;                /* Guest -> host */
+    uint64_t tx_dropped;        /* Bytes lost as the tx ring was full */
+} SerialHost;
+
+static SerialHost hosts[SERIAL_PORT_COUNT];
+
+/**
+ * Wake the I/O thread, unless a wake is already pending. Never blocks.
+ */
+static void
+host_wake(SerialHost *h)
+{
+    if (atomic_exchange(&h->wake_pending, 1) == 0) {
+        const char c = 0;
+
+        (void) write(h->wake_fd[1], &c, 1);
+    }
+}
+
+/* ========================================================================
+ * Serial Device Callbacks (emulator thread)
+ * ======================================================================== */
+
+/**
+ * Called when the guest transmits a byte.
+ */
+static void
+host_on_write(uint8_t data, void *userdata)
+{
+    SerialHost *h = userdata;
+    uint8_t *p;
+
+    if (ring_write_span(&h->tx, &p) == 0) {
+        h->tx_dropped++;
+        return;
+    }
+    *p = data;
+    ring_produce(&h->tx, 1);
+
+    host_wake(h);
+}
+
+/**
+ * Called when the UART receive FIFO has room. Moves as much received data
+ * into it as fits, in blocks.
+ */
+static void
+host_on_rx_space(void *userdata)
+{
+    SerialHost *h = userdata;
+    size_t moved = 0;
+
+    for (;;) {
+        uint8_t *p;
+        size_t len = ring_read_span(&h->rx, &p);
+        int n;
+
+        if (len == 0) {
+            break;
+        }
+        if (len > 16) {
+            len = 16;
+        }
+        n = serial_bus_device_write_block(h->port, p, (int) len);
+        if (n <= 0) {
+            break;
+        }
+        ring_consume(&h->rx, (size_t) n);
+        moved += (size_t) n;
+    }
+
+    if (moved != 0 && atomic_exchange(&h->rx_blocked, 0)) {
+        host_wake(h);
+    }
+}
+
+/**
+ * Report modem status lines: asserted while a peer is connected.
+ */
+static uint8_t
+host_get_status(void *userdata)
+{
+    SerialHost *h = userdata;
+
+    if (atomic_load(&h->connected)) {
+        return SERIAL_STAT_CTS | SERIAL_STAT_DSR | SERIAL_STAT_DCD;
+    }
+    return 0;
+}
+
+/* ========================================================================
+ * I/O Thread
+ * ======================================================================== */
+
+/**
+ * Drop the current peer of a socket backend.
+ */
+static void
+host_disconnect(SerialHost *h)
+{
+    if (h->fd != -1) {
+        close(h->fd);
+        h->fd = -1;
+    }
+    atomic_store(&h->connected, 0);
+    rpclog("Serial Host: COM%d peer disconnected\n", h->port + 1);
+}
+
+/**
+ * Read whatever the host has for us into the rx ring.
+ *
+ * @return 0 normally, -1 on end of stream or error
+ */
+static int
+host_read(SerialHost *h)
+{
+    uint8_t *p;
+    size_t len = ring_write_span(&h->rx, &p);
+    ssize_t n;
+
+    if (len == 0) {
+        return 0;
+    }
+
+    n = read(h->fd, p, len);
+    if (n > 0) {
+        ring_produce(&h->rx, (size_t) n);
+        return 0;
+    }
+    if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * Write as much of the tx ring to the host as it will take.
+ *
+ * @return 0 normally, -1 on error
+ */
+static int
+host_write(SerialHost *h)
+{
+    for (;;) {
+        uint8_t *p;
+        const size_t len = ring_read_span(&h->tx, &p);
+        ssize_t n;
+
+        if (len == 0) {
+            return 0;
+        }
+        if (h->fd == -1) {
+            /* Nothing connected: the bytes go nowhere, as on a bare port */
+            ring_consume(&h->tx, len);
+            continue;
+        }
+
+        if (h->type == SerialHost_UnixSocket) {
+            n = send(h->fd, p, len, SEND_FLAGS);
+        } else {
+            n = write(h->fd, p, len);
+        }
+        if (n > 0) {
+            ring_consume(&h->tx, (size_t) n);
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+            return 0;
+        }
+        return -1;
+    }
+}
+
+static void *
+host_thread(void *arg)
+{
+    SerialHost *h = arg;
+    int pty_idle = 0;
+
+    while (!atomic_load(&h->quit)) {
+        struct pollfd fds[2];
+        int nfds = 1;
+        int timeout = -1;
+        int can_read = (h->type != SerialHost_File);
+        short events;
+
+        fds[0].fd = h->wake_fd[0];
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+
+        if (can_read && ring_free(&h->rx) == 0) {
+            atomic_store(&h->rx_blocked, 1);
+            can_read = (ring_free(&h->rx) != 0);
+        }
+        events = (can_read ? POLLIN : 0) | (ring_used(&h->tx) != 0 ? POLLOUT : 0);
+
+        if (pty_idle) {
+            /* Reading a master with no slave open fails at once, so just
+               wait a while before trying again */
+            timeout = SERIAL_HOST_PTY_RETRY_MS;
+        } else if (h->fd != -1 && events != 0) {
+            fds[1].fd = h->fd;
+            fds[1].events = events;
+            fds[1].revents = 0;
+            nfds = 2;
+        } else if (h->fd == -1 && h->listen_fd != -1) {
+            fds[1].fd = h->listen_fd;
+            fds[1].events = POLLIN;
+            fds[1].revents = 0;
+            nfds = 2;
+        }
+
+        if (poll(fds, (nfds_t) nfds, timeout) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            rpclog("Serial Host: COM%d poll failed: %s\n", h->port + 1, strerror(errno));
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+
+            atomic_store(&h->wake_pending, 0);
+            (void) read(h->wake_fd[0], buf, sizeof(buf));
+        }
+
+        if (pty_idle) {
+            pty_idle = 0;
+            continue;
+        }
+        if (nfds != 2) {
+            continue;
+        }
+
+        if (h->fd == -1) {
+            /* Listening socket */
+            if (fds[1].revents & POLLIN) {
+                int fd = accept(h->listen_fd, NULL, NULL);
+
+                if (fd != -1) {
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                    h->fd = fd;
+                    atomic_store(&h->connected, 1);
+                    rpclog("Serial Host: COM%d peer connected to '%s'\n", h->port + 1, h->path);
+                }
+            }
+            continue;
+        }
+
+        if (can_read && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) &&
+            host_read(h) != 0)
+        {
+            if (h->type == SerialHost_Pty) {
+                pty_idle = 1;
+            } else {
+                if (h->type != SerialHost_UnixSocket) {
+                    rpclog("Serial Host: COM%d read from '%s' failed: %s\n",
+                           h->port + 1, h->path, strerror(errno));
+                }
+                host_disconnect(h);
+            }
+        }
+
+        if (h->fd != -1 && (fds[1].revents & (POLLOUT | POLLHUP | POLLERR)) &&
+            host_write(h) != 0)
+        {
+            if (h->type == SerialHost_Pty) {
+                /* No slave open: the bytes go nowhere */
+                ring_consume(&h->tx, ring_used(&h->tx));
+            } else {
+                if (h->type != SerialHost_UnixSocket) {
+                    rpclog("Serial Host: COM%d write to '%s' failed: %s\n",
+                           h->port + 1, h->path, strerror(errno));
+                }
+                host_disconnect(h);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* ========================================================================
+ * Backend Setup
+ * ======================================================================== */
+
+/**
+ * Put a terminal into raw mode, so bytes pass through unchanged.
+ */
+static void
+host_make_raw(int fd)
+{
+    struct termios t;
+
+    if (tcgetattr(fd, &t) == 0) {
+        cfmakeraw(&t);
+        tcsetattr(fd, TCSANOW, &t);
+    }
+}
+
+/**
+ * Open the host side of a backend.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int
+host_open_stream(SerialHost *h)
+{
+    switch (h->type) {
+    case SerialHost_Pty:
+        h->fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (h->fd == -1 || grantpt(h->fd) != 0 || unlockpt(h->fd) != 0) {
+            return -1;
+        }
+        host_make_raw(h->fd);
+        snprintf(h->path, sizeof(h->path), "%s", ptsname(h->fd));
+        atomic_store(&h->connected, 1);
+        return 0;
+
+    case SerialHost_UnixSocket: {
+        struct sockaddr_un addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(h->path) >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(addr.sun_path, h->path);
+
+        h->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (h->listen_fd == -1) {
+            return -1;
+        }
+        unlink(h->path);
+        if (bind(h->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+            listen(h->listen_fd, 1) != 0)
+        {
+            return -1;
+        }
+        return 0;
+    }
+
+    case SerialHost_File:
+        h->fd = open(h->path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (h->fd == -1) {
+            return -1;
+        }
+        atomic_store(&h->connected, 1);
+        return 0;
+
+    case SerialHost_Device:
+        h->fd = open(h->path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (h->fd == -1) {
+            return -1;
+        }
+        host_make_raw(h->fd);
+        atomic_store(&h->connected, 1);
+        return 0;
+
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+/**
+ * Release everything a backend holds. The I/O thread must not be running.
+ */
+static void
+host_release(SerialHost *h)
+{
+    if (h->fd != -1) {
+        close(h->fd);
+    }
+    if (h->listen_fd != -1) {
+        close(h->listen_fd);
+        unlink(h->path);
+    }
+    if (h->wake_fd[0] != -1) {
+        close(h->wake_fd[0]);
+        close(h->wake_fd[1]);
+    }
+    free(h->rx.data);
+    free(h->tx.data);
+
+    memset(h, 0, sizeof(*h));
+    h->fd = -1;
+    h->listen_fd = -1;
+    h->wake_fd[0] = h->wake_fd[1] = -1;
+}
+
+/* ========================================================================
+ * Public API
+ * ======================================================================== */
+
+int
+serial_host_open(SerialPortID port, SerialHostType type, const char *path)
+{
+    SerialHost *h;
+    SerialDevice device;
+
+    if (port >= SERIAL_PORT_COUNT) {
+        return -1;
+    }
+
+    serial_host_close(port);
+    if (type == SerialHost_None) {
+        return 0;
+    }
+
+    h = &hosts[port];
+    memset(h, 0, sizeof(*h));
+    h->fd = -1;
+    h->listen_fd = -1;
+    h->wake_fd[0] = h->wake_fd[1] = -1;
+    h->port = port;
+    h->type = type;
+    snprintf(h->path, sizeof(h->path), "%s", path != NULL ? path : "");
+
+    h->rx.data = malloc(SERIAL_HOST_RING_SIZE);
+    h->tx.data = malloc(SERIAL_HOST_RING_SIZE);
+    if (h->rx.data == NULL || h->tx.data == NULL || pipe(h->wake_fd) != 0) {
+        rpclog("Serial Host: COM%d failed to allocate buffers\n", port + 1);
+        host_release(h);
+        return -1;
+    }
+    fcntl(h->wake_fd[0], F_SETFL, fcntl(h->wake_fd[0], F_GETFL) | O_NONBLOCK);
+    fcntl(h->wake_fd[1], F_SETFL, fcntl(h->wake_fd[1], F_GETFL) | O_NONBLOCK);
+
+    if (host_open_stream(h) != 0) {
+        rpclog("Serial Host: COM%d failed to open '%s': %s\n", port + 1, h->path,
+               strerror(errno));
+        host_release(h);
+        return -1;
+    }
+
+    if (pthread_create(&h->thread, NULL, host_thread, h) != 0) {
+        rpclog("Serial Host: COM%d failed to start I/O thread\n", port + 1);
+        host_release(h);
+        return -1;
+    }
+#ifdef __linux__
+    (void) pthread_setname_np(h->thread, "rpcemu: serial");
+#endif
+    h->open = 1;
+
+    memset(&device, 0, sizeof(device));
+    device.name = "Host Serial";
+    device.on_write = host_on_write;
+    device.get_status = host_get_status;
+    device.on_rx_space = host_on_rx_space;
+    device.userdata = h;
+
+    serial_bus_detach(port);
+    if (serial_bus_attach(port, &device) < 0) {
+        serial_host_close(port);
+        return -1;
+    }
+
+    rpclog("Serial Host: COM%d connected to '%s'\n", port + 1, h->path);
+    return 0;
+}
+
+void
+serial_host_close(SerialPortID port)
+{
+    SerialHost *h;
+
+    if (port >= SERIAL_PORT_COUNT || !hosts[port].open) {
+        return;
+    }
+
+    h = &hosts[port];
+    serial_bus_detach(port);
+
+    atomic_store(&h->quit, 1);
+    atomic_store(&h->wake_pending, 0);
+    host_wake(h);
+    pthread_join(h->thread, NULL);
+
+    if (h->tx_dropped != 0) {
+        rpclog("Serial Host: COM%d dropped %llu transmitted bytes\n", port + 1,
+               (unsigned long long) h->tx_dropped);
+    }
+    host_release(h);
+}
+
+void
+serial_host_start(void)
+{
+    int port;
+
+    for (port = 0; port < SERIAL_PORT_COUNT; port++) {
+        if (serial_host_open((SerialPortID) port, (SerialHostType) config.serial_host_type[port],
+                             config.serial_host_path[port]) != 0)
+        {
+            error("Could not connect COM%d to '%s'", port + 1, config.serial_host_path[port]);
+        }
+    }
+}
@@ -0,0 +1,72 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 RPCEmu contributors
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Host Serial Backends
+ *
+ * Connects an emulated serial port to a host byte stream: a pseudo-terminal,
+ * a Unix domain socket, a log file or a host serial device. Data is moved
+ * in blocks by an I/O thread per port, through ring buffers, so the
+ * emulator thread never waits on the host.
+ */
+
+#ifndef SERIAL_HOST_H
+#define SERIAL_HOST_H
+
+#include "serial.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    SerialHost_None = 0,        /* Nothing attached */
+    SerialHost_Pty,             /* New pseudo-terminal, slave name logged */
+    SerialHost_UnixSocket,      /* Listening Unix domain socket at path */
+    SerialHost_File,            /* Transmitted data appended to file at path */
+    SerialHost_Device,          /* Host serial device at path */
+} SerialHostType;
+
+/**
+ * Attach a host backend to a serial port, replacing any already attached.
+ * @param port  Which port
+ * @param type  Kind of backend
+ * @param path  Socket, file or device path (unused for SerialHost_Pty)
+ * @return 0 on success, -1 on failure
+ */
+int serial_host_open(SerialPortID port, SerialHostType type, const char *path);
+
+/**
+ * Detach and close the host backend on a serial port, if any.
+ * @param port  Which port
+ */
+void serial_host_close(SerialPortID port);
+
+/**
+ * Attach the host backends chosen in the configuration to both ports,
+ * replacing any already attached.
+ */
+void serial_host_start(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SERIAL_HOST_H */
@@ -27,6 +27,7 @@ void slirp_select_fill(Slirp *slirp, int *pnfds,
 void slirp_select_poll(Slirp *slirp,
                        fd_set *readfds, fd_set *writefds, fd_set *xfds,
                        int select_error);
+int slirp_select_timeout(Slirp *slirp);
 
 void slirp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len);
 
@@ -365,6 +365,32 @@ void slirp_select_fill(Slirp *slirp, int *pnfds,
         *pnfds = nfds;
 }
 
+/*
+ * Milliseconds until the protocol timers next need slirp_select_poll(),
+ * or -1 if nothing is pending and only socket activity matters.
+ * Only meaningful straight after slirp_select_fill().
+ */
+int slirp_select_timeout(Slirp *slirp)
+{
+    u_int now = os_get_time_ms();
+    int timeout = -1;
+
+    (void) slirp;
+
+    if (time_fasttimo) {
+        timeout = (now - time_fasttimo) >= 2 ? 0 : (int) (2 - (now - time_fasttimo));
+    }
+    if (do_slowtimo) {
+        int slow = (now - last_slowtimo) >= 499 ? 0 : (int) (499 - (now - last_slowtimo));
+
+        if (timeout < 0 || slow < timeout) {
+            timeout = slow;
+        }
+    }
+
+    return timeout;
+}
+
 void slirp_select_poll(Slirp *slirp,
                        fd_set *readfds, fd_set *writefds, fd_set *xfds,
                        int select_error)
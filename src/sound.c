@@ -25,6 +25,7 @@
 #include "rpcemu.h"
 #include "mem.h"
 #include "iomd.h"
+#include "replay.h"
 
 #include "sound.h"
 
@@ -118,15 +119,22 @@ sound_irq_update(void)
         int offset = (iomd.sndstat & IOMD_DMA_STATUS_BUFFER) << 1;
         int len;
         unsigned int c;
+        int drop = 0;
 
         // If bigsoundbufferhead is 1 less than bigsoundbuffertail, then
         // the buffer list is full.
         if (((bigsoundbufferhead + 1) & 3) == bigsoundbuffertail)
         {
-                soundcount += 4000;
                 // kick the sound thread to clear the list
                 sound_thread_wakeup();
-                return;
+                if (replay_mode == ReplayMode_Off) {
+                        soundcount += 4000;
+                        return;
+                }
+                // While recording or replaying, the guest's interrupt must
+                // not depend on how fast the host plays sound, so the data
+                // is dropped instead of the interrupt being put off
+                drop = 1;
         }
         page  = soundaddr[offset] & 0xFFFFF000; /** TODO This should also be & with phys_space_mask */
         start = soundaddr[offset] & 0xFF0;
@@ -141,6 +149,10 @@ sound_irq_update(void)
         iomd.sndstat |= (IOMD_DMA_STATUS_INTERRUPT | IOMD_DMA_STATUS_OVERRUN);
         iomd.sndstat ^= IOMD_DMA_STATUS_BUFFER; /* Swap between buffer A and B */
 
+	if (drop) {
+		return;
+	}
+
 	/* Handle sound data all over physical RAM */
 	if (page & 0x08000000) {
 		ramp =  ram1;
@@ -178,7 +178,6 @@ typedef struct {
 
 typedef struct {
     /* Data registers */
-    uint8_t rbr;        /* Receive Buffer Register */
     uint8_t thr;        /* Transmit Holding Register */
     uint8_t dll;        /* Divisor Latch Low */
     uint8_t dlm;        /* Divisor Latch High */
@@ -193,11 +192,15 @@ typedef struct {
     uint8_t msr;        /* Modem Status Register */
     uint8_t scr;        /* Scratch Register */
     
-    /* FIFO buffers */
+    /* FIFO buffers (the receive FIFO holds one byte, the RBR, when the
+       FIFOs are disabled) */
     uint8_t rx_fifo[16];
     uint8_t tx_fifo[16];
     int rx_head, rx_tail, rx_count;
     int tx_head, tx_tail, tx_count;
+    int rx_timeout;     /* Character timeout pending for data below trigger level */
+    int rx_timer_armed; /* Character timeout timer running */
+    uint64_t rx_timer_expiry; /* Emulated time (ns) the timeout fires at */
     
     /* State */
     int fifo_enabled;
@@ -210,6 +213,9 @@ typedef struct {
 
 static SuperIOType super_type;
 
+/* Emulated time (ns) as of the last serial timer tick */
+static uint64_t uart_clock;
+
 /* Configuration mode */
 static int configmode = SUPERIO_MODE_NORMAL;
 static uint8_t configregs665[16];
@@ -562,6 +568,105 @@ uart_reset(UART *uart, uint16_t base)
     uart->dlm = 0;
 }
 
+/**
+ * Number of bytes the receive FIFO can hold: 16, or 1 with FIFOs disabled.
+ */
+static int
+uart_rx_capacity(const UART *uart)
+{
+    return uart->fifo_enabled ? 16 : 1;
+}
+
+/**
+ * Receive FIFO trigger level selected by FCR bits 7:6.
+ */
+static int
+uart_rx_trigger(const UART *uart)
+{
+    static const int levels[4] = { 1, 4, 8, 14 };
+
+    return uart->fifo_enabled ? levels[uart->fcr >> 6] : 1;
+}
+
+/**
+ * Add a received byte to the receive FIFO, flagging an overrun if full.
+ */
+static void
+uart_rx_push(UART *uart, uint8_t data)
+{
+    if (uart->rx_count >= uart_rx_capacity(uart)) {
+        /* Overrun: a 16450 overwrites its RBR, a 16550 loses the new byte */
+        uart->lsr |= LSR_OE;
+        if (!uart->fifo_enabled) {
+            uart->rx_fifo[uart->rx_head] = data;
+        }
+        return;
+    }
+    uart->rx_fifo[uart->rx_tail] = data;
+    uart->rx_tail = (uart->rx_tail + 1) & 15;
+    uart->rx_count++;
+    uart->lsr |= LSR_DR;
+}
+
+/**
+ * Remove the oldest byte from the receive FIFO.
+ */
+/**
+ * Time taken to receive one character at the current baud rate and line
+ * format, in nanoseconds. The divisor counts a 1.8432 MHz clock / 16.
+ */
+static uint64_t
+uart_char_time(const UART *uart)
+{
+    unsigned divisor = ((unsigned) uart->dlm << 8) | uart->dll;
+    unsigned bits;
+
+    if (divisor == 0) {
+        divisor = 65536;
+    }
+
+    /* Start bit, 5-8 data bits, optional parity, 1 or 2 stop bits */
+    bits = 1 + 5 + (uart->lcr & 0x03) + ((uart->lcr & 0x08) ? 1 : 0) +
+           ((uart->lcr & 0x04) ? 2 : 1);
+
+    return (uint64_t) divisor * 16 * bits * 1000000000ULL / 1843200;
+}
+
+/**
+ * (Re)start the character timeout timer. A 16550 raises the timeout
+ * interrupt when no character has been received or read from the FIFO for
+ * four character times.
+ */
+static void
+uart_rx_timer_restart(UART *uart)
+{
+    uart->rx_timeout = 0;
+    uart->rx_timer_armed = 1;
+    uart->rx_timer_expiry = uart_clock + 4 * uart_char_time(uart);
+}
+
+static uint8_t
+uart_rx_pop(UART *uart)
+{
+    uint8_t val;
+
+    if (uart->rx_count == 0) {
+        /* Reading an empty RBR returns the last byte again */
+        return uart->rx_fifo[(uart->rx_head - 1) & 15];
+    }
+    val = uart->rx_fifo[uart->rx_head];
+    uart->rx_head = (uart->rx_head + 1) & 15;
+    uart->rx_count--;
+    if (uart->rx_count == 0) {
+        uart->lsr &= ~LSR_DR;
+        uart->rx_timeout = 0;
+        uart->rx_timer_armed = 0;
+    } else {
+        uart_rx_timer_restart(uart);
+    }
+    return val;
+}
+
 static void
 uart_update_iir(UART *uart)
 {
@@ -569,9 +674,12 @@ uart_update_iir(UART *uart)
     if ((uart->ier & 0x04) && (uart->lsr & (LSR_OE | LSR_PE | LSR_FE | LSR_BI))) {
         /* Receiver Line Status */
         uart->iir = IIR_RLS;
-    } else if ((uart->ier & 0x01) && (uart->lsr & LSR_DR)) {
-        /* Received Data Available */
+    } else if ((uart->ier & 0x01) && uart->rx_count >= uart_rx_trigger(uart)) {
+        /* Received Data Available, at or above the trigger level */
         uart->iir = IIR_RDA;
+    } else if ((uart->ier & 0x01) && uart->rx_count > 0 && uart->rx_timeout) {
+        /* Character Timeout, data below the trigger level */
+        uart->iir = IIR_CTI;
     } else if ((uart->ier & 0x02) && (uart->lsr & LSR_THRE)) {
         /* Transmitter Holding Register Empty */
         uart->iir = IIR_THRE;
@@ -617,10 +725,17 @@ uart_write(UART *uart, uint32_t offset, uint8_t val, SerialPortID bus_port)
         
     case UART_FCR:  /* FCR (write-only) */
         uart->fcr = val;
+        if (((val & 0x01) != 0) != uart->fifo_enabled) {
+            /* Changing FIFO mode clears the FIFOs */
+            val |= 0x06;
+        }
         uart->fifo_enabled = (val & 0x01) != 0;
         if (val & 0x02) {
             /* Clear receive FIFO */
             uart->rx_head = uart->rx_tail = uart->rx_count = 0;
+            uart->rx_timeout = 0;
+            uart->rx_timer_armed = 0;
+            uart->lsr &= ~LSR_DR;
         }
         if (val & 0x04) {
             /* Clear transmit FIFO */
@@ -667,9 +782,12 @@ uart_read(UART *uart, uint32_t offset, SerialPortID bus_port)
             val = uart->dll;
         } else {
             /* Read receive buffer */
-            val = uart->rbr;
-            uart->lsr &= ~LSR_DR;
+            val = uart_rx_pop(uart);
             uart_update_iir(uart);
+            if (uart->rx_count == 0) {
+                /* Let the attached device refill the FIFO */
+                serial_bus_rx_space(bus_port);
+            }
         }
         break;
         
@@ -733,41 +851,140 @@ uart_read(UART *uart, uint32_t offset, SerialPortID bus_port)
  * ======================================================================== */
 
 /**
- * Inject a received byte into a UART's receive buffer.
- * Called by serial bus when device sends data to host.
+ * Get the UART for a serial bus port.
  */
-void
-superio_serial_rx(SerialPortID port, uint8_t data)
+static UART *
+uart_from_port(SerialPortID port)
 {
-    UART *uart;
-    
     switch (port) {
     case SERIAL_PORT_COM1:
-        uart = &com1;
-        break;
+        return &com1;
     case SERIAL_PORT_COM2:
-        uart = &com2;
-        break;
+        return &com2;
     default:
-        return;
+        return NULL;
     }
-    
-    /* Put data in receive buffer register */
-    uart->rbr = data;
-    
-    /* Set Data Ready bit in LSR */
-    uart->lsr |= LSR_DR;
-    
-    /* Update interrupt identification */
-    uart_update_iir(uart);
-    
-    /* Trigger FIQ for COM1 if RX interrupt is enabled */
-    if (port == SERIAL_PORT_COM1 && (uart->ier & 0x01)) {
+}
+
+/**
+ * Raise the serial interrupt if received data is ready to be serviced.
+ */
+static void
+uart_rx_interrupt(UART *uart, SerialPortID port)
+{
+    const uint8_t id = uart->iir & 0x0F;
+
+    /* Trigger FIQ for COM1 if an RX interrupt is pending */
+    if (port == SERIAL_PORT_COM1 && (id == IIR_RDA || id == IIR_CTI)) {
         iomd.fiq.status |= IOMD_FIQ_SERIAL;
         updateirqs();
     }
 }
 
+/**
+ * Inject a received byte into a UART's receive buffer.
+ * Called by serial bus when device sends data to host.
+ */
+void
+superio_serial_rx(SerialPortID port, uint8_t data)
+{
+    UART *uart = uart_from_port(port);
+
+    if (uart != NULL && superio_serial_rx_block(port, &data, 1) == 0) {
+        /* No room: the byte is lost and an overrun flagged */
+        uart_rx_push(uart, data);
+        uart_update_iir(uart);
+    }
+}
+
+/**
+ * Inject a block of received bytes into a UART's receive FIFO, as many as
+ * fit. The interrupt state is updated once for the whole block: a data
+ * available interrupt if the trigger level is reached. The character
+ * timeout timer is restarted, so data left below the trigger level raises
+ * a timeout interrupt from superio_serial_timer() once the line has been
+ * quiet for four character times.
+ *
+ * @param port Which port
+ * @param data Bytes received
+ * @param len  Number of bytes
+ * @return Number of bytes accepted
+ */
+int
+superio_serial_rx_block(SerialPortID port, const uint8_t *data, int len)
+{
+    UART *uart = uart_from_port(port);
+    int space, i;
+
+    if (uart == NULL) {
+        return 0;
+    }
+
+    space = uart_rx_capacity(uart) - uart->rx_count;
+    if (space <= 0) {
+        return 0;
+    }
+    if (len > space) {
+        len = space;
+    }
+
+    for (i = 0; i < len; i++) {
+        uart_rx_push(uart, data[i]);
+    }
+    uart_rx_timer_restart(uart);
+
+    uart_update_iir(uart);
+    uart_rx_interrupt(uart, port);
+
+    return len;
+}
+
+/**
+ * Advance the UARTs' character timeout timers, raising the timeout
+ * interrupt on any whose receive FIFO has held data untouched for four
+ * character times. Called from the periodic timer interrupt, so timeouts
+ * are seen with its 2ms granularity.
+ *
+ * @param nsec Current emulated time in nanoseconds
+ */
+void
+superio_serial_timer(uint64_t nsec)
+{
+    SerialPortID port;
+
+    uart_clock = nsec;
+
+    for (port = SERIAL_PORT_COM1; port < SERIAL_PORT_COUNT; port++) {
+        UART *uart = uart_from_port(port);
+
+        if (uart->rx_timer_armed && nsec >= uart->rx_timer_expiry) {
+            uart->rx_timer_armed = 0;
+            if (uart->rx_count > 0) {
+                uart->rx_timeout = 1;
+                uart_update_iir(uart);
+                uart_rx_interrupt(uart, port);
+            }
+        }
+    }
+}
+
+/**
+ * Number of bytes that can be added to a UART's receive FIFO.
+ *
+ * @param port Which port
+ * @return Free space in bytes
+ */
+int
+superio_serial_rx_space(SerialPortID port)
+{
+    UART *uart = uart_from_port(port);
+
+    if (uart == NULL) {
+        return 0;
+    }
+    return uart_rx_capacity(uart) - uart->rx_count;
+}
+
 /**
  * Update a UART's modem status register.
  * Called by serial bus when device status lines change.
@@ -775,18 +992,11 @@ superio_serial_rx(SerialPortID port, uint8_t data)
 void
 superio_serial_update_msr(SerialPortID port, uint8_t status)
 {
-    UART *uart;
+    UART *uart = uart_from_port(port);
     uint8_t old_status;
     uint8_t delta;
     
-    switch (port) {
-    case SERIAL_PORT_COM1:
-        uart = &com1;
-        break;
-    case SERIAL_PORT_COM2:
-        uart = &com2;
-        break;
-    default:
+    if (uart == NULL) {
         return;
     }
     
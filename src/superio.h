@@ -48,7 +48,10 @@ extern void superio_get_snapshot(SuperIOStateSnapshot *snapshot);
 /* Serial port interface (called by serial bus) */
 #include "serial.h"  /* For SerialPortID */
 extern void superio_serial_rx(SerialPortID port, uint8_t data);
+extern int superio_serial_rx_block(SerialPortID port, const uint8_t *data, int len);
+extern int superio_serial_rx_space(SerialPortID port);
 extern void superio_serial_update_msr(SerialPortID port, uint8_t status);
+extern void superio_serial_timer(uint64_t nsec);
 
 #ifdef __cplusplus
 }
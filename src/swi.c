@@ -0,0 +1,250 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * swi.c - Host handlers for guest SWIs
+ *
+ * Open addressing hash table keyed on SWI number. Entries are never
+ * removed, so a lookup stops at the first empty slot. A SWI may have a
+ * few handlers from different subsystems; they are tried in the order they
+ * were registered until one handles the call. Registered SWIs always have
+ * an entry and are counted; while profiling is enabled,
+ * entries with no handler are also added for every other SWI seen, so
+ * the whole SWI mix can be reported.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rpcemu.h"
+#include "swi.h"
+
+#define SWI_TABLE_BITS	12
+#define SWI_TABLE_SIZE	(1u << SWI_TABLE_BITS)
+
+/** Stop adding profiling entries when the table is this full */
+#define SWI_TABLE_LIMIT	((SWI_TABLE_SIZE * 3) / 4)
+
+/** Flag stored in an entry's SWI number to mark it in use */
+#define SWI_ENTRY_USED	0x80000000u
+
+/** Maximum number of handlers for one SWI */
+#define SWI_MAX_HANDLERS	4
+
+typedef struct {
+	uint32_t	swinum;		/**< SWI number | SWI_ENTRY_USED, 0 if empty */
+	SWIHandler	handlers[SWI_MAX_HANDLERS]; /**< In registration order */
+	unsigned	nhandlers;	/**< 0 for entries only used for profiling */
+	uint64_t	count;		/**< Number of calls */
+} SWIEntry;
+
+static SWIEntry swi_table[SWI_TABLE_SIZE];
+static unsigned swi_entries;	/**< Number of slots in use */
+static int swi_profiling;	/**< Count SWIs that have no handler */
+
+/**
+ * Find the slot for a SWI number: either its entry or the empty slot
+ * where it would be inserted.
+ *
+ * @param swinum SWI number
+ * @return Pointer to slot
+ */
+static inline SWIEntry *
+swi_lookup(uint32_t swinum)
+{
+	const uint32_t key = swinum | SWI_ENTRY_USED;
+	uint32_t i = (swinum * 2654435761u) >> (32 - SWI_TABLE_BITS);
+
+	for (;;) {
+		SWIEntry *entry = &swi_table[i];
+
+		if (entry->swinum == key || entry->swinum == 0) {
+			return entry;
+		}
+		i = (i + 1) & (SWI_TABLE_SIZE - 1);
+	}
+}
+
+/**
+ * Clear all handlers and counts. Must be called before any subsystem
+ * registers its handlers.
+ *
+ * Profiling can be enabled from startup by setting RPCEMU_SWI_PROFILE.
+ */
+void
+swi_init(void)
+{
+	const char *profile = getenv("RPCEMU_SWI_PROFILE");
+
+	memset(swi_table, 0, sizeof(swi_table));
+	swi_entries = 0;
+	swi_profiling = (profile != NULL && profile[0] != '\0' && profile[0] != '0');
+}
+
+/**
+ * Add a host handler for a SWI. Handlers already registered for the SWI
+ * are tried first; registering the same handler again has no effect.
+ *
+ * @param swinum  SWI number, with the X bit clear
+ * @param handler Function to call when the guest issues the SWI
+ */
+void
+swi_register(uint32_t swinum, SWIHandler handler)
+{
+	SWIEntry *entry = swi_lookup(swinum);
+	unsigned i;
+
+	if (entry->swinum == 0) {
+		if (swi_entries >= SWI_TABLE_SIZE - 1) {
+			fatal("SWI table full registering &%x", swinum);
+		}
+		entry->swinum = swinum | SWI_ENTRY_USED;
+		swi_entries++;
+	}
+
+	for (i = 0; i < entry->nhandlers; i++) {
+		if (entry->handlers[i] == handler) {
+			return;
+		}
+	}
+	if (entry->nhandlers == SWI_MAX_HANDLERS) {
+		fatal("Too many handlers registered for SWI &%x", swinum);
+	}
+	entry->handlers[entry->nhandlers++] = handler;
+}
+
+/**
+ * Pass a guest SWI to its host handler, if it has one.
+ *
+ * Called from opSWI() for every SWI the guest issues.
+ *
+ * @param swinum SWI number, with the X bit clear
+ * @return 1 if the SWI has been handled, 0 to pass it on to RISC OS
+ */
+int
+swi_dispatch(uint32_t swinum)
+{
+	SWIEntry *entry = swi_lookup(swinum);
+	unsigned i;
+
+	if (entry->swinum == 0) {
+		if (!swi_profiling || swi_entries >= SWI_TABLE_LIMIT) {
+			return 0;
+		}
+		entry->swinum = swinum | SWI_ENTRY_USED;
+		swi_entries++;
+	}
+
+	entry->count++;
+
+	for (i = 0; i < entry->nhandlers; i++) {
+		if (entry->handlers[i](swinum)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Enable or disable counting of SWIs that have no host handler.
+ *
+ * @param enable Non-zero to enable
+ */
+void
+swi_profile_enable(int enable)
+{
+	swi_profiling = enable;
+}
+
+/**
+ * Compare two SWICount entries so the most called sorts first.
+ */
+static int
+swi_count_compare(const void *a, const void *b)
+{
+	const SWICount *ca = a;
+	const SWICount *cb = b;
+
+	if (ca->count != cb->count) {
+		return (ca->count > cb->count) ? -1 : 1;
+	}
+	return (ca->swinum < cb->swinum) ? -1 : (ca->swinum > cb->swinum);
+}
+
+/**
+ * Get the number of calls to each SWI seen so far, most called first.
+ * SWIs without a handler are only included while profiling is enabled.
+ *
+ * @param counts Filled in with up to max entries
+ * @param max    Size of counts
+ * @return Number of entries filled in
+ */
+int
+swi_get_counts(SWICount *counts, int max)
+{
+	SWICount *all;
+	unsigned i;
+	int n = 0;
+
+	all = malloc(SWI_TABLE_SIZE * sizeof(SWICount));
+	if (all == NULL) {
+		return 0;
+	}
+
+	for (i = 0; i < SWI_TABLE_SIZE; i++) {
+		if (swi_table[i].swinum != 0 && swi_table[i].count != 0) {
+			all[n].swinum = swi_table[i].swinum & ~SWI_ENTRY_USED;
+			all[n].count = swi_table[i].count;
+			n++;
+		}
+	}
+
+	qsort(all, (size_t) n, sizeof(SWICount), swi_count_compare);
+
+	if (n > max) {
+		n = max;
+	}
+	memcpy(counts, all, (size_t) n * sizeof(SWICount));
+	free(all);
+
+	return n;
+}
+
+/**
+ * Write the most called SWIs to the log, if profiling is enabled.
+ */
+void
+swi_profile_log(void)
+{
+	SWICount counts[32];
+	int n, i;
+
+	if (!swi_profiling) {
+		return;
+	}
+
+	n = swi_get_counts(counts, 32);
+
+	rpclog("SWI profile: %d most called SWIs\n", n);
+	for (i = 0; i < n; i++) {
+		rpclog("  &%05x %12llu\n", counts[i].swinum,
+		       (unsigned long long) counts[i].count);
+	}
+}
@@ -0,0 +1,75 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * swi.h - Host handlers for guest SWIs
+ *
+ * Subsystems register a handler for each SWI number they want to see;
+ * more than one subsystem may register for the same SWI.
+ * opSWI() looks the SWI up in a small hash table, so SWIs nobody is
+ * interested in cost one probe before being passed to RISC OS.
+ */
+
+#ifndef SWI_H
+#define SWI_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SWI_OS_Byte		0x6
+#define SWI_OS_Word		0x7
+#define SWI_OS_Mouse		0x1c
+#define SWI_OS_CallASWI		0x6f
+#define SWI_OS_CallASWIR12	0x71
+
+#define SWI_IIC_Control		0x240
+
+#define SWI_Portable_ReadFeatures	0x42fc5
+#define SWI_Portable_Idle		0x42fc6
+
+/**
+ * Host handler for a SWI. Registers are read and written through arm.reg[].
+ *
+ * @param swinum SWI number, with the X bit clear
+ * @return 1 if the SWI has been handled, 0 to pass it on to RISC OS
+ */
+typedef int (*SWIHandler)(uint32_t swinum);
+
+/** Number of calls to one SWI, as reported by swi_get_counts() */
+typedef struct {
+	uint32_t	swinum;
+	uint64_t	count;
+} SWICount;
+
+extern void swi_init(void);
+extern void swi_register(uint32_t swinum, SWIHandler handler);
+extern int swi_dispatch(uint32_t swinum);
+extern void swi_profile_enable(int enable);
+extern int swi_get_counts(SWICount *counts, int max);
+extern void swi_profile_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SWI_H */
@@ -0,0 +1,494 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * transcache.c - Persistent cache of dynarec translations of ROM code
+ *
+ * The file is named after the ROM hash and CPU model, and holds a header
+ * followed by TransCacheBlock records. It is mapped read-only and indexed
+ * with an open-addressed hash table; blocks compiled during the run are
+ * held in the same table and the whole table is written back on close.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rpcemu.h"
+#include "mem.h"
+#include "romload.h"
+#include "replay.h"
+#include "transcache.h"
+
+#define TRANSCACHE_MAGIC	0x43545052	/* "RPTC" */
+#define TRANSCACHE_VERSION	2
+#define TRANSCACHE_MAX_BLOCKS	32768		/**< Limit on blocks in one file */
+
+typedef struct {
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	rom_hash;	/**< romload_get_hash() of the image */
+	uint64_t	build_id;	/**< Identifies the code generator build */
+	uint32_t	cpu_model;	/**< CPUModel the code was generated for */
+	uint32_t	block_count;	/**< Number of records that follow */
+	uint64_t	checksum;	/**< transcache_checksum() of the rest of the file */
+} TransCacheHeader;
+
+static struct {
+	int		enabled;	/**< Requested with RPCEMU_DYNAREC_CACHE */
+	uint64_t	build_id;	/**< Zero if the code generator cannot cache */
+	int		open;		/**< Key below is valid */
+	uint64_t	rom_hash;
+	uint32_t	cpu_model;
+	char		name[64];	/**< Filename within the cache directory */
+
+	uint8_t		*map;		/**< Mapping of the file, or NULL */
+	size_t		map_size;
+
+	const TransCacheBlock **index;	/**< Hash table, NULL for empty slots */
+	uint32_t	index_size;	/**< Number of slots (power of two) */
+	uint32_t	count;		/**< Number of blocks in the table */
+
+	TransCacheBlock	**owned;	/**< Blocks stored during this run */
+	uint32_t	owned_count;
+	uint32_t	owned_size;
+
+	int		dirty;		/**< Table differs from the file */
+	uint32_t	hits;		/**< Blocks installed from the cache */
+} transcache;
+
+/**
+ * @param block Cached block
+ * @return Size of the whole record in bytes
+ */
+static size_t
+transcache_record_size(const TransCacheBlock *block)
+{
+	return (sizeof(TransCacheBlock) + block->code_size + (block->reloc_count * 2u) + 3u) & ~(size_t) 3;
+}
+
+/**
+ * Continue a 64-bit FNV-1a hash over some bytes.
+ *
+ * @param hash Hash so far
+ * @param data Bytes to add
+ * @param size Number of bytes
+ * @return Updated hash
+ */
+static uint64_t
+transcache_hash_bytes(uint64_t hash, const uint8_t *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+	return hash;
+}
+
+/**
+ * Calculate the checksum of a cache file: its header up to the checksum
+ * field, and all the records after the header.
+ *
+ * @param file Contents of the file
+ * @param size Size of the file in bytes, at least sizeof(TransCacheHeader)
+ * @return Checksum
+ */
+static uint64_t
+transcache_checksum(const uint8_t *file, size_t size)
+{
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+
+	hash = transcache_hash_bytes(hash, file, offsetof(TransCacheHeader, checksum));
+	return transcache_hash_bytes(hash, file + sizeof(TransCacheHeader), size - sizeof(TransCacheHeader));
+}
+
+/**
+ * @return Starting slot in the hash table for a key
+ */
+static uint32_t
+transcache_hash(uint32_t pc, uint32_t rom_offset, uint32_t r15_mask)
+{
+	uint32_t h = (pc >> 2) * 0x9e3779b1u;
+
+	h ^= (rom_offset >> 2) * 0x85ebca6bu;
+	h ^= r15_mask;
+	return h & (transcache.index_size - 1);
+}
+
+/**
+ * Find the hash table slot holding a key, or the empty slot it would go in.
+ */
+static uint32_t
+transcache_slot(uint32_t pc, uint32_t rom_offset, uint32_t r15_mask)
+{
+	uint32_t slot = transcache_hash(pc, rom_offset, r15_mask);
+
+	for (;;) {
+		const TransCacheBlock *b = transcache.index[slot];
+
+		if (b == NULL || (b->pc == pc && b->rom_offset == rom_offset && b->r15_mask == r15_mask)) {
+			return slot;
+		}
+		slot = (slot + 1) & (transcache.index_size - 1);
+	}
+}
+
+/**
+ * Add a block to the hash table, replacing any with the same key.
+ *
+ * @param block Block to add
+ */
+static void
+transcache_insert(const TransCacheBlock *block)
+{
+	uint32_t slot;
+
+	if ((transcache.count + 1) * 4 > transcache.index_size * 3) {
+		const TransCacheBlock **old = transcache.index;
+		const uint32_t old_size = transcache.index_size;
+		uint32_t i;
+
+		transcache.index_size = old_size ? old_size * 2 : 4096;
+		transcache.index = calloc(transcache.index_size, sizeof(TransCacheBlock *));
+		if (transcache.index == NULL) {
+			fatal("Out of memory in transcache_insert()");
+		}
+		for (i = 0; i < old_size; i++) {
+			if (old[i] != NULL) {
+				transcache.index[transcache_slot(old[i]->pc, old[i]->rom_offset, old[i]->r15_mask)] = old[i];
+			}
+		}
+		free(old);
+	}
+
+	slot = transcache_slot(block->pc, block->rom_offset, block->r15_mask);
+	if (transcache.index[slot] == NULL) {
+		transcache.count++;
+	}
+	transcache.index[slot] = block;
+}
+
+/**
+ * Check a mapped cache file and add its blocks to the hash table.
+ *
+ * @return 1 if the file matches the current key and its checksum, 0 if it
+ *         is stale or corrupt
+ */
+static int
+transcache_load(void)
+{
+	const TransCacheHeader *header = (const TransCacheHeader *) transcache.map;
+	size_t pos = sizeof(TransCacheHeader);
+	uint32_t i;
+
+	if (transcache.map_size < sizeof(TransCacheHeader) ||
+	    header->magic != TRANSCACHE_MAGIC ||
+	    header->version != TRANSCACHE_VERSION ||
+	    header->rom_hash != transcache.rom_hash ||
+	    header->build_id != transcache.build_id ||
+	    header->cpu_model != transcache.cpu_model ||
+	    header->block_count > TRANSCACHE_MAX_BLOCKS ||
+	    header->checksum != transcache_checksum(transcache.map, transcache.map_size))
+	{
+		return 0;
+	}
+
+	for (i = 0; i < header->block_count; i++) {
+		const TransCacheBlock *b = (const TransCacheBlock *) (transcache.map + pos);
+
+		if (transcache.map_size - pos < sizeof(TransCacheBlock) ||
+		    transcache.map_size - pos < transcache_record_size(b) ||
+		    b->rom_offset >= ROMSIZE)
+		{
+			return 0;
+		}
+		transcache_insert(b);
+		pos += transcache_record_size(b);
+	}
+
+	return 1;
+}
+
+/**
+ * Write the hash table to the cache file.
+ */
+static void
+transcache_save(void)
+{
+	TransCacheHeader header;
+	uint8_t *buffer;
+	size_t size = sizeof(TransCacheHeader);
+	size_t pos;
+	uint32_t i;
+
+	for (i = 0; i < transcache.index_size; i++) {
+		if (transcache.index[i] != NULL) {
+			size += transcache_record_size(transcache.index[i]);
+		}
+	}
+
+	buffer = malloc(size);
+	if (buffer == NULL) {
+		rpclog("Translation cache: Out of memory saving '%s'\n", transcache.name);
+		return;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = TRANSCACHE_MAGIC;
+	header.version = TRANSCACHE_VERSION;
+	header.rom_hash = transcache.rom_hash;
+	header.build_id = transcache.build_id;
+	header.cpu_model = transcache.cpu_model;
+	header.block_count = transcache.count;
+	memcpy(buffer, &header, sizeof(header));
+
+	pos = sizeof(TransCacheHeader);
+	for (i = 0; i < transcache.index_size; i++) {
+		const TransCacheBlock *b = transcache.index[i];
+
+		if (b != NULL) {
+			memcpy(buffer + pos, b, transcache_record_size(b));
+			pos += transcache_record_size(b);
+		}
+	}
+
+	header.checksum = transcache_checksum(buffer, size);
+	memcpy(buffer + offsetof(TransCacheHeader, checksum), &header.checksum, sizeof(header.checksum));
+
+	if (rpcemu_cache_file_write(transcache.name, buffer, size)) {
+		rpclog("Translation cache: Saved %u blocks to '%s'\n", transcache.count, transcache.name);
+	} else {
+		rpclog("Translation cache: Could not write '%s'\n", transcache.name);
+	}
+	free(buffer);
+}
+
+/**
+ * Check whether the cache has been requested. Called once on start-up.
+ */
+void
+transcache_init(void)
+{
+	const char *env = getenv("RPCEMU_DYNAREC_CACHE");
+
+	transcache.enabled = (env != NULL && env[0] != '\0' && strcmp(env, "0") != 0);
+	if (transcache.enabled && replay_mode != ReplayMode_Off) {
+		rpclog("Dynarec cache: Not used while recording or replaying a session\n");
+		transcache.enabled = 0;
+	}
+}
+
+/**
+ * @return Non-zero if the cache has been requested
+ */
+int
+transcache_enabled(void)
+{
+	return transcache.enabled;
+}
+
+/**
+ * Set by a code generator that can relocate its blocks, to identify its
+ * build. Cache files written by any other build are ignored.
+ *
+ * @param build_id Build identifier, or 0 if the build cannot be identified
+ */
+void
+transcache_set_build(uint64_t build_id)
+{
+	transcache.build_id = build_id;
+	if (build_id == 0) {
+		rpclog("Translation cache: Cannot identify this executable, not used\n");
+	}
+}
+
+/**
+ * Open the cache file for the loaded ROM and CPU model, if they have
+ * changed since the last call. Called on every machine reset.
+ */
+void
+transcache_reset(void)
+{
+	const uint64_t rom_hash = romload_get_hash();
+	const uint32_t cpu_model = (uint32_t) machine.cpu_model;
+
+	if (!transcache.enabled || transcache.build_id == 0) {
+		return;
+	}
+	if (transcache.open && transcache.rom_hash == rom_hash && transcache.cpu_model == cpu_model) {
+		return;
+	}
+
+	transcache_close();
+
+	transcache.rom_hash = rom_hash;
+	transcache.cpu_model = cpu_model;
+	snprintf(transcache.name, sizeof(transcache.name), "dynarec-%016llx-%u.bin",
+	         (unsigned long long) rom_hash, cpu_model);
+	transcache.open = 1;
+
+	transcache.map = rpcemu_cache_file_map(transcache.name, &transcache.map_size);
+	if (transcache.map == NULL) {
+		return;
+	}
+	if (!transcache_load()) {
+		rpclog("Translation cache: Ignoring stale or corrupt '%s'\n", transcache.name);
+		if (transcache.index != NULL) {
+			memset(transcache.index, 0, transcache.index_size * sizeof(TransCacheBlock *));
+		}
+		transcache.count = 0;
+		rpcemu_cache_file_unmap(transcache.map, transcache.map_size);
+		transcache.map = NULL;
+		return;
+	}
+	rpclog("Translation cache: Loaded %u blocks from '%s'\n", transcache.count, transcache.name);
+}
+
+/**
+ * Write back the cache if blocks were added, and release it. Called on
+ * close, and before a different ROM or CPU model is used.
+ */
+void
+transcache_close(void)
+{
+	uint32_t i;
+
+	if (!transcache.open) {
+		return;
+	}
+
+	rpclog("Translation cache: %u blocks installed from '%s'\n", transcache.hits, transcache.name);
+	if (transcache.dirty) {
+		transcache_save();
+	}
+
+	for (i = 0; i < transcache.owned_count; i++) {
+		free(transcache.owned[i]);
+	}
+	free(transcache.owned);
+	free(transcache.index);
+	if (transcache.map != NULL) {
+		rpcemu_cache_file_unmap(transcache.map, transcache.map_size);
+	}
+
+	transcache.owned = NULL;
+	transcache.owned_count = 0;
+	transcache.owned_size = 0;
+	transcache.index = NULL;
+	transcache.index_size = 0;
+	transcache.count = 0;
+	transcache.map = NULL;
+	transcache.dirty = 0;
+	transcache.hits = 0;
+	transcache.open = 0;
+}
+
+/**
+ * Find where in the ROM image some code is.
+ *
+ * @param code       Host pointer to the first instruction
+ * @param rom_offset Filled in with the offset within the ROM
+ * @return 1 if the cache is in use and the code is in the ROM, else 0
+ */
+int
+transcache_rom_offset(const uint32_t *code, uint32_t *rom_offset)
+{
+	if (!transcache.open || code < rom || code >= rom + (ROMSIZE / 4)) {
+		return 0;
+	}
+	*rom_offset = (uint32_t) (code - rom) * 4;
+	return 1;
+}
+
+/**
+ * Look up a block in the cache.
+ *
+ * @param pc         Virtual address of first instruction
+ * @param rom_offset Offset of first instruction within the ROM
+ * @param r15_mask   Current R15 address mask
+ * @return Cached block, or NULL if there is none
+ */
+const TransCacheBlock *
+transcache_find(uint32_t pc, uint32_t rom_offset, uint32_t r15_mask)
+{
+	const TransCacheBlock *b;
+
+	if (transcache.count == 0) {
+		return NULL;
+	}
+	b = transcache.index[transcache_slot(pc, rom_offset, r15_mask)];
+	if (b != NULL) {
+		transcache.hits++;
+	}
+	return b;
+}
+
+/**
+ * Add a newly compiled block to the cache, replacing any with the same key.
+ *
+ * @param block  Header of block (only the key, flags and sizes are used)
+ * @param code   Generated code, with relocated fields made relative to
+ *               the start of the code buffer
+ * @param relocs Offsets of relocated fields within the code
+ */
+void
+transcache_store(const TransCacheBlock *block, const uint8_t *code, const uint16_t *relocs)
+{
+	TransCacheBlock *b;
+	uint8_t *p;
+	unsigned i;
+
+	if (!transcache.open || transcache.count >= TRANSCACHE_MAX_BLOCKS) {
+		return;
+	}
+
+	b = malloc(transcache_record_size(block));
+	if (b == NULL) {
+		return;
+	}
+	if (transcache.owned_count == transcache.owned_size) {
+		const uint32_t new_size = transcache.owned_size ? transcache.owned_size * 2 : 1024;
+		TransCacheBlock **owned = realloc(transcache.owned, new_size * sizeof(TransCacheBlock *));
+
+		if (owned == NULL) {
+			free(b);
+			return;
+		}
+		transcache.owned = owned;
+		transcache.owned_size = new_size;
+	}
+	transcache.owned[transcache.owned_count++] = b;
+
+	memset(b, 0, transcache_record_size(block));
+	*b = *block;
+	p = (uint8_t *) (b + 1);
+	memcpy(p, code, block->code_size);
+	p += block->code_size;
+	for (i = 0; i < block->reloc_count; i++) {
+		*p++ = (uint8_t) relocs[i];
+		*p++ = (uint8_t) (relocs[i] >> 8);
+	}
+
+	transcache_insert(b);
+	transcache.dirty = 1;
+}
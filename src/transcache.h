@@ -0,0 +1,92 @@
+/*
+  RPCEmu - An Acorn system emulator
+
+  Copyright (C) 2025 Andrew Timmins
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * transcache.h - Persistent cache of dynarec translations of ROM code
+ *
+ * When the RPCEMU_DYNAREC_CACHE environment variable is set (to anything
+ * but "0"), blocks the dynarec compiles from the ROM image are kept and
+ * written to the "cache" directory when the emulator closes or switches
+ * ROM. The next run maps the file and installs blocks from it instead of
+ * compiling them.
+ *
+ * A file is only used when the ROM image (after the loader's patches),
+ * the CPU model and the executable all match, and its checksum is
+ * correct, so a change to any of them makes the dynarec start afresh.
+ * The executable is identified by a hash of its file, which is only
+ * available on Linux.
+ */
+
+#ifndef TRANSCACHE_H
+#define TRANSCACHE_H
+
+#include <stdint.h>
+
+#define TRANSCACHE_SUPERBLOCK	1	/**< Block was built as a superblock */
+
+/**
+ * A cached block. The generated code follows this header, then
+ * 'reloc_count' 16-bit offsets within the code of 32-bit fields that
+ * address something outside the block. The whole record is padded to a
+ * multiple of 4 bytes.
+ */
+typedef struct {
+	uint32_t	pc;		/**< Virtual address of first instruction */
+	uint32_t	rom_offset;	/**< Offset of first instruction within the ROM */
+	uint32_t	r15_mask;	/**< R15 address mask when compiled */
+	uint16_t	flags;		/**< TRANSCACHE_* flags */
+	uint16_t	reloc_count;	/**< Number of relocations after the code */
+	uint32_t	code_size;	/**< Bytes of code after this header */
+} TransCacheBlock;
+
+extern void transcache_init(void);
+extern int transcache_enabled(void);
+extern void transcache_set_build(uint64_t build_id);
+extern void transcache_reset(void);
+extern void transcache_close(void);
+
+extern int transcache_rom_offset(const uint32_t *code, uint32_t *rom_offset);
+extern const TransCacheBlock *transcache_find(uint32_t pc, uint32_t rom_offset, uint32_t r15_mask);
+extern void transcache_store(const TransCacheBlock *block, const uint8_t *code, const uint16_t *relocs);
+
+/**
+ * @param block Cached block
+ * @return Pointer to the block's code
+ */
+static inline const uint8_t *
+transcache_block_code(const TransCacheBlock *block)
+{
+	return (const uint8_t *) (block + 1);
+}
+
+/**
+ * @param block Cached block
+ * @param index Relocation number
+ * @return Offset within the code of the relocated field
+ */
+static inline uint16_t
+transcache_block_reloc(const TransCacheBlock *block, unsigned index)
+{
+	const uint8_t *p = transcache_block_code(block) + block->code_size + (index * 2);
+
+	return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+#endif /* TRANSCACHE_H */
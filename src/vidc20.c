@@ -28,18 +28,27 @@
    ARM 7500FE Datasheet - ARM DDI 0077B
    Cirrus Logic CL-PS7500FE Advance Data Book
 */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "rpcemu.h"
 #include "cp15.h"
+#include "fbexport.h"
 #include "vidc20.h"
 #include "keyboard.h"
 #include "sound.h"
 #include "mem.h"
 #include "iomd.h"
+#include "replay.h"
 static int current_sizex = -1; /**< Width of the video mode, -1 on invalid */
 static int current_sizey = -1; /**< Height of the video mode, -1 on invalid */
 
@@ -126,13 +135,74 @@ static struct cached_state {
         int cursorx;
         int cursory;
         int cursorheight;
+        int cursor_activex;		/**< X offset of the pointer active point within the cursor */
+        int cursor_activey;		/**< Y offset of the pointer active point within the cursor */
         int lastblock;
+        int dirtypages;			/**< Number of dirty 4KB blocks in the displayed area */
         int doublesize;
         uint32_t bpp;
         uint8_t *dirtybuffer;
         int threadpending;
+        int mode_changed;		/**< Screen size or depth changed since the last update */
 } thr;
 
+#define CURSOR_WIDTH		32	/**< Width of the VIDC20 cursor in pixels */
+#define CURSOR_MAX_HEIGHT	256	/**< Tallest cursor exported to the GUI */
+
+/* Cursor sprite as last sent to the GUI, colour 0 is fully transparent.
+   Only accessed by the video thread, or the machine thread when it has
+   the mutex. */
+static struct {
+	uint32_t image[CURSOR_WIDTH * CURSOR_MAX_HEIGHT];
+	uint32_t scratch[CURSOR_WIDTH * CURSOR_MAX_HEIGHT];
+	int height;			/**< Height in rows, 0 when the cursor is hidden */
+	int x;
+	int y;
+	int activex;
+	int activey;
+	int valid;			/**< Has the GUI been sent a cursor yet */
+} cursor_sprite;
+
+static void video_cursor_update(void);
+
+#define VIDC_BANDS_MAX		4		/**< Most bands a frame is split into */
+#define VIDC_BANDS_MIN_PIXELS	(512 * 1024)	/**< Smallest dirty area converted in bands */
+#define VIDC_BANDS_MIN_ROWS	32		/**< Smallest band height */
+
+/* A horizontal band of the display converted by one thread */
+typedef struct {
+	int		y0;		/**< First row of band */
+	int		y1;		/**< Row after the last row of band */
+	uint32_t	addr;		/**< Address of first pixel of band */
+	int		drawit;		/**< Dirty state of the block containing addr */
+	int		yl;		/**< Filled in with first row updated, or -1 */
+	int		yh;		/**< Filled in with last row updated + 1, or -1 */
+} VideoBand;
+
+/* Video buffer details for the frame being converted. Set by the video
+   thread before any band is converted. */
+static struct {
+	const uint8_t	*ramp;
+	uint32_t	vidstart;
+	uint32_t	vidend;
+} frame;
+
+/* Threads converting the lower bands of large frames */
+static struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	start_cond;	/**< Signalled when a new frame is handed out */
+	pthread_cond_t	done_cond;	/**< Signalled when the last band is finished */
+	int		workers;	/**< Number of worker threads */
+	unsigned	generation;	/**< Incremented for each frame handed out */
+	int		nbands;		/**< Bands in the current frame */
+	int		pending;	/**< Bands the workers have still to finish */
+	VideoBand	bands[VIDC_BANDS_MAX];
+} band_pool;
+
+/* Frame statistics, read and reset once a second by the GUI */
+static atomic_uint frames_converted;	/**< Frames converted by the video thread */
+static atomic_uint frames_dropped;	/**< Frames skipped as the video thread was busy */
+
 /* Two dirty buffers, so one can be written to by the main thread
    while the display thread is reading the other */
 static uint8_t dirtybuffer1[512 * 4];
@@ -165,8 +235,16 @@ video_image_scanline(int row)
 static void
 video_update(int yl, int yh)
 {
+	if (thr.mode_changed) {
+		thr.mode_changed = 0;
+		rpcemu_video_mode_changed();
+	}
+
 	rpcemu_video_update(thr.bitmap, current_sizex, current_sizey,
 	    yl, yh, thr.doublesize, thr.host_xsize, thr.host_ysize);
+
+	fbexport_publish(thr.bitmap, current_sizex, current_sizey,
+	    yl, yh, thr.doublesize);
 }
 
 void
@@ -177,6 +255,7 @@ initvideo(void)
 	memset(&thr, 0, sizeof(thr));
 	memset(dirtybuffer1, 0xff, sizeof(dirtybuffer1));
 	memset(dirtybuffer2, 0xff, sizeof(dirtybuffer2));
+	fbexport_init();
 	vidcstartthread();
 }
 
@@ -246,6 +325,7 @@ void
 closevideo(void)
 {
 	vidcendthread();
+	fbexport_close();
 }
 
 /**
@@ -296,12 +376,17 @@ drawscr(void)
 	static int lastframeborder = 0;
 
 	// Must get the mutex before altering the thread's state.
-	if (!vidctrymutex()) {
+	if (replay_mode != ReplayMode_Off) {
+		// The frames the guest sees dropped must not depend on host
+		// speed, so wait for the thread to finish the last one
+		vidcwaitmutex(&thr.threadpending);
+	} else if (!vidctrymutex()) {
 		return;
 	}
 
 	// If the thread hasn't run since the last request then don't request it again
 	if (thr.threadpending) {
+		atomic_fetch_add_explicit(&frames_dropped, 1, memory_order_relaxed);
 		goto unlock_mutex_return;
 	}
 
@@ -310,8 +395,11 @@ drawscr(void)
 
 	thr.cursorx = vidc.hcsr - vidc.hdsr;
 	thr.cursory = vidc.vcsr - vidc.vdsr;
+	thr.cursor_activex = 0;
+	thr.cursor_activey = 0;
 	if (mousehack) {
 		mouse_hack_get_pos(&thr.cursorx, &thr.cursory);
+		mouse_hack_get_active_point(&thr.cursor_activex, &thr.cursor_activey);
 	}
 	thr.cursorheight = vidc.vcer - vidc.vcsr;
 
@@ -324,6 +412,9 @@ drawscr(void)
 	thr.iomd_vidend = iomd.vidend;
 	thr.iomd_vidinit = iomd.vidinit;
 	thr.iomd_vidcr = iomd.vidcr;
+	if (thr.bpp != vidc.bit8) {
+		thr.mode_changed = 1;
+	}
 	thr.bpp = vidc.bit8;
 
 	if (thr.vidc_xsize < 2) {
@@ -336,6 +427,7 @@ drawscr(void)
 	// Have we changed screen size since the last draw?
 	if (thr.vidc_xsize != current_sizex || thr.vidc_ysize != current_sizey) {
 		resizedisplay(thr.vidc_xsize, thr.vidc_ysize);
+		thr.mode_changed = 1;
 	}
 
 	thr.host_xsize = thr.vidc_xsize;
@@ -376,6 +468,11 @@ drawscr(void)
 
 			video_update(0, thr.vidc_ysize);
 		}
+
+		// No cursor is displayed either; hiding the exported sprite
+		// also has the VNC server resend the rows it was drawn over
+		thr.cursorheight = 0;
+		video_cursor_update();
 		goto unlock_mutex_return;
 	}
 
@@ -383,6 +480,7 @@ drawscr(void)
 		int x, y;
 		int c;
 		int lastblock;
+		int dirtypages;
 
 		if (vidc.palchange) {
 			resetbuffer();
@@ -396,11 +494,13 @@ drawscr(void)
 
 		x = y = c = 0;
 		lastblock = -1;
+		dirtypages = 0;
 		while (y < thr.vidc_ysize) {
 			static const int xdiff[8] = { 8192, 4096, 2048, 1024, 512, 512, 256, 256 };
 
 			if (dirtybuffer[c++]) {
 				lastblock = c;
+				dirtypages++;
 			}
 			x += xdiff[thr.bpp] << 2;
 			while (x > thr.vidc_xsize) {
@@ -409,6 +509,7 @@ drawscr(void)
 			}
 		}
 		thr.lastblock = lastblock;
+		thr.dirtypages = dirtypages;
 		thr.dirtybuffer = dirtybuffer;
 		dirtybuffer = (dirtybuffer == dirtybuffer1) ? dirtybuffer2 : dirtybuffer1;
 	}
@@ -433,66 +534,123 @@ unlock_mutex_return:
 }
 
 /**
- * VIDC display thread. This is called whenever vidcwakeupthread() signals it.
- * It will only be called when it has the vidc mutex.
+ * Decode the hardware cursor into an ARGB sprite and pass it to the GUI
+ * if its shape or position has changed since the last frame.
  *
- * Update bitmap backbuffer with values from hardware video ram, then update screen
+ * The cursor is never plotted into the display bitmap, so moving the
+ * pointer does not dirty any scanlines.
  *
  * thread: video
  */
-void
-vidcthread(void)
+static void
+video_cursor_update(void)
 {
-	const uint32_t vidstart = thr.iomd_vidstart & 0x7ffff0;
-	uint32_t vidend;
-	int drawit = 0;
-	int x, y;
 	const uint8_t *ramp;
 	uint32_t addr;
-	int yl = -1, yh = -1;
-	static int oldcursorheight;
-	static int oldcursory;
+	uint32_t *p = cursor_sprite.scratch;
+	int height = 0;
+	int shape_changed;
+	int x, y;
 
-	/* Deal with the possibility of a spurious thread wakeup */
-	if (thr.threadpending == 0) {
-		return;
-	}
+	if (thr.cursorheight > 1) {
+		height = thr.cursorheight;
+		if (height > CURSOR_MAX_HEIGHT) {
+			height = CURSOR_MAX_HEIGHT;
+		}
 
-	thr.threadpending = 0;
+		/* Calculate host address of cursor data from physical address.
+		   This assumes that cursor data is always in DRAM, not VRAM,
+		   which is currently true for RISC OS */
+		if (thr.iomd_cinit & 0x8000000) {
+			ramp = (const uint8_t *) ram1;
+		} else if (thr.iomd_cinit & 0x4000000) {
+			ramp = (const uint8_t *) ram01;
+		} else {
+			ramp = (const uint8_t *) ram00;
+		}
+		addr = thr.iomd_cinit & mem_rammask;
 
-	if (thr.iomd_vidinit & 0x10000000) {
-		/* Using DRAM for video */
-		/* TODO video could be in DRAM other than simm 0 bank 0 */
-		ramp = (const uint8_t *) ram00;
-		vidend = (thr.iomd_vidend + 16) & 0x7ffff0;
-	} else {
-		/* Using VRAM for video */
-		ramp = (const uint8_t *) vram;
-		vidend = (thr.iomd_vidend + 2048) & 0xfffff0;
-		if (vidend > 0x800000) {
-			vidend &= 0x7ffff0;
+		/* 2bpp, 8 bytes per row */
+		for (y = 0; y < height; y++) {
+			for (x = 0; x < CURSOR_WIDTH; x += 4) {
+#ifdef _RPCEMU_BIG_ENDIAN
+				const uint8_t data = ramp[addr ^ 3];
+#else
+				const uint8_t data = ramp[addr];
+#endif
+				int i;
+
+				for (i = 0; i < 8; i += 2) {
+					const int c = (data >> i) & 3;
+
+					*p++ = c ? thr.cursor_palette[c - 1] : 0;
+				}
+				addr++;
+			}
 		}
 	}
 
-	addr = thr.iomd_vidinit & 0x7fffff;
+	shape_changed = (height != cursor_sprite.height) ||
+	    memcmp(cursor_sprite.scratch, cursor_sprite.image,
+	           (size_t) (height * CURSOR_WIDTH) * sizeof(uint32_t)) != 0;
+
+	if (cursor_sprite.valid && !shape_changed) {
+		/* A hidden cursor has no position worth reporting */
+		if (height == 0 ||
+		    (thr.cursorx == cursor_sprite.x && thr.cursory == cursor_sprite.y &&
+		     thr.cursor_activex == cursor_sprite.activex &&
+		     thr.cursor_activey == cursor_sprite.activey))
+		{
+			return;
+		}
+	}
+
+	if (shape_changed) {
+		memcpy(cursor_sprite.image, cursor_sprite.scratch,
+		       (size_t) (height * CURSOR_WIDTH) * sizeof(uint32_t));
+		cursor_sprite.height = height;
+	}
+	cursor_sprite.x = thr.cursorx;
+	cursor_sprite.y = thr.cursory;
+	cursor_sprite.activex = thr.cursor_activex;
+	cursor_sprite.activey = thr.cursor_activey;
+
+	rpcemu_video_cursor(cursor_sprite.image, CURSOR_WIDTH, height,
+	    thr.cursorx, thr.cursory, thr.cursor_activex, thr.cursor_activey,
+	    shape_changed || !cursor_sprite.valid);
+
+	cursor_sprite.valid = 1;
+}
+
+/**
+ * Convert a horizontal band of the display from VIDC format into the
+ * bitmap, skipping any 4KB blocks that are not dirty.
+ *
+ * thread: video or band worker
+ *
+ * @param band Rows to convert, start address and dirty state; the range
+ *             of rows actually updated is filled in
+ */
+static void
+video_convert_band(VideoBand *band)
+{
+	const uint32_t vidstart = frame.vidstart;
+	const uint32_t vidend = frame.vidend;
+	const uint8_t *ramp = frame.ramp;
+	uint32_t addr = band->addr;
+	int drawit = band->drawit;
+	int x, y;
+	int yl = -1, yh = -1;
 
-	drawit = thr.dirtybuffer[addr >> 12];
 	if (drawit) {
-		yl = 0;
+		yl = band->y0;
 	}
 
 	switch (thr.bpp) {
 	case 0: /* 1 bpp on 32 bpp */
-		for (y = 0; y < thr.vidc_ysize; y++) {
+		for (y = band->y0; y < band->y1; y++) {
 			uint32_t *vidp = video_image_scanline(y);
 
-			if (y < (oldcursorheight + oldcursory) && (y >= (oldcursory - 2))) {
-				drawit = 1;
-				yh = y + 8;
-				if (yl == -1) {
-					yl = y;
-				}
-			}
 			if (drawit) {
 				yh = y + 1;
 			}
@@ -524,9 +682,6 @@ vidcthread(void)
 				}
 				if ((addr & 0xfff) == 0) {
 					drawit = thr.dirtybuffer[addr >> 12];
-					if (y < (oldcursorheight + oldcursory) && (y >= (oldcursory - 2))) {
-						drawit = 1;
-					}
 					if (drawit) {
 						yh = y + 8;
 					}
@@ -538,16 +693,9 @@ vidcthread(void)
 		}
 		break;
 	case 1: /* 2 bpp on 32 bpp */
-		for (y = 0; y < thr.vidc_ysize; y++) {
+		for (y = band->y0; y < band->y1; y++) {
 			uint32_t *vidp = video_image_scanline(y);
 
-			if (y < (oldcursorheight + oldcursory) && (y >= (oldcursory - 2))) {
-				drawit = 1;
-				yh = y + 8;
-				if (yl == -1) {
-					yl = y;
-				}
-			}
 			if (drawit) {
 				yh = y + 1;
 			}
@@ -575,9 +723,6 @@ vidcthread(void)
 				}
 				if ((addr & 0xfff) == 0) {
 					drawit = thr.dirtybuffer[addr >> 12];
-					if (y < (oldcursorheight + oldcursory) && (y >= (oldcursory - 2))) {
-						drawit = 1;
-					}
 					if (drawit) {
 						yh = y + 8;
 					}
@@ -589,16 +734,9 @@ vidcthread(void)
 		}
 		break;
 	case 2: /* 4 bpp on 32 bpp */
-		for (y = 0; y < thr.vidc_ysize; y++) {
+		for (y = band->y0; y < band->y1; y++) {
 			uint32_t *vidp = video_image_scanline(y);
 
-			if (y < (oldcursorheight + oldcursory) && (y >= (oldcursory - 2))) {
-				drawit = 1;
-				yh = y + 8;
-				if (yl == -1) {
-					yl = y;
-				}
-			}
 			if (drawit) {
 				yh = y + 1;
 			}
@@ -635,9 +773,6 @@ vidcthread(void)
 				}
 				if ((addr & 0xfff) == 0) {
 					drawit = thr.dirtybuffer[addr >> 12];
-					if (y < (oldcursorheight + oldcursory) && (y >= (oldcursory - 2))) {
-						drawit = 1;
-					}
 					if (drawit) {
 						yh = y + 8;
 					}
@@ -649,16 +784,9 @@ vidcthread(void)
 		}
 		break;
 	case 3: /* 8 bpp on 32 bpp */
-		for (y = 0; y < thr.vidc_ysize; y++) {
+		for (y = band->y0; y < band->y1; y++) {
 			uint32_t *vidp = video_image_scanline(y);
 
-			if (y < (oldcursorheight + oldcursory) && (y >= (oldcursory - 2))) {
-				drawit = 1;
-				yh = y + 8;
-				if (yl == -1) {
-					yl = y;
-				}
-			}
 			if (drawit) {
 				yh = y + 1;
 			}
@@ -687,9 +815,6 @@ vidcthread(void)
 				}
 				if ((addr & 0xfff) == 0) {
 					drawit = thr.dirtybuffer[addr >> 12];
-					if (y < (oldcursorheight + oldcursory) && (y >= (oldcursory - 2))) {
-						drawit = 1;
-					}
 					if (drawit) {
 						yh = y + 8;
 					}
@@ -701,16 +826,9 @@ vidcthread(void)
 		}
 		break;
 	case 4: /* 16 bpp on 32 bpp */
-		for (y = 0; y < thr.vidc_ysize; y++) {
+		for (y = band->y0; y < band->y1; y++) {
 			uint32_t *vidp = video_image_scanline(y);
 
-			if (y < (oldcursorheight + oldcursory) && (y >= (oldcursory - 2))) {
-				drawit = 1;
-				yh = y + 8;
-				if (yl == -1) {
-					yl = y;
-				}
-			}
 			if (drawit) {
 				yh = y + 1;
 			}
@@ -743,9 +861,6 @@ vidcthread(void)
 				}
 				if ((addr & 0xfff) == 0) {
 					drawit = thr.dirtybuffer[addr >> 12];
-					if (y < (oldcursorheight + oldcursory) && (y >= (oldcursory - 2))) {
-						drawit = 1;
-					}
 					if (drawit) {
 						yh = y + 8;
 					}
@@ -757,16 +872,9 @@ vidcthread(void)
 		}
 		break;
 	case 6: /* 32 bpp on 32 bpp */
-		for (y = 0; y < thr.vidc_ysize; y++) {
+		for (y = band->y0; y < band->y1; y++) {
 			uint32_t *vidp = video_image_scanline(y);
 
-			if (y < (oldcursorheight + oldcursory) && (y >= (oldcursory - 2))) {
-				drawit = 1;
-				yh = y + 8;
-				if (yl == -1) {
-					yl = y;
-				}
-			}
 			if (drawit) {
 				yh = y + 1;
 			}
@@ -789,9 +897,6 @@ vidcthread(void)
 				}
 				if ((addr & 0xfff) == 0) {
 					drawit = thr.dirtybuffer[addr >> 12];
-					if (y < (oldcursorheight + oldcursory) && (y >= (oldcursory - 2))) {
-						drawit = 1;
-					}
 					if (drawit) {
 						yh = y + 8;
 					}
@@ -806,66 +911,270 @@ vidcthread(void)
 		fatal("Bad BPP %i\n", thr.bpp);
 	}
 
-	/* Cursor layer is plotted over regular display */
-	if (thr.cursorheight > 1) {
-		/* Calculate host address of cursor data from physical address.
-		   This assumes that cursor data is always in DRAM, not VRAM,
-		   which is currently true for RISC OS */
-		if (thr.iomd_cinit & 0x8000000) {
-			ramp = (const uint8_t *) ram1;
-		} else if (thr.iomd_cinit & 0x4000000) {
-			ramp = (const uint8_t *) ram01;
-		} else {
-			ramp = (const uint8_t *) ram00;
+	band->yl = yl;
+	band->yh = yh;
+}
+
+/**
+ * Address reached by the display fetch after a number of bytes, wrapping
+ * from the end of the video buffer back to the start as vidcthread() does.
+ *
+ * @param addr  Starting address
+ * @param bytes Number of bytes fetched
+ * @return Address after the fetch
+ */
+static uint32_t
+video_advance(uint32_t addr, uint32_t bytes)
+{
+	const uint32_t vidstart = frame.vidstart;
+	const uint32_t vidend = frame.vidend;
+
+	if (addr < vidend && vidstart < vidend && addr + bytes >= vidend) {
+		return vidstart + ((addr + bytes - vidend) % (vidend - vidstart));
+	}
+	return addr + bytes;
+}
+
+/**
+ * Body of each band worker thread. Worker n converts band n + 1 of each
+ * frame handed out by video_convert_bands(); band 0 is converted by the
+ * video thread itself.
+ *
+ * @param arg Band number, cast to a pointer
+ * @return Never returns
+ */
+static void *
+video_band_worker(void *arg)
+{
+	const int band = (int) (intptr_t) arg;
+	unsigned generation = 0;
+
+	pthread_mutex_lock(&band_pool.lock);
+
+	for (;;) {
+		while (band_pool.generation == generation) {
+			pthread_cond_wait(&band_pool.start_cond, &band_pool.lock);
 		}
-		addr = thr.iomd_cinit & mem_rammask;
-		// printf("Mouse now at %i,%i\n", thr.cursorx, thr.cursory);
-		for (y = 0; y < thr.cursorheight; y++) {
-			if ((y + thr.cursory) >= thr.vidc_ysize) {
-				break;
-			}
-			if ((y + thr.cursory) >= 0) {
-				uint32_t *vidp = video_image_scanline(y + thr.cursory);
+		generation = band_pool.generation;
 
-				for (x = 0; x < 32; x += 4) {
-#ifdef _RPCEMU_BIG_ENDIAN
-					addr ^= 3;
-#endif
-					if ((x + thr.cursorx)     >= 0 && (x + thr.cursorx)     < thr.vidc_xsize && ramp[addr]        & 3) {
-						vidp[x + thr.cursorx]     = thr.cursor_palette[(ramp[addr] & 3) - 1];
-					}
-					if ((x + thr.cursorx + 1) >= 0 && (x + thr.cursorx + 1) < thr.vidc_xsize && (ramp[addr] >> 2) & 3) {
-						vidp[x + thr.cursorx + 1] = thr.cursor_palette[((ramp[addr] >> 2) & 3) - 1];
-					}
-					if ((x + thr.cursorx + 2) >= 0 && (x + thr.cursorx + 2) < thr.vidc_xsize && (ramp[addr] >> 4) & 3) {
-						vidp[x + thr.cursorx + 2] = thr.cursor_palette[((ramp[addr] >> 4) & 3) - 1];
-					}
-					if ((x + thr.cursorx + 3) >= 0 && (x + thr.cursorx + 3) < thr.vidc_xsize && (ramp[addr] >> 6) & 3) {
-						vidp[x + thr.cursorx + 3] = thr.cursor_palette[((ramp[addr] >> 6) & 3) - 1];
-					}
-#ifdef _RPCEMU_BIG_ENDIAN
-					addr ^= 3;
-#endif
-					addr++;
-				}
+		if (band < band_pool.nbands) {
+			pthread_mutex_unlock(&band_pool.lock);
+			video_convert_band(&band_pool.bands[band]);
+			pthread_mutex_lock(&band_pool.lock);
+
+			band_pool.pending--;
+			if (band_pool.pending == 0) {
+				pthread_cond_signal(&band_pool.done_cond);
 			}
 		}
+	}
 
-		if (yl > thr.cursory) {
-			yl = thr.cursory;
+	return NULL;
+}
+
+/**
+ * Start the threads used to convert large frames in parallel bands.
+ *
+ * One host core is left for the emulator thread, and small hosts run
+ * without any workers.
+ *
+ * @param cpus Number of host CPUs
+ */
+void
+vidc_start_band_workers(int cpus)
+{
+	int bands = cpus - 1;
+	int i;
+
+	if (bands > VIDC_BANDS_MAX) {
+		bands = VIDC_BANDS_MAX;
+	}
+
+	pthread_mutex_init(&band_pool.lock, NULL);
+	pthread_cond_init(&band_pool.start_cond, NULL);
+	pthread_cond_init(&band_pool.done_cond, NULL);
+
+	for (i = 1; i < bands; i++) {
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, video_band_worker, (void *) (intptr_t) i)) {
+			error("Couldn't create video band worker thread");
+			break;
 		}
-		if (yl == -1) {
-			yl = thr.cursory;
+#ifdef __linux__
+		pthread_setname_np(thread, "rpcemu: vidc band");
+#endif
+		pthread_detach(thread);
+		band_pool.workers++;
+	}
+
+	rpclog("VIDC: %d video band worker thread(s)\n", band_pool.workers);
+}
+
+/**
+ * Convert the frame in parallel bands, if it is large enough to be worth
+ * it, and wait for all of the bands to be finished.
+ *
+ * thread: video
+ *
+ * @param addr Address of the first pixel of the frame
+ * @param yl   Filled in with the first row updated, or -1
+ * @param yh   Filled in with the last row updated plus one, or -1
+ * @return 1 if the frame was converted, 0 if it should be converted in one piece
+ */
+static int
+video_convert_bands(uint32_t addr, int *yl, int *yh)
+{
+	/* Pixels per fetch step and bytes per fetch step for each bpp,
+	   matching the loops in video_convert_band() */
+	static const int step_pixels[8] = { 8, 4, 32, 16, 8, 0, 4, 0 };
+	static const int step_bytes[8]  = { 1, 1, 16, 16, 16, 0, 16, 0 };
+	static const int bits[8]        = { 1, 2, 4, 8, 16, 0, 32, 0 };
+	const int nbands = band_pool.workers + 1;
+	uint32_t row_bytes;
+	int rows;
+	int i;
+
+	if (band_pool.workers == 0 || bits[thr.bpp] == 0) {
+		return 0;
+	}
+
+	/* The fetch must land exactly on the end of the buffer to wrap */
+	if (addr & 0xf) {
+		return 0;
+	}
+
+	/* Only worth waking the workers for a large dirty area */
+	if (((thr.dirtypages * 4096 * 8) / bits[thr.bpp]) < VIDC_BANDS_MIN_PIXELS ||
+	    thr.vidc_ysize < nbands * VIDC_BANDS_MIN_ROWS)
+	{
+		return 0;
+	}
+
+	row_bytes = (uint32_t) (((thr.vidc_xsize + step_pixels[thr.bpp] - 1) / step_pixels[thr.bpp]) *
+	                        step_bytes[thr.bpp]);
+	rows = (thr.vidc_ysize + nbands - 1) / nbands;
+
+	for (i = 0; i < nbands; i++) {
+		VideoBand *band = &band_pool.bands[i];
+		uint32_t start;
+
+		band->y0 = i * rows;
+		band->y1 = (i == nbands - 1) ? thr.vidc_ysize : band->y0 + rows;
+		start = video_advance(addr, (uint32_t) band->y0 * row_bytes);
+		band->addr = start;
+
+		/* Dirty state carried into the band. After a wrap to a start
+		   address that is not block aligned, the serial walk still uses
+		   the last block before the end, so take either */
+		band->drawit = thr.dirtybuffer[start >> 12];
+		if (i != 0 && (frame.vidstart & 0xfff) && frame.vidend > frame.vidstart &&
+		    (start >> 12) == (frame.vidstart >> 12))
+		{
+			band->drawit |= thr.dirtybuffer[(frame.vidend - 1) >> 12];
 		}
-		if (thr.cursory < 0) {
-			yl = 0;
+	}
+
+	pthread_mutex_lock(&band_pool.lock);
+	band_pool.nbands = nbands;
+	band_pool.pending = nbands - 1;
+	band_pool.generation++;
+	pthread_cond_broadcast(&band_pool.start_cond);
+	pthread_mutex_unlock(&band_pool.lock);
+
+	video_convert_band(&band_pool.bands[0]);
+
+	/* Barrier: every band must be in the bitmap before it is sent on */
+	pthread_mutex_lock(&band_pool.lock);
+	while (band_pool.pending != 0) {
+		pthread_cond_wait(&band_pool.done_cond, &band_pool.lock);
+	}
+	pthread_mutex_unlock(&band_pool.lock);
+
+	*yl = -1;
+	*yh = -1;
+	for (i = 0; i < nbands; i++) {
+		const VideoBand *band = &band_pool.bands[i];
+
+		if (band->yl != -1 && (*yl == -1 || band->yl < *yl)) {
+			*yl = band->yl;
 		}
-		if (yh < (thr.cursorheight + thr.cursory)) {
-			yh = thr.cursorheight + thr.cursory;
+		if (band->yh > *yh) {
+			*yh = band->yh;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Return and reset the number of frames converted by the video thread and
+ * the number dropped because it was still busy, since the last call.
+ *
+ * @param converted Filled in with frames converted
+ * @param dropped   Filled in with frames dropped
+ */
+void
+vidc_get_frame_stats(unsigned *converted, unsigned *dropped)
+{
+	*converted = atomic_exchange_explicit(&frames_converted, 0, memory_order_relaxed);
+	*dropped = atomic_exchange_explicit(&frames_dropped, 0, memory_order_relaxed);
+}
+
+/**
+ * VIDC display thread. This is called whenever vidcwakeupthread() signals it.
+ * It will only be called when it has the vidc mutex.
+ *
+ * Update bitmap backbuffer with values from hardware video ram, then update screen
+ *
+ * thread: video
+ */
+void
+vidcthread(void)
+{
+	uint32_t addr;
+	int yl = -1, yh = -1;
+
+	/* Deal with the possibility of a spurious thread wakeup */
+	if (thr.threadpending == 0) {
+		return;
+	}
+
+	thr.threadpending = 0;
+
+	if (thr.iomd_vidinit & 0x10000000) {
+		/* Using DRAM for video */
+		/* TODO video could be in DRAM other than simm 0 bank 0 */
+		frame.ramp = (const uint8_t *) ram00;
+		frame.vidend = (thr.iomd_vidend + 16) & 0x7ffff0;
+	} else {
+		/* Using VRAM for video */
+		frame.ramp = (const uint8_t *) vram;
+		frame.vidend = (thr.iomd_vidend + 2048) & 0xfffff0;
+		if (frame.vidend > 0x800000) {
+			frame.vidend &= 0x7ffff0;
 		}
 	}
-	oldcursorheight = thr.cursorheight;
-	oldcursory = thr.cursory;
+	frame.vidstart = thr.iomd_vidstart & 0x7ffff0;
+
+	addr = thr.iomd_vidinit & 0x7fffff;
+
+	if (!video_convert_bands(addr, &yl, &yh)) {
+		VideoBand band;
+
+		band.y0 = 0;
+		band.y1 = thr.vidc_ysize;
+		band.addr = addr;
+		band.drawit = thr.dirtybuffer[addr >> 12];
+		video_convert_band(&band);
+		yl = band.yl;
+		yh = band.yh;
+	}
+	atomic_fetch_add_explicit(&frames_converted, 1, memory_order_relaxed);
+
+
+	/* Cursor layer is exported separately and composited by the GUI */
+	video_cursor_update();
 
 	/* Clean the dirtybuffer now we have updated eveything in it */
 	memset(thr.dirtybuffer, 0, 512 * 4);
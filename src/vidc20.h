@@ -44,12 +44,15 @@ extern void drawscr(void);
 extern void vidcthread(void);
 extern void vidc_get_doublesize(int *double_x, int *double_y);
 extern void vidc_get_snapshot(VIDCStateSnapshot *snapshot);
+extern void vidc_start_band_workers(int cpus);
+extern void vidc_get_frame_stats(unsigned *converted, unsigned *dropped);
 
 /* Platform specific functions */
 extern void vidcstartthread(void);
 extern void vidcendthread(void);
 extern void vidcwakeupthread(void);
 extern int vidctrymutex(void);
+extern void vidcwaitmutex(const int *pending);
 extern void vidcreleasemutex(void);
 
 extern uint8_t *dirtybuffer;
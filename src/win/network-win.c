@@ -192,6 +192,14 @@ network_plt_setirqstatus(uint32_t address)
 	irqstatus = address;
 }
 
+/**
+ * Nothing to do here; receive notifications arrive through sig_io()
+ */
+void
+network_plt_poll(void)
+{
+}
+
 int
 network_plt_init(void)
 { 
@@ -20,6 +20,7 @@
 
 /* Windows specific stuff */
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -129,3 +130,245 @@ rpcemu_log_os(void)
 		rpclog("OS: ProductInfoType = %ld\n", dwType);
 	}
 }
+
+/**
+ * Map a read-only copy of an image that is shared between RPCEmu processes.
+ *
+ * Not implemented on Windows; callers keep their private copy.
+ *
+ * @param name Content-derived filename for the image
+ * @param data Image contents
+ * @param size Size of the image in bytes
+ * @return Always NULL
+ */
+void *
+rpcemu_shared_image_map(const char *name, const void *data, size_t size)
+{
+	NOT_USED(name);
+	NOT_USED(data);
+	NOT_USED(size);
+
+	return NULL;
+}
+
+/**
+ * Release a mapping returned by rpcemu_shared_image_map().
+ *
+ * @param p    Pointer to mapping
+ * @param size Size of the image in bytes
+ */
+void
+rpcemu_shared_image_unmap(void *p, size_t size)
+{
+	NOT_USED(p);
+	NOT_USED(size);
+}
+
+/**
+ * Map a file from the cache directory read-only.
+ *
+ * Not implemented on Windows.
+ *
+ * @param name Filename within the cache directory
+ * @param size Filled in with the size of the file in bytes
+ * @return Always NULL
+ */
+void *
+rpcemu_cache_file_map(const char *name, size_t *size)
+{
+	NOT_USED(name);
+	NOT_USED(size);
+
+	return NULL;
+}
+
+/**
+ * Release a mapping returned by rpcemu_cache_file_map().
+ *
+ * @param p    Pointer to mapping
+ * @param size Size of the file in bytes
+ */
+void
+rpcemu_cache_file_unmap(void *p, size_t size)
+{
+	NOT_USED(p);
+	NOT_USED(size);
+}
+
+/**
+ * Replace a file in the cache directory.
+ *
+ * Not implemented on Windows.
+ *
+ * @param name Filename within the cache directory
+ * @param data Data to write
+ * @param size Size of data in bytes
+ * @return Always 0
+ */
+int
+rpcemu_cache_file_write(const char *name, const void *data, size_t size)
+{
+	NOT_USED(name);
+	NOT_USED(data);
+	NOT_USED(size);
+
+	return 0;
+}
+
+/**
+ * Calculate a hash of the running executable's file.
+ *
+ * Not implemented on Windows.
+ *
+ * @param hash Unused
+ * @return Always 0
+ */
+int
+rpcemu_executable_hash(uint64_t *hash)
+{
+	NOT_USED(hash);
+
+	return 0;
+}
+
+/**
+ * Create a named shared memory region that other processes can map.
+ *
+ * Not implemented on Windows.
+ *
+ * @param name Name of the region
+ * @param size Size of the region in bytes
+ * @return Always NULL
+ */
+void *
+rpcemu_shared_memory_create(const char *name, size_t size)
+{
+	NOT_USED(name);
+	NOT_USED(size);
+
+	return NULL;
+}
+
+/**
+ * Remove the name of a region made by rpcemu_shared_memory_create().
+ *
+ * @param name Name of the region
+ */
+void
+rpcemu_shared_memory_remove(const char *name)
+{
+	NOT_USED(name);
+}
+
+/**
+ * Set errno from a Windows error code, so that callers can report
+ * failures with strerror().
+ *
+ * @param err Value from GetLastError()
+ */
+static void
+win_set_errno(DWORD err)
+{
+	switch (err) {
+	case ERROR_FILE_NOT_FOUND:
+	case ERROR_PATH_NOT_FOUND:
+		errno = ENOENT;
+		break;
+	case ERROR_ACCESS_DENIED:
+	case ERROR_SHARING_VIOLATION:
+	case ERROR_LOCK_VIOLATION:
+		errno = EACCES;
+		break;
+	case ERROR_DISK_FULL:
+	case ERROR_HANDLE_DISK_FULL:
+		errno = ENOSPC;
+		break;
+	case ERROR_WRITE_PROTECT:
+		errno = EROFS;
+		break;
+	case ERROR_NOT_ENOUGH_MEMORY:
+	case ERROR_OUTOFMEMORY:
+		errno = ENOMEM;
+		break;
+	case ERROR_FILENAME_EXCED_RANGE:
+		errno = ENAMETOOLONG;
+		break;
+	default:
+		errno = EIO;
+		break;
+	}
+}
+
+/**
+ * Replace the contents of a file so that after a crash it holds either
+ * the old or the new contents, never a mixture.
+ *
+ * The data is written to a temporary file alongside, flushed to disc and
+ * moved over the original.
+ *
+ * @param path Pathname of file
+ * @param data Data to write
+ * @param size Size of data in bytes
+ * @return 1 on success, 0 on failure (errno is set)
+ */
+int
+rpcemu_file_write_atomic(const char *path, const void *data, size_t size)
+{
+	char tmp[1024];
+	HANDLE h;
+	DWORD written;
+	BOOL ok;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	h = CreateFileA(tmp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+	                FILE_ATTRIBUTE_NORMAL, NULL);
+	if (h == INVALID_HANDLE_VALUE) {
+		win_set_errno(GetLastError());
+		return 0;
+	}
+
+	ok = WriteFile(h, data, (DWORD) size, &written, NULL) &&
+	     FlushFileBuffers(h);
+	if (!ok) {
+		win_set_errno(GetLastError());
+	} else if (written != (DWORD) size) {
+		errno = EIO;
+		ok = FALSE;
+	}
+	CloseHandle(h);
+
+	if (ok && !MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+		win_set_errno(GetLastError());
+		ok = FALSE;
+	}
+	if (!ok) {
+		DeleteFileA(tmp);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Copy a file as cheaply as the filesystem allows.
+ *
+ * Not implemented on Windows; callers fall back to an ordinary copy.
+ *
+ * @param src      Pathname of the file to copy
+ * @param dst      Pathname of the copy
+ * @param progress Progress callback
+ * @param opaque   Passed to progress
+ * @return Always 0 (errno is set to ENOSYS)
+ */
+int
+rpcemu_file_clone(const char *src, const char *dst,
+                  int (*progress)(void *opaque, uint64_t done, uint64_t total), void *opaque)
+{
+	NOT_USED(src);
+	NOT_USED(dst);
+	NOT_USED(progress);
+	NOT_USED(opaque);
+
+	errno = ENOSYS;
+	return 0;
+}